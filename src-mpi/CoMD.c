@@ -60,6 +60,7 @@
 #include "timestep.h"
 #include "constants.h"
 #include "checkpoint.h"
+#include "neighborList.h"
 
 #define REDIRECT_OUTPUT 0
 #define   MIN(A,B) ((A) < (B) ? (A) : (B))
@@ -71,7 +72,8 @@ static void initSubsystems(void);
 static void finalizeSubsystems(void);
 
 static BasePotential* initPotential(
-   int doeam, const char* potDir, const char* potName, const char* potType);
+   int doeam, const char* potDir, const char* potName, const char* potType,
+   int usePairCache, int ghostDensity);
 static SpeciesData* initSpecies(BasePotential* pot);
 static Validate* initValidate(SimFlat* s);
 static void validateResult(const Validate* val, SimFlat *sim);
@@ -122,6 +124,9 @@ int main(int argc, char** argv)
      startTimer(chkptLoadTimer);
      loadCheckpoint(sim);
      stopTimer(chkptLoadTimer);
+     // The restored atoms are not where the lists expect them.
+     if (sim->nbrList)
+        invalidateNeighborList(sim->nbrList);
      iStep = sim->iteration;
      loaded = 1;
    }
@@ -130,6 +135,9 @@ int main(int argc, char** argv)
    profileStart(loopTimer);
    for (; iStep<nSteps;)
    {
+     // The sums started by the last timestep are needed from here on.
+     finishEnergySums(sim);
+
      // ----------------------------------------------------------------------
      // ilaguna - Save checkpoint
      int ckptRate = 2;
@@ -143,10 +151,6 @@ int main(int argc, char** argv)
      loaded = 0;
      // ----------------------------------------------------------------------
 
-     startTimer(commReduceTimer);
-     sumAtoms(sim);
-     stopTimer(commReduceTimer);
-
      printThings(sim, iStep, getElapsedTime(timestepTimer));
 
      startTimer(timestepTimer);
@@ -155,10 +159,19 @@ int main(int argc, char** argv)
 
      iStep += printRate;
      sim->iteration = iStep; // ilaguna: save last iteration in Domain struct
+
+     if (sim->balance && iStep % sim->balance->rate == 0 && iStep < nSteps)
+     {
+       startTimer(balanceTimer);
+       balanceLoad(sim->balance, sim);
+       stopTimer(balanceTimer);
+     }
    }
    profileStop(loopTimer);
+   if (sim->balance)
+      measureLoadImbalance(sim->balance, sim);
 
-   sumAtoms(sim);
+   finishEnergySums(sim);
    printThings(sim, iStep, getElapsedTime(timestepTimer));
    timestampBarrier("Ending simulation\n");
 
@@ -168,6 +181,10 @@ int main(int argc, char** argv)
 
    printPerformanceResults(sim->atoms->nGlobal, sim->printRate);
    printPerformanceResultsYaml(yamlFile);
+   printHaloBytes(screenOut);
+   printHaloBytes(yamlFile);
+   printLoadBalance(screenOut, sim->balance);
+   printLoadBalance(yamlFile, sim->balance);
 
    destroySimulation(&sim);
    comdFree(validate);
@@ -202,34 +219,74 @@ SimFlat* initSimulation(Command cmd)
    sim->ePotential = 0.0;
    sim->eKinetic = 0.0;
    sim->atomExchange = NULL;
-
-   sim->pot = initPotential(cmd.doeam, cmd.potDir, cmd.potName, cmd.potType);
+   sim->nbrList = NULL;
+   sim->ghostExchange = NULL;
+   sim->migrateExchange = NULL;
+   sim->threadBuffers = NULL;
+   sim->balance = NULL;
+   sim->sumRequest = initReduceRequest();
+   sim->overlapHalo = cmd.overlapHalo;
+   sim->haloMode = parseHaloMode(cmd.haloMode);
+   if (cmd.sharedHalo)
+      sim->haloMode |= HALO_SHARED;
+
+   sim->pot = initPotential(cmd.doeam, cmd.potDir, cmd.potName, cmd.potType,
+                            cmd.pairCache, cmd.ghostDensity);
    real_t latticeConstant = cmd.lat;
    if (cmd.lat < 0.0)
       latticeConstant = sim->pot->lat;
 
-   // ensure input parameters make sense.
-   sanityChecks(cmd, sim->pot->cutoff, latticeConstant, sim->pot->latticeType);
+   // With neighbor lists the link cells must hold all pairs within
+   // the list cutoff.
+   real_t boxCutoff = sim->pot->cutoff;
+   if (cmd.useNbrList)
+      boxCutoff += cmd.skin;
 
-   sim->species = initSpecies(sim->pot);
+   // The halo must hold all atoms within one cutoff of the local
+   // domain, cellsPerCutoff boxes.  EAM ghost densities need the
+   // neighbors of every such halo atom as well.
+   int nHaloLayers = cmd.cellsPerCutoff;
+   if (cmd.doeam && cmd.ghostDensity)
+      nHaloLayers *= 2;
 
    real3 globalExtent;
    globalExtent[0] = cmd.nx * latticeConstant;
    globalExtent[1] = cmd.ny * latticeConstant;
    globalExtent[2] = cmd.nz * latticeConstant;
 
+   // choose the processor grid along the axes the user left open.
+   int procGrid[3] = {cmd.xproc, cmd.yproc, cmd.zproc};
+   chooseProcGrid(getNRanks(), globalExtent, boxCutoff/cmd.cellsPerCutoff,
+                  nHaloLayers, procGrid);
+   cmd.xproc = procGrid[0];
+   cmd.yproc = procGrid[1];
+   cmd.zproc = procGrid[2];
+
+   // ensure input parameters make sense.
+   sanityChecks(cmd, boxCutoff, latticeConstant, sim->pot->latticeType);
+
+   sim->species = initSpecies(sim->pot);
+
    sim->domain = initDecomposition(
-      cmd.xproc, cmd.yproc, cmd.zproc, globalExtent);
+      cmd.xproc, cmd.yproc, cmd.zproc, parseRankMap(cmd.rankMap), globalExtent);
 
-   sim->boxes = initLinkCells(sim->domain, sim->pot->cutoff);
-   sim->atoms = initAtoms(sim->boxes);
+   sim->boxes = initLinkCells(sim->domain, boxCutoff, cmd.cellsPerCutoff,
+                              nHaloLayers, parseBoxOrder(cmd.boxOrder));
+   sim->atoms = initAtoms();
+   sim->threadBuffers = initThreadBuffers();
 
    // create lattice with desired temperature and displacement.
    createFccLattice(cmd.nx, cmd.ny, cmd.nz, latticeConstant, sim);
    setTemperature(sim, cmd.temperature);
    randomDisplacements(sim, cmd.initialDelta);
 
-   sim->atomExchange = initAtomHaloExchange(sim->domain, sim->boxes);
+   sim->atomExchange = initAtomHaloExchange(sim->domain, sim->boxes, sim->haloMode, 1);
+   if (cmd.useNbrList)
+   {
+      sim->nbrList = initNeighborList(sim->pot->cutoff, cmd.skin);
+      sim->ghostExchange = initGhostHaloExchange(sim->domain, sim->boxes, sim->haloMode);
+      sim->migrateExchange = initMigrationHaloExchange(sim->domain, sim->boxes, sim->haloMode);
+   }
 
    // Forces must be computed before we call the time stepper.
    startTimer(redistributeTimer);
@@ -242,6 +299,13 @@ SimFlat* initSimulation(Command cmd)
 
    kineticEnergy(sim);
 
+   // the planes can only move between print intervals.
+   if (cmd.balance > 0)
+   {
+      int rate = (cmd.balance + cmd.printRate - 1) / cmd.printRate * cmd.printRate;
+      sim->balance = initLoadBalance(rate);
+   }
+
    return sim;
 }
 
@@ -258,8 +322,14 @@ void destroySimulation(SimFlat** ps)
    destroyLinkCells(&(s->boxes));
    destroyAtoms(s->atoms);
    destroyHaloExchange(&(s->atomExchange));
+   destroyHaloExchange(&(s->ghostExchange));
+   destroyHaloExchange(&(s->migrateExchange));
+   destroyNeighborList(&(s->nbrList));
+   destroyThreadBuffers(&(s->threadBuffers));
+   destroyLoadBalance(&(s->balance));
+   destroyReduceRequest(&(s->sumRequest));
    comdFree(s->species);
-   comdFree(s->domain);
+   destroyDecomposition(&(s->domain));
    comdFree(s);
    *ps = NULL;
 
@@ -285,12 +355,13 @@ void finalizeSubsystems(void)
 
 /// decide whether to get LJ or EAM potentials
 BasePotential* initPotential(
-   int doeam, const char* potDir, const char* potName, const char* potType)
+   int doeam, const char* potDir, const char* potName, const char* potType,
+   int usePairCache, int ghostDensity)
 {
    BasePotential* pot = NULL;
 
    if (doeam) 
-      pot = initEamPot(potDir, potName, potType);
+      pot = initEamPot(potDir, potName, potType, usePairCache, ghostDensity);
    else 
       pot = initLjPot();
    assert(pot);
@@ -428,17 +499,44 @@ void printSimulationDataYaml(FILE* file, SimFlat* s)
    fprintf(file,"Decomposition data: \n");
    fprintf(file,"  Processors         : %6d,%6d,%6d\n", 
            s->domain->procGrid[0], s->domain->procGrid[1], s->domain->procGrid[2]);
+   if (s->domain->rankMap == RANK_MAP_NODE)
+      fprintf(file,"  Rank map           : node, %d x %d x %d per node\n",
+              s->domain->nodeBrick[0], s->domain->nodeBrick[1], s->domain->nodeBrick[2]);
+   else
+      fprintf(file,"  Rank map           : %s\n", rankMapName(s->domain->rankMap));
+   if (s->balance)
+      fprintf(file,"  Load balancing     : every %d steps\n", s->balance->rate);
    fprintf(file,"  Local boxes        : %6d,%6d,%6d = %8d\n", 
            s->boxes->gridSize[0], s->boxes->gridSize[1], s->boxes->gridSize[2], 
            s->boxes->gridSize[0]*s->boxes->gridSize[1]*s->boxes->gridSize[2]);
+   fprintf(file,"  Halo/local boxes   : %8d / %8d = %6.3f\n",
+           s->boxes->nHaloBoxes, s->boxes->nLocalBoxes,
+           (double) s->boxes->nHaloBoxes / s->boxes->nLocalBoxes);
+   fprintf(file,"  Box order          : %s\n", boxOrderName(s->boxes->boxOrder));
+   fprintf(file,"  Cells per cutoff   : %d (%d boxes in the stencil)\n",
+           s->boxes->cellsPerCutoff, s->boxes->nNbrBoxes);
    fprintf(file,"  Box size           : [ %14.10f, %14.10f, %14.10f ]\n", 
            s->boxes->boxSize[0], s->boxes->boxSize[1], s->boxes->boxSize[2]);
    fprintf(file,"  Box factor         : [ %14.10f, %14.10f, %14.10f ] \n", 
            s->boxes->boxSize[0]/s->pot->cutoff,
            s->boxes->boxSize[1]/s->pot->cutoff,
            s->boxes->boxSize[2]/s->pot->cutoff);
-   fprintf(file, "  Max Link Cell Occupancy: %d of %d\n",
-           maxOcc, MAXATOMS);
+   fprintf(file, "  Max Link Cell Occupancy: %d\n", maxOcc);
+   fprintf(file,"  Threads per rank   : %d%s\n", getNThreads(),
+           builtWithOpenMP() ? "" : " (built without OpenMP)");
+   if (s->threadBuffers)
+      fprintf(file,"  Thread buffers     : %d x %7.3f MB\n", s->threadBuffers->nThreads-1,
+              (float)s->threadBuffers->nAtoms*(sizeof(real3)+2*sizeof(real_t))/1024/1024);
+   if (s->nbrList)
+   {
+      printSeparator(file);
+      fprintf(file,"Neighbor list data: \n");
+      fprintf(file,"  Skin               : %14.10f\n", s->nbrList->skin);
+      fprintf(file,"  List cutoff        : %14.10f\n", s->nbrList->cutoff);
+      fprintf(file,"  Pairs (rank 0)     : %d\n", s->nbrList->nPairs);
+      fprintf(file,"  List footprint     : %7.3f MB (rank 0)\n",
+              (float)(s->nbrList->capacity*sizeof(int))/1024/1024);
+   }
    printSeparator(file);
    fprintf(file,"Potential data: \n");
    s->pot->print(file, s->pot);
@@ -449,10 +547,9 @@ void printSimulationDataYaml(FILE* file, SimFlat* s)
    float totalMemLocal = (float)(perAtomSize*s->atoms->nLocal)/1024/1024;
    float totalMemGlobal = (float)(perAtomSize*s->atoms->nGlobal)/1024/1024;
 
-   int nLocalBoxes = s->boxes->gridSize[0]*s->boxes->gridSize[1]*s->boxes->gridSize[2];
-   int nTotalBoxes = (s->boxes->gridSize[0]+2)*(s->boxes->gridSize[1]+2)*(s->boxes->gridSize[2]+2);
-   float paddedMemLocal = (float) nLocalBoxes*(perAtomSize*MAXATOMS)/1024/1024;
-   float paddedMemTotal = (float) nTotalBoxes*(perAtomSize*MAXATOMS)/1024/1024;
+   // The storage of the link cells, headroom included.
+   float paddedMemLocal = (float) s->boxes->haloBegin*perAtomSize/1024/1024;
+   float paddedMemTotal = (float) s->atoms->capacity*perAtomSize/1024/1024;
 
    printSeparator(file);
    fprintf(file,"Memory data: \n");
@@ -506,6 +603,73 @@ void sanityChecks(Command cmd, double cutoff, double latticeConst, char latticeT
                  "\nOnly FCC Lattice type supported, not %s. Fatal Error.\n",
                  latticeType);
    }
+
+   // Check for a sensible neighbor list skin and box size (fail code 8)
+   if (cmd.useNbrList && cmd.skin < 0.0)
+   {
+      failCode |= 8;
+      if (printRank())
+         fprintf(screenOut,
+                 "\nNeighbor list skin must not be negative, not %g.\n",
+                 cmd.skin);
+   }
+   if (cmd.cellsPerCutoff < 1 || cmd.cellsPerCutoff > MAX_CELLS_PER_CUTOFF)
+   {
+      failCode |= 8;
+      if (printRank())
+         fprintf(screenOut,
+                 "\nThe number of link cells per cutoff must be 1 to %d, not %d.\n",
+                 MAX_CELLS_PER_CUTOFF, cmd.cellsPerCutoff);
+   }
+
+   // Ghost densities are only implemented for link cells (fail code 16)
+   if (cmd.doeam && cmd.ghostDensity && cmd.useNbrList)
+   {
+      failCode |= 16;
+      if (printRank())
+         fprintf(screenOut,
+                 "\nEAM ghost densities cannot be combined with neighbor lists.\n");
+   }
+
+   // Check for a known halo exchange mode (fail code 32)
+   int haloMode = parseHaloMode(cmd.haloMode);
+   if (haloMode < 0 || ! haloModeAvailable(haloMode))
+   {
+      failCode |= 32;
+      if (printRank())
+         fprintf(screenOut,
+                 "\nHalo exchange mode %s is not known or not available in this build.\n"
+                 "  Choose axes, direct, or neighbor (needs MPI 3).\n",
+                 cmd.haloMode);
+   }
+
+   // Check for a known rank map and box order (fail code 128)
+   if (parseRankMap(cmd.rankMap) < 0)
+   {
+      failCode |= 128;
+      if (printRank())
+         fprintf(screenOut,
+                 "\nRank map %s is not known.  Choose xyz, cart, or node.\n",
+                 cmd.rankMap);
+   }
+   if (parseBoxOrder(cmd.boxOrder) < 0)
+   {
+      failCode |= 128;
+      if (printRank())
+         fprintf(screenOut,
+                 "\nBox order %s is not known.  Choose xyz, morton, or hilbert.\n",
+                 cmd.boxOrder);
+   }
+
+   // Shared memory halos need MPI 3 and point to point messages (fail code 64)
+   if (cmd.sharedHalo && haloMode >= 0 && ! haloModeAvailable(haloMode | HALO_SHARED))
+   {
+      failCode |= 64;
+      if (printRank())
+         fprintf(screenOut,
+                 "\nShared memory halo data needs MPI 3 and halo exchange mode axes or direct.\n");
+   }
+
    int checkCode = failCode;
    bcastParallel(&checkCode, sizeof(int), 0);
    // This assertion can only fail if different tasks failed different
@@ -542,6 +706,13 @@ void sanityChecks(Command cmd, double cutoff, double latticeConst, char latticeT
 /// available, setting the DO_MPI flag to OFF will create a purely
 /// serial build (you will likely also need to change the setting of
 /// CC).
+///
+/// Setting DO_OPENMP to ON builds a hybrid MPI+OpenMP version
+/// (CoMD-mpi-openmp) in which every rank runs OMP_NUM_THREADS threads
+/// over its link cells.  Running one rank per socket or per node
+/// reduces the halo surface and the number of messages compared to one
+/// rank per core.  Only the master thread calls MPI
+/// (MPI_THREAD_FUNNELED).
 /// 
 /// The makefile should handle all the dependency checking needed, via
 /// makedepend.
@@ -570,13 +741,6 @@ void sanityChecks(Command cmd, double cutoff, double latticeConst, char latticeT
 /// step-to-step as it reduces the noise generated by atoms crossing the
 /// cutoff threshold. However, it does not affect the long-term energy
 /// conservation of the code.
-///
-/// #MAXATOMS in linkCells.h
-/// 
-/// The default value is 64, which allows ample padding of the linkCell
-/// structure to allow for density fluctuations. Reducing it may improve
-/// the efficiency of the code via improved thread utilization and
-/// reduced memory footprint.
 
 // --------------------------------------------------------------
 
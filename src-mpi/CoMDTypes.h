@@ -6,10 +6,14 @@
 
 #include <stdio.h>
 #include "mytype.h"
+#include "parallel.h"
 #include "haloExchange.h"
 #include "linkCells.h"
 #include "decomposition.h"
 #include "initAtoms.h"
+#include "neighborList.h"
+#include "threadBuffers.h"
+#include "loadBalance.h"
 
 struct SimFlatSt;
 
@@ -56,8 +60,7 @@ typedef struct ValidateSt
 } Validate;
 
 /// 
-/// The fundamental simulation data structure with MAXATOMS in every
-/// link cell.
+/// The fundamental simulation data structure.
 /// 
 typedef struct SimFlatSt
 {
@@ -79,6 +82,17 @@ typedef struct SimFlatSt
    BasePotential *pot;	  //!< the potential
 
    HaloExchange* atomExchange;
+
+   NeighborList* nbrList;         //!< neighbor lists (NULL if not used)
+   HaloExchange* ghostExchange;   //!< ghost position updates for nbrList
+   HaloExchange* migrateExchange; //!< atoms leaving the domain, for nbrList
+   ThreadBuffers* threadBuffers;  //!< force buffers for OpenMP threads (NULL with one thread)
+   int overlapHalo;               //!< overlap halo exchanges with force computation
+   int haloMode;                  //!< how halo exchanges reach the neighbors (a HaloMode, maybe with HALO_SHARED)
+   LoadBalance* balance;          //!< dynamic load balancer (NULL if not used)
+   ReduceRequest* sumRequest;     //!< the sums of startEnergySums
+   double localSums[3];           //!< ePotential, eKinetic, and nLocal of this task
+   double globalSums[3];          //!< the same summed over all tasks
    
    int iteration; // ilaguna: to checkpoint the last iteration
 
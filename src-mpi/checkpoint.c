@@ -13,6 +13,8 @@
 #include "checkpoint.h"
 #include "parallel.h"
 #include "CoMDTypes.h"
+#include "loadBalance.h"
+#include "memUtils.h"
 
 #include <stdio.h>
 #include <assert.h>
@@ -39,6 +41,19 @@
   buf += size;                           \
 } while (0)
 
+/* The atoms of each box are stored one box after the other. */
+#define copyBoxesToBuf(buf, src, boxes) do {                      \
+  for (int iBox = 0; iBox < (boxes)->nTotalBoxes; iBox++)         \
+    copyToBuf(buf, (src) + (boxes)->boxOffset[iBox],              \
+              (boxes)->nAtoms[iBox] * sizeof(*(src)));            \
+} while (0)
+
+#define copyBoxesFromBuf(dst, buf, boxes) do {                    \
+  for (int iBox = 0; iBox < (boxes)->nTotalBoxes; iBox++)         \
+    copyFromBuf((dst) + (boxes)->boxOffset[iBox], buf,            \
+                (boxes)->nAtoms[iBox] * sizeof(*(dst)));          \
+} while (0)
+
 #define ALIGN 4096 /* 4KB */
 
 /**
@@ -86,7 +101,12 @@ void writeCheckpoint(SimFlat *sim)
 {
   int fd;
   int nTotalBoxes = sim->boxes->nTotalBoxes;
-  int maxTotalAtoms = MAXATOMS * nTotalBoxes;
+  int nPlanes = 0;
+  for (int i = 0; i < 3; i++)
+    nPlanes += sim->domain->procGrid[i] + 1;
+  int nStoredAtoms = 0;
+  for (int iBox = 0; iBox < nTotalBoxes; iBox++)
+    nStoredAtoms += sim->boxes->nAtoms[iBox];
 
   char *buf;
   char *orig_buf;
@@ -106,10 +126,10 @@ void writeCheckpoint(SimFlat *sim)
   assert(fd > 0 && "Could not open checkpoint file (to write)");
 
   // Allocate buffer for checkpoint data
-  size = (17 * size_of_int) + (34 * size_of_float) +
-         (nTotalBoxes * sizeof(int)) +
-         (maxTotalAtoms * 2 * sizeof(int)) +
-         (maxTotalAtoms * 10 * sizeof(real_t)) + 1;
+  size = (21 * size_of_int) + (34 * size_of_float) +
+         (nTotalBoxes * sizeof(int)) + (nPlanes * sizeof(real_t)) +
+         (nStoredAtoms * 2 * sizeof(int)) +
+         (nStoredAtoms * 10 * sizeof(real_t)) + 1;
   size += (size % ALIGN == 0 ? 0 : (ALIGN - (size % ALIGN)));
   buf = orig_buf = (char *)aligned_malloc(size);
   assert(buf && "Could not allocate buffer");
@@ -152,6 +172,11 @@ void writeCheckpoint(SimFlat *sim)
   writeToBuf(buf, "%f ", sim->domain->localExtent[1]);
   writeToBuf(buf, "%f ", sim->domain->localExtent[2]);
 
+  // The load balancer may have moved the planes between processors
+  for (int i = 0; i < 3; i++)
+    copyToBuf(buf, sim->domain->plane[i],
+              (sim->domain->procGrid[i] + 1) * sizeof(real_t));
+
   // Save LinkCell structure
   writeToBuf(buf, "%d ", sim->boxes->gridSize[0]);
   writeToBuf(buf, "%d ", sim->boxes->gridSize[1]);
@@ -160,6 +185,9 @@ void writeCheckpoint(SimFlat *sim)
   writeToBuf(buf, "%d ", sim->boxes->nLocalBoxes);
   writeToBuf(buf, "%d ", sim->boxes->nHaloBoxes);
   writeToBuf(buf, "%d ", sim->boxes->nTotalBoxes);
+  writeToBuf(buf, "%d ", sim->boxes->boxOrder);
+  writeToBuf(buf, "%d ", sim->boxes->cellsPerCutoff);
+  writeToBuf(buf, "%d ", sim->boxes->nHaloLayers);
 
   writeToBuf(buf, "%f ", sim->boxes->localMin[0]);
   writeToBuf(buf, "%f ", sim->boxes->localMin[1]);
@@ -183,12 +211,12 @@ void writeCheckpoint(SimFlat *sim)
   writeToBuf(buf, "%d ", sim->atoms->nLocal);
   writeToBuf(buf, "%d ", sim->atoms->nGlobal);
 
-  copyToBuf(buf, sim->atoms->gid, maxTotalAtoms * sizeof(int));
-  copyToBuf(buf, sim->atoms->iSpecies, maxTotalAtoms * sizeof(int));
-  copyToBuf(buf, sim->atoms->r, maxTotalAtoms * sizeof(real3));
-  copyToBuf(buf, sim->atoms->p, maxTotalAtoms * sizeof(real3));
-  copyToBuf(buf, sim->atoms->f, maxTotalAtoms * sizeof(real3));
-  copyToBuf(buf, sim->atoms->U, maxTotalAtoms * sizeof(real_t));
+  copyBoxesToBuf(buf, sim->atoms->gid, sim->boxes);
+  copyBoxesToBuf(buf, sim->atoms->iSpecies, sim->boxes);
+  copyBoxesToBuf(buf, sim->atoms->r, sim->boxes);
+  copyBoxesToBuf(buf, sim->atoms->p, sim->boxes);
+  copyBoxesToBuf(buf, sim->atoms->f, sim->boxes);
+  copyBoxesToBuf(buf, sim->atoms->U, sim->boxes);
 
   // Save SpeciesDataSt structure
   writeToBuf(buf, "%c", sim->species->name[0]);
@@ -223,8 +251,6 @@ void writeCheckpoint(SimFlat *sim)
 void loadCheckpoint(SimFlat *sim)
 {
   int fd;
-  int nTotalBoxes = sim->boxes->nTotalBoxes;
-  int maxTotalAtoms = MAXATOMS * nTotalBoxes;
 
   char *data;
   char *orig_data;
@@ -260,9 +286,12 @@ void loadCheckpoint(SimFlat *sim)
   sim->dt = strtof(data, &data);
 
   // Load Domain structure
-  sim->domain->procGrid[0] = strtol(data, &data, 10);
-  sim->domain->procGrid[1] = strtol(data, &data, 10);
-  sim->domain->procGrid[2] = strtol(data, &data, 10);
+  for (int i = 0; i < 3; i++)
+  {
+    int procGrid = strtol(data, &data, 10);
+    assert(procGrid == sim->domain->procGrid[i] &&
+           "Checkpoint has a different processor grid");
+  }
 
   sim->domain->procCoord[0] = strtol(data, &data, 10);
   sim->domain->procCoord[1] = strtol(data, &data, 10);
@@ -292,45 +321,80 @@ void loadCheckpoint(SimFlat *sim)
   sim->domain->localExtent[1] = strtof(data, &data);
   sim->domain->localExtent[2] = strtof(data, &data);
 
-  // Load LinkCell structure
-  sim->boxes->gridSize[0] = strtol(data, &data, 10);
-  sim->boxes->gridSize[1] = strtol(data, &data, 10);
-  sim->boxes->gridSize[2] = strtol(data, &data, 10);
-
-  sim->boxes->nLocalBoxes = strtol(data, &data, 10);
-  sim->boxes->nHaloBoxes = strtol(data, &data, 10);
-  sim->boxes->nTotalBoxes = strtol(data, &data, 10);
-
-  sim->boxes->localMin[0] = strtof(data, &data);
-  sim->boxes->localMin[1] = strtof(data, &data);
-  sim->boxes->localMin[2] = strtof(data, &data);
-
-  sim->boxes->localMax[0] = strtof(data, &data);
-  sim->boxes->localMax[1] = strtof(data, &data);
-  sim->boxes->localMax[2] = strtof(data, &data);
-
-  sim->boxes->boxSize[0] = strtof(data, &data);
-  sim->boxes->boxSize[1] = strtof(data, &data);
-  sim->boxes->boxSize[2] = strtof(data, &data);
-
-  sim->boxes->invBoxSize[0] = strtof(data, &data);
-  sim->boxes->invBoxSize[1] = strtof(data, &data);
-  sim->boxes->invBoxSize[2] = strtof(data, &data);
+  // Restore the planes between processors.  If the load balancer had
+  // moved them, the local bounds change and the boxes, atoms and
+  // exchanges set up from the command line no longer fit.
+  int moved = 0;
+  ++data;
+  for (int i = 0; i < 3; i++)
+    for (int ip = 0; ip <= sim->domain->procGrid[i]; ip++)
+    {
+      real_t plane;
+      copyFromBuf(&plane, data, sizeof(real_t));
+      moved |= (plane != sim->domain->plane[i][ip]);
+      sim->domain->plane[i][ip] = plane;
+    }
+  if (moved)
+    resizeDomain(sim);
+  else
+    updateLocalBounds(sim->domain);
+  int nTotalBoxes = sim->boxes->nTotalBoxes;
+  int *nAtoms = comdMalloc(nTotalBoxes * sizeof(int));
+
+  // Load LinkCell structure.  The boxes follow from the command line
+  // and the planes, so the saved grid must match them.
+  int gridSize[3];
+  gridSize[0] = strtol(data, &data, 10);
+  gridSize[1] = strtol(data, &data, 10);
+  gridSize[2] = strtol(data, &data, 10);
+
+  int nLocalBoxes = strtol(data, &data, 10);
+  int nHaloBoxes = strtol(data, &data, 10);
+  int nSavedBoxes = strtol(data, &data, 10);
+  // The box tables are not saved, so the atoms are only in the right
+  // boxes if they were stored in the same order.
+  int boxOrder = strtol(data, &data, 10);
+  assert(boxOrder == sim->boxes->boxOrder && "Checkpoint has a different box order");
+  // The number of cells per cutoff (-C) and the halo depth (-g, or a
+  // pruned stencil) change the number of boxes.
+  int cellsPerCutoff = strtol(data, &data, 10);
+  assert(cellsPerCutoff == sim->boxes->cellsPerCutoff &&
+         "Checkpoint has a different number of cells per cutoff");
+  int nHaloLayers = strtol(data, &data, 10);
+  assert(nHaloLayers == sim->boxes->nHaloLayers &&
+         "Checkpoint has a different halo depth");
+  for (int i = 0; i < 3; i++)
+    assert(gridSize[i] == sim->boxes->gridSize[i] &&
+           "Checkpoint has a different link cell grid");
+  assert(nLocalBoxes == sim->boxes->nLocalBoxes &&
+         nHaloBoxes == sim->boxes->nHaloBoxes &&
+         nSavedBoxes == nTotalBoxes &&
+         "Checkpoint has a different number of boxes");
+
+  // The extent of the boxes follows from the local bounds
+  for (int i = 0; i < 12; i++)
+    strtof(data, &data);
 
   ++data;
-  copyFromBuf(sim->boxes->nAtoms, data, nTotalBoxes * sizeof(int));
+  copyFromBuf(nAtoms, data, nTotalBoxes * sizeof(int));
 
   // Load Atoms structure
   sim->atoms->nLocal = strtol(data, &data, 10);
   sim->atoms->nGlobal = strtol(data, &data, 10);
 
+  // Replace the atoms in the boxes by the saved ones
+  for (int iBox = 0; iBox < nTotalBoxes; iBox++)
+    sim->boxes->nAtoms[iBox] = 0;
+  reserveAtoms(sim->boxes, sim->atoms, nAtoms, 1);
+  memcpy(sim->boxes->nAtoms, nAtoms, nTotalBoxes * sizeof(int));
+
   ++data;
-  copyFromBuf(sim->atoms->gid, data, maxTotalAtoms * sizeof(int));
-  copyFromBuf(sim->atoms->iSpecies, data, maxTotalAtoms * sizeof(int));
-  copyFromBuf(sim->atoms->r, data, maxTotalAtoms * sizeof(real3));
-  copyFromBuf(sim->atoms->p, data, maxTotalAtoms * sizeof(real3));
-  copyFromBuf(sim->atoms->f, data, maxTotalAtoms * sizeof(real3));
-  copyFromBuf(sim->atoms->U, data, maxTotalAtoms * sizeof(real_t));
+  copyBoxesFromBuf(sim->atoms->gid, data, sim->boxes);
+  copyBoxesFromBuf(sim->atoms->iSpecies, data, sim->boxes);
+  copyBoxesFromBuf(sim->atoms->r, data, sim->boxes);
+  copyBoxesFromBuf(sim->atoms->p, data, sim->boxes);
+  copyBoxesFromBuf(sim->atoms->f, data, sim->boxes);
+  copyBoxesFromBuf(sim->atoms->U, data, sim->boxes);
 
   // Load SpeciesDataSt structure
   sim->species->name[0] = data[0];
@@ -351,4 +415,5 @@ void loadCheckpoint(SimFlat *sim)
 
   // Free data
   aligned_free(orig_data);
+  comdFree(nAtoms);
 }
@@ -157,7 +157,7 @@ void processArgs(int argc, char** argv)
 
    o = myargs;
    sArgs= (char*)comdCalloc(2*(n+2),sizeof(char));
-   opts = (struct option*)comdCalloc(n,sizeof(struct option));
+   opts = (struct option*)comdCalloc(n+1,sizeof(struct option));
    for (i=0; i<n; i++)
    {
       opts[i].name = o->longArg;
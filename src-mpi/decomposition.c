@@ -3,32 +3,58 @@
 /// spatial Cartesian domain decomposition.  The simulation box is
 /// divided into equal size bricks by a grid that is xproc by yproc by
 /// zproc in size.
+///
+/// Which rank gets which brick matters for the halo exchanges: data
+/// sent between ranks on the same node never touches the network.  The
+/// original placement (RANK_MAP_XYZ) fills the grid in rank order with
+/// x fastest.  A node with n consecutive ranks then owns a thin slab of
+/// the grid and most of its halo faces lead off the node.  Two other
+/// placements are available:
+/// - RANK_MAP_CART lets the MPI library place the ranks through
+///   MPI_Cart_create with reorder.  Whether that helps depends on the
+///   library.
+/// - RANK_MAP_NODE gives each node a compact brick of the grid whose
+///   shape minimizes the halo of the brick that lies off the node.
+///   This needs the same number of ranks on every node and a brick that
+///   divides the grid.  Otherwise RANK_MAP_XYZ is used.
+///
+/// In all cases each rank learns the grid coordinates of all others,
+/// so processorNum works for any placement.
+///
+/// The grid itself can be left to chooseProcGrid.
+///
+/// The bricks are bounded by planes normal to the axes.  They start out
+/// evenly spaced, but the load balancer may move them, so bricks in
+/// the same layer of the grid share their extent along that axis only.
 
 #include "decomposition.h"
 
 #include <assert.h>
+#include <string.h>
 
 #include "memUtils.h"
 #include "parallel.h"
 
+static int mkNodeBrick(Domain* dd);
+static void nodeCoords(Domain* dd);
+static int haloCells(const real3 localExtent, real_t cutoff, int nHaloLayers,
+                     int* nLocal, int* nHalo);
+
 /// \param [in] xproc x-size of domain decomposition grid.
 /// \param [in] yproc y-size of domain decomposition grid.
 /// \param [in] zproc z-size of domain decomposition grid.
+/// \param [in] rankMap How to place the ranks on the grid (a RankMap).
 /// \param [in] globalExtent Size of the simulation domain (in Angstroms).
-Domain* initDecomposition(int xproc, int yproc, int zproc, real3 globalExtent)
+Domain* initDecomposition(int xproc, int yproc, int zproc, int rankMap,
+                          real3 globalExtent)
 {
-   assert( xproc * yproc * zproc == getNRanks());
+   int nRanks = getNRanks();
+   assert( xproc * yproc * zproc == nRanks);
 
    Domain* dd = comdMalloc(sizeof(Domain));
    dd->procGrid[0] = xproc;
    dd->procGrid[1] = yproc;
    dd->procGrid[2] = zproc;
-   // calculate grid coordinates i,j,k for this processor
-   int myRank = getMyRank();
-   dd->procCoord[0] = myRank % dd->procGrid[0];
-   myRank /= dd->procGrid[0];
-   dd->procCoord[1] = myRank % dd->procGrid[1];
-   dd->procCoord[2] = myRank / dd->procGrid[1];
 
    // initialialize global bounds
    for (int i = 0; i < 3; i++)
@@ -36,19 +62,76 @@ Domain* initDecomposition(int xproc, int yproc, int zproc, real3 globalExtent)
       dd->globalMin[i] = 0;
       dd->globalMax[i] = globalExtent[i];
       dd->globalExtent[i] = dd->globalMax[i] - dd->globalMin[i];
+      dd->localExtent[i] = dd->globalExtent[i] / dd->procGrid[i];
    }
-   
+
+   int myNode = getMyNode();
+   dd->rankNode = comdMalloc(nRanks*sizeof(int));
+   gatherIntParallel(&myNode, dd->rankNode, 1);
+
+   // calculate grid coordinates i,j,k for this processor
+   if (rankMap == RANK_MAP_NODE && ! mkNodeBrick(dd))
+      rankMap = RANK_MAP_XYZ;
+   dd->rankMap = rankMap;
+   if (rankMap == RANK_MAP_CART)
+      cartCoordsParallel(dd->procGrid, dd->procCoord);
+   else if (rankMap == RANK_MAP_NODE)
+      nodeCoords(dd);
+   else
+   {
+      int myRank = getMyRank();
+      dd->procCoord[0] = myRank % dd->procGrid[0];
+      myRank /= dd->procGrid[0];
+      dd->procCoord[1] = myRank % dd->procGrid[1];
+      dd->procCoord[2] = myRank / dd->procGrid[1];
+   }
+
+   // find the rank at every grid position
+   int* coords = comdMalloc(3*nRanks*sizeof(int));
+   gatherIntParallel(dd->procCoord, coords, 3);
+   dd->procRank = comdMalloc(nRanks*sizeof(int));
+   for (int iRank = 0; iRank < nRanks; iRank++)
+   {
+      int* cc = coords + 3*iRank;
+      int iGrid = cc[0] + dd->procGrid[0]*(cc[1] + dd->procGrid[1]*cc[2]);
+      dd->procRank[iGrid] = iRank;
+   }
+   comdFree(coords);
+
    // initialize local bounds on this processor
    for (int i = 0; i < 3; i++)
    {
-      dd->localExtent[i] = dd->globalExtent[i] / dd->procGrid[i];
-      dd->localMin[i] = dd->globalMin[i] +  dd->procCoord[i]    * dd->localExtent[i];
-      dd->localMax[i] = dd->globalMin[i] + (dd->procCoord[i]+1) * dd->localExtent[i];
+      dd->plane[i] = comdMalloc((dd->procGrid[i]+1)*sizeof(real_t));
+      for (int ip = 0; ip <= dd->procGrid[i]; ip++)
+         dd->plane[i][ip] = dd->globalMin[i] + ip * dd->localExtent[i];
+      dd->localMin[i] = dd->plane[i][dd->procCoord[i]];
+      dd->localMax[i] = dd->plane[i][dd->procCoord[i]+1];
    }
 
    return dd;
 }
 
+void destroyDecomposition(Domain** domain)
+{
+   if (! *domain) return;
+   comdFree((*domain)->procRank);
+   comdFree((*domain)->rankNode);
+   for (int i = 0; i < 3; i++)
+      comdFree((*domain)->plane[i]);
+   comdFree(*domain);
+   *domain = NULL;
+}
+
+void updateLocalBounds(Domain* domain)
+{
+   for (int i = 0; i < 3; i++)
+   {
+      domain->localMin[i] = domain->plane[i][domain->procCoord[i]];
+      domain->localMax[i] = domain->plane[i][domain->procCoord[i]+1];
+      domain->localExtent[i] = domain->localMax[i] - domain->localMin[i];
+   }
+}
+
 /// \details
 /// Calculates the rank of the processor with grid coordinates
 /// (ix+dix, iy+diy, iz+diz) where (ix, iy, iz) are the grid coordinates
@@ -62,5 +145,194 @@ int processorNum(Domain* domain, int dix, int diy, int diz)
    int iy = (procCoord[1] + diy + procGrid[1]) % procGrid[1];
    int iz = (procCoord[2] + diz + procGrid[2]) % procGrid[2];
 
-   return ix + procGrid[0] *(iy + procGrid[1]*iz);
+   return domain->procRank[ix + procGrid[0] *(iy + procGrid[1]*iz)];
+}
+
+int onMyNode(Domain* domain, int rank)
+{
+   return domain->rankNode[rank] == domain->rankNode[getMyRank()];
+}
+
+int parseRankMap(const char* name)
+{
+   if (strcmp(name, "xyz") == 0)  return RANK_MAP_XYZ;
+   if (strcmp(name, "cart") == 0) return RANK_MAP_CART;
+   if (strcmp(name, "node") == 0) return RANK_MAP_NODE;
+   return -1;
+}
+
+const char* rankMapName(int rankMap)
+{
+   switch (rankMap)
+   {
+     case RANK_MAP_XYZ:  return "xyz";
+     case RANK_MAP_CART: return "cart";
+     case RANK_MAP_NODE: return "node";
+   }
+   return "unknown";
+}
+
+/// \details
+/// Tries every factorization of nRanks that keeps the non-zero entries
+/// of procGrid and takes the one with the fewest halo link cells per
+/// local link cell, i.e., the least halo data per atom.  The cell
+/// counts are those initLinkCells will use for the given cutoff, so
+/// the rounding of the cells is taken into account.  Grids that leave
+/// a task with fewer than two link cells along some axis are only
+/// chosen if there is no other way.  If the fixed entries do not divide
+/// nRanks the zero entries are set to one and the sanity checks report
+/// the mismatch.
+void chooseProcGrid(int nRanks, const real3 globalExtent, real_t cutoff,
+                    int nHaloLayers, int procGrid[3])
+{
+   int best[3] = {0, 0, 0};
+   int bestOk = -1;
+   double bestRatio = 0.0;
+   for (int px = 1; px <= nRanks; px++)
+      for (int py = 1; py <= nRanks/px; py++)
+      {
+         if (nRanks % (px*py) != 0)
+            continue;
+         int grid[3] = {px, py, nRanks/(px*py)};
+         int match = 1;
+         for (int i = 0; i < 3; i++)
+            if (procGrid[i] > 0 && procGrid[i] != grid[i])
+               match = 0;
+         if (! match)
+            continue;
+
+         real3 localExtent;
+         for (int i = 0; i < 3; i++)
+            localExtent[i] = globalExtent[i] / grid[i];
+         int nLocal, nHalo;
+         int ok = haloCells(localExtent, cutoff, nHaloLayers, &nLocal, &nHalo);
+         double ratio = (nLocal > 0) ? (double) nHalo / nLocal : 1e30;
+         if (ok > bestOk || (ok == bestOk && ratio < bestRatio))
+         {
+            bestOk = ok;
+            bestRatio = ratio;
+            for (int i = 0; i < 3; i++)
+               best[i] = grid[i];
+         }
+      }
+   for (int i = 0; i < 3; i++)
+      if (procGrid[i] <= 0)
+         procGrid[i] = (bestOk >= 0) ? best[i] : 1;
+}
+
+/// Count the link cells of a domain of size localExtent the way
+/// initLinkCells would lay them out for the given cutoff and halo
+/// depth.  The number of local cells is returned in nLocal and the
+/// number of halo cells in nHalo.  Returns 0 if any axis has fewer than
+/// two local cells or fewer cells than halo layers, since initLinkCells
+/// cannot handle such a domain.
+int haloCells(const real3 localExtent, real_t cutoff, int nHaloLayers,
+              int* nLocal, int* nHalo)
+{
+   int ok = 1;
+   int nPadded = 1;
+   *nLocal = 1;
+   for (int i = 0; i < 3; i++)
+   {
+      int gridSize = localExtent[i] / cutoff;
+      if (gridSize < 2 || gridSize < nHaloLayers)
+         ok = 0;
+      *nLocal *= gridSize;
+      nPadded *= gridSize + 2*nHaloLayers;
+   }
+   *nHalo = nPadded - *nLocal;
+   return ok;
+}
+
+/// Choose the shape of the brick of processors each node owns.  Among
+/// all bricks with as many processors as a node has ranks that divide
+/// the grid evenly, take the one with the least halo that leaves the
+/// node.  For a thin halo of width h around a brick of size B this is
+/// 2h*(sum of face areas) + 4h^2*(sum of edge lengths) + ..., so the
+/// bricks are compared by face area first and by edge length to break
+/// ties.  Faces normal to an axis that the brick spans completely do not
+/// count: by periodicity their halo is on the node itself.  Remaining
+/// ties go to the brick that is thinnest in x, whose faces carry the
+/// least data in HALO_AXES mode (nothing is forwarded across them).
+/// Returns 0 if the nodes differ in size or no brick fits.
+int mkNodeBrick(Domain* dd)
+{
+   int nRanks = getNRanks();
+   int* nodeSize = comdCalloc(nRanks, sizeof(int));
+   for (int iRank = 0; iRank < nRanks; iRank++)
+      nodeSize[dd->rankNode[iRank]]++;
+   int size = nodeSize[dd->rankNode[0]];
+   int uniform = 1;
+   for (int iRank = 0; iRank < nRanks; iRank++)
+      if (nodeSize[dd->rankNode[iRank]] != size)
+         uniform = 0;
+   comdFree(nodeSize);
+   if (! uniform)
+      return 0;
+
+   const int* grid = dd->procGrid;
+   double bestArea = -1.0;
+   double bestEdge = -1.0;
+   for (int bx = 1; bx <= grid[0]; bx++)
+      for (int by = 1; by <= grid[1]; by++)
+      {
+         if (grid[0]%bx != 0 || grid[1]%by != 0 || size%(bx*by) != 0)
+            continue;
+         int bz = size/(bx*by);
+         if (grid[2]%bz != 0)
+            continue;
+         int bb[3] = {bx, by, bz};
+         double extent[3];
+         int open[3];
+         for (int ii = 0; ii < 3; ii++)
+         {
+            extent[ii] = bb[ii]*dd->localExtent[ii];
+            open[ii] = bb[ii] < grid[ii];
+         }
+         double area = 0.0;
+         double edge = 0.0;
+         for (int ii = 0; ii < 3; ii++)
+         {
+            int jj = (ii+1)%3;
+            int kk = (ii+2)%3;
+            area += open[ii] * extent[jj]*extent[kk];
+            edge += open[ii]*open[jj] * extent[kk];
+         }
+         double tol = 1e-9*(area + bestArea);
+         if (bestArea < 0 || area < bestArea - tol ||
+             (area <= bestArea + tol && edge < bestEdge))
+         {
+            bestArea = area;
+            bestEdge = edge;
+            for (int ii = 0; ii < 3; ii++)
+               dd->nodeBrick[ii] = bb[ii];
+         }
+      }
+   return bestArea >= 0;
+}
+
+/// Set the grid coordinates of the calling task in RANK_MAP_NODE.  The
+/// nodes are numbered in order of their lowest rank and fill the grid
+/// of bricks with x fastest.  Within its node's brick a task is placed
+/// by its order among the ranks of the node, again x fastest.
+void nodeCoords(Domain* dd)
+{
+   int myRank = getMyRank();
+   int myNode = dd->rankNode[myRank];
+   int nodeIndex = 0;
+   int nodeRank = 0;
+   for (int iRank = 0; iRank < getNRanks(); iRank++)
+   {
+      if (iRank < myNode && dd->rankNode[iRank] == iRank)
+         nodeIndex++;
+      if (iRank < myRank && dd->rankNode[iRank] == myNode)
+         nodeRank++;
+   }
+
+   const int* bb = dd->nodeBrick;
+   int nbx = dd->procGrid[0]/bb[0];
+   int nby = dd->procGrid[1]/bb[1];
+   dd->procCoord[0] = (nodeIndex%nbx)*bb[0]     + nodeRank%bb[0];
+   dd->procCoord[1] = ((nodeIndex/nbx)%nby)*bb[1] + (nodeRank/bb[0])%bb[1];
+   dd->procCoord[2] = (nodeIndex/(nbx*nby))*bb[2] + nodeRank/(bb[0]*bb[1]);
 }
@@ -6,12 +6,24 @@
 
 #include "mytype.h"
 
+/// How the ranks are placed on the processor grid.
+enum RankMap
+{
+   RANK_MAP_XYZ,  //!< rank order with x fastest
+   RANK_MAP_CART, //!< as chosen by MPI_Cart_create with reorder
+   RANK_MAP_NODE  //!< each node owns a compact brick of the grid
+};
+
 /// Domain decomposition information.
 typedef struct DomainSt
 {
    // process-layout data
    int procGrid[3];        //!< number of processors in each dimension
    int procCoord[3];       //!< i,j,k for this processor
+   int rankMap;            //!< how ranks are placed on the grid (a RankMap)
+   int nodeBrick[3];       //!< processors of a node in each dimension (RANK_MAP_NODE)
+   int* procRank;          //!< rank at each grid position, x fastest
+   int* rankNode;          //!< node (lowest rank on it) of each rank
 
    // global bounds data
    real3 globalMin;        //!< minimum global coordinate (angstroms)
@@ -22,12 +34,31 @@ typedef struct DomainSt
    real3 localMin;         //!< minimum coordinate on local processor
    real3 localMax;         //!< maximum coordinate on local processor
    real3 localExtent;      //!< localMax - localMin
+   real_t* plane[3];       //!< procGrid[i]+1 boundaries of the processors along axis i
 } Domain;
 
 struct DomainSt* initDecomposition(int xproc, int yproc, int zproc,
-                                   real3 globalExtent);
+                                   int rankMap, real3 globalExtent);
+
+void destroyDecomposition(Domain** domain);
+
+/// Set the local bounds from the planes.
+void updateLocalBounds(Domain* domain);
+
+/// Choose the entries of procGrid that are zero.
+void chooseProcGrid(int nRanks, const real3 globalExtent, real_t cutoff,
+                    int nHaloLayers, int procGrid[3]);
 
 /// Find the MPI rank of a neighbor domain from a relative coordinate.
 int processorNum(Domain* domain, int dix, int diy, int dik);
 
+/// Return non-zero if rank runs on the same node as the calling task.
+int onMyNode(Domain* domain, int rank);
+
+/// Return a RankMap or -1 if the name is not known.
+int parseRankMap(const char* name);
+
+/// Return the name of a RankMap.
+const char* rankMapName(int rankMap);
+
 #endif
@@ -54,7 +54,12 @@
 ///   energy contribution to the force and add to the two-body force
 ///
 /// The second loop over pairs doubles the data motion requirement
-/// relative to a simple pair potential.
+/// relative to a simple pair potential.  Optionally (\--pairCache), the
+/// first loop records every pair inside the cutoff together with
+/// \f$ \rho'(r_{ij})\hat{r}_{ij} \f$.  The third loop then streams
+/// through this buffer instead of repeating the distance computation,
+/// square root, and table lookup, at the cost of storing 2 ints and 3
+/// reals per pair.
 ///
 /// The second consequence of the force expression is that computing the
 /// forces on all atoms requires additional communication beyond the
@@ -75,7 +80,16 @@
 /// density problem.  One possibility is to extend the halo exchange
 /// radius for the atom exchange to twice the potential cutoff distance.
 /// This is likely undesirable due to large increase in communication
-/// volume.  The other possibility is to accumulate partial force terms
+/// volume.  Nevertheless, it is available as an option
+/// (\--ghostDensity) since it removes the communication from the force
+/// routine entirely.  In this mode the halo cells reach two cutoffs
+/// beyond the local domain, the first loop also visits the pairs
+/// between halo atoms, and the second loop computes
+/// \f$ F'(\bar\rho) \f$ for the halo atoms as well as the local ones.
+/// Only the halo atoms in the first layer (i.e., within one cutoff of
+/// the local domain) see all of their
+/// neighbors, but these are the only halo atoms that interact with
+/// local atoms in the third loop.  The other possibility is to accumulate partial force terms
 /// on the tasks where they can be computed.  In this method, tasks will
 /// compute force contributions for remote atoms, then communicate the
 /// partial forces at the end of the halo exchange.  This method has the
@@ -99,9 +113,34 @@
 #include "CoMDTypes.h"
 #include "performanceTimers.h"
 #include "haloExchange.h"
+#include "threadBuffers.h"
+#include "timestep.h"
 
 #define MAX(A,B) ((A) > (B) ? (A) : (B))
 
+/// Alignment of the interpolation tables, so that the coefficients of
+/// one interval never straddle two cache lines.
+#define CACHE_LINE 64
+
+/// A pair recorded during the first pass of eamForce for reuse in the
+/// third pass.
+/// \see recordPair
+typedef struct EamPairSt
+{
+   int iOff;        //!< atom index of atom i
+   int jOff;        //!< atom index of atom j
+   real3 dRhoHat;   //!< rho'(r_ij) times the unit vector from j to i
+} EamPair;
+
+/// The pairs recorded by one thread.  Each thread records the pairs it
+/// visits in pass 1 and handles the same pairs in pass 3.
+typedef struct EamPairCacheSt
+{
+   int nPairs;      //!< number of pairs in the cache
+   int capacity;    //!< allocated length of pairs
+   EamPair* pairs;  //!< the pairs
+} EamPairCache;
+
 /// Handles interpolation of tabular data.
 ///
 /// \see initInterpolationObject
@@ -112,6 +151,7 @@ typedef struct InterpolationObjectSt
    real_t x0;      //!< the starting ordinate range
    real_t invDx;   //!< the inverse of the table spacing
    real_t* values; //!< the abscissa values
+   real_t* coef;   //!< cubic coefficients, 4 per interval, n+1 intervals
 } InterpolationObject;
 
 /// Derived struct for an EAM potential.
@@ -132,11 +172,24 @@ typedef struct EamPotentialSt
    InterpolationObject* phi;  //!< Pair energy
    InterpolationObject* rho;  //!< Electron Density
    InterpolationObject* f;    //!< Embedding Energy
+   real_t* phiRho;            //!< phi and rho coefficients, interleaved
+
+   int usePairCache;          //!< if non-zero, record pairs in pass 1
+   int nPairCaches;           //!< number of pair caches (one per thread)
+   EamPairCache* pairCaches;  //!< the pair caches
+
+   int ghostDensity;          //!< if non-zero, compute ghost rhobar locally
+   int nGhostAtoms;           //!< halo atoms embedded in the last call
+   int nInnerGhostAtoms;      //!< those in the first halo layer
+   int nLocalPairs;           //!< pass 1 pairs with a local atom
+   int nGhostPairs;           //!< pass 1 pairs between two halo atoms
 
    real_t* rhobar;        //!< per atom storage for rhobar
    real_t* dfEmbed;       //!< per atom storage for derivative of Embedding
+   int nAtomSlots;        //!< length of rhobar and dfEmbed
    HaloExchange* forceExchange;
    ForceExchangeData* forceExchangeData;
+   LinkCell* boxes;       //!< the link cells the storage above was set up for
 } EamPotential;
 
 // EAM functionality
@@ -144,13 +197,28 @@ static int eamForce(SimFlat* s);
 static void eamPrint(FILE* file, BasePotential* pot);
 static void eamDestroy(BasePotential** pot); 
 static void eamBcastPotential(EamPotential* pot);
+static real_t eamLinkCellPhiRho(SimFlat* s, real_t rCut2, enum BoxPairs pairs);
+static void eamLinkCellForce(SimFlat* s, real_t rCut2, enum BoxPairs pairs);
+static real_t eamNbrListPhiRho(SimFlat* s, real_t rCut2);
+static void eamNbrListForce(SimFlat* s, real_t rCut2, enum BoxPairs pairs);
+static void eamPairCacheForce(SimFlat* s, enum BoxPairs pairs);
+static void eamThirdPass(SimFlat* s, real_t rCut2, enum BoxPairs pairs);
+static int visitLocalPair(enum BoxPairs pairs, int iOff, int jOff, int haloBegin);
+static void recordPair(EamPairCache* cache, int iOff, int jOff, real_t dRho, real3 dr, real_t r);
+static void countGhostAtoms(SimFlat* s);
+static int isOuterHaloBox(LinkCell* boxes, int iBox);
+static void fitEamArrays(EamPotential* pot, int nAtoms);
 
 
 // Table interpolation functionality
 static InterpolationObject* initInterpolationObject(
    int n, real_t x0, real_t dx, real_t* data);
 static void destroyInterpolationObject(InterpolationObject** table);
+static void initInterpolationCoefficients(InterpolationObject* table);
 static void interpolate(InterpolationObject* table, real_t r, real_t* f, real_t* df);
+static void initPhiRhoTable(EamPotential* pot);
+static void interpolatePhiRho(EamPotential* pot, real_t r,
+                              real_t* phi, real_t* dPhi, real_t* rho, real_t* dRho);
 static void bcastInterpolationObject(InterpolationObject** table);
 static void printTableData(InterpolationObject* table, const char* fileName);
 
@@ -168,7 +236,12 @@ static void typeNotSupported(const char* callSite, const char* type);
 /// \param [in] dir   The directory in which potential table files are found.
 /// \param [in] file  The name of the potential table file.
 /// \param [in] type  The file format of the potential file (setfl or funcfl).
-BasePotential* initEamPot(const char* dir, const char* file, const char* type)
+/// \param [in] usePairCache If non-zero, cache pair data between passes.
+/// \param [in] ghostDensity If non-zero, compute the density of halo
+///                          atoms locally instead of exchanging it.  The
+///                          halo cells must reach two cutoffs deep.
+BasePotential* initEamPot(const char* dir, const char* file, const char* type,
+                          int usePairCache, int ghostDensity)
 {
    EamPotential* pot = comdMalloc(sizeof(EamPotential));
    assert(pot);
@@ -185,7 +258,20 @@ BasePotential* initEamPot(const char* dir, const char* file, const char* type)
    // initialization until the first time we call the force routine.
    pot->dfEmbed = NULL;
    pot->rhobar  = NULL;
+   pot->nAtomSlots = 0;
    pot->forceExchange = NULL;
+   pot->forceExchangeData = NULL;
+   pot->boxes = NULL;
+
+   pot->usePairCache = usePairCache;
+   pot->nPairCaches = getNThreads();
+   pot->pairCaches = comdCalloc(pot->nPairCaches, sizeof(EamPairCache));
+
+   pot->ghostDensity = ghostDensity;
+   pot->nGhostAtoms = 0;
+   pot->nInnerGhostAtoms = 0;
+   pot->nLocalPairs = 0;
+   pot->nGhostPairs = 0;
 
    if (getMyRank() == 0)
    {
@@ -197,6 +283,7 @@ BasePotential* initEamPot(const char* dir, const char* file, const char* type)
          typeNotSupported("initEamPot", type);
    }
    eamBcastPotential(pot);
+   initPhiRhoTable(pot);
    
    return (BasePotential*) pot;
 }
@@ -212,103 +299,79 @@ BasePotential* initEamPot(const char* dir, const char* file, const char* type)
 ///   -# Loop over all atoms and their neighbors, compute the embedding
 ///   energy contribution to the force and add to the two-body force
 /// 
+/// In ghost density mode the first two steps also cover the halo atoms
+/// and the halo exchange between steps 2 and 3 is skipped.
 int eamForce(SimFlat* s)
 {
    EamPotential* pot = (EamPotential*) s->pot;
    assert(pot);
 
-   // set up halo exchange and internal storage on first call to forces.
-   if (pot->forceExchange == NULL)
+   // set up halo exchange on first call to forces and again whenever
+   // the load balancer has replaced the link cells.
+   if (pot->boxes != s->boxes)
    {
-      int maxTotalAtoms = MAXATOMS*s->boxes->nTotalBoxes;
-      pot->dfEmbed = comdMalloc(maxTotalAtoms*sizeof(real_t));
-      pot->rhobar  = comdMalloc(maxTotalAtoms*sizeof(real_t));
-      pot->forceExchange = initForceHaloExchange(s->domain, s->boxes);
-      pot->forceExchangeData = comdMalloc(sizeof(ForceExchangeData));
-      pot->forceExchangeData->dfEmbed = pot->dfEmbed;
-      pot->forceExchangeData->boxes = s->boxes;
+      comdFree(pot->forceExchangeData);
+      destroyHaloExchange(&(pot->forceExchange));
+      pot->boxes = s->boxes;
+      if (pot->ghostDensity)
+      {
+         assert(s->boxes->nHaloLayers >= 2*s->boxes->cellsPerCutoff);
+      }
+      else
+      {
+         pot->forceExchange = initForceHaloExchange(s->domain, s->boxes, s->haloMode, s->nbrList == NULL);
+         pot->forceExchangeData = comdMalloc(sizeof(ForceExchangeData));
+         pot->forceExchangeData->boxes = s->boxes;
+      }
    }
+   fitEamArrays(pot, s->atoms->capacity);
+   fitThreadBuffers(s->threadBuffers, s->atoms->capacity);
    
    real_t rCut2 = pot->cutoff*pot->cutoff;
 
-   // zero forces / energy / rho /rhoprime
+   // zero forces / energy / rho /rhoprime.  All of rhobar and dfEmbed
+   // is cleared, in case the atom exchange below grows the atom arrays.
    real_t etot = 0.0;
-   memset(s->atoms->f,  0, s->boxes->nTotalBoxes*MAXATOMS*sizeof(real3));
-   memset(s->atoms->U,  0, s->boxes->nTotalBoxes*MAXATOMS*sizeof(real_t));
-   memset(pot->dfEmbed, 0, s->boxes->nTotalBoxes*MAXATOMS*sizeof(real_t));
-   memset(pot->rhobar,  0, s->boxes->nTotalBoxes*MAXATOMS*sizeof(real_t));
-
-   int nbrBoxes[27];
-   // loop over local boxes
-   for (int iBox=0; iBox<s->boxes->nLocalBoxes; iBox++)
+   int fSize = s->atoms->capacity;
+   #pragma omp parallel for
+   for (int ii=0; ii<fSize; ii++)
    {
-      int nIBox = s->boxes->nAtoms[iBox];
-      int nNbrBoxes = getNeighborBoxes(s->boxes, iBox, nbrBoxes);
-      // loop over neighbor boxes of iBox (some may be halo boxes)
-      for (int jTmp=0; jTmp<nNbrBoxes; jTmp++)
-      {
-         int jBox = nbrBoxes[jTmp];
-         if (jBox < iBox ) continue;
-
-         int nJBox = s->boxes->nAtoms[jBox];
-         // loop over atoms in iBox
-         for (int iOff=MAXATOMS*iBox,ii=0; ii<nIBox; ii++,iOff++)
-         {
-            // loop over atoms in jBox
-            for (int jOff=MAXATOMS*jBox,ij=0; ij<nJBox; ij++,jOff++)
-            {
-               if ( (iBox==jBox) &&(ij <= ii) ) continue;
-
-               double r2 = 0.0;
-               real3 dr;
-               for (int k=0; k<3; k++)
-               {
-                  dr[k]=s->atoms->r[iOff][k]-s->atoms->r[jOff][k];
-                  r2+=dr[k]*dr[k];
-               }
-               if(r2>rCut2) continue;
-
-               double r = sqrt(r2);
-
-               real_t phiTmp, dPhi, rhoTmp, dRho;
-               interpolate(pot->phi, r, &phiTmp, &dPhi);
-               interpolate(pot->rho, r, &rhoTmp, &dRho);
-
-               for (int k=0; k<3; k++)
-               {
-                  s->atoms->f[iOff][k] -= dPhi*dr[k]/r;
-                  s->atoms->f[jOff][k] += dPhi*dr[k]/r;
-               }
-
-               // update energy terms
-               // calculate energy contribution based on whether
-               // the neighbor box is local or remote
-               if (jBox < s->boxes->nLocalBoxes)
-                  etot += phiTmp;
-               else
-                  etot += 0.5*phiTmp;
-
-               s->atoms->U[iOff] += 0.5*phiTmp;
-               s->atoms->U[jOff] += 0.5*phiTmp;
-
-               // accumulate rhobar for each atom
-               pot->rhobar[iOff] += rhoTmp;
-               pot->rhobar[jOff] += rhoTmp;
-
-            } // loop over atoms in jBox
-         } // loop over atoms in iBox
-      } // loop over neighbor boxes
-   } // loop over local boxes
+      zeroReal3(s->atoms->f[ii]);
+      s->atoms->U[ii] = 0.;
+   }
+   #pragma omp parallel for
+   for (int ii=0; ii<pot->nAtomSlots; ii++)
+   {
+      pot->dfEmbed[ii] = 0.;
+      pot->rhobar[ii] = 0.;
+   }
+   for (int ii=0; ii<pot->nPairCaches; ii++)
+      pot->pairCaches[ii].nPairs = 0;
+   pot->nLocalPairs = 0;
+   pot->nGhostPairs = 0;
+
+   if (s->nbrList)
+      etot += eamNbrListPhiRho(s, rCut2);
+   else if (haloExchangeInFlight(s->atomExchange))
+   {
+      // The pairs of inner boxes do not depend on the atom exchange.
+      etot += eamLinkCellPhiRho(s, rCut2, INNER_PAIRS);
+      finishRedistribution(s);
+      fitEamArrays(pot, s->atoms->capacity);
+      etot += eamLinkCellPhiRho(s, rCut2, OUTER_PAIRS);
+   }
+   else
+      etot += eamLinkCellPhiRho(s, rCut2, ALL_PAIRS);
 
    // Compute Embedding Energy
    // loop over all local boxes
+   #pragma omp parallel for reduction(+:etot)
    for (int iBox=0; iBox<s->boxes->nLocalBoxes; iBox++)
    {
-      int iOff;
       int nIBox =  s->boxes->nAtoms[iBox];
 
       // loop over atoms in iBox
-      for (int iOff=MAXATOMS*iBox,ii=0; ii<nIBox; ii++,iOff++)
+      for (int iOff=s->boxes->boxOffset[iBox],ii=0; ii<nIBox; ii++,iOff++)
       {
          real_t fEmbed, dfEmbed;
          interpolate(pot->f, pot->rhobar[iOff], &fEmbed, &dfEmbed);
@@ -318,62 +381,479 @@ int eamForce(SimFlat* s)
       }
    }
 
-   // exchange derivative of the embedding energy with repsect to rhobar
-   startTimer(eamHaloTimer);
-   haloExchange(pot->forceExchange, pot->forceExchangeData);
-   stopTimer(eamHaloTimer);
-
-   // third pass
-   // loop over local boxes
-   for (int iBox=0; iBox<s->boxes->nLocalBoxes; iBox++)
+   if (pot->ghostDensity)
    {
-      int nIBox =  s->boxes->nAtoms[iBox];
-      int nNbrBoxes = getNeighborBoxes(s->boxes, iBox, nbrBoxes);
-      // loop over neighbor boxes of iBox (some may be halo boxes)
-      for (int jTmp=0; jTmp<nNbrBoxes; jTmp++)
+      // the halo atoms have their own rhobar.  No energy is tallied
+      // since the owning task counts it.
+      #pragma omp parallel for
+      for (int iBox=s->boxes->nLocalBoxes; iBox<s->boxes->nTotalBoxes; iBox++)
       {
-         int jBox = nbrBoxes[jTmp];
-         if(jBox < iBox) continue;
+         int nIBox =  s->boxes->nAtoms[iBox];
+         for (int iOff=s->boxes->boxOffset[iBox],ii=0; ii<nIBox; ii++,iOff++)
+         {
+            real_t fEmbed, dfEmbed;
+            interpolate(pot->f, pot->rhobar[iOff], &fEmbed, &dfEmbed);
+            pot->dfEmbed[iOff] = dfEmbed;
+         }
+      }
+      countGhostAtoms(s);
+   }
+   else
+   {
+      // exchange derivative of the embedding energy with repsect to rhobar
+      pot->forceExchangeData->dfEmbed = pot->dfEmbed;
+      pot->forceExchangeData->r = s->atoms->r;
+      pot->forceExchangeData->gid = s->atoms->gid;
+      startTimer(eamHaloTimer);
+      if (s->overlapHalo)
+         postHaloExchange(pot->forceExchange, pot->forceExchangeData);
+      else
+         haloExchange(pot->forceExchange, pot->forceExchangeData);
+      stopTimer(eamHaloTimer);
+   }
+
+   // third pass.  The exchange writes only halo atoms, so the pairs of
+   // two local atoms can go ahead while it is in flight.
+   if (pot->forceExchange && haloExchangeInFlight(pot->forceExchange))
+   {
+      eamThirdPass(s, rCut2, INNER_PAIRS);
+      startTimer(eamHaloTimer);
+      completeHaloExchange(pot->forceExchange);
+      stopTimer(eamHaloTimer);
+      eamThirdPass(s, rCut2, OUTER_PAIRS);
+   }
+   else
+      eamThirdPass(s, rCut2, ALL_PAIRS);
 
-         int nJBox = s->boxes->nAtoms[jBox];
-         // loop over atoms in iBox
-         for (int iOff=MAXATOMS*iBox,ii=0; ii<nIBox; ii++,iOff++)
+   s->ePotential = (real_t) etot;
+
+   return 0;
+}
+
+/// First pass of the link cell force loop.  Computes the pair energy
+/// and forces and accumulates the electron density (rhobar) of all
+/// atoms.  In ghost density mode pairs of two halo atoms are included
+/// so that the halo atoms in the first layer get their full density.
+/// Pairs of two atoms beyond the first halo layer are still skipped.
+/// Only the box pairs selected by pairs are visited.  While the inner
+/// pairs are computed, the master thread keeps the atom exchange
+/// moving.
+///
+/// \return The local pair energy.
+real_t eamLinkCellPhiRho(SimFlat* s, real_t rCut2, enum BoxPairs pairs)
+{
+   EamPotential* pot = (EamPotential*) s->pot;
+   int nLocalBoxes = s->boxes->nLocalBoxes;
+   real_t etot = 0.0;
+   int nLocalPairs = 0;
+   int nGhostPairs = 0;
+
+   #pragma omp parallel reduction(+:etot,nLocalPairs,nGhostPairs)
+   {
+      real3* f = s->atoms->f;
+      real_t* U = s->atoms->U;
+      real_t* rho = pot->rhobar;
+      selectThreadBuffers(s->threadBuffers, &f, &U, &rho);
+      EamPairCache* cache = pot->pairCaches + getMyThread();
+      int nbrBoxes[MAX_HALF_SHELL_BOXES];
+      // loop over all boxes (the stencil of a halo box may hold local boxes)
+      #pragma omp for schedule(dynamic, 4)
+      for (int iBox=0; iBox<s->boxes->nTotalBoxes; iBox++)
+      {
+         if (pairs == INNER_PAIRS)
+         {
+            if (! isInnerBox(s->boxes, iBox, ATOM_EXCHANGE_DEPTH)) continue;
+            if (getMyThread() == 0)
+               progressHaloExchange(s->atomExchange);
+         }
+         int nIBox = s->boxes->nAtoms[iBox];
+         if (nIBox == 0) continue;
+         int nNbrBoxes;
+         int iOuter = 0;
+         if (pot->ghostDensity)
+         {
+            nNbrBoxes = getHalfShellBoxesWithHalo(s->boxes, iBox, nbrBoxes);
+            iOuter = isOuterHaloBox(s->boxes, iBox);
+         }
+         else
+            nNbrBoxes = getHalfShellBoxes(s->boxes, iBox, nbrBoxes);
+         // loop over half-shell neighbor boxes of iBox
+         for (int jTmp=0; jTmp<nNbrBoxes; jTmp++)
          {
-            // loop over atoms in jBox
-            for (int jOff=MAXATOMS*jBox,ij=0; ij<nJBox; ij++,jOff++)
-            { 
-               if ((iBox==jBox) && (ij <= ii))  continue;
-
-               double r2 = 0.0;
-               real3 dr;
-               for (int k=0; k<3; k++)
+            int jBox = nbrBoxes[jTmp];
+            if (iOuter && isOuterHaloBox(s->boxes, jBox)) continue;
+            if (! visitBoxPair(s->boxes, pairs, ATOM_EXCHANGE_DEPTH, iBox, jBox)) continue;
+
+            int nJBox = s->boxes->nAtoms[jBox];
+            // each local atom of the pair owns half of the energy.
+            real_t eScale = 0.5*((iBox < nLocalBoxes) + (jBox < nLocalBoxes));
+            int* nPairs = (eScale > 0.0) ? &nLocalPairs : &nGhostPairs;
+
+            // loop over atoms in iBox
+            for (int iOff=s->boxes->boxOffset[iBox],ii=0; ii<nIBox; ii++,iOff++)
+            {
+               // loop over atoms in jBox.  Pairs within iBox are visited once.
+               int jBegin = (jBox == iBox) ? ii+1 : 0;
+               for (int jOff=s->boxes->boxOffset[jBox]+jBegin,ij=jBegin; ij<nJBox; ij++,jOff++)
                {
-                  dr[k]=s->atoms->r[iOff][k]-s->atoms->r[jOff][k];
-                  r2+=dr[k]*dr[k];
-               }
-               if(r2>=rCut2) continue;
 
-               real_t r = sqrt(r2);
+                  double r2 = 0.0;
+                  real3 dr;
+                  for (int k=0; k<3; k++)
+                  {
+                     dr[k]=s->atoms->r[iOff][k]-s->atoms->r[jOff][k];
+                     r2+=dr[k]*dr[k];
+                  }
+                  if(r2>rCut2) continue;
+
+                  double r = sqrt(r2);
+
+                  real_t phiTmp, dPhi, rhoTmp, dRho;
+                  interpolatePhiRho(pot, r, &phiTmp, &dPhi, &rhoTmp, &dRho);
+
+                  for (int k=0; k<3; k++)
+                  {
+                     f[iOff][k] -= dPhi*dr[k]/r;
+                     f[jOff][k] += dPhi*dr[k]/r;
+                  }
+
+                  // update energy terms
+                  etot += eScale*phiTmp;
+
+                  U[iOff] += 0.5*phiTmp;
+                  U[jOff] += 0.5*phiTmp;
+
+                  // accumulate rhobar for each atom
+                  rho[iOff] += rhoTmp;
+                  rho[jOff] += rhoTmp;
+                  ++(*nPairs);
+
+                  if (pot->usePairCache && r2 < rCut2 && eScale > 0.0)
+                     recordPair(cache, iOff, jOff, dRho, dr, r);
+
+               } // loop over atoms in jBox
+            } // loop over atoms in iBox
+         } // loop over neighbor boxes
+      } // loop over all boxes
+      reduceThreadBuffers(s->threadBuffers, s->boxes, s->atoms->f, s->atoms->U, pot->rhobar);
+   }
 
-               real_t rhoTmp, dRho;
-               interpolate(pot->rho, r, &rhoTmp, &dRho);
+   pot->nLocalPairs += nLocalPairs;
+   pot->nGhostPairs += nGhostPairs;
+   return etot;
+}
 
-               for (int k=0; k<3; k++)
-               {
-                  s->atoms->f[iOff][k] -= (pot->dfEmbed[iOff]+pot->dfEmbed[jOff])*dRho*dr[k]/r;
-                  s->atoms->f[jOff][k] += (pot->dfEmbed[iOff]+pot->dfEmbed[jOff])*dRho*dr[k]/r;
-               }
+/// Third pass of the link cell force loop.  Adds the embedding forces
+/// using the exchanged derivatives of the embedding energy.  Only the
+/// box pairs selected by pairs are visited, where all local boxes are
+/// inner.
+void eamLinkCellForce(SimFlat* s, real_t rCut2, enum BoxPairs pairs)
+{
+   EamPotential* pot = (EamPotential*) s->pot;
 
-            } // loop over atoms in jBox
-         } // loop over atoms in iBox
-      } // loop over neighbor boxes
-   } // loop over local boxes
+   #pragma omp parallel
+   {
+      real3* f = s->atoms->f;
+      selectThreadBuffers(s->threadBuffers, &f, NULL, NULL);
+      int nbrBoxes[MAX_HALF_SHELL_BOXES];
+      // loop over all boxes (the stencil of a halo box may hold local boxes)
+      #pragma omp for schedule(dynamic, 4)
+      for (int iBox=0; iBox<s->boxes->nTotalBoxes; iBox++)
+      {
+         if (pairs == INNER_PAIRS)
+         {
+            if (iBox >= s->boxes->nLocalBoxes) continue;
+            if (getMyThread() == 0)
+               progressHaloExchange(pot->forceExchange);
+         }
+         int nIBox = s->boxes->nAtoms[iBox];
+         if (nIBox == 0) continue;
+         int nNbrBoxes = getHalfShellBoxes(s->boxes, iBox, nbrBoxes);
+         // loop over half-shell neighbor boxes of iBox
+         for (int jTmp=0; jTmp<nNbrBoxes; jTmp++)
+         {
+            int jBox = nbrBoxes[jTmp];
+            if (! visitBoxPair(s->boxes, pairs, 0, iBox, jBox)) continue;
 
-   s->ePotential = (real_t) etot;
+            int nJBox = s->boxes->nAtoms[jBox];
+            // loop over atoms in iBox
+            for (int iOff=s->boxes->boxOffset[iBox],ii=0; ii<nIBox; ii++,iOff++)
+            {
+               // loop over atoms in jBox.  Pairs within iBox are visited once.
+               int jBegin = (jBox == iBox) ? ii+1 : 0;
+               for (int jOff=s->boxes->boxOffset[jBox]+jBegin,ij=jBegin; ij<nJBox; ij++,jOff++)
+               { 
+
+                  double r2 = 0.0;
+                  real3 dr;
+                  for (int k=0; k<3; k++)
+                  {
+                     dr[k]=s->atoms->r[iOff][k]-s->atoms->r[jOff][k];
+                     r2+=dr[k]*dr[k];
+                  }
+                  if(r2>=rCut2) continue;
+
+                  real_t r = sqrt(r2);
+
+                  real_t rhoTmp, dRho;
+                  interpolate(pot->rho, r, &rhoTmp, &dRho);
+
+                  for (int k=0; k<3; k++)
+                  {
+                     f[iOff][k] -= (pot->dfEmbed[iOff]+pot->dfEmbed[jOff])*dRho*dr[k]/r;
+                     f[jOff][k] += (pot->dfEmbed[iOff]+pot->dfEmbed[jOff])*dRho*dr[k]/r;
+                  }
+
+               } // loop over atoms in jBox
+            } // loop over atoms in iBox
+         } // loop over neighbor boxes
+      } // loop over all boxes
+      reduceThreadBuffers(s->threadBuffers, s->boxes, s->atoms->f, NULL, NULL);
+   }
+}
+
+/// Same as eamLinkCellPhiRho, but visits only the pairs stored in the
+/// neighbor lists.
+real_t eamNbrListPhiRho(SimFlat* s, real_t rCut2)
+{
+   EamPotential* pot = (EamPotential*) s->pot;
+   NeighborList* nbrList = s->nbrList;
+   int haloBegin = s->boxes->haloBegin;
+   real_t etot = 0.0;
+
+   #pragma omp parallel reduction(+:etot)
+   {
+      real3* f = s->atoms->f;
+      real_t* U = s->atoms->U;
+      real_t* rho = pot->rhobar;
+      selectThreadBuffers(s->threadBuffers, &f, &U, &rho);
+      EamPairCache* cache = pot->pairCaches + getMyThread();
+      #pragma omp for
+      for (int iRow=0; iRow<nbrList->nRows; iRow++)
+      {
+         int iOff = nbrList->iOff[iRow];
+         for (int jj=nbrList->start[iRow]; jj<nbrList->start[iRow+1]; jj++)
+         {
+            int jOff = nbrList->nbrs[jj];
+
+            double r2 = 0.0;
+            real3 dr;
+            for (int k=0; k<3; k++)
+            {
+               dr[k]=s->atoms->r[iOff][k]-s->atoms->r[jOff][k];
+               r2+=dr[k]*dr[k];
+            }
+            if(r2>rCut2) continue;
+
+            double r = sqrt(r2);
+
+            real_t phiTmp, dPhi, rhoTmp, dRho;
+            interpolatePhiRho(pot, r, &phiTmp, &dPhi, &rhoTmp, &dRho);
+
+            for (int k=0; k<3; k++)
+            {
+               f[iOff][k] -= dPhi*dr[k]/r;
+               f[jOff][k] += dPhi*dr[k]/r;
+            }
+
+            // halo atoms are stored after all local atoms
+            if (jOff < haloBegin)
+               etot += phiTmp;
+            else
+               etot += 0.5*phiTmp;
+
+            U[iOff] += 0.5*phiTmp;
+            U[jOff] += 0.5*phiTmp;
+
+            rho[iOff] += rhoTmp;
+            rho[jOff] += rhoTmp;
+
+            if (pot->usePairCache && r2 < rCut2)
+               recordPair(cache, iOff, jOff, dRho, dr, r);
+         }
+      }
+      reduceThreadBuffers(s->threadBuffers, s->boxes, s->atoms->f, s->atoms->U, pot->rhobar);
+   }
+
+   return etot;
+}
+
+/// Same as eamLinkCellForce, but visits only the pairs stored in the
+/// neighbor lists.
+void eamNbrListForce(SimFlat* s, real_t rCut2, enum BoxPairs pairs)
+{
+   EamPotential* pot = (EamPotential*) s->pot;
+   NeighborList* nbrList = s->nbrList;
+   int haloBegin = s->boxes->haloBegin;
+
+   #pragma omp parallel
+   {
+      real3* f = s->atoms->f;
+      selectThreadBuffers(s->threadBuffers, &f, NULL, NULL);
+      #pragma omp for
+      for (int iRow=0; iRow<nbrList->nRows; iRow++)
+      {
+         if (pairs == INNER_PAIRS && getMyThread() == 0 && iRow % 64 == 0)
+            progressHaloExchange(pot->forceExchange);
+         int iOff = nbrList->iOff[iRow];
+         for (int jj=nbrList->start[iRow]; jj<nbrList->start[iRow+1]; jj++)
+         {
+            int jOff = nbrList->nbrs[jj];
+            if (! visitLocalPair(pairs, iOff, jOff, haloBegin)) continue;
+
+            double r2 = 0.0;
+            real3 dr;
+            for (int k=0; k<3; k++)
+            {
+               dr[k]=s->atoms->r[iOff][k]-s->atoms->r[jOff][k];
+               r2+=dr[k]*dr[k];
+            }
+            if(r2>=rCut2) continue;
+
+            real_t r = sqrt(r2);
+
+            real_t rhoTmp, dRho;
+            interpolate(pot->rho, r, &rhoTmp, &dRho);
+
+            for (int k=0; k<3; k++)
+            {
+               f[iOff][k] -= (pot->dfEmbed[iOff]+pot->dfEmbed[jOff])*dRho*dr[k]/r;
+               f[jOff][k] += (pot->dfEmbed[iOff]+pot->dfEmbed[jOff])*dRho*dr[k]/r;
+            }
+         }
+      }
+      reduceThreadBuffers(s->threadBuffers, s->boxes, s->atoms->f, NULL, NULL);
+   }
+}
+
+/// Third pass using the pairs recorded by the first pass.  Equivalent to
+/// eamLinkCellForce or eamNbrListForce, but without recomputing the
+/// pair distances or interpolating rho.
+void eamPairCacheForce(SimFlat* s, enum BoxPairs pairs)
+{
+   EamPotential* pot = (EamPotential*) s->pot;
+   int haloBegin = s->boxes->haloBegin;
+
+   // each thread handles the pairs it recorded in pass 1
+   #pragma omp parallel
+   {
+      real3* f = s->atoms->f;
+      selectThreadBuffers(s->threadBuffers, &f, NULL, NULL);
+      int iThread = getMyThread();
+      assert(iThread < pot->nPairCaches);
+      const EamPairCache* cache = pot->pairCaches + iThread;
+      for (int iPair=0; iPair<cache->nPairs; iPair++)
+      {
+         if (pairs == INNER_PAIRS && iThread == 0 && iPair % 1024 == 0)
+            progressHaloExchange(pot->forceExchange);
+         const EamPair* pp = cache->pairs + iPair;
+         int iOff = pp->iOff;
+         int jOff = pp->jOff;
+         if (! visitLocalPair(pairs, iOff, jOff, haloBegin)) continue;
+         real_t dfSum = pot->dfEmbed[iOff]+pot->dfEmbed[jOff];
+         for (int k=0; k<3; k++)
+         {
+            f[iOff][k] -= dfSum*pp->dRhoHat[k];
+            f[jOff][k] += dfSum*pp->dRhoHat[k];
+         }
+      }
+      #pragma omp barrier
+      reduceThreadBuffers(s->threadBuffers, s->boxes, s->atoms->f, NULL, NULL);
+   }
+}
+
+/// Third pass with whichever of the pair cache, the neighbor lists, or
+/// the link cells is in use.  Only the pairs selected by pairs are
+/// visited.  Pairs of two local atoms are inner.
+void eamThirdPass(SimFlat* s, real_t rCut2, enum BoxPairs pairs)
+{
+   EamPotential* pot = (EamPotential*) s->pot;
+   if (pot->usePairCache)
+      eamPairCacheForce(s, pairs);
+   else if (s->nbrList)
+      eamNbrListForce(s, rCut2, pairs);
+   else
+      eamLinkCellForce(s, rCut2, pairs);
+}
 
+/// Same as visitBoxPair for the pairs of the third pass, given by atom
+/// offsets.  Local atoms are stored before all halo atoms.
+int visitLocalPair(enum BoxPairs pairs, int iOff, int jOff, int haloBegin)
+{
+   if (pairs == ALL_PAIRS)
+      return 1;
+   int inner = (iOff < haloBegin && jOff < haloBegin);
+   return (pairs == INNER_PAIRS) == inner;
+}
+
+/// Append a pair to the pair cache, growing the cache as needed.  The
+/// cache keeps its size across calls to eamForce, so it only grows
+/// during the first few steps.
+void recordPair(EamPairCache* cache, int iOff, int jOff, real_t dRho, real3 dr, real_t r)
+{
+   if (cache->nPairs == cache->capacity)
+   {
+      cache->capacity = MAX(2*cache->capacity, 1024);
+      cache->pairs = comdRealloc(cache->pairs, cache->capacity*sizeof(EamPair));
+      assert(cache->pairs);
+   }
+   EamPair* pp = cache->pairs + cache->nPairs++;
+   pp->iOff = iOff;
+   pp->jOff = jOff;
+   for (int k=0; k<3; k++)
+      pp->dRhoHat[k] = dRho*dr[k]/r;
+}
+
+/// Count the halo atoms and those of them in the first halo layer.  The
+/// first layer holds exactly the atoms whose F'(rhobar) the force halo
+/// exchange would have received.
+void countGhostAtoms(SimFlat* s)
+{
+   EamPotential* pot = (EamPotential*) s->pot;
+   LinkCell* boxes = s->boxes;
+   int nGhost = 0;
+   int nInner = 0;
+   for (int iBox=boxes->nLocalBoxes; iBox<boxes->nTotalBoxes; iBox++)
+   {
+      nGhost += boxes->nAtoms[iBox];
+      if (! isOuterHaloBox(boxes, iBox))
+         nInner += boxes->nAtoms[iBox];
+   }
+   pot->nGhostAtoms = nGhost;
+   pot->nInnerGhostAtoms = nInner;
+}
+
+/// Returns non-zero if iBox is a halo box beyond the first halo layer,
+/// which is one cutoff (cellsPerCutoff boxes) deep.
+int isOuterHaloBox(LinkCell* boxes, int iBox)
+{
+   int* ib = boxes->boxTuple + 3*iBox;
+   int depth = boxes->cellsPerCutoff;
+   for (int m=0; m<3; m++)
+      if (ib[m] < -depth || ib[m] >= boxes->gridSize[m]+depth)
+         return 1;
    return 0;
 }
 
+/// Make rhobar and dfEmbed at least nAtoms long.  The atom arrays can
+/// grow while the first pass is under way (see finishRedistribution),
+/// so the data is kept and the new slots are zero.  Some headroom
+/// avoids reallocating them every time the link cells are rebuilt.
+void fitEamArrays(EamPotential* pot, int nAtoms)
+{
+   if (pot->nAtomSlots >= nAtoms)
+      return;
+   int n = nAtoms + nAtoms/8;
+   pot->rhobar  = comdRealloc(pot->rhobar,  n*sizeof(real_t));
+   pot->dfEmbed = comdRealloc(pot->dfEmbed, n*sizeof(real_t));
+   for (int ii=pot->nAtomSlots; ii<n; ii++)
+   {
+      pot->rhobar[ii] = 0.;
+      pot->dfEmbed[ii] = 0.;
+   }
+   pot->nAtomSlots = n;
+}
+
 void eamPrint(FILE* file, BasePotential* pot)
 {
    EamPotential *eamPot = (EamPotential*) pot;
@@ -384,6 +864,29 @@ void eamPrint(FILE* file, BasePotential* pot)
    fprintf(file, "  Lattice type    : %s\n", eamPot->latticeType);
    fprintf(file, "  Lattice spacing : "FMT1" Angstroms\n", eamPot->lat);
    fprintf(file, "  Cutoff          : "FMT1" Angstroms\n", eamPot->cutoff);
+   if (eamPot->usePairCache)
+   {
+      int nPairs = 0;
+      int capacity = 0;
+      for (int ii=0; ii<eamPot->nPairCaches; ii++)
+      {
+         nPairs += eamPot->pairCaches[ii].nPairs;
+         capacity += eamPot->pairCaches[ii].capacity;
+      }
+      fprintf(file, "  Pair cache      : %d pairs (rank 0)\n", nPairs);
+      fprintf(file, "  Pair cache size : %.3f MB (rank 0, %d B/pair, %.3f MB allocated)\n",
+              (double)nPairs*sizeof(EamPair)/1024/1024, (int)sizeof(EamPair),
+              (double)capacity*sizeof(EamPair)/1024/1024);
+   }
+   if (eamPot->ghostDensity)
+   {
+      fprintf(file, "  Ghost densities : %d halo atoms embedded (rank 0)\n", eamPot->nGhostAtoms);
+      fprintf(file, "  Removed exchange: %d atoms, %.3f kB received (rank 0)\n",
+              eamPot->nInnerGhostAtoms,
+              (double)eamPot->nInnerGhostAtoms*sizeof(real_t)/1024);
+      fprintf(file, "  Extra pass 1    : %d halo-halo pairs vs %d local pairs (rank 0)\n",
+              eamPot->nGhostPairs, eamPot->nLocalPairs);
+   }
 }
 
 void eamDestroy(BasePotential** pPot)
@@ -394,6 +897,13 @@ void eamDestroy(BasePotential** pPot)
    destroyInterpolationObject(&(pot->phi));
    destroyInterpolationObject(&(pot->rho));
    destroyInterpolationObject(&(pot->f));
+   comdAlignedFree(pot->phiRho);
+   for (int ii=0; ii<pot->nPairCaches; ii++)
+      comdFree(pot->pairCaches[ii].pairs);
+   comdFree(pot->pairCaches);
+   comdFree(pot->dfEmbed);
+   comdFree(pot->rhobar);
+   comdFree(pot->forceExchangeData);
    destroyHaloExchange(&(pot->forceExchange));
    comdFree(pot);
    *pPot = NULL;
@@ -470,9 +980,42 @@ InterpolationObject* initInterpolationObject(
    table->values[-1] = table->values[0];
    table->values[n+1] = table->values[n] = table->values[n-1];
 
+   initInterpolationCoefficients(table);
+
    return table;
 }
 
+/// Converts the table values into per-interval cubic polynomial
+/// coefficients so that interpolate() needs no stencil arithmetic.
+///
+/// Interval ii spans values[ii] to values[ii+1].  The cubic matches the
+/// table values at both ends and the centered difference derivative
+/// (values[ii+1]-values[ii-1])/2 at both ends (a Catmull-Rom spline).
+/// Hence f and df are continuous across intervals and df is the exact
+/// derivative of f.  The four coefficients of an interval are stored
+/// next to each other, and the table starts on a cache line so that
+/// they share one.  Interval n extends the table past its end where
+/// the function is flat.
+void initInterpolationCoefficients(InterpolationObject* table)
+{
+   int n = table->n;
+   const real_t* tt = table->values; // alias
+   table->coef = comdAlignedMalloc(CACHE_LINE, 4*(n+1)*sizeof(real_t));
+
+   for (int ii=0; ii<=n; ++ii)
+   {
+      real_t p0 = tt[ii];
+      real_t p1 = tt[ii+1];
+      real_t m0 = 0.5*(tt[ii+1] - tt[ii-1]);
+      real_t m1 = 0.5*((ii+2 <= n+1 ? tt[ii+2] : tt[n+1]) - tt[ii]);
+      real_t* cc = table->coef + 4*ii;
+      cc[0] = p0;
+      cc[1] = m0;
+      cc[2] = 3.0*(p1 - p0) - 2.0*m0 - m1;
+      cc[3] = 2.0*(p0 - p1) + m0 + m1;
+   }
+}
+
 void destroyInterpolationObject(InterpolationObject** a)
 {
    if ( ! a ) return;
@@ -482,6 +1025,7 @@ void destroyInterpolationObject(InterpolationObject** a)
       (*a)->values--;
       comdFree((*a)->values);
    }
+   comdAlignedFree((*a)->coef);
    comdFree(*a);
    *a = NULL;
 
@@ -493,17 +1037,16 @@ void destroyInterpolationObject(InterpolationObject** a)
 /// The forces on the particle are much more sensitive to the derivative
 /// of the potential than on the potential itself.  It is therefore
 /// absolutely essential that the interpolated derivatives are smooth
-/// and continuous.  This function uses simple quadratic interpolation
-/// to find f(r).  Since quadric interpolants don't have smooth
-/// derivatives, f'(r) is computed using a 4 point finite difference
-/// stencil.
+/// and continuous.  This function evaluates the piecewise cubic
+/// (Catmull-Rom) interpolant built by initInterpolationCoefficients.
+/// Its derivative is continuous and agrees with the 4 point finite
+/// difference used by earlier versions at the table points.
 ///
 /// Interpolation is used heavily by the EAM force routine so this
-/// function is a potential performance hot spot.  Feel free to
-/// reimplement this function (and initInterpolationObject if necessay)
-/// with any higher performing implementation of interpolation, as long
-/// as the alternate implmentation that has the required smoothness
-/// properties.  Cubic splines are one common alternate choice.
+/// function is a potential performance hot spot.  The lookup is branch
+/// free: r is clamped to the table range, a single index selects the
+/// four coefficients of the interval (which share a cache line), and f
+/// and df follow from Horner's rule.
 ///
 /// \param [in] table Interpolation table.
 /// \param [in] r Point where function value is needed.
@@ -511,26 +1054,63 @@ void destroyInterpolationObject(InterpolationObject** a)
 /// \param [out] df The interpolated value of df(r)/dr.
 void interpolate(InterpolationObject* table, real_t r, real_t* f, real_t* df)
 {
-   const real_t* tt = table->values; // alias
-   
-   if ( r < table->x0 ) r = table->x0;
+   real_t x = (r-table->x0)*(table->invDx);
+   x = (x > 0.0) ? x : 0.0;
+   x = (x < table->n) ? x : table->n;
 
-   r = (r-table->x0)*(table->invDx) ;
-   int ii = (int)floor(r);
-   if (ii > table->n)
-   {
-      ii = table->n;
-      r = table->n / table->invDx;
-   }
-   // reset r to fractional distance
-   r = r - floor(r);
+   int ii = (int) x;
+   x -= ii; // fractional distance into interval ii
 
-   real_t g1 = tt[ii+1] - tt[ii-1];
-   real_t g2 = tt[ii+2] - tt[ii];
+   const real_t* cc = table->coef + 4*ii;
+   *f  = cc[0] + x*(cc[1] + x*(cc[2] + x*cc[3]));
+   *df = (cc[1] + x*(2.0*cc[2] + x*3.0*cc[3]))*table->invDx;
+}
 
-   *f = tt[ii] + 0.5*r*(g1 + r*(tt[ii+1] + tt[ii-1] - 2.0*tt[ii]) );
+/// Builds a combined table for the pair functions phi(r) and rho(r).
+/// Both functions are tabulated on the same grid in funcfl and setfl
+/// files.  For each interval, the four phi coefficients are followed by
+/// the four rho coefficients so that the first pass of eamForce reads
+/// a single 8-value block per pair instead of two separate tables.  The
+/// table starts on a cache line, so each block fills at most one line.
+void initPhiRhoTable(EamPotential* pot)
+{
+   InterpolationObject* phi = pot->phi;
+   InterpolationObject* rho = pot->rho;
+   assert(phi->n == rho->n);
+   assert(phi->x0 == rho->x0);
+   assert(phi->invDx == rho->invDx);
+
+   int nIntervals = phi->n + 1;
+   pot->phiRho = comdAlignedMalloc(CACHE_LINE, 8*nIntervals*sizeof(real_t));
+   for (int ii=0; ii<nIntervals; ++ii)
+      for (int k=0; k<4; ++k)
+      {
+         pot->phiRho[8*ii+k]   = phi->coef[4*ii+k];
+         pot->phiRho[8*ii+4+k] = rho->coef[4*ii+k];
+      }
+}
 
-   *df = 0.5*(g1 + r*(g2-g1))*table->invDx;
+/// Same as calling interpolate() for pot->phi and pot->rho, but the
+/// index and fractional distance are computed only once and both sets
+/// of coefficients come from one block of the fused table.
+///
+/// \see initPhiRhoTable
+void interpolatePhiRho(EamPotential* pot, real_t r,
+                       real_t* phi, real_t* dPhi, real_t* rho, real_t* dRho)
+{
+   const InterpolationObject* table = pot->phi;
+   real_t x = (r-table->x0)*(table->invDx);
+   x = (x > 0.0) ? x : 0.0;
+   x = (x < table->n) ? x : table->n;
+
+   int ii = (int) x;
+   x -= ii;
+
+   const real_t* cc = pot->phiRho + 8*ii;
+   *phi  = cc[0] + x*(cc[1] + x*(cc[2] + x*cc[3]));
+   *dPhi = (cc[1] + x*(2.0*cc[2] + x*3.0*cc[3]))*table->invDx;
+   *rho  = cc[4] + x*(cc[5] + x*(cc[6] + x*cc[7]));
+   *dRho = (cc[5] + x*(2.0*cc[6] + x*3.0*cc[7]))*table->invDx;
 }
 
 /// Broadcasts an InterpolationObject from rank 0 to all other ranks.
@@ -570,6 +1150,9 @@ void bcastInterpolationObject(InterpolationObject** table)
    
    int valuesSize = sizeof(real_t) * ((*table)->n+3);
    bcastParallel((*table)->values-1, valuesSize, 0);
+
+   if (getMyRank() != 0)
+      initInterpolationCoefficients(*table);
 }
 
 void printTableData(InterpolationObject* table, const char* fileName)
@@ -16,8 +16,11 @@ struct LinkCellSt;
 typedef struct ForceExchangeDataSt
 {
    real_t* dfEmbed; //<! derivative of embedding energy
+   real3* r;        //<! atom positions (to select the ghost atoms)
+   int* gid;        //<! atom ids (to order the atoms of a message)
    struct LinkCellSt* boxes;
 }ForceExchangeData;
 
-struct BasePotentialSt* initEamPot(const char* dir, const char* file, const char* type);
+struct BasePotentialSt* initEamPot(const char* dir, const char* file, const char* type,
+                                   int usePairCache, int ghostDensity);
 #endif
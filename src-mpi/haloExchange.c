@@ -27,10 +27,37 @@
 /// can begin.  Architectures with low message latency and many off node
 /// network links would likely benefit from alternate halo exchange
 /// strategies that send independent messages to each neighbor task.
+///
+/// Such a strategy is available as an alternative (see HaloMode).  In
+/// the direct modes every task sends one message to each of its 26
+/// neighbors in a single round.  Nothing is forwarded, so the messages
+/// to edge and corner neighbors carry only the cells those neighbors
+/// need and all messages can be in flight at the same time.  The
+/// messages are either independent point to point messages
+/// (HALO_DIRECT) or one neighborhood collective (HALO_NEIGHBOR) that
+/// lets the MPI library schedule them.  Which mode is faster depends on
+/// the message latency and on how many network links a node can drive
+/// at once.
+///
+/// Tasks on the same node need not copy halo data through the MPI
+/// library at all.  With HALO_SHARED the send buffers live in an MPI 3
+/// shared memory window and a neighbor on the same node unloads our
+/// data straight from that window (see postPhase).  Only neighbors on
+/// other nodes get real messages.
+///
+/// The latency of the exchange can be hidden by the split phase
+/// versions (postHaloExchange, progressHaloExchange, and
+/// completeHaloExchange) which let the force routines work on the
+/// interior of the domain while the messages are in flight.
+///
+/// Neither the link cells (see initLinkCells) nor the messages have a
+/// fixed capacity.  The length of every message is sent ahead of its
+/// data, and the buffers grow to fit (see postPhase).
 
 #include "haloExchange.h"
 
 #include <assert.h>
+#include <string.h>
 
 #include "CoMDTypes.h"
 #include "decomposition.h"
@@ -40,8 +67,6 @@
 #include "memUtils.h"
 #include "performanceTimers.h"
 
-#define MAX(A,B) ((A) > (B) ? (A) : (B))
-
 /// Don't change the order of the faces in this enum.
 enum HaloFaceOrder {HALO_X_MINUS, HALO_X_PLUS,
                     HALO_Y_MINUS, HALO_Y_PLUS,
@@ -50,14 +75,23 @@ enum HaloFaceOrder {HALO_X_MINUS, HALO_X_PLUS,
 /// Don't change the order of the axes in this enum.
 enum HaloAxisOrder {HALO_X_AXIS, HALO_Y_AXIS, HALO_Z_AXIS};
 
+/// Largest number of cells in a column of a force message (see
+/// loadForceBuffer).  A corner message of a direct exchange crosses
+/// three faces, each cellsPerCutoff cells deep.
+#define MAX_FORCE_GROUP (MAX_CELLS_PER_CUTOFF*MAX_CELLS_PER_CUTOFF*MAX_CELLS_PER_CUTOFF)
+
 /// Extra data members that are needed for the exchange of atom data.
 /// For an atom exchange, the HaloExchangeSt::parms will point to a
 /// structure of this type.
 typedef struct AtomExchangeParmsSt
 {
-   int nCells[6];        //!< Number of cells in cellList for each face.
-   int* cellList[6];     //!< List of link cells from which to load data for each face.
-   real_t* pbcFactor[6]; //!< Whether this face is a periodic boundary.
+   int nMsgs;                        //!< Number of messages.
+   int nCells[HALO_MAX_MSGS];        //!< Number of cells in cellList for each message.
+   int* cellList[HALO_MAX_MSGS];     //!< List of link cells from which to load data for each message.
+   real_t* pbcFactor[HALO_MAX_MSGS]; //!< Whether this message crosses a periodic boundary.
+   real_t ghostMin[HALO_MAX_MSGS][3]; //!< Lower bounds of the atoms to send (see mkGhostSlabs).
+   real_t ghostMax[HALO_MAX_MSGS][3]; //!< Upper bounds of the atoms to send.
+   int* nIncoming;                   //!< Received atoms per link cell (see reserveAtomsBuffers).
 }
 AtomExchangeParms;
 
@@ -66,12 +100,42 @@ AtomExchangeParms;
 /// structure of this type.
 typedef struct ForceExchangeParmsSt
 {
-   int nCells[6];     //!< Number of cells to send/recv for each face.
-   int* sendCells[6]; //!< List of link cells to send for each face.
-   int* recvCells[6]; //!< List of link cells to recv for each face.
+   int nMsgs;                     //!< Number of messages.
+   int nCells[HALO_MAX_MSGS];     //!< Number of cells to send/recv for each message.
+   int* sendCells[HALO_MAX_MSGS]; //!< List of link cells to send for each message.
+   int* recvCells[HALO_MAX_MSGS]; //!< List of link cells to recv for each message.
+   int groupSize[HALO_MAX_MSGS];  //!< Number of consecutive cells in the lists that form a column (see loadForceBuffer).
+   real_t ghostMin[HALO_MAX_MSGS][3]; //!< Same as in AtomExchangeParms.
+   real_t ghostMax[HALO_MAX_MSGS][3]; //!< Same as in AtomExchangeParms.
 }
 ForceExchangeParms;
 
+/// Extra data members that are needed for the exchange of ghost atoms.
+/// The cell lists and periodic shifts are the same as for the atom
+/// exchange.  In addition, the exchange records the storage index of
+/// every atom that is sent or received in each message so that later
+/// exchanges can refresh the ghost positions in exactly the same order.
+/// While the exchange records, link cells may still be moved to make
+/// room (see putAtomInBox), so the box and gid of each atom are noted
+/// instead and turned into storage indices at the end (see
+/// exchangeGhostAtoms).
+/// For a ghost exchange, the HaloExchangeSt::parms will point to a
+/// structure of this type.
+typedef struct GhostExchangeParmsSt
+{
+   AtomExchangeParms atomParms; //!< Cell lists and pbc factors.
+   int refresh;       //!< If non-zero, send positions in recorded order.
+   int nSendSlots[HALO_MAX_MSGS]; //!< Number of atoms sent in each message.
+   int maxSendSlots[HALO_MAX_MSGS]; //!< Capacity of sendSlots and sendBoxes.
+   int* sendSlots[HALO_MAX_MSGS]; //!< Storage index of each atom sent, in send order.
+   int* sendBoxes[HALO_MAX_MSGS]; //!< Link cell of each atom sent while recording.
+   int nRecvSlots[HALO_MAX_MSGS]; //!< Number of atoms received in each message.
+   int maxRecvSlots[HALO_MAX_MSGS]; //!< Capacity of recvSlots and recvBoxes.
+   int* recvSlots[HALO_MAX_MSGS]; //!< Storage index of each atom received, in recv order.
+   int* recvBoxes[HALO_MAX_MSGS]; //!< Link cell of each atom received while recording.
+}
+GhostExchangeParms;
+
 /// A structure to package data for a single atom to pack into a
 /// send/recv buffer.  Also used for sorting atoms within link cells.
 typedef struct AtomMsgSt
@@ -83,6 +147,22 @@ typedef struct AtomMsgSt
 }
 AtomMsg;
 
+/// Package data for a ghost atom.  Ghost atoms need no momenta.
+typedef struct GhostMsgSt
+{
+   int gid;
+   int type;
+   real_t rx, ry, rz;
+}
+GhostMsg;
+
+/// Package data for a ghost position refresh.
+typedef struct PositionMsgSt
+{
+   real_t rx, ry, rz;
+}
+PositionMsg;
+
 /// Package data for the force exchange.
 typedef struct ForceMsgSt
 {
@@ -90,16 +170,53 @@ typedef struct ForceMsgSt
 }
 ForceMsg;
 
-static HaloExchange* initHaloExchange(Domain* domain);
-static void exchangeData(HaloExchange* haloExchange, void* data, int iAxis);
+/// Bytes loaded by all halo exchanges for neighbors on the same node
+/// (haloBytes[0]) and on other nodes (haloBytes[1]).
+static double haloBytes[2] = {0.0, 0.0};
+
+/// Cells that take part in a message of a direct exchange.
+enum DirectCells {DIRECT_ATOM_SEND, DIRECT_FORCE_SEND, DIRECT_FORCE_RECV};
+
+static HaloExchange* initHaloExchange(Domain* domain, int mode);
+static void msgDirection(HaloExchange* haloExchange, int iMsg, int dir[3]);
+static void directDirection(int iMsg, int dir[3]);
+static int oppositeMsg(HaloExchange* haloExchange, int iMsg);
+static void phaseMsgs(HaloExchange* haloExchange, int iPhase, int* begin, int* end);
+static void allocHaloBuffers(HaloExchange* haloExchange, void* data);
+static void fitCommBuffer(char** buf, int* capacity, int size);
+static void postPhase(HaloExchange* haloExchange, int iPhase);
+static void startPhaseData(HaloExchange* haloExchange);
+static int completePhase(HaloExchange* haloExchange, int mayGrow);
+static void mkPbcFactors(HaloExchange* haloExchange, Domain* domain, real_t** pbcFactor);
+static void mkGhostSlabs(HaloExchange* haloExchange, LinkCell* boxes, int filterGhosts,
+                         real_t ghostMin[][3], real_t ghostMax[][3]);
+static int inGhostSlab(const real_t* ghostMin, const real_t* ghostMax, const real_t* r);
+static int* mkDirectCellList(LinkCell* boxes, int iMsg, enum DirectCells which, int* nCells, int* groupSize);
+static int* mkMigrationCellList(HaloExchange* haloExchange, LinkCell* boxes, int iMsg, int* nCells);
+static int* mkCellList(LinkCell* boxes, const int begin[3], const int end[3], int* nCells);
+static int* mkForceCellList(LinkCell* boxes, const int begin[3], const int end[3],
+                            const int dir[3], int* nCells, int* groupSize);
 
 static int* mkAtomCellList(LinkCell* boxes, enum HaloFaceOrder iFace, const int nCells);
+static int countCellAtoms(LinkCell* boxes, const int* cellList, int nCells);
+static int sizeAtomsBuffer(void* vparms, void* data, int face);
 static int loadAtomsBuffer(void* vparms, void* data, int face, char* charBuf);
 static void unloadAtomsBuffer(void* vparms, void* data, int face, int bufSize, char* charBuf);
+static int reserveAtomsBuffers(void* vparms, void* data, int begin, int end,
+                               const int* bufSize, char** buf, int mayGrow);
 static void destroyAtomsExchange(void* vparms);
 
-static int* mkForceSendCellList(LinkCell* boxes, int face, int nCells);
-static int* mkForceRecvCellList(LinkCell* boxes, int face, int nCells);
+static int sizeGhostBuffer(void* vparms, void* data, int face);
+static void fitGhostSlots(int** slots, int** boxes, int* capacity, int n);
+static int loadGhostBuffer(void* vparms, void* data, int face, char* charBuf);
+static void unloadGhostBuffer(void* vparms, void* data, int face, int bufSize, char* charBuf);
+static void destroyGhostExchange(void* vparms);
+static int findAtomInCell(Atoms* atoms, LinkCell* boxes, int iBox, int gid);
+
+static int* mkForceSendCellList(LinkCell* boxes, int face, int nCells, int* groupSize);
+static int* mkForceRecvCellList(LinkCell* boxes, int face, int nCells, int* groupSize);
+static int nextAtomById(ForceExchangeData* data, const int* cells, int groupSize, int* next);
+static int sizeForceBuffer(void* vparms, void* data, int face);
 static int loadForceBuffer(void* vparms, void* data, int face, char* charBuf);
 static void unloadForceBuffer(void* vparms, void* data, int face, int bufSize, char* charBuf);
 static void destroyForceExchange(void* vparms);
@@ -120,12 +237,11 @@ static int sortAtomsById(const void* a, const void* b);
 ///
 /// This constructor does the following:
 ///
-/// - Sets the bufCapacity to hold the largest possible number of atoms
-///   that can be sent across a face.
 /// - Initialize function pointers to the atom-specific versions
-/// - Sets the number of link cells to send across each face.
-/// - Builds the list of link cells to send across each face.  As
-///   explained in the comments for mkAtomCellList, this list must
+/// - Sets the number of link cells to send in each message.
+/// - Builds the list of link cells to send in each message.  As
+///   explained in the comments for mkAtomCellList (and
+///   mkDirectCellList for the direct modes), this list must
 ///   include any link cell, local or halo, that could possibly contain
 ///   an atom that needs to be sent across the face.  Atoms that need to
 ///   be sent include "ghost atoms" that are located in local link
@@ -133,60 +249,143 @@ static int sortAtomsById(const void* a, const void* b);
 ///   formerly local atoms that have just moved into halo link cells and
 ///   need to be sent to the rank that owns the spatial domain the atom
 ///   has moved into.
-/// - Sets a coordinate shift factor for each face to account for
+/// - Sets a coordinate shift factor for each message to account for
 ///   periodic boundary conditions.  For most faces the factor is zero.
 ///   For faces on the +x, +y, or +z face of the simulation domain
 ///   the factor is -1.0 (to shift the coordinates by -1 times the
 ///   simulation domain size).  For -x, -y, and -z faces of the
-///   simulation domain, the factor is +1.0.
+///   simulation domain, the factor is +1.0.  The message to an edge or
+///   corner neighbor in a direct mode takes the factor of each face it
+///   crosses.
+/// - If filterGhosts is set, sets the slab of positions of the atoms
+///   that are sent in each message (see mkGhostSlabs).  Only atoms
+///   within the interaction range of the receiving task are sent, not
+///   all atoms of the cells in the list.
 ///
 /// \see redistributeAtoms
-HaloExchange* initAtomHaloExchange(Domain* domain, LinkCell* boxes)
+HaloExchange* initAtomHaloExchange(Domain* domain, LinkCell* boxes, int mode, int filterGhosts)
 {
-   HaloExchange* hh = initHaloExchange(domain);
-   
-   int size0 = (boxes->gridSize[1]+2)*(boxes->gridSize[2]+2);
-   int size1 = (boxes->gridSize[0]+2)*(boxes->gridSize[2]+2);
-   int size2 = (boxes->gridSize[0]+2)*(boxes->gridSize[1]+2);
-   int maxSize = MAX(size0, size1);
-   maxSize = MAX(size1, size2);
-   hh->bufCapacity = maxSize*2*MAXATOMS*sizeof(AtomMsg);
+   HaloExchange* hh = initHaloExchange(domain, mode);
    
+   hh->sizeBuffer = sizeAtomsBuffer;
    hh->loadBuffer = loadAtomsBuffer;
    hh->unloadBuffer = unloadAtomsBuffer;
+   hh->reserveBuffers = reserveAtomsBuffers;
    hh->destroy = destroyAtomsExchange;
 
    AtomExchangeParms* parms = comdMalloc(sizeof(AtomExchangeParms));
+   parms->nMsgs = hh->nMsgs;
+   parms->nIncoming = comdCalloc(boxes->nTotalBoxes, sizeof(int));
 
-   parms->nCells[HALO_X_MINUS] = 2*(boxes->gridSize[1]+2)*(boxes->gridSize[2]+2);
-   parms->nCells[HALO_Y_MINUS] = 2*(boxes->gridSize[0]+2)*(boxes->gridSize[2]+2);
-   parms->nCells[HALO_Z_MINUS] = 2*(boxes->gridSize[0]+2)*(boxes->gridSize[1]+2);
-   parms->nCells[HALO_X_PLUS]  = parms->nCells[HALO_X_MINUS];
-   parms->nCells[HALO_Y_PLUS]  = parms->nCells[HALO_Y_MINUS];
-   parms->nCells[HALO_Z_PLUS]  = parms->nCells[HALO_Z_MINUS];
-
-   for (int ii=0; ii<6; ++ii)
-      parms->cellList[ii] = mkAtomCellList(boxes, ii, parms->nCells[ii]);
+   if (hh->mode == HALO_AXES)
+   {
+      // nHalo local planes plus one plane of halo cells.
+      int h = boxes->nHaloLayers;
+      int nPlanes = h + 1;
+      parms->nCells[HALO_X_MINUS] = nPlanes*(boxes->gridSize[1]+2*h)*(boxes->gridSize[2]+2*h);
+      parms->nCells[HALO_Y_MINUS] = nPlanes*(boxes->gridSize[0]+2*h)*(boxes->gridSize[2]+2*h);
+      parms->nCells[HALO_Z_MINUS] = nPlanes*(boxes->gridSize[0]+2*h)*(boxes->gridSize[1]+2*h);
+      parms->nCells[HALO_X_PLUS]  = parms->nCells[HALO_X_MINUS];
+      parms->nCells[HALO_Y_PLUS]  = parms->nCells[HALO_Y_MINUS];
+      parms->nCells[HALO_Z_PLUS]  = parms->nCells[HALO_Z_MINUS];
 
-   for (int ii=0; ii<6; ++ii)
+      for (int ii=0; ii<6; ++ii)
+         parms->cellList[ii] = mkAtomCellList(boxes, ii, parms->nCells[ii]);
+   }
+   else
    {
-      parms->pbcFactor[ii] = comdMalloc(3*sizeof(real_t));
-      for (int jj=0; jj<3; ++jj)
-         parms->pbcFactor[ii][jj] = 0.0;
+      for (int ii=0; ii<hh->nMsgs; ++ii)
+         parms->cellList[ii] = mkDirectCellList(boxes, ii, DIRECT_ATOM_SEND, &parms->nCells[ii], NULL);
    }
-   int* procCoord = domain->procCoord; //alias
-   int* procGrid  = domain->procGrid; //alias
-   if (procCoord[HALO_X_AXIS] == 0)                       parms->pbcFactor[HALO_X_MINUS][HALO_X_AXIS] = +1.0;
-   if (procCoord[HALO_X_AXIS] == procGrid[HALO_X_AXIS]-1) parms->pbcFactor[HALO_X_PLUS][HALO_X_AXIS]  = -1.0;
-   if (procCoord[HALO_Y_AXIS] == 0)                       parms->pbcFactor[HALO_Y_MINUS][HALO_Y_AXIS] = +1.0;
-   if (procCoord[HALO_Y_AXIS] == procGrid[HALO_Y_AXIS]-1) parms->pbcFactor[HALO_Y_PLUS][HALO_Y_AXIS]  = -1.0;
-   if (procCoord[HALO_Z_AXIS] == 0)                       parms->pbcFactor[HALO_Z_MINUS][HALO_Z_AXIS] = +1.0;
-   if (procCoord[HALO_Z_AXIS] == procGrid[HALO_Z_AXIS]-1) parms->pbcFactor[HALO_Z_PLUS][HALO_Z_AXIS]  = -1.0;
+
+   mkPbcFactors(hh, domain, parms->pbcFactor);
+   mkGhostSlabs(hh, boxes, filterGhosts, parms->ghostMin, parms->ghostMax);
    
    hh->parms = parms;
    return hh;
 }
 
+/// The migration exchange is used with neighbor lists in place of the
+/// atom exchange.  It sends only the atoms that updateLinkCells has
+/// moved into halo cells, i.e., atoms that have left the local domain,
+/// and thereby hands them over to their new owners.  Ghost atoms are
+/// sent afterwards by the ghost exchange, which needs to send them
+/// anyway to record the storage order.  Without the migration exchange
+/// every ghost atom would be sent twice on each list rebuild, once with
+/// its full state.
+///
+/// The message data, unloading, and periodic shifts are the same as
+/// for the atom exchange.  Only the cell lists differ (see
+/// mkMigrationCellList).
+///
+/// \see redistributeAtoms
+HaloExchange* initMigrationHaloExchange(Domain* domain, LinkCell* boxes, int mode)
+{
+   HaloExchange* hh = initAtomHaloExchange(domain, boxes, mode, 0);
+   AtomExchangeParms* parms = (AtomExchangeParms*) hh->parms;
+
+   for (int ii=0; ii<hh->nMsgs; ++ii)
+   {
+      comdFree(parms->cellList[ii]);
+      parms->cellList[ii] = mkMigrationCellList(hh, boxes, ii, &parms->nCells[ii]);
+   }
+
+   return hh;
+}
+
+/// The ghost exchange is used with neighbor lists.  Neighbor lists
+/// refer to atoms by their storage index, so between list rebuilds the
+/// atoms must not move between link cells or change order within a
+/// cell.  Rather than running a full atom exchange every step, we send
+/// only updated positions of the ghost atoms in the same order as the
+/// last full exchange.
+///
+/// The ghost exchange uses the same cell lists and periodic shifts as
+/// the atom exchange.  Its first use (exchangeGhostAtoms) sends the
+/// gid, species, and position of each ghost atom (but no momenta) and
+/// records, for every message, which atoms were sent and where the
+/// received atoms were stored.  Subsequent refreshes
+/// (updateGhostPositions) replay these lists and send only positions.
+/// The exchange is always blocking, so the link cells simply grow as
+/// the atoms arrive.
+///
+/// The ghost atoms are not filtered by distance.  Atoms that move
+/// toward the domain surface before the next list rebuild must
+/// already be there.  The EAM force exchange relies on all atoms of
+/// the cells being present as well.
+///
+/// \see exchangeGhostAtoms
+/// \see updateGhostPositions
+HaloExchange* initGhostHaloExchange(Domain* domain, LinkCell* boxes, int mode)
+{
+   HaloExchange* hh = initAtomHaloExchange(domain, boxes, mode, 0);
+
+   GhostExchangeParms* parms = comdMalloc(sizeof(GhostExchangeParms));
+   parms->atomParms = *((AtomExchangeParms*) hh->parms);
+   comdFree(hh->parms);
+
+   parms->refresh = 0;
+   for (int ii=0; ii<hh->nMsgs; ++ii)
+   {
+      parms->nSendSlots[ii] = 0;
+      parms->nRecvSlots[ii] = 0;
+      parms->maxSendSlots[ii] = 0; // see fitGhostSlots
+      parms->maxRecvSlots[ii] = 0;
+      parms->sendSlots[ii] = NULL;
+      parms->recvSlots[ii] = NULL;
+      parms->sendBoxes[ii] = NULL;
+      parms->recvBoxes[ii] = NULL;
+   }
+
+   hh->sizeBuffer = sizeGhostBuffer;
+   hh->loadBuffer = loadGhostBuffer;
+   hh->unloadBuffer = unloadGhostBuffer;
+   hh->reserveBuffers = NULL;
+   hh->destroy = destroyGhostExchange;
+   hh->parms = parms;
+   return hh;
+}
+
 /// The force exchange is considerably simpler than the atom exchange.
 /// In the force case we only need to exchange data that is needed to
 /// complete the force calculation.  Since the atoms have not moved we
@@ -198,39 +397,71 @@ HaloExchange* initAtomHaloExchange(Domain* domain, LinkCell* boxes)
 /// received from the x-axis send, and the z-axis must send some data
 /// from the y-axis send.  This accumulation of data to send is
 /// responsible for data reaching neighbor cells that share only edges
-/// or corners.
+/// or corners.  In the direct modes each message carries exactly the
+/// local cells that lie in the halo of the receiving task.
+///
+/// The two ends need not divide the halo into the same cells along the
+/// axes a message crosses: after the load balancer has moved the
+/// planes, neighboring tasks have cells of different sizes, and with
+/// more than one halo layer an atom may sit in the second plane of
+/// cells on one end and in the first on the other.  Therefore the
+/// cells of each column across the faces (groupSize cells) are treated
+/// as one, with the atoms in the order of their ids.
+///
+/// If the atom exchange filters the ghost atoms, the force exchange
+/// must apply the same filter (filterGhosts) so that the data is sent
+/// for exactly the atoms the receiver holds.  This works because the
+/// atoms have not moved since the atom exchange, and the forwarded halo
+/// atoms in HALO_AXES mode are filtered again on the same positions.
 ///
 /// \see eam.c for an explanation of the requirement to exchange
 /// force data.
-HaloExchange* initForceHaloExchange(Domain* domain, LinkCell* boxes)
+HaloExchange* initForceHaloExchange(Domain* domain, LinkCell* boxes, int mode, int filterGhosts)
 {
-   HaloExchange* hh = initHaloExchange(domain);
+   HaloExchange* hh = initHaloExchange(domain, mode);
 
+   hh->sizeBuffer = sizeForceBuffer;
    hh->loadBuffer = loadForceBuffer;
    hh->unloadBuffer = unloadForceBuffer;
+   hh->reserveBuffers = NULL;
    hh->destroy = destroyForceExchange;
 
-   int size0 = (boxes->gridSize[1])*(boxes->gridSize[2]);
-   int size1 = (boxes->gridSize[0]+2)*(boxes->gridSize[2]);
-   int size2 = (boxes->gridSize[0]+2)*(boxes->gridSize[1]+2);
-   int maxSize = MAX(size0, size1);
-   maxSize = MAX(size1, size2);
-   hh->bufCapacity = (maxSize)*MAXATOMS*sizeof(ForceMsg);
-
    ForceExchangeParms* parms = comdMalloc(sizeof(ForceExchangeParms));
+   parms->nMsgs = hh->nMsgs;
 
-   parms->nCells[HALO_X_MINUS] = (boxes->gridSize[1]  )*(boxes->gridSize[2]  );
-   parms->nCells[HALO_Y_MINUS] = (boxes->gridSize[0]+2)*(boxes->gridSize[2]  );
-   parms->nCells[HALO_Z_MINUS] = (boxes->gridSize[0]+2)*(boxes->gridSize[1]+2);
-   parms->nCells[HALO_X_PLUS]  = parms->nCells[HALO_X_MINUS];
-   parms->nCells[HALO_Y_PLUS]  = parms->nCells[HALO_Y_MINUS];
-   parms->nCells[HALO_Z_PLUS]  = parms->nCells[HALO_Z_MINUS];
+   if (hh->mode == HALO_AXES)
+   {
+      // nHalo planes of cells per face.
+      int h = boxes->nHaloLayers;
+      parms->nCells[HALO_X_MINUS] = h*(boxes->gridSize[1]    )*(boxes->gridSize[2]    );
+      parms->nCells[HALO_Y_MINUS] = h*(boxes->gridSize[0]+2*h)*(boxes->gridSize[2]    );
+      parms->nCells[HALO_Z_MINUS] = h*(boxes->gridSize[0]+2*h)*(boxes->gridSize[1]+2*h);
+      parms->nCells[HALO_X_PLUS]  = parms->nCells[HALO_X_MINUS];
+      parms->nCells[HALO_Y_PLUS]  = parms->nCells[HALO_Y_MINUS];
+      parms->nCells[HALO_Z_PLUS]  = parms->nCells[HALO_Z_MINUS];
 
-   for (int ii=0; ii<6; ++ii)
+      for (int ii=0; ii<6; ++ii)
+      {
+         parms->sendCells[ii] = mkForceSendCellList(boxes, ii, parms->nCells[ii], &parms->groupSize[ii]);
+         parms->recvCells[ii] = mkForceRecvCellList(boxes, ii, parms->nCells[ii], &parms->groupSize[ii]);
+      }
+   }
+   else
    {
-      parms->sendCells[ii] = mkForceSendCellList(boxes, ii, parms->nCells[ii]);
-      parms->recvCells[ii] = mkForceRecvCellList(boxes, ii, parms->nCells[ii]);
+      for (int ii=0; ii<hh->nMsgs; ++ii)
+      {
+         int nRecv, recvGroupSize;
+         parms->sendCells[ii] = mkDirectCellList(boxes, ii, DIRECT_FORCE_SEND, &parms->nCells[ii], &parms->groupSize[ii]);
+         parms->recvCells[ii] = mkDirectCellList(boxes, ii, DIRECT_FORCE_RECV, &nRecv, &recvGroupSize);
+         assert(nRecv == parms->nCells[ii]);
+         assert(recvGroupSize == parms->groupSize[ii]);
+      }
    }
+
+   for (int ii=0; ii<hh->nMsgs; ++ii)
+      assert(parms->groupSize[ii] <= MAX_FORCE_GROUP);
+
+   mkGhostSlabs(hh, boxes, filterGhosts, parms->ghostMin, parms->ghostMax);
    
    hh->parms = parms;
    return hh;
@@ -238,7 +469,15 @@ HaloExchange* initForceHaloExchange(Domain* domain, LinkCell* boxes)
 
 void destroyHaloExchange(HaloExchange** haloExchange)
 {
+   if (! *haloExchange) return;
    (*haloExchange)->destroy((*haloExchange)->parms);
+   assert((*haloExchange)->splitPhase < 0);
+   for (int ii=0; ii<(*haloExchange)->nMsgs; ++ii)
+      destroyCommRequest(&((*haloExchange)->request[ii]));
+   destroyNeighborComm(&((*haloExchange)->nbrComm));
+   freeCommBuffer((*haloExchange)->recvBuf);
+   freeCommBuffer((*haloExchange)->sendBuf);
+   destroySharedBuffer(&((*haloExchange)->shm));
    comdFree((*haloExchange)->parms);
    comdFree(*haloExchange);
    *haloExchange = NULL;
@@ -246,69 +485,753 @@ void destroyHaloExchange(HaloExchange** haloExchange)
 
 void haloExchange(HaloExchange* haloExchange, void* data)
 {
-   for (int iAxis=0; iAxis<3; ++iAxis)
-      exchangeData(haloExchange, data, iAxis);
+   postHaloExchange(haloExchange, data);
+   completeHaloExchange(haloExchange);
+}
+
+/// \details
+/// Discards all atoms in the halo link cells and replaces them with
+/// ghost atoms sent from their owners, recording the send and receive
+/// order for updateGhostPositions.  The atoms must already be in the
+/// correct local link cells, i.e., a migration (or atom) exchange must
+/// precede this call.
+///
+/// A separate exchange is needed because the migration exchange leaves
+/// atoms that have just left the local domain in the halo cells.  These
+/// atoms are not sent back by their new owner in the same exchange, so
+/// their positions could never be refreshed.
+///
+/// The halo cells are sorted at the end so that the force exchange sees
+/// the atoms in the same order as the owning tasks.  Only then are the
+/// recorded atoms looked up in their cells to get their final storage
+/// indices.  The local cells must be sorted already.
+void exchangeGhostAtoms(HaloExchange* ghostExchange, SimFlat* s)
+{
+   GhostExchangeParms* parms = (GhostExchangeParms*) ghostExchange->parms;
+   LinkCell* boxes = s->boxes;
+
+   emptyHaloCells(boxes);
+   for (int ii=0; ii<ghostExchange->nMsgs; ++ii)
+   {
+      parms->nSendSlots[ii] = 0;
+      parms->nRecvSlots[ii] = 0;
+   }
+   parms->refresh = 0;
+   haloExchange(ghostExchange, s);
+
+   for (int iBox=boxes->nLocalBoxes; iBox<boxes->nTotalBoxes; ++iBox)
+      sortAtomsInCell(s->atoms, boxes, iBox);
+
+   // The slot lists hold the gids so far.
+   for (int iMsg=0; iMsg<ghostExchange->nMsgs; ++iMsg)
+   {
+      int* lists[2] = {parms->sendSlots[iMsg], parms->recvSlots[iMsg]};
+      int* cells[2] = {parms->sendBoxes[iMsg], parms->recvBoxes[iMsg]};
+      int nSlots[2] = {parms->nSendSlots[iMsg], parms->nRecvSlots[iMsg]};
+      for (int iList=0; iList<2; ++iList)
+         for (int ii=0; ii<nSlots[iList]; ++ii)
+         {
+            int iBox = cells[iList][ii];
+            lists[iList][ii] = boxes->boxOffset[iBox] +
+               findAtomInCell(s->atoms, boxes, iBox, lists[iList][ii]);
+         }
+   }
+   parms->refresh = 1;
+}
+
+/// \details
+/// Sends the current positions of the atoms recorded by the last call
+/// to exchangeGhostAtoms and stores them in the recorded locations.
+/// No atoms are added, removed, or moved between link cells.  In
+/// HALO_AXES mode the exchange proceeds axis by axis, so ghost
+/// positions received across the x-faces are updated before they are
+/// forwarded across the y- and z-faces, exactly as in the full
+/// exchange.
+void updateGhostPositions(HaloExchange* ghostExchange, SimFlat* s)
+{
+   GhostExchangeParms* parms = (GhostExchangeParms*) ghostExchange->parms;
+   assert(parms->refresh);
+   haloExchange(ghostExchange, s);
+}
+
+int parseHaloMode(const char* name)
+{
+   if (strcmp(name, "axes") == 0)     return HALO_AXES;
+   if (strcmp(name, "direct") == 0)   return HALO_DIRECT;
+   if (strcmp(name, "neighbor") == 0) return HALO_NEIGHBOR;
+   return -1;
+}
+
+const char* haloModeName(int mode)
+{
+   switch (mode)
+   {
+     case HALO_AXES:     return "axes";
+     case HALO_DIRECT:   return "direct";
+     case HALO_NEIGHBOR: return "neighbor";
+   }
+   return "unknown";
+}
+
+/// HALO_NEIGHBOR needs an MPI 3 library, and so does HALO_SHARED.
+/// HALO_SHARED cannot be combined with HALO_NEIGHBOR.
+int haloModeAvailable(int mode)
+{
+   if (mode & HALO_SHARED)
+   {
+      mode &= ~HALO_SHARED;
+      if (mode == HALO_NEIGHBOR || ! sharedBufferAvailable())
+         return 0;
+   }
+   if (mode == HALO_NEIGHBOR)
+      return neighborCommAvailable();
+   return (mode == HALO_AXES || mode == HALO_DIRECT);
 }
 
 /// Base class constructor.
-HaloExchange* initHaloExchange(Domain* domain)
+///
+/// In HALO_AXES mode message ii goes across face ii (see
+/// HaloFaceOrder).  Otherwise there is one message for each of the 26
+/// neighbors (see msgDirection).  In either case the message opposite
+/// to message ii (see oppositeMsg) is the one the neighbor of message
+/// ii sends back to us.
+HaloExchange* initHaloExchange(Domain* domain, int mode)
 {
    HaloExchange* hh = comdMalloc(sizeof(HaloExchange));
 
-   // Rank of neighbor task for each face.
-   hh->nbrRank[HALO_X_MINUS] = processorNum(domain, -1,  0,  0);
-   hh->nbrRank[HALO_X_PLUS]  = processorNum(domain, +1,  0,  0);
-   hh->nbrRank[HALO_Y_MINUS] = processorNum(domain,  0, -1,  0);
-   hh->nbrRank[HALO_Y_PLUS]  = processorNum(domain,  0, +1,  0);
-   hh->nbrRank[HALO_Z_MINUS] = processorNum(domain,  0,  0, -1);
-   hh->nbrRank[HALO_Z_PLUS]  = processorNum(domain,  0,  0, +1);
-   hh->bufCapacity = 0; // will be set by sub-class.
+   hh->shared = (mode & HALO_SHARED) != 0;
+   mode &= ~HALO_SHARED;
+   assert(! (hh->shared && mode == HALO_NEIGHBOR));
+   hh->mode = mode;
+   hh->nMsgs = (mode == HALO_AXES) ? 6 : 26;
+   for (int ii=0; ii<hh->nMsgs; ++ii)
+   {
+      int dir[3];
+      msgDirection(hh, ii, dir);
+      hh->nbrRank[ii] = processorNum(domain, dir[0], dir[1], dir[2]);
+      hh->nbrOnNode[ii] = onMyNode(domain, hh->nbrRank[ii]);
+      hh->request[ii] = initCommRequest();
+      hh->nbrShm[ii] = NULL; // set on first exchange if shared.
+   }
+   hh->sendBuf = NULL; // allocated on first exchange.
+   hh->recvBuf = NULL;
+   hh->sendCapacity = 0;
+   hh->recvCapacity = 0;
+   hh->splitPhase = -1;
+   hh->splitHeaders = 0;
+   hh->splitData = NULL;
+   hh->deferred = 0;
+   hh->shm = NULL;
+   hh->shmBuf = NULL;
+   hh->shmUsed = 0;
+   hh->nExchanges = 0;
+
+   hh->nbrComm = NULL;
+   if (mode == HALO_NEIGHBOR)
+   {
+      int source[HALO_MAX_MSGS];
+      for (int ii=0; ii<hh->nMsgs; ++ii)
+         source[ii] = hh->nbrRank[oppositeMsg(hh, ii)];
+      hh->nbrComm = initNeighborComm(hh->nMsgs, hh->nbrRank, source);
+   }
 
    return hh;
 }
 
-/// This is the function that does the heavy lifting for the
-/// communication of halo data.  It is called once for each axis and
-/// sends and receives two message.  Loading and unloading of the
-/// buffers is in the hands of the sub-class virtual functions.
+/// Get the direction (-1, 0, or +1 along each axis) of the neighbor to
+/// which message iMsg is sent.  The 26 messages of the direct modes
+/// run over all directions but (0, 0, 0) with x fastest, so message
+/// 25-iMsg goes in the opposite direction.
+void msgDirection(HaloExchange* haloExchange, int iMsg, int dir[3])
+{
+   if (haloExchange->mode == HALO_AXES)
+   {
+      dir[0] = dir[1] = dir[2] = 0;
+      dir[iMsg/2] = (iMsg%2 == 0) ? -1 : +1;
+      return;
+   }
+   directDirection(iMsg, dir);
+}
+
+/// Get the direction of message iMsg of a direct exchange.
+void directDirection(int iMsg, int dir[3])
+{
+   int index = (iMsg < 13) ? iMsg : iMsg+1; // skip (0, 0, 0)
+   dir[0] = index%3 - 1;
+   dir[1] = (index/3)%3 - 1;
+   dir[2] = index/9 - 1;
+}
+
+/// Return the message that goes in the direction opposite to iMsg.
+int oppositeMsg(HaloExchange* haloExchange, int iMsg)
+{
+   if (haloExchange->mode == HALO_AXES)
+      return iMsg^1;
+   return haloExchange->nMsgs-1 - iMsg;
+}
+
+/// The messages of HALO_AXES go in three phases of two, one per axis.
+/// The direct modes send all messages in a single phase.
+void phaseMsgs(HaloExchange* haloExchange, int iPhase, int* begin, int* end)
+{
+   if (haloExchange->mode == HALO_AXES)
+   {
+      *begin = 2*iPhase;
+      *end = 2*iPhase+2;
+      return;
+   }
+   *begin = 0;
+   *end = haloExchange->nMsgs;
+}
+
+/// Allocate the shared window of a shared exchange on first use and
+/// look up the windows of the neighbors on the same node.  The first
+/// exchange is collective, which the window allocation requires.
 ///
-/// \param [in] iAxis     Axis index.
-/// \param [in, out] data Pointer to data that will be passed to the load and
-///                       unload functions
-void exchangeData(HaloExchange* haloExchange, void* data, int iAxis)
+/// The window cannot grow later, so it gets twice the room that all
+/// messages of the first exchange may need (forwarded halo atoms of
+/// HALO_AXES are not all there yet).  A message that does not fit is
+/// sent through MPI instead (see postPhase), so the size only matters
+/// for speed.
+void allocHaloBuffers(HaloExchange* haloExchange, void* data)
 {
-   enum HaloFaceOrder faceM = 2*iAxis;
-   enum HaloFaceOrder faceP = faceM+1;
+   if (! haloExchange->shared || haloExchange->shm)
+      return;
+   int size = 0;
+   for (int ii=0; ii<haloExchange->nMsgs; ++ii)
+      size += haloExchange->sizeBuffer(haloExchange->parms, data, ii);
+   haloExchange->bufSize = 2*size + 64;
+   haloExchange->shm = initSharedBuffer(2*haloExchange->bufSize);
+   for (int ii=0; ii<haloExchange->nMsgs; ++ii)
+      haloExchange->nbrShm[ii] = sharedBufferOfRank(haloExchange->shm, haloExchange->nbrRank[ii]);
+}
 
-   char* sendBufM = comdMalloc(haloExchange->bufCapacity);
-   char* sendBufP = comdMalloc(haloExchange->bufCapacity);
-   char* recvBufM = comdMalloc(haloExchange->bufCapacity);
-   char* recvBufP = comdMalloc(haloExchange->bufCapacity);
+/// Make a send or receive buffer at least size bytes long.  Its
+/// contents are not kept.  The buffers belong to the HaloExchange and
+/// are reused by every later call, so the multi-MB buffers are not
+/// mapped and page faulted in again on each exchange.  Some headroom
+/// avoids reallocating them whenever a message grows by a few atoms.
+void fitCommBuffer(char** buf, int* capacity, int size)
+{
+   if (*buf && *capacity >= size)
+      return;
+   freeCommBuffer(*buf);
+   *capacity = size + size/8 + 64;
+   *buf = allocCommBuffer(*capacity);
+}
 
-   int nSendM = haloExchange->loadBuffer(haloExchange->parms, data, faceM, sendBufM);
-   int nSendP = haloExchange->loadBuffer(haloExchange->parms, data, faceP, sendBufP);
+/// \details
+/// A split phase exchange lets the caller do work that neither reads
+/// data the exchange will change nor writes data it sends while the
+/// messages are in flight.  For the atom exchange that is anything that
+/// touches only local link cells that are not next to the domain
+/// surface (received atoms that have migrated into the domain land in
+/// the outermost plane of local cells).  The force exchange writes only
+/// halo cells.
+///
+/// In HALO_AXES mode the axes still go one after the other since the
+/// y-axis messages include data received across the x-faces.  This
+/// function posts the x-axis messages.  progressHaloExchange moves on
+/// to the next axis whenever the current one has arrived, so the
+/// caller should call it every now and then while it works.
+/// completeHaloExchange finishes the remaining axes.  The direct modes
+/// post all messages at once.
+///
+/// Received atoms may need more storage than the atom arrays have.
+/// The arrays cannot be reallocated under the feet of a force loop, so
+/// progressHaloExchange leaves such a phase to completeHaloExchange.
+///
+/// haloExchange is simply a post followed by a complete.
+///
+/// Only one thread may call the split phase functions.
+void postHaloExchange(HaloExchange* haloExchange, void* data)
+{
+   assert(haloExchange->splitPhase < 0);
+   allocHaloBuffers(haloExchange, data);
+   if (haloExchange->shared)
+   {
+      haloExchange->shmBuf = sharedBufferBase(haloExchange->shm)
+         + (haloExchange->nExchanges%2)*haloExchange->bufSize;
+      haloExchange->shmUsed = 0;
+   }
+   haloExchange->nExchanges++;
+   haloExchange->splitData = data;
+   postPhase(haloExchange, 0);
+}
 
-   int nbrRankM = haloExchange->nbrRank[faceM];
-   int nbrRankP = haloExchange->nbrRank[faceP];
+int progressHaloExchange(HaloExchange* haloExchange)
+{
+   while (haloExchange->splitPhase >= 0)
+   {
+      if (haloExchange->deferred)
+         return 0;
+      int done = 1;
+      startTimer(commHaloTimer);
+      if (haloExchange->nbrComm)
+         done = testNeighborExchange(haloExchange->nbrComm);
+      else
+      {
+         int begin, end;
+         phaseMsgs(haloExchange, haloExchange->splitPhase, &begin, &end);
+         for (int ii=begin; ii<end && done; ++ii)
+            done = testSendReceiveParallel(haloExchange->request[ii]);
+      }
+      stopTimer(commHaloTimer);
+      if (! done)
+         return 0;
+      if (haloExchange->splitHeaders)
+      {
+         startPhaseData(haloExchange);
+         continue;
+      }
+      if (! completePhase(haloExchange, 0))
+      {
+         haloExchange->deferred = 1;
+         return 0;
+      }
+   }
+   return 1;
+}
+
+void completeHaloExchange(HaloExchange* haloExchange)
+{
+   while (haloExchange->splitPhase >= 0)
+      completePhase(haloExchange, 1);
+   haloExchange->deferred = 0;
+}
+
+int haloExchangeInFlight(HaloExchange* haloExchange)
+{
+   return haloExchange->splitPhase >= 0;
+}
+
+/// Load the send buffers of the messages of iPhase and start their
+/// headers.  Message ii is tagged with ii and received by its neighbor
+/// as the reply to that neighbor's message oppositeMsg(ii).  All
+/// messages of a phase are loaded before any is unloaded.
+///
+/// Loading and unloading of the buffers is in the hands of the
+/// sub-class virtual functions.  The sub-class bounds the size of each
+/// message first (see HaloExchangeSt::sizeBuffer) so that the send
+/// buffer can grow before it is loaded.  The receiver learns the length
+/// of each message from its header, a message of two integers that
+/// goes ahead of the data (see startPhaseData).  In HALO_NEIGHBOR mode
+/// the lengths are exchanged by a collective instead.
+///
+/// In a shared exchange, a message to a neighbor on the same node is
+/// loaded into our window, and its header tells the neighbor where it
+/// starts (the layouts of the tasks differ).  The neighbor unloads the
+/// data from our window once the header has arrived, so only the header
+/// is sent.  Since the two sides of every pair of messages travel in
+/// the same phase, a task can only complete an exchange after all its
+/// neighbors have completed the previous one.  Alternating between two
+/// copies of the window therefore guarantees that data is not
+/// overwritten while a neighbor still reads it.  The phases of an
+/// exchange use different parts of the copy.  A message that does not
+/// fit into what is left is sent like a message to another node.
+void postPhase(HaloExchange* haloExchange, int iPhase)
+{
+   void* data = haloExchange->splitData;
+   int begin, end;
+   phaseMsgs(haloExchange, iPhase, &begin, &end);
+
+   int maxLen[HALO_MAX_MSGS];
+   int sendSize = 0;
+   for (int ii=begin; ii<end; ++ii)
+   {
+      maxLen[ii] = haloExchange->sizeBuffer(haloExchange->parms, data, ii);
+      haloExchange->sendHeader[ii][1] = -1;
+      if (haloExchange->nbrShm[ii] &&
+          haloExchange->shmUsed + maxLen[ii] <= haloExchange->bufSize)
+      {
+         haloExchange->msgOffset[ii] = haloExchange->shmBuf + haloExchange->shmUsed
+            - sharedBufferBase(haloExchange->shm);
+         haloExchange->sendHeader[ii][1] = haloExchange->msgOffset[ii];
+         haloExchange->shmUsed += maxLen[ii];
+         continue;
+      }
+      haloExchange->msgOffset[ii] = sendSize;
+      sendSize += maxLen[ii];
+   }
+   fitCommBuffer(&haloExchange->sendBuf, &haloExchange->sendCapacity, sendSize);
+
+   for (int ii=begin; ii<end; ++ii)
+   {
+      char* sendBuf = haloExchange->sendBuf + haloExchange->msgOffset[ii];
+      if (haloExchange->sendHeader[ii][1] >= 0)
+         sendBuf = sharedBufferBase(haloExchange->shm) + haloExchange->msgOffset[ii];
+      haloExchange->sendLen[ii] = haloExchange->loadBuffer(
+         haloExchange->parms, data, ii, sendBuf);
+      assert(haloExchange->sendLen[ii] <= maxLen[ii]);
+      haloExchange->sendHeader[ii][0] = haloExchange->sendLen[ii];
+      haloBytes[haloExchange->nbrOnNode[ii] ? 0 : 1] += haloExchange->sendLen[ii];
+   }
+
+   startTimer(commHaloTimer);
+   if (haloExchange->shm)
+      syncSharedBuffer(haloExchange->shm);
+   haloExchange->splitPhase = iPhase;
+   if (haloExchange->nbrComm)
+   {
+      int recvLen[HALO_MAX_MSGS];
+      exchangeNeighborLengths(haloExchange->nbrComm, haloExchange->sendLen, recvLen);
+      for (int ii=begin; ii<end; ++ii)
+      {
+         haloExchange->recvHeader[ii][0] = recvLen[ii];
+         haloExchange->recvHeader[ii][1] = -1;
+      }
+      stopTimer(commHaloTimer);
+      startPhaseData(haloExchange);
+      return;
+   }
+   for (int ii=begin; ii<end; ++ii)
+   {
+      int jj = oppositeMsg(haloExchange, ii);
+      startSendReceiveParallel(haloExchange->request[ii],
+                               haloExchange->sendHeader[ii], 2*sizeof(int), haloExchange->nbrRank[ii],
+                               haloExchange->recvHeader[ii], 2*sizeof(int), haloExchange->nbrRank[jj], ii);
+   }
+   haloExchange->splitHeaders = 1;
+   stopTimer(commHaloTimer);
+}
 
-   int nRecvM, nRecvP;
+/// Start the data of the phase in flight once its headers have arrived.
+/// The receive buffer grows to hold all data of the phase that comes
+/// as a message.  Empty messages are not sent at all, which both sides
+/// know from the header.
+void startPhaseData(HaloExchange* haloExchange)
+{
+   int begin, end;
+   phaseMsgs(haloExchange, haloExchange->splitPhase, &begin, &end);
+
+   int recvSize = 0;
+   int recvDispl[HALO_MAX_MSGS];
+   for (int ii=begin; ii<end; ++ii)
+   {
+      int jj = oppositeMsg(haloExchange, ii);
+      haloExchange->recvLen[ii] = haloExchange->recvHeader[ii][0];
+      if (haloExchange->recvHeader[ii][1] >= 0)
+         continue;
+      haloExchange->recvOffset[jj] = recvSize;
+      recvDispl[ii] = recvSize;
+      recvSize += haloExchange->recvLen[ii];
+   }
+   fitCommBuffer(&haloExchange->recvBuf, &haloExchange->recvCapacity, recvSize);
 
    startTimer(commHaloTimer);
-   nRecvP = sendReceiveParallel(sendBufM, nSendM, nbrRankM, recvBufP, haloExchange->bufCapacity, nbrRankP);
-   nRecvM = sendReceiveParallel(sendBufP, nSendP, nbrRankP, recvBufM, haloExchange->bufCapacity, nbrRankM);
+   if (haloExchange->nbrComm)
+   {
+      startNeighborExchange(haloExchange->nbrComm,
+                            haloExchange->sendBuf, haloExchange->sendLen, haloExchange->msgOffset,
+                            haloExchange->recvBuf, haloExchange->recvLen, recvDispl);
+   }
+   else
+   {
+      for (int ii=begin; ii<end; ++ii)
+      {
+         int jj = oppositeMsg(haloExchange, ii);
+         int dest = haloExchange->nbrRank[ii];
+         int source = haloExchange->nbrRank[jj];
+         if (haloExchange->sendHeader[ii][1] >= 0 || haloExchange->sendLen[ii] == 0)
+            dest = -1;
+         if (haloExchange->recvHeader[ii][1] >= 0 || haloExchange->recvLen[ii] == 0)
+            source = -1;
+         if (dest < 0 && source < 0)
+            continue;
+         startSendReceiveParallel(haloExchange->request[ii],
+                                  haloExchange->sendBuf + haloExchange->msgOffset[ii],
+                                  haloExchange->sendLen[ii], dest,
+                                  haloExchange->recvBuf + haloExchange->recvOffset[jj],
+                                  haloExchange->recvLen[ii], source, ii);
+      }
+   }
+   haloExchange->splitHeaders = 0;
    stopTimer(commHaloTimer);
-   
-   haloExchange->unloadBuffer(haloExchange->parms, data, faceM, nRecvM, recvBufM);
-   haloExchange->unloadBuffer(haloExchange->parms, data, faceP, nRecvP, recvBufP);
-   comdFree(recvBufP);
-   comdFree(recvBufM);
-   comdFree(sendBufP);
-   comdFree(sendBufM);
+}
+
+/// Wait for the messages of the phase in flight, unload them, and post
+/// the next phase, if any.  The data received from neighbor ii is
+/// unloaded as message ii.  In a shared exchange the data of a
+/// neighbor on the same node may be unloaded from its window instead.
+///
+/// Before anything is unloaded, the sub-class gets to make room for all
+/// messages of the phase (see HaloExchangeSt::reserveBuffers).  If it
+/// cannot without mayGrow, the phase stays in flight and may be
+/// completed again later.  Waiting again does no harm.
+/// \return 0 if the phase could not be unloaded.
+int completePhase(HaloExchange* haloExchange, int mayGrow)
+{
+   int iPhase = haloExchange->splitPhase;
+   void* data = haloExchange->splitData;
+   int begin, end;
+   phaseMsgs(haloExchange, iPhase, &begin, &end);
+
+   if (haloExchange->splitHeaders)
+   {
+      startTimer(commHaloTimer);
+      for (int ii=begin; ii<end; ++ii)
+         waitSendReceiveParallel(haloExchange->request[ii]);
+      stopTimer(commHaloTimer);
+      startPhaseData(haloExchange);
+   }
+
+   startTimer(commHaloTimer);
+   if (haloExchange->nbrComm)
+      waitNeighborExchange(haloExchange->nbrComm);
+   else
+      for (int ii=begin; ii<end; ++ii)
+         waitSendReceiveParallel(haloExchange->request[ii]);
+   if (haloExchange->shm)
+      syncSharedBuffer(haloExchange->shm);
+   stopTimer(commHaloTimer);
+
+   int bufSize[HALO_MAX_MSGS];
+   char* buf[HALO_MAX_MSGS];
+   for (int ii=begin; ii<end; ++ii)
+   {
+      int jj = oppositeMsg(haloExchange, ii);
+      bufSize[ii] = haloExchange->recvLen[jj];
+      buf[ii] = haloExchange->recvBuf + haloExchange->recvOffset[ii];
+      if (haloExchange->recvHeader[jj][1] >= 0)
+         buf[ii] = haloExchange->nbrShm[ii] + haloExchange->recvHeader[jj][1];
+   }
+
+   if (haloExchange->reserveBuffers &&
+       ! haloExchange->reserveBuffers(haloExchange->parms, data, begin, end,
+                                      bufSize, buf, mayGrow))
+      return 0;
+
+   for (int ii=begin; ii<end; ++ii)
+      haloExchange->unloadBuffer(haloExchange->parms, data, ii, bufSize[ii], buf[ii]);
+
+   haloExchange->splitPhase = -1;
+   if (haloExchange->mode == HALO_AXES && iPhase < HALO_Z_AXIS)
+      postPhase(haloExchange, iPhase+1);
+   else
+      haloExchange->splitData = NULL;
+   return 1;
+}
+
+/// \details
+/// Data a task sends to itself counts as on node.
+void printHaloBytes(FILE* file)
+{
+   double bytes[2];
+   addDoubleParallel(haloBytes, bytes, 2);
+   if (! printRank())
+      return;
+   double total = bytes[0] + bytes[1];
+   if (total <= 0.0)
+      total = 1.0;
+   fprintf(file, "Halo exchange data:\n");
+   fprintf(file, "  On node            : %12.3f MB (%5.1f%%)\n",
+           bytes[0]/1024/1024, 100.0*bytes[0]/total);
+   fprintf(file, "  Off node           : %12.3f MB (%5.1f%%)\n",
+           bytes[1]/1024/1024, 100.0*bytes[1]/total);
+   fprintf(file, "\n");
+}
+
+/// Set the coordinate shift factor of each message.  A message gets a
+/// factor of +1.0 (-1.0) along each axis on which it is sent to the
+/// minus (plus) side from a task on the minus (plus) boundary of the
+/// simulation domain.
+void mkPbcFactors(HaloExchange* haloExchange, Domain* domain, real_t** pbcFactor)
+{
+   int* procCoord = domain->procCoord; //alias
+   int* procGrid  = domain->procGrid; //alias
+   for (int ii=0; ii<haloExchange->nMsgs; ++ii)
+   {
+      int dir[3];
+      msgDirection(haloExchange, ii, dir);
+      pbcFactor[ii] = comdMalloc(3*sizeof(real_t));
+      for (int jj=0; jj<3; ++jj)
+      {
+         pbcFactor[ii][jj] = 0.0;
+         if (dir[jj] < 0 && procCoord[jj] == 0)             pbcFactor[ii][jj] = +1.0;
+         if (dir[jj] > 0 && procCoord[jj] == procGrid[jj]-1) pbcFactor[ii][jj] = -1.0;
+      }
+   }
+}
+
+/// Set the slab of positions of the atoms each message may carry.  An
+/// atom is sent if it is within the halo depth (nHaloLayers boxes of
+/// cutoff/cellsPerCutoff) of every face the message crosses, i.e., if
+/// it lies in the halo of the receiving task (up to the cutoff rather
+/// than up to the size of the cells).  Atoms
+/// that have left the local domain are beyond the face and always
+/// pass.  Along the other axes there is no limit.  Without
+/// filterGhosts every atom passes.
+void mkGhostSlabs(HaloExchange* haloExchange, LinkCell* boxes, int filterGhosts,
+                  real_t ghostMin[][3], real_t ghostMax[][3])
+{
+   real_t width = boxes->nHaloLayers*boxes->cutoff/boxes->cellsPerCutoff;
+   for (int ii=0; ii<haloExchange->nMsgs; ++ii)
+   {
+      int dir[3];
+      msgDirection(haloExchange, ii, dir);
+      for (int jj=0; jj<3; ++jj)
+      {
+         ghostMin[ii][jj] = -1.0e30;
+         ghostMax[ii][jj] = +1.0e30;
+         if (! filterGhosts)
+            continue;
+         if (dir[jj] < 0) ghostMax[ii][jj] = boxes->localMin[jj] + width;
+         if (dir[jj] > 0) ghostMin[ii][jj] = boxes->localMax[jj] - width;
+      }
+   }
+}
+
+/// Return non-zero if r is in the slab given by ghostMin and ghostMax.
+int inGhostSlab(const real_t* ghostMin, const real_t* ghostMax, const real_t* r)
+{
+   return (r[0] >= ghostMin[0] && r[0] < ghostMax[0] &&
+           r[1] >= ghostMin[1] && r[1] < ghostMax[1] &&
+           r[2] >= ghostMin[2] && r[2] < ghostMax[2]);
+}
+
+/// Make the list of link cells of message iMsg of a direct exchange.
+/// Along each axis the range of cells depends on the direction of the
+/// message:
+///
+/// | which             | direction -1 | direction 0 | direction +1
+/// | :---------------- | :----------- | :---------- | :-----------
+/// | DIRECT_ATOM_SEND  | -1 to h-1    | -1 to g     | g-h to g
+/// | DIRECT_FORCE_SEND | 0 to h-1     | 0 to g-1    | g-h to g-1
+/// | DIRECT_FORCE_RECV | -h to -1     | 0 to g-1    | g to g+h-1
+///
+/// where g is the grid size and h the number of halo layers.  As in
+/// mkAtomCellList the atom messages include the first plane of halo
+/// cells so that atoms that have just left the local domain reach
+/// their new owner and every task that holds them as ghosts.  Since
+/// nothing is forwarded, the other halo planes need not be sent.  The
+/// force lists are iterated in the same order on both ends.
+///
+/// \param [out] nCells The number of cells in the list.
+/// \param [out] groupSize For the force lists, the number of cells of
+///                        a column (see mkForceCellList).  Unused for
+///                        DIRECT_ATOM_SEND.
+/// \return The list of cells.  Caller is responsible to free the list.
+int* mkDirectCellList(LinkCell* boxes, int iMsg, enum DirectCells which, int* nCells, int* groupSize)
+{
+   int dir[3];
+   int begin[3], end[3];
+   directDirection(iMsg, dir);
+   int h = boxes->nHaloLayers;
+   for (int ii=0; ii<3; ++ii)
+   {
+      int g = boxes->gridSize[ii];
+      switch (which)
+      {
+        case DIRECT_ATOM_SEND:
+         begin[ii] = (dir[ii] > 0) ? g-h : -1;
+         end[ii]   = (dir[ii] < 0) ? h   : g+1;
+         break;
+        case DIRECT_FORCE_SEND:
+         begin[ii] = (dir[ii] > 0) ? g-h : 0;
+         end[ii]   = (dir[ii] < 0) ? h   : g;
+         break;
+        case DIRECT_FORCE_RECV:
+         begin[ii] = (dir[ii] < 0) ? -h : ((dir[ii] == 0) ? 0 : g);
+         end[ii]   = (dir[ii] < 0) ?  0 : ((dir[ii] == 0) ? g : g+h);
+         break;
+      }
+   }
+
+   if (which == DIRECT_ATOM_SEND)
+      return mkCellList(boxes, begin, end, nCells);
+   return mkForceCellList(boxes, begin, end, dir, nCells, groupSize);
+}
+
+/// Make the list of link cells of message iMsg of a migration exchange.
+/// These are the cells of the first plane of halo cells that lie in
+/// the direction of the message.  In HALO_AXES mode atoms that have
+/// crossed an edge or a corner are forwarded, so the lists of each
+/// face span the whole plane, including the first halo cells of the
+/// other axes.  In the direct modes they go straight to the new owner.
+///
+/// \param [out] nCells The number of cells in the list.
+/// \return The list of cells.  Caller is responsible to free the list.
+int* mkMigrationCellList(HaloExchange* haloExchange, LinkCell* boxes, int iMsg, int* nCells)
+{
+   int dir[3];
+   int begin[3], end[3];
+   msgDirection(haloExchange, iMsg, dir);
+   for (int ii=0; ii<3; ++ii)
+   {
+      int g = boxes->gridSize[ii];
+      if (dir[ii] < 0)
+      {
+         begin[ii] = -1; end[ii] = 0;
+      }
+      else if (dir[ii] > 0)
+      {
+         begin[ii] = g;  end[ii] = g+1;
+      }
+      else if (haloExchange->mode == HALO_AXES)
+      {
+         begin[ii] = -1; end[ii] = g+1;
+      }
+      else
+      {
+         begin[ii] = 0;  end[ii] = g;
+      }
+   }
+   return mkCellList(boxes, begin, end, nCells);
+}
+
+/// Make the list of link cells with grid coordinates from begin to
+/// end-1 along each axis, z fastest.
+int* mkCellList(LinkCell* boxes, const int begin[3], const int end[3], int* nCells)
+{
+   *nCells = (end[0]-begin[0])*(end[1]-begin[1])*(end[2]-begin[2]);
+   int* list = comdMalloc(*nCells*sizeof(int));
+   int count = 0;
+   for (int ix=begin[0]; ix<end[0]; ++ix)
+      for (int iy=begin[1]; iy<end[1]; ++iy)
+         for (int iz=begin[2]; iz<end[2]; ++iz)
+            list[count++] = getBoxFromTuple(boxes, ix, iy, iz);
+   assert(count == *nCells);
+   return list;
+}
+
+/// Make the list of link cells with grid coordinates from begin to
+/// end-1 along each axis for a force message in direction dir.  The
+/// axes that the message crosses run fastest, so that the cells of a
+/// column across the faces are consecutive.  The number of cells of a
+/// column is returned in groupSize (1 with one halo layer).
+int* mkForceCellList(LinkCell* boxes, const int begin[3], const int end[3],
+                     const int dir[3], int* nCells, int* groupSize)
+{
+   // the axes along the faces first, then the crossed ones.
+   int axis[3];
+   int nAxes = 0;
+   *groupSize = 1;
+   for (int ii=0; ii<3; ++ii)
+      if (dir[ii] == 0)
+         axis[nAxes++] = ii;
+   for (int ii=0; ii<3; ++ii)
+      if (dir[ii] != 0)
+      {
+         axis[nAxes++] = ii;
+         *groupSize *= end[ii]-begin[ii];
+      }
+
+   *nCells = (end[0]-begin[0])*(end[1]-begin[1])*(end[2]-begin[2]);
+   int* list = comdMalloc(*nCells*sizeof(int));
+   int count = 0;
+   int tt[3];
+   for (tt[axis[0]]=begin[axis[0]]; tt[axis[0]]<end[axis[0]]; ++tt[axis[0]])
+      for (tt[axis[1]]=begin[axis[1]]; tt[axis[1]]<end[axis[1]]; ++tt[axis[1]])
+         for (tt[axis[2]]=begin[axis[2]]; tt[axis[2]]<end[axis[2]]; ++tt[axis[2]])
+            list[count++] = getBoxFromTuple(boxes, tt[0], tt[1], tt[2]);
+   assert(count == *nCells);
+   return list;
 }
 
 /// Make a list of link cells that need to be sent across the specified
-/// face.  For each face, the list must include all cells, local and
-/// halo, in the first two planes of link cells.  Halo cells must be
+/// face.  For each face, the list must include the nHaloLayers planes
+/// of local cells closest to the face and the first plane of halo
+/// cells beyond it (two planes in the usual case).  Halo cells must be
 /// included in the list of link cells to send since local atoms may
 /// have moved from local cells into halo cells on this time step.
 /// (Actual remote atoms should have been deleted, so the halo cells
@@ -316,7 +1239,8 @@ void exchangeData(HaloExchange* haloExchange, void* data, int iAxis)
 /// Sending these atoms will allow them to be reassigned to the task
 /// that covers the spatial domain they have moved into.
 ///
-/// Note that link cell grid coordinates range from -1 to gridSize[iAxis].
+/// Note that link cell grid coordinates range from -nHaloLayers to
+/// gridSize[iAxis]+nHaloLayers-1.
 /// \see initLinkCells for an explanation link cell grid coordinates.
 ///
 /// \param [in] boxes  Link cell information.
@@ -328,19 +1252,20 @@ void exchangeData(HaloExchange* haloExchange, void* data, int iAxis)
 int* mkAtomCellList(LinkCell* boxes, enum HaloFaceOrder iFace, const int nCells)
 {
    int* list = comdMalloc(nCells*sizeof(int));
-   int xBegin = -1;
-   int xEnd   = boxes->gridSize[0]+1;
-   int yBegin = -1;
-   int yEnd   = boxes->gridSize[1]+1;
-   int zBegin = -1;
-   int zEnd   = boxes->gridSize[2]+1;
-
-   if (iFace == HALO_X_MINUS) xEnd = xBegin+2;
-   if (iFace == HALO_X_PLUS)  xBegin = xEnd-2;
-   if (iFace == HALO_Y_MINUS) yEnd = yBegin+2;
-   if (iFace == HALO_Y_PLUS)  yBegin = yEnd-2;
-   if (iFace == HALO_Z_MINUS) zEnd = zBegin+2;
-   if (iFace == HALO_Z_PLUS)  zBegin = zEnd-2;
+   int h = boxes->nHaloLayers;
+   int xBegin = -h;
+   int xEnd   = boxes->gridSize[0]+h;
+   int yBegin = -h;
+   int yEnd   = boxes->gridSize[1]+h;
+   int zBegin = -h;
+   int zEnd   = boxes->gridSize[2]+h;
+
+   if (iFace == HALO_X_MINUS) {xBegin = -1; xEnd = h;}
+   if (iFace == HALO_X_PLUS)  {xBegin = boxes->gridSize[0]-h; xEnd = boxes->gridSize[0]+1;}
+   if (iFace == HALO_Y_MINUS) {yBegin = -1; yEnd = h;}
+   if (iFace == HALO_Y_PLUS)  {yBegin = boxes->gridSize[1]-h; yEnd = boxes->gridSize[1]+1;}
+   if (iFace == HALO_Z_MINUS) {zBegin = -1; zEnd = h;}
+   if (iFace == HALO_Z_PLUS)  {zBegin = boxes->gridSize[2]-h; zEnd = boxes->gridSize[2]+1;}
 
    int count = 0;
    for (int ix=xBegin; ix<xEnd; ++ix)
@@ -351,10 +1276,32 @@ int* mkAtomCellList(LinkCell* boxes, enum HaloFaceOrder iFace, const int nCells)
    return list;
 }
 
+/// Return the number of atoms in the link cells of a cell list.
+int countCellAtoms(LinkCell* boxes, const int* cellList, int nCells)
+{
+   int nAtoms = 0;
+   for (int iCell=0; iCell<nCells; ++iCell)
+      nAtoms += boxes->nAtoms[cellList[iCell]];
+   return nAtoms;
+}
+
+/// The sizeBuffer function for a halo exchange of atom data.  At most
+/// all atoms of the link cells in the cellList are sent.
+///
+/// \see HaloExchangeSt::sizeBuffer for an explanation of the
+/// parameters.
+int sizeAtomsBuffer(void* vparms, void* data, int face)
+{
+   AtomExchangeParms* parms = (AtomExchangeParms*) vparms;
+   SimFlat* s = (SimFlat*) data;
+   return countCellAtoms(s->boxes, parms->cellList[face], parms->nCells[face])*sizeof(AtomMsg);
+}
+
 /// The loadBuffer function for a halo exchange of atom data.  Iterates
-/// link cells in the cellList and load any atoms into the send buffer.
-/// This function also shifts coordinates of the atoms by an appropriate
-/// factor if they are being sent across a periodic boundary.
+/// link cells in the cellList and load any atoms in the ghost slab of
+/// the message into the send buffer.  This function also shifts
+/// coordinates of the atoms by an appropriate factor if they are being
+/// sent across a periodic boundary.
 ///
 /// \see HaloExchangeSt::loadBuffer for an explanation of the loadBuffer
 /// parameters.
@@ -376,9 +1323,11 @@ int loadAtomsBuffer(void* vparms, void* data, int face, char* charBuf)
    for (int iCell=0; iCell<nCells; ++iCell)
    {
       int iBox = cellList[iCell];
-      int iOff = iBox*MAXATOMS;
+      int iOff = s->boxes->boxOffset[iBox];
       for (int ii=iOff; ii<iOff+s->boxes->nAtoms[iBox]; ++ii)
       {
+         if (! inGhostSlab(parms->ghostMin[face], parms->ghostMax[face], s->atoms->r[ii]))
+            continue;
          buf[nBuf].gid  = s->atoms->gid[ii];
          buf[nBuf].type = s->atoms->iSpecies[ii];
          buf[nBuf].rx = s->atoms->r[ii][0] + shift[0];
@@ -425,15 +1374,191 @@ void unloadAtomsBuffer(void* vparms, void* data, int face, int bufSize, char* ch
    }
 }
 
+/// The reserveBuffers function for a halo exchange of atom data.
+/// Counts the received atoms that go to each link cell and makes room
+/// for them (see reserveAtoms).
+///
+/// \see HaloExchangeSt::reserveBuffers for an explanation of the
+/// parameters.
+int reserveAtomsBuffers(void* vparms, void* data, int begin, int end,
+                        const int* bufSize, char** buf, int mayGrow)
+{
+   AtomExchangeParms* parms = (AtomExchangeParms*) vparms;
+   SimFlat* s = (SimFlat*) data;
+   int* nIncoming = parms->nIncoming;
+
+   for (int ii=begin; ii<end; ++ii)
+   {
+      AtomMsg* msg = (AtomMsg*) buf[ii];
+      int nBuf = bufSize[ii] / sizeof(AtomMsg);
+      for (int jj=0; jj<nBuf; ++jj)
+      {
+         real_t rr[3] = {msg[jj].rx, msg[jj].ry, msg[jj].rz};
+         nIncoming[getBoxFromCoord(s->boxes, rr)]++;
+      }
+   }
+   int ok = reserveAtoms(s->boxes, s->atoms, nIncoming, mayGrow);
+   for (int iBox=0; iBox<s->boxes->nTotalBoxes; ++iBox)
+      nIncoming[iBox] = 0;
+   return ok;
+}
+
 void destroyAtomsExchange(void* vparms)
 {
    AtomExchangeParms* parms = (AtomExchangeParms*) vparms;
 
-   for (int ii=0; ii<6; ++ii)
+   for (int ii=0; ii<parms->nMsgs; ++ii)
    {
       comdFree(parms->pbcFactor[ii]);
       comdFree(parms->cellList[ii]);
    }
+   comdFree(parms->nIncoming);
+}
+
+/// The sizeBuffer function for a ghost exchange.  A recording exchange
+/// sends all atoms of the link cells in the cell list, a refresh the
+/// recorded atoms.
+///
+/// \see HaloExchangeSt::sizeBuffer for an explanation of the
+/// parameters.
+int sizeGhostBuffer(void* vparms, void* data, int face)
+{
+   GhostExchangeParms* parms = (GhostExchangeParms*) vparms;
+   SimFlat* s = (SimFlat*) data;
+   if (parms->refresh)
+      return parms->nSendSlots[face]*sizeof(PositionMsg);
+   AtomExchangeParms* atomParms = &parms->atomParms;
+   return countCellAtoms(s->boxes, atomParms->cellList[face], atomParms->nCells[face])*sizeof(GhostMsg);
+}
+
+/// Make the slot and box lists of a message of a ghost exchange at
+/// least n long.  Their contents are not kept, as they are only grown
+/// before recording anew.
+void fitGhostSlots(int** slots, int** boxes, int* capacity, int n)
+{
+   if (*capacity >= n)
+      return;
+   *capacity = n + n/8;
+   comdFree(*slots);
+   comdFree(*boxes);
+   *slots = comdMalloc(*capacity*sizeof(int));
+   *boxes = comdMalloc(*capacity*sizeof(int));
+}
+
+/// The loadBuffer function for a ghost exchange.  When recording, this
+/// loads the gid, species, and position of the atoms in the cell list
+/// and remembers the box and gid of every atom.  When refreshing, it
+/// loads only the positions of the recorded atoms.  Positions are
+/// shifted for periodic boundaries in both cases.
+///
+/// \see HaloExchangeSt::loadBuffer for an explanation of the loadBuffer
+/// parameters.
+int loadGhostBuffer(void* vparms, void* data, int face, char* charBuf)
+{
+   GhostExchangeParms* parms = (GhostExchangeParms*) vparms;
+   SimFlat* s = (SimFlat*) data;
+
+   real_t* pbcFactor = parms->atomParms.pbcFactor[face];
+   real3 shift;
+   shift[0] = pbcFactor[0] * s->domain->globalExtent[0];
+   shift[1] = pbcFactor[1] * s->domain->globalExtent[1];
+   shift[2] = pbcFactor[2] * s->domain->globalExtent[2];
+
+   if (! parms->refresh)
+   {
+      AtomExchangeParms* atomParms = &parms->atomParms;
+      GhostMsg* buf = (GhostMsg*) charBuf;
+      fitGhostSlots(&parms->sendSlots[face], &parms->sendBoxes[face], &parms->maxSendSlots[face],
+                    countCellAtoms(s->boxes, atomParms->cellList[face], atomParms->nCells[face]));
+      int nSlots = 0;
+      for (int iCell=0; iCell<atomParms->nCells[face]; ++iCell)
+      {
+         int iBox = atomParms->cellList[face][iCell];
+         int iOff = s->boxes->boxOffset[iBox];
+         for (int ii=iOff; ii<iOff+s->boxes->nAtoms[iBox]; ++ii)
+         {
+            parms->sendSlots[face][nSlots] = s->atoms->gid[ii];
+            parms->sendBoxes[face][nSlots] = iBox;
+            buf[nSlots].gid  = s->atoms->gid[ii];
+            buf[nSlots].type = s->atoms->iSpecies[ii];
+            buf[nSlots].rx = s->atoms->r[ii][0] + shift[0];
+            buf[nSlots].ry = s->atoms->r[ii][1] + shift[1];
+            buf[nSlots].rz = s->atoms->r[ii][2] + shift[2];
+            ++nSlots;
+         }
+      }
+      parms->nSendSlots[face] = nSlots;
+      return nSlots*sizeof(GhostMsg);
+   }
+
+   PositionMsg* buf = (PositionMsg*) charBuf;
+   int nSlots = parms->nSendSlots[face];
+   int* slots = parms->sendSlots[face];
+   for (int ii=0; ii<nSlots; ++ii)
+   {
+      buf[ii].rx = s->atoms->r[slots[ii]][0] + shift[0];
+      buf[ii].ry = s->atoms->r[slots[ii]][1] + shift[1];
+      buf[ii].rz = s->atoms->r[slots[ii]][2] + shift[2];
+   }
+   return nSlots*sizeof(PositionMsg);
+}
+
+/// The unloadBuffer function for a ghost exchange.  When recording,
+/// atoms are placed in link cells just as in unloadAtomsBuffer (with
+/// zero momenta) and the box and gid of each atom are remembered.
+/// When refreshing, the received positions are copied to the recorded
+/// locations.
+///
+/// \see HaloExchangeSt::unloadBuffer for an explanation of the
+/// unloadBuffer parameters.
+void unloadGhostBuffer(void* vparms, void* data, int face, int bufSize, char* charBuf)
+{
+   GhostExchangeParms* parms = (GhostExchangeParms*) vparms;
+   SimFlat* s = (SimFlat*) data;
+
+   if (! parms->refresh)
+   {
+      GhostMsg* buf = (GhostMsg*) charBuf;
+      int nBuf = bufSize / sizeof(GhostMsg);
+      assert(bufSize % sizeof(GhostMsg) == 0);
+      fitGhostSlots(&parms->recvSlots[face], &parms->recvBoxes[face], &parms->maxRecvSlots[face], nBuf);
+      for (int ii=0; ii<nBuf; ++ii)
+      {
+         int iOff = putAtomInBox(s->boxes, s->atoms, buf[ii].gid, buf[ii].type,
+                                 buf[ii].rx, buf[ii].ry, buf[ii].rz,
+                                 0.0, 0.0, 0.0);
+         parms->recvSlots[face][ii] = buf[ii].gid;
+         parms->recvBoxes[face][ii] = getBoxFromCoord(s->boxes, s->atoms->r[iOff]);
+      }
+      parms->nRecvSlots[face] = nBuf;
+      return;
+   }
+
+   PositionMsg* buf = (PositionMsg*) charBuf;
+   int nBuf = bufSize / sizeof(PositionMsg);
+   assert(bufSize % sizeof(PositionMsg) == 0);
+   assert(nBuf == parms->nRecvSlots[face]);
+   int* slots = parms->recvSlots[face];
+   for (int ii=0; ii<nBuf; ++ii)
+   {
+      s->atoms->r[slots[ii]][0] = buf[ii].rx;
+      s->atoms->r[slots[ii]][1] = buf[ii].ry;
+      s->atoms->r[slots[ii]][2] = buf[ii].rz;
+   }
+}
+
+void destroyGhostExchange(void* vparms)
+{
+   GhostExchangeParms* parms = (GhostExchangeParms*) vparms;
+
+   destroyAtomsExchange(&parms->atomParms);
+   for (int ii=0; ii<parms->atomParms.nMsgs; ++ii)
+   {
+      comdFree(parms->sendSlots[ii]);
+      comdFree(parms->recvSlots[ii]);
+      comdFree(parms->sendBoxes[ii]);
+      comdFree(parms->recvBoxes[ii]);
+   }
 }
 
 /// Make a list of link cells that need to send data across the
@@ -443,44 +1568,44 @@ void destroyAtomsExchange(void* vparms)
 ///
 /// \see initLinkCells for information about the conventions for grid
 /// coordinates of link cells.
-int* mkForceSendCellList(LinkCell* boxes, int face, int nCells)
+int* mkForceSendCellList(LinkCell* boxes, int face, int nCells, int* groupSize)
 {
-   int* list = comdMalloc(nCells*sizeof(int));
    int xBegin, xEnd, yBegin, yEnd, zBegin, zEnd;
 
    int nx = boxes->gridSize[0];
    int ny = boxes->gridSize[1];
    int nz = boxes->gridSize[2];
+   int h  = boxes->nHaloLayers;
    switch(face)
    {
      case HALO_X_MINUS:
-      xBegin=0;    xEnd=1;    yBegin=0;    yEnd=ny;   zBegin=0;    zEnd=nz;
+      xBegin=0;    xEnd=h;    yBegin=0;    yEnd=ny;   zBegin=0;    zEnd=nz;
       break;
      case HALO_X_PLUS:
-      xBegin=nx-1; xEnd=nx;   yBegin=0;    yEnd=ny;   zBegin=0;    zEnd=nz;
+      xBegin=nx-h; xEnd=nx;   yBegin=0;    yEnd=ny;   zBegin=0;    zEnd=nz;
       break;
      case HALO_Y_MINUS:
-      xBegin=-1;   xEnd=nx+1; yBegin=0;    yEnd=1;    zBegin=0;    zEnd=nz;
+      xBegin=-h;   xEnd=nx+h; yBegin=0;    yEnd=h;    zBegin=0;    zEnd=nz;
       break;
      case HALO_Y_PLUS:
-      xBegin=-1;   xEnd=nx+1; yBegin=ny-1; yEnd=ny;   zBegin=0;    zEnd=nz;
+      xBegin=-h;   xEnd=nx+h; yBegin=ny-h; yEnd=ny;   zBegin=0;    zEnd=nz;
       break;
      case HALO_Z_MINUS:
-      xBegin=-1;   xEnd=nx+1; yBegin=-1;   yEnd=ny+1; zBegin=0;    zEnd=1;
+      xBegin=-h;   xEnd=nx+h; yBegin=-h;   yEnd=ny+h; zBegin=0;    zEnd=h;
       break;
      case HALO_Z_PLUS:
-      xBegin=-1;   xEnd=nx+1; yBegin=-1;   yEnd=ny+1; zBegin=nz-1; zEnd=nz;
+      xBegin=-h;   xEnd=nx+h; yBegin=-h;   yEnd=ny+h; zBegin=nz-h; zEnd=nz;
       break;
      default:
       assert(1==0);
    }
    
-   int count = 0;
-   for (int ix=xBegin; ix<xEnd; ++ix)
-      for (int iy=yBegin; iy<yEnd; ++iy)
-         for (int iz=zBegin; iz<zEnd; ++iz)
-            list[count++] = getBoxFromTuple(boxes, ix, iy, iz);
-   
+   int begin[3] = {xBegin, yBegin, zBegin};
+   int end[3] = {xEnd, yEnd, zEnd};
+   int dir[3] = {0, 0, 0};
+   dir[face/2] = (face%2 == 0) ? -1 : +1;
+   int count;
+   int* list = mkForceCellList(boxes, begin, end, dir, &count, groupSize);
    assert(count == nCells);
    return list;
 }
@@ -492,51 +1617,67 @@ int* mkForceSendCellList(LinkCell* boxes, int face, int nCells)
 ///
 /// \see initLinkCells for information about the conventions for grid
 /// coordinates of link cells.
-int* mkForceRecvCellList(LinkCell* boxes, int face, int nCells)
+int* mkForceRecvCellList(LinkCell* boxes, int face, int nCells, int* groupSize)
 {
-   int* list = comdMalloc(nCells*sizeof(int));
    int xBegin, xEnd, yBegin, yEnd, zBegin, zEnd;
 
    int nx = boxes->gridSize[0];
    int ny = boxes->gridSize[1];
    int nz = boxes->gridSize[2];
+   int h  = boxes->nHaloLayers;
    switch(face)
    {
      case HALO_X_MINUS:
-      xBegin=-1; xEnd=0;    yBegin=0;  yEnd=ny;   zBegin=0;  zEnd=nz;
+      xBegin=-h; xEnd=0;    yBegin=0;  yEnd=ny;   zBegin=0;  zEnd=nz;
       break;
      case HALO_X_PLUS:
-      xBegin=nx; xEnd=nx+1; yBegin=0;  yEnd=ny;   zBegin=0;  zEnd=nz;
+      xBegin=nx; xEnd=nx+h; yBegin=0;  yEnd=ny;   zBegin=0;  zEnd=nz;
       break;
      case HALO_Y_MINUS:
-      xBegin=-1; xEnd=nx+1; yBegin=-1; yEnd=0;    zBegin=0;  zEnd=nz;
+      xBegin=-h; xEnd=nx+h; yBegin=-h; yEnd=0;    zBegin=0;  zEnd=nz;
       break;
      case HALO_Y_PLUS:
-      xBegin=-1; xEnd=nx+1; yBegin=ny; yEnd=ny+1; zBegin=0;  zEnd=nz;
+      xBegin=-h; xEnd=nx+h; yBegin=ny; yEnd=ny+h; zBegin=0;  zEnd=nz;
       break;
      case HALO_Z_MINUS:
-      xBegin=-1; xEnd=nx+1; yBegin=-1; yEnd=ny+1; zBegin=-1; zEnd=0;
+      xBegin=-h; xEnd=nx+h; yBegin=-h; yEnd=ny+h; zBegin=-h; zEnd=0;
       break;
      case HALO_Z_PLUS:
-      xBegin=-1; xEnd=nx+1; yBegin=-1; yEnd=ny+1; zBegin=nz; zEnd=nz+1;
+      xBegin=-h; xEnd=nx+h; yBegin=-h; yEnd=ny+h; zBegin=nz; zEnd=nz+h;
       break;
      default:
       assert(1==0);
    }
    
-   int count = 0;
-   for (int ix=xBegin; ix<xEnd; ++ix)
-      for (int iy=yBegin; iy<yEnd; ++iy)
-         for (int iz=zBegin; iz<zEnd; ++iz)
-            list[count++] = getBoxFromTuple(boxes, ix, iy, iz);
-   
+   int begin[3] = {xBegin, yBegin, zBegin};
+   int end[3] = {xEnd, yEnd, zEnd};
+   int dir[3] = {0, 0, 0};
+   dir[face/2] = (face%2 == 0) ? -1 : +1;
+   int count;
+   int* list = mkForceCellList(boxes, begin, end, dir, &count, groupSize);
    assert(count == nCells);
    return list;
 }
 
+/// The sizeBuffer function for a force exchange.  At most all atoms of
+/// the link cells in the send list are sent.
+///
+/// \see HaloExchangeSt::sizeBuffer for an explanation of the
+/// parameters.
+int sizeForceBuffer(void* vparms, void* vdata, int face)
+{
+   ForceExchangeParms* parms = (ForceExchangeParms*) vparms;
+   ForceExchangeData* data = (ForceExchangeData*) vdata;
+   return countCellAtoms(data->boxes, parms->sendCells[face], parms->nCells[face])*sizeof(ForceMsg);
+}
+
 /// The loadBuffer function for a force exchange.
 /// Iterate the send list and load the derivative of the embedding
 /// energy with respect to the local density into the send buffer.
+/// Only atoms in the ghost slab of the message are sent, just as in
+/// loadAtomsBuffer.  The atoms of each column of groupSize cells are
+/// sent in the order of their ids, which the receiver reproduces no
+/// matter how it divides the column into cells.
 ///
 /// \see HaloExchangeSt::loadBuffer for an explanation of the loadBuffer
 /// parameters.
@@ -548,13 +1689,18 @@ int loadForceBuffer(void* vparms, void* vdata, int face, char* charBuf)
    
    int nCells = parms->nCells[face];
    int* cellList = parms->sendCells[face];
+   int groupSize = parms->groupSize[face];
+   int next[MAX_FORCE_GROUP];
    int nBuf = 0;
-   for (int iCell=0; iCell<nCells; ++iCell)
+   for (int iCell=0; iCell<nCells; iCell+=groupSize)
    {
-      int iBox = cellList[iCell];
-      int iOff = iBox*MAXATOMS;
-      for (int ii=iOff; ii<iOff+data->boxes->nAtoms[iBox]; ++ii)
+      for (int jj=0; jj<groupSize; ++jj)
+         next[jj] = data->boxes->boxOffset[cellList[iCell+jj]];
+      int ii;
+      while ((ii = nextAtomById(data, cellList+iCell, groupSize, next)) >= 0)
       {
+         if (! inGhostSlab(parms->ghostMin[face], parms->ghostMax[face], data->r[ii]))
+            continue;
          buf[nBuf].dfEmbed = data->dfEmbed[ii];
          ++nBuf;
       }
@@ -577,12 +1723,15 @@ void unloadForceBuffer(void* vparms, void* vdata, int face, int bufSize, char* c
    
    int nCells = parms->nCells[face];
    int* cellList = parms->recvCells[face];
+   int groupSize = parms->groupSize[face];
+   int next[MAX_FORCE_GROUP];
    int iBuf = 0;
-   for (int iCell=0; iCell<nCells; ++iCell)
+   for (int iCell=0; iCell<nCells; iCell+=groupSize)
    {
-      int iBox = cellList[iCell];
-      int iOff = iBox*MAXATOMS;
-      for (int ii=iOff; ii<iOff+data->boxes->nAtoms[iBox]; ++ii)
+      for (int jj=0; jj<groupSize; ++jj)
+         next[jj] = data->boxes->boxOffset[cellList[iCell+jj]];
+      int ii;
+      while ((ii = nextAtomById(data, cellList+iCell, groupSize, next)) >= 0)
       {
          data->dfEmbed[ii] = buf[iBuf].dfEmbed;
          ++iBuf;
@@ -591,11 +1740,31 @@ void unloadForceBuffer(void* vparms, void* vdata, int face, int bufSize, char* c
    assert(iBuf == bufSize/ sizeof(ForceMsg));
 }
 
+/// Step through the atoms of a column of groupSize cells in the order
+/// of their ids.  The atoms of each cell are already in that order
+/// (see sortAtomsInCell), so the cells are merged.  next holds the
+/// offset of the next atom of each cell and starts at the first atom.
+/// \return The offset of the next atom, -1 when the column is done.
+int nextAtomById(ForceExchangeData* data, const int* cells, int groupSize, int* next)
+{
+   int iMin = -1;
+   for (int ii=0; ii<groupSize; ++ii)
+   {
+      if (next[ii] == data->boxes->boxOffset[cells[ii]] + data->boxes->nAtoms[cells[ii]])
+         continue;
+      if (iMin < 0 || data->gid[next[ii]] < data->gid[next[iMin]])
+         iMin = ii;
+   }
+   if (iMin < 0)
+      return -1;
+   return next[iMin]++;
+}
+
 void destroyForceExchange(void* vparms)
 {
    ForceExchangeParms* parms = (ForceExchangeParms*) vparms;
 
-   for (int ii=0; ii<6; ++ii)
+   for (int ii=0; ii<parms->nMsgs; ++ii)
    {
       comdFree(parms->sendCells[ii]);
       comdFree(parms->recvCells[ii]);
@@ -616,7 +1785,7 @@ void sortAtomsInCell(Atoms* atoms, LinkCell* boxes, int iBox)
 
    AtomMsg tmp[nAtoms];
 
-   int begin = iBox*MAXATOMS;
+   int begin = boxes->boxOffset[iBox];
    int end = begin + nAtoms;
    for (int ii=begin, iTmp=0; ii<end; ++ii, ++iTmp)
    {
@@ -644,6 +1813,27 @@ void sortAtomsInCell(Atoms* atoms, LinkCell* boxes, int iBox)
    
 }
 
+/// Find the atom with the specified gid in a link cell that has been
+/// sorted by sortAtomsInCell.
+/// \return The index of the atom within the link cell.
+int findAtomInCell(Atoms* atoms, LinkCell* boxes, int iBox, int gid)
+{
+   const int* cellGid = atoms->gid + boxes->boxOffset[iBox];
+   int lo = 0;
+   int hi = boxes->nAtoms[iBox]-1;
+   while (lo <= hi)
+   {
+      int mid = (lo+hi)/2;
+      if (cellGid[mid] == gid) return mid;
+      if (cellGid[mid] < gid)
+         lo = mid+1;
+      else
+         hi = mid-1;
+   }
+   assert(1==0);
+   return -1;
+}
+
 ///  A function suitable for passing to qsort to sort atoms by gid.
 ///  Because every atom in the simulation is supposed to have a unique
 ///  id, this function checks that the atoms have different gids.  If
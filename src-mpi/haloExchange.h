@@ -4,17 +4,38 @@
 #ifndef __HALO_EXCHANGE_
 #define __HALO_EXCHANGE_
 
+#include <stdio.h>
+
 #include "mytype.h"
 struct AtomsSt;
 struct LinkCellSt;
 struct DomainSt;
+struct SimFlatSt;
+struct CommRequestSt;
+struct NeighborCommSt;
+struct SharedBufferSt;
+
+/// How a halo exchange reaches the 26 neighbor tasks.
+enum HaloMode
+{
+   HALO_AXES,     //!< three phases of two face messages, data forwarded
+   HALO_DIRECT,   //!< one phase of 26 point to point messages
+   HALO_NEIGHBOR  //!< one phase as a neighborhood collective
+};
+
+/// Flag that may be or'ed to HALO_AXES or HALO_DIRECT to read the
+/// data of neighbors on the same node from shared memory.
+#define HALO_SHARED 0x100
+
+/// The largest number of messages of a halo exchange.
+#define HALO_MAX_MSGS 26
 
 /// A polymorphic structure to store information about a halo exchange.
 /// This structure can be thought of as an abstract base class that
 /// specifies the interface and implements the communication patterns of
 /// a halo exchange.  Concrete sub-classes supply actual implementations
-/// of the loadBuffer, unloadBuffer, and destroy functions, that are
-/// specific to the actual data being exchanged.  If the subclass needs
+/// of the sizeBuffer, loadBuffer, unloadBuffer, and destroy functions,
+/// that are specific to the actual data being exchanged.  If the subclass needs
 /// additional data members, these can be stored in a structure that is
 /// pointed to by parms.
 ///
@@ -25,12 +46,79 @@ struct DomainSt;
 /// \see redistributeAtoms
 typedef struct HaloExchangeSt
 {
-   /// The MPI ranks of the six face neighbors of the local domain.
-   /// Ranks are stored in the order specified in HaloFaceOrder.
-   int nbrRank[6];
-   /// The maximum send/recv buffer size (in bytes) that will be needed
-   /// for this halo exchange.
-   int bufCapacity;
+   /// How the messages are sent (one of HaloMode).
+   int mode;
+   /// The number of messages, 6 for HALO_AXES and 26 otherwise.
+   int nMsgs;
+   /// The MPI rank to which each message is sent.  In HALO_AXES mode
+   /// the messages are stored in the order specified in HaloFaceOrder,
+   /// otherwise in the order of msgDirection.
+   int nbrRank[HALO_MAX_MSGS];
+   /// Non-zero if the neighbor of each message is on the same node.
+   int nbrOnNode[HALO_MAX_MSGS];
+   /// Offset of each message in sendBuf, or in the shared window if
+   /// sendHeader[ii][1] is not negative.
+   int msgOffset[HALO_MAX_MSGS];
+   /// Offset in recvBuf of the data received from each neighbor.
+   int recvOffset[HALO_MAX_MSGS];
+   /// Send and receive buffers for the messages of a phase, packed one
+   /// after the other.  They are allocated on the first exchange,
+   /// reused by all later exchanges, and only grow when a phase needs
+   /// more room (see postPhase).
+   char* sendBuf;
+   char* recvBuf;
+   /// Size (in bytes) of sendBuf and recvBuf.
+   int sendCapacity;
+   int recvCapacity;
+   /// Number of bytes sent in each message.
+   int sendLen[HALO_MAX_MSGS];
+   /// Number of bytes received in each message, indexed like sendLen
+   /// (i.e., from the neighbor opposite to the one sent to).
+   int recvLen[HALO_MAX_MSGS];
+   /// Header of each message sent and received, indexed like sendLen
+   /// and recvLen: the length of the data and its offset in the shared
+   /// window of the sender, or -1 if the data follows as a message of
+   /// its own.  The headers go ahead of the data so that the receiver
+   /// can make room for it (see postPhase).
+   int sendHeader[HALO_MAX_MSGS][2];
+   int recvHeader[HALO_MAX_MSGS][2];
+   /// State of a split phase exchange (see postHaloExchange).  The
+   /// phase whose messages are in flight, or -1 if none.
+   int splitPhase;
+   /// Non-zero while only the headers of splitPhase are in flight.
+   int splitHeaders;
+   /// The data argument of the split phase exchange in flight.
+   void* splitData;
+   /// Non-zero if progressHaloExchange could not make room for the
+   /// phase that has arrived.  completeHaloExchange unloads it.
+   int deferred;
+   /// Requests of the point to point messages.
+   struct CommRequestSt* request[HALO_MAX_MSGS];
+   /// Graph communicator for HALO_NEIGHBOR mode (NULL otherwise).
+   struct NeighborCommSt* nbrComm;
+   /// Non-zero if the mode included HALO_SHARED.
+   int shared;
+   /// Shared window of two copies of bufSize bytes, used by
+   /// alternate exchanges (NULL unless shared).  See postPhase.
+   struct SharedBufferSt* shm;
+   /// Size (in bytes) of one copy of the window.
+   int bufSize;
+   /// The copy used by the exchange in flight.
+   char* shmBuf;
+   /// Number of bytes of shmBuf loaded so far by the exchange in flight.
+   int shmUsed;
+   /// Number of exchanges started so far.
+   int nExchanges;
+   /// The window of neighbor ii if it is on the same node, else NULL.
+   char* nbrShm[HALO_MAX_MSGS];
+   /// Pointer to a sub-class specific function that bounds the size of
+   /// a message before it is loaded.
+   /// \param [in] parms The parms member of the structure.
+   /// \param [in] data  Same as for loadBuffer.
+   /// \param [in] face  Specifies the message.
+   /// \return The largest number of bytes that loadBuffer may load
+   ///         into the send buffer of the message.
+   int  (*sizeBuffer)(void* parms, void* data, int face);
    /// Pointer to a sub-class specific function to load the send buffer.
    /// \param [in] parms The parms member of the structure.  This is a
    ///                   pointer to a sub-class specific structure that can
@@ -41,7 +129,8 @@ typedef struct HaloExchangeSt
    ///                   loadBuffer function will cast the pointer to a
    ///                   concrete type that is appropriate for the data
    ///                   being exchanged.
-   /// \param [in] face  Specifies the face across which data is being sent.
+   /// \param [in] face  Specifies the message (the face or direction
+   ///                   across which data is being sent).
    /// \param [in] buf   The send buffer to be loaded
    /// \return The number of bytes loaded into the send buffer.
    int  (*loadBuffer)(void* parms, void* data, int face, char* buf);
@@ -55,10 +144,26 @@ typedef struct HaloExchangeSt
    ///                   unloadBuffer function will cast the pointer to a
    ///                   concrete type that is appropriate for the data
    ///                   being exchanged.
-   /// \param [in] face  Specifies the face across which data is being sent.
+   /// \param [in] face  Specifies the message (the face or direction
+   ///                   across which data is being received).
    /// \param [in] bufSize The number of bytes in the recv buffer.
    /// \param [in] buf   The recv buffer to be unloaded.
    void (*unloadBuffer)(void* parms, void* data, int face, int bufSize, char* buf);
+   /// Pointer to an optional sub-class specific function that makes
+   /// room for the data received in the messages of a phase before any
+   /// of them is unloaded.  May be NULL.
+   /// \param [in] parms   The parms member of the structure.
+   /// \param [out] data   Same as for unloadBuffer.
+   /// \param [in] begin   The first message of the phase.
+   /// \param [in] end     One past the last message of the phase.
+   /// \param [in] bufSize The number of bytes in the recv buffer of
+   ///                     each message (indexed by message).
+   /// \param [in] buf     The recv buffer of each message.
+   /// \param [in] mayGrow If zero, storage that the caller may be
+   ///                     using must not be reallocated.
+   /// \return 0 if there is not enough room and mayGrow is zero.
+   int (*reserveBuffers)(void* parms, void* data, int begin, int end,
+                         const int* bufSize, char** buf, int mayGrow);
    /// Pointer to a function to deallocate any memory used by the
    /// sub-class parms.  Essentially this is a virtual destructor.
    void (*destroy)(void* parms);
@@ -68,11 +173,35 @@ typedef struct HaloExchangeSt
 } 
 HaloExchange;
 
+/// Return a HaloMode or -1 if the name is not known.
+int parseHaloMode(const char* name);
+
+/// Return the name of a HaloMode.
+const char* haloModeName(int mode);
+
+/// Return non-zero if the mode (possibly with HALO_SHARED) can be used
+/// in this build.
+int haloModeAvailable(int mode);
+
 /// Create a HaloExchange for atom data.
-HaloExchange* initAtomHaloExchange(struct DomainSt* domain, struct LinkCellSt* boxes);
+HaloExchange* initAtomHaloExchange(struct DomainSt* domain, struct LinkCellSt* boxes,
+                                   int mode, int filterGhosts);
 
 /// Create a HaloExchange for force data.
-HaloExchange* initForceHaloExchange(struct DomainSt* domain, struct LinkCellSt* boxes);
+HaloExchange* initForceHaloExchange(struct DomainSt* domain, struct LinkCellSt* boxes,
+                                    int mode, int filterGhosts);
+
+/// Create a HaloExchange that moves atoms that left the local domain.
+HaloExchange* initMigrationHaloExchange(struct DomainSt* domain, struct LinkCellSt* boxes, int mode);
+
+/// Create a HaloExchange for ghost atoms with a fixed storage order.
+HaloExchange* initGhostHaloExchange(struct DomainSt* domain, struct LinkCellSt* boxes, int mode);
+
+/// Replace all ghost atoms and record their storage order.
+void exchangeGhostAtoms(HaloExchange* ghostExchange, struct SimFlatSt* s);
+
+/// Refresh the positions of the ghost atoms recorded by exchangeGhostAtoms.
+void updateGhostPositions(HaloExchange* ghostExchange, struct SimFlatSt* s);
 
 /// HaloExchange destructor.
 void destroyHaloExchange(HaloExchange** haloExchange);
@@ -80,6 +209,27 @@ void destroyHaloExchange(HaloExchange** haloExchange);
 /// Execute a halo exchange.
 void haloExchange(HaloExchange* haloExchange, void* data);
 
+/// Number of planes of local link cells next to the domain surface that
+/// an atom exchange can change.  \see postHaloExchange
+#define ATOM_EXCHANGE_DEPTH 1
+
+/// Start a split phase halo exchange.
+void postHaloExchange(HaloExchange* haloExchange, void* data);
+
+/// Advance a split phase halo exchange without blocking.  Returns
+/// non-zero once the exchange is complete.
+int progressHaloExchange(HaloExchange* haloExchange);
+
+/// Wait for a split phase halo exchange to complete.
+void completeHaloExchange(HaloExchange* haloExchange);
+
+/// Return non-zero while a split phase halo exchange is in flight.
+int haloExchangeInFlight(HaloExchange* haloExchange);
+
+/// Print the number of bytes all halo exchanges have sent to tasks on
+/// the same node and on other nodes.  Collective over all tasks.
+void printHaloBytes(FILE* file);
+
 /// Sort the atoms by gid in the specified link cell.
 void sortAtomsInCell(struct AtomsSt* atoms, struct LinkCellSt* boxes, int iBox);
 
@@ -19,33 +19,23 @@ static void computeVcm(SimFlat* s, real_t vcm[3]);
 
 /// \details
 /// Call functions such as createFccLattice and setTemperature to set up
-/// initial atom positions and momenta.
-Atoms* initAtoms(LinkCell* boxes)
+/// initial atom positions and momenta.  The arrays start out empty and
+/// grow as atoms are put into the link cells (see putAtomInBox).
+Atoms* initAtoms(void)
 {
    Atoms* atoms = comdMalloc(sizeof(Atoms));
 
-   int maxTotalAtoms = MAXATOMS*boxes->nTotalBoxes;
-
-   atoms->gid =      (int*)   comdMalloc(maxTotalAtoms*sizeof(int));
-   atoms->iSpecies = (int*)   comdMalloc(maxTotalAtoms*sizeof(int));
-   atoms->r =        (real3*) comdMalloc(maxTotalAtoms*sizeof(real3));
-   atoms->p =        (real3*) comdMalloc(maxTotalAtoms*sizeof(real3));
-   atoms->f =        (real3*) comdMalloc(maxTotalAtoms*sizeof(real3));
-   atoms->U =        (real_t*)comdMalloc(maxTotalAtoms*sizeof(real_t));
+   atoms->capacity = 0;
+   atoms->gid =      NULL;
+   atoms->iSpecies = NULL;
+   atoms->r =        NULL;
+   atoms->p =        NULL;
+   atoms->f =        NULL;
+   atoms->U =        NULL;
 
    atoms->nLocal = 0;
    atoms->nGlobal = 0;
 
-   for (int iOff = 0; iOff < maxTotalAtoms; iOff++)
-   {
-      atoms->gid[iOff] = 0;
-      atoms->iSpecies[iOff] = 0;
-      zeroReal3(atoms->r[iOff]);
-      zeroReal3(atoms->p[iOff]);
-      zeroReal3(atoms->f[iOff]);
-      atoms->U[iOff] = 0.;
-   }
-
    return atoms;
 }
 
@@ -122,7 +112,7 @@ void setVcm(SimFlat* s, real_t newVcm[3])
 
    for (int iBox=0; iBox<s->boxes->nLocalBoxes; ++iBox)
    {
-      for (int iOff=MAXATOMS*iBox, ii=0; ii<s->boxes->nAtoms[iBox]; ++ii, ++iOff)
+      for (int iOff=s->boxes->boxOffset[iBox], ii=0; ii<s->boxes->nAtoms[iBox]; ++ii, ++iOff)
       {
          int iSpecies = s->atoms->iSpecies[iOff];
          real_t mass = s->species[iSpecies].mass;
@@ -149,7 +139,7 @@ void setTemperature(SimFlat* s, real_t temperature)
    // set initial velocities for the distribution
    for (int iBox=0; iBox<s->boxes->nLocalBoxes; ++iBox)
    {
-      for (int iOff=MAXATOMS*iBox, ii=0; ii<s->boxes->nAtoms[iBox]; ++ii, ++iOff)
+      for (int iOff=s->boxes->boxOffset[iBox], ii=0; ii<s->boxes->nAtoms[iBox]; ++ii, ++iOff)
       {
          int iType = s->atoms->iSpecies[iOff];
          real_t mass = s->species[iType].mass;
@@ -171,7 +161,7 @@ void setTemperature(SimFlat* s, real_t temperature)
    real_t scaleFactor = sqrt(temperature/temp);
    for (int iBox=0; iBox<s->boxes->nLocalBoxes; ++iBox)
    {
-      for (int iOff=MAXATOMS*iBox, ii=0; ii<s->boxes->nAtoms[iBox]; ++ii, ++iOff)
+      for (int iOff=s->boxes->boxOffset[iBox], ii=0; ii<s->boxes->nAtoms[iBox]; ++ii, ++iOff)
       {
          s->atoms->p[iOff][0] *= scaleFactor;
          s->atoms->p[iOff][1] *= scaleFactor;
@@ -190,7 +180,7 @@ void randomDisplacements(SimFlat* s, real_t delta)
 {
    for (int iBox=0; iBox<s->boxes->nLocalBoxes; ++iBox)
    {
-      for (int iOff=MAXATOMS*iBox, ii=0; ii<s->boxes->nAtoms[iBox]; ++ii, ++iOff)
+      for (int iOff=s->boxes->boxOffset[iBox], ii=0; ii<s->boxes->nAtoms[iBox]; ++ii, ++iOff)
       {
          uint64_t seed = mkSeed(s->atoms->gid[iOff], 457);
          s->atoms->r[iOff][0] += (2.0*lcg61(&seed)-1.0) * delta;
@@ -209,7 +199,7 @@ void computeVcm(SimFlat* s, real_t vcm[3])
    // sum the momenta and particle masses 
    for (int iBox=0; iBox<s->boxes->nLocalBoxes; ++iBox)
    {
-      for (int iOff=MAXATOMS*iBox, ii=0; ii<s->boxes->nAtoms[iBox]; ++ii, ++iOff)
+      for (int iOff=s->boxes->boxOffset[iBox], ii=0; ii<s->boxes->nAtoms[iBox]; ++ii, ++iOff)
       {
          vcmLocal[0] += s->atoms->p[iOff][0];
          vcmLocal[1] += s->atoms->p[iOff][1];
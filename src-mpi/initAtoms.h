@@ -7,7 +7,6 @@
 #include "mytype.h"
 
 struct SimFlatSt;
-struct LinkCellSt;
 
 /// Atom data
 typedef struct AtomsSt
@@ -15,6 +14,7 @@ typedef struct AtomsSt
    // atom-specific data
    int nLocal;    //!< total number of atoms on this processor
    int nGlobal;   //!< total number of atoms in simulation
+   int capacity;  //!< length of the arrays (see LinkCellSt::boxOffset)
 
    int* gid;      //!< A globally unique id for each atom
    int* iSpecies; //!< the species index of the atom
@@ -26,8 +26,8 @@ typedef struct AtomsSt
 } Atoms;
 
 
-/// Allocates memory to store atom data.
-Atoms* initAtoms(struct LinkCellSt* boxes);
+/// Creates an empty atom store.
+Atoms* initAtoms(void);
 void destroyAtoms(struct AtomsSt* atoms);
 
 void createFccLattice(int nx, int ny, int nz, real_t lat, struct SimFlatSt* s);
@@ -19,6 +19,15 @@
 /// keep a strict separation between the link cells that are entirely
 /// inside the local domain and those that represent halo regions.
 ///
+/// The 27 cells around an atom hold a volume of at least 27 cutoff^3,
+/// against 4.19 cutoff^3 for the sphere the atom interacts with, so
+/// most of the distances computed exceed the cutoff.  With
+/// cellsPerCutoff n > 1 the boxes are only cutoff/n long.  The stencil
+/// then reaches n boxes in each direction, and boxes whose closest
+/// points are farther apart than the cutoff are left out of it, which
+/// brings the searched volume closer to the sphere.  The halo must be
+/// n boxes deep to hold the same atoms as one box of cutoff size.
+///
 /// The number of local link cells in each direction is stored in
 /// gridSize.  Local link cells have 3D grid coordinates (ix, iy, iz)
 /// where ix, iy, and iz can range from 0 to gridSize[iAxis]-1,
@@ -26,42 +35,74 @@
 /// number of local link cells is thus nLocalBoxes =
 /// gridSize[0]*gridSize[1]*gridSize[2].
 ///
-/// The local link cells are surrounded by one complete shell of halo
-/// link cells.  The halo cells provide temporary storage for halo or
-/// "ghost" atoms that belong to other tasks, but whose coordinates are
-/// needed locally to complete the force calculation.  Halo link cells
-/// have at least one coordinate with a value of either -1 or
-/// gridSize[iAxis].
+/// The local link cells are surrounded by nHaloLayers complete shells
+/// of halo link cells (usually one).  The halo cells provide temporary
+/// storage for halo or "ghost" atoms that belong to other tasks, but
+/// whose coordinates are needed locally to complete the force
+/// calculation.  Halo link cells have at least one coordinate that is
+/// negative or not less than gridSize[iAxis].  The valid coordinate
+/// range is -nHaloLayers to gridSize[iAxis]+nHaloLayers-1.
 ///
 /// Because CoMD stores data in ordinary 1D C arrays, a mapping is
-/// needed from the 3D grid coords to a 1D array index.  For the local
-/// cells we use the conventional mapping ix + iy*nx + iz*nx*ny.  This
-/// keeps all of the local cells in a contiguous region of memory
+/// needed from the 3D grid coords to a 1D array index.  By default the
+/// local cells use the conventional mapping ix + iy*nx + iz*nx*ny.
+/// This keeps all of the local cells in a contiguous region of memory
 /// starting from the beginning of any relevant array and makes it easy
 /// to iterate the local cells in a single loop.  Halo cells are mapped
-/// differently.  After the local cells, the two planes of link cells
-/// that are face neighbors with local cells across the -x or +x axis
-/// are next.  These are followed by face neighbors across the -y and +y
+/// differently.  After the local cells, the planes of link cells that
+/// are face neighbors with local cells across the -x or +x axis are
+/// next.  These are followed by face neighbors across the -y and +y
 /// axis (including cells that are y-face neighbors with an x-plane of
 /// halo cells), followed by all remaining cells in the -z and +z planes
 /// of halo cells.  The total number of link cells (on each rank) is
-/// nTotalBoxes.
+/// nTotalBoxes.  Both mappings are tabulated when the link cells are
+/// created (boxIndex and boxTuple).
+///
+/// With x fastest, the 27 cells around a cell lie in nine runs that are
+/// a whole plane of cells apart.  On a large domain these runs fall on
+/// different pages and evict each other from the cache.  The cells of
+/// each region (the local cells and each halo slab) can instead be
+/// stored along a Morton or Hilbert curve (boxOrder).  Cells that are
+/// close on such a curve are close in space, so the neighborhoods of
+/// consecutive cells share most of their memory.  Every loop over the
+/// cells visits them in storage order and so follows the curve as
+/// well.
+///
+/// The atoms of a link cell are stored one after the other in the atom
+/// arrays, starting at index boxOffset[iBox], and the number of atoms in
+/// link cell iBox is nAtoms[iBox].  Each link cell has room for
+/// boxCapacity[iBox] atoms, which is a little more than it held when
+/// updateLinkCells last laid out the cells (or, for halo cells, than
+/// the last halo exchange brought).  The slots of all local cells come
+/// before those of the halo cells (haloBegin), so that the storage
+/// index alone tells a local from a halo atom.  A cell that fills up is
+/// moved to the free slots after the last cell of its region, and the
+/// atom arrays grow when those run out (see reserveAtoms).  The arrays
+/// thus hold little more than the atoms that are present, instead of
+/// a fixed number of slots for every cell, most of which would be
+/// empty.  Arrays that are indexed like the atom arrays must hold
+/// atoms->capacity items.
 ///
-/// Data storage arrays that are used in association with link cells
-/// should be allocated to store nTotalBoxes*MAXATOMS items.  Data for
-/// the first atom in linkCell iBox is stored at index iBox*MAXATOMS.
-/// Data for subsequent atoms in the same link cell are stored
-/// sequentially, and the number of atoms in link cell iBox is
-/// nAtoms[iBox].
+/// Besides the two mappings, each box knows its position in the index
+/// grid (boxCell), i.e., the halo padded grid with another
+/// cellsPerCutoff layers of cells around it that hold -1.  The
+/// neighbors of a box are found at fixed offsets (strides) from that
+/// position, so no grid coordinates are computed in the force loops,
+/// and offsets that leave the halo find -1 instead of needing bounds
+/// checks.  boxDepth tells how deep inside the local domain a box is
+/// (isInnerBox).
 ///
 /// \see getBoxFromTuple is the 3D->1D mapping for link cell indices.
-/// \see getTuple is the 1D->3D mapping
+/// \see boxTuple is the 1D->3D mapping
 ///
 /// \param [in] cutoff The cutoff distance of the potential.
+/// \param [in] nHaloLayers The number of layers of halo cells.
 
 #include "linkCells.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <assert.h>
 #include <math.h>
@@ -75,38 +116,64 @@
 #define   MIN(A,B) ((A) < (B) ? (A) : (B))
 #define   MAX(A,B) ((A) > (B) ? (A) : (B))
 
-static void copyAtom(LinkCell* boxes, Atoms* atoms, int iAtom, int iBox, int jAtom, int jBox);
-static int getBoxFromCoord(LinkCell* boxes, real_t rr[3]);
-static void emptyHaloCells(LinkCell* boxes);
-static void getTuple(LinkCell* boxes, int iBox, int* ixp, int* iyp, int* izp);
-
-LinkCell* initLinkCells(const Domain* domain, real_t cutoff)
+static int headroom(int nAtoms);
+static int makeRoom(LinkCell* boxes, Atoms* atoms, int nLocalSlots, int nHaloSlots, int mayGrow);
+static void shiftHaloBoxes(LinkCell* boxes, Atoms* atoms, int shift);
+static void moveBox(LinkCell* boxes, Atoms* atoms, int iBox, int capacity);
+static void copyAtoms(Atoms* to, int jOff, const Atoms* from, int iOff, int n);
+static void mkBoxTables(LinkCell* boxes);
+static real_t boxGap2(LinkCell* boxes, int dx, int dy, int dz);
+static uint64_t curveKey(int boxOrder, int nBits, int ix, int iy, int iz);
+static int compareCurveCells(const void* a, const void* b);
+static int halfShellBoxes(LinkCell* boxes, int iBox, int* nbrBoxes, int haloPairs);
+
+LinkCell* initLinkCells(const Domain* domain, real_t cutoff,
+                        int cellsPerCutoff, int nHaloLayers, int boxOrder)
 {
    assert(domain);
+   assert(cellsPerCutoff >= 1 && cellsPerCutoff <= MAX_CELLS_PER_CUTOFF);
    LinkCell* ll = comdMalloc(sizeof(LinkCell));
 
+   real_t minBoxSize = cutoff / cellsPerCutoff;
    for (int i = 0; i < 3; i++)
    {
       ll->localMin[i] = domain->localMin[i];
       ll->localMax[i] = domain->localMax[i];
-      ll->gridSize[i] = domain->localExtent[i] / cutoff; // local number of boxes
+      ll->gridSize[i] = domain->localExtent[i] / minBoxSize; // local number of boxes
       ll->boxSize[i] = domain->localExtent[i] / ((real_t) ll->gridSize[i]);
       ll->invBoxSize[i] = 1.0/ll->boxSize[i];
    }
 
+   ll->nHaloLayers = nHaloLayers;
+   ll->cellsPerCutoff = cellsPerCutoff;
+   ll->boxOrder = boxOrder;
+   ll->cutoff = cutoff;
    ll->nLocalBoxes = ll->gridSize[0] * ll->gridSize[1] * ll->gridSize[2];
-   
-   ll->nHaloBoxes = 2 * ((ll->gridSize[0] + 2) *
-                         (ll->gridSize[1] + ll->gridSize[2] + 2) +
-                         (ll->gridSize[1] * ll->gridSize[2]));
+
+   int nPadded = 1;
+   for (int i = 0; i < 3; i++)
+      nPadded *= ll->gridSize[i] + 2*nHaloLayers;
+   ll->nHaloBoxes = nPadded - ll->nLocalBoxes;
 
    ll->nTotalBoxes = ll->nLocalBoxes + ll->nHaloBoxes;
    
-   ll->nAtoms = comdMalloc(ll->nTotalBoxes*sizeof(int));
-   for (int iBox=0; iBox<ll->nTotalBoxes; ++iBox)
-      ll->nAtoms[iBox] = 0;
-
+   // The boxes get their slots as the atoms arrive.
+   ll->nAtoms = comdCalloc(ll->nTotalBoxes, sizeof(int));
+   ll->boxOffset = comdCalloc(ll->nTotalBoxes, sizeof(int));
+   ll->boxCapacity = comdCalloc(ll->nTotalBoxes, sizeof(int));
+   ll->localEnd = 0;
+   ll->haloBegin = 0;
+   ll->haloEnd = 0;
+   ll->spare = initAtoms();
+
+   // Halo cells are filled from the outermost local cells of the
+   // neighboring tasks, so every task needs nHaloLayers local cells.
    assert ( (ll->gridSize[0] >= 2) && (ll->gridSize[1] >= 2) && (ll->gridSize[2] >= 2) );
+   assert ( (ll->gridSize[0] >= nHaloLayers) &&
+            (ll->gridSize[1] >= nHaloLayers) &&
+            (ll->gridSize[2] >= nHaloLayers) );
+
+   mkBoxTables(ll);
    return ll;
 }
 
@@ -116,6 +183,13 @@ void destroyLinkCells(LinkCell** boxes)
    if (! *boxes) return;
 
    comdFree((*boxes)->nAtoms);
+   comdFree((*boxes)->boxOffset);
+   comdFree((*boxes)->boxCapacity);
+   comdFree((*boxes)->boxIndex);
+   comdFree((*boxes)->boxTuple);
+   comdFree((*boxes)->boxCell);
+   comdFree((*boxes)->boxDepth);
+   destroyAtoms((*boxes)->spare);
    comdFree(*boxes);
    *boxes = NULL;
 
@@ -123,28 +197,90 @@ void destroyLinkCells(LinkCell** boxes)
 }
 
 /// \details
-/// Populates the nbrBoxes array with the 27 boxes that are adjacent to
-/// iBox.  The count is 27 instead of 26 because iBox is included in the
-/// list (as neighbor 13).  Caller is responsible to alloc and free
-/// nbrBoxes.
-/// \return The number of nbr boxes (always 27 in this implementation).
+/// Populates the nbrBoxes array with the boxes that may hold atoms
+/// within the cutoff of an atom in iBox.  With one box per cutoff these
+/// are the 27 boxes that are adjacent to iBox.  The count is 27 instead
+/// of 26 because iBox is included in the list (as neighbor 13).  Only
+/// boxes that exist are listed, which for local boxes are all of them.
+/// Caller is responsible to alloc and free nbrBoxes, which must hold
+/// MAX_NBR_BOXES entries.
+/// \return The number of nbr boxes (27 for a local box with one box
+/// per cutoff).
 int getNeighborBoxes(LinkCell* boxes, int iBox, int* nbrBoxes)
 {
-   int ix, iy, iz;
-   getTuple(boxes, iBox, &ix, &iy, &iz);
-   
+   const int* boxIndex = boxes->boxIndex + boxes->boxCell[iBox];
    int count = 0;
-   for (int i=ix-1; i<=ix+1; i++)
-      for (int j=iy-1; j<=iy+1; j++)
-         for (int k=iz-1; k<=iz+1; k++)
-            nbrBoxes[count++] = getBoxFromTuple(boxes,i,j,k);
+   for (int ii=0; ii<boxes->nNbrBoxes; ++ii)
+   {
+      int jBox = boxIndex[boxes->nbrStride[ii]];
+      if (jBox >= 0)
+         nbrBoxes[count++] = jBox;
+   }
    
    return count;
 }
 
+/// \details
+/// Populates the nbrBoxes array with the half-shell stencil of iBox:
+/// the cells that must be paired with iBox so that every pair of atoms
+/// in adjacent cells is visited exactly once, provided the stencil is
+/// applied to all cells, local and halo.  iBox itself is the first
+/// entry if it is a local cell.  It is followed by those of its forward
+/// neighbors (13 with one box per cutoff) that lie in the halo-padded
+/// grid and for which at least one of the two cells is local.  Pairs of
+/// halo cells never contribute to local forces or energy and are
+/// omitted.
+///
+/// The caller must pair atoms within iBox only once (e.g., ij > ii)
+/// and all atoms of iBox with all atoms of the other cells.  A pair
+/// counts fully toward the local energy if both cells are local and
+/// half otherwise.
+///
+/// Caller is responsible to alloc and free nbrBoxes, which must hold
+/// MAX_HALF_SHELL_BOXES entries.
+/// \return The number of cells in the stencil of iBox (0 to 14 with
+/// one box per cutoff).
+int getHalfShellBoxes(LinkCell* boxes, int iBox, int* nbrBoxes)
+{
+   return halfShellBoxes(boxes, iBox, nbrBoxes, 0);
+}
+
+/// \details
+/// Same as getHalfShellBoxes, except that pairs of halo cells are
+/// included.  Needed by algorithms that compute properties of halo
+/// atoms redundantly (such as the ghost density EAM).  iBox is always
+/// the first entry.
+int getHalfShellBoxesWithHalo(LinkCell* boxes, int iBox, int* nbrBoxes)
+{
+   return halfShellBoxes(boxes, iBox, nbrBoxes, 1);
+}
+
+int halfShellBoxes(LinkCell* boxes, int iBox, int* nbrBoxes, int haloPairs)
+{
+   int iLocal = (iBox < boxes->nLocalBoxes);
+   const int* boxIndex = boxes->boxIndex + boxes->boxCell[iBox];
+
+   int count = 0;
+   if (iLocal || haloPairs)
+      nbrBoxes[count++] = iBox;
+   for (int ii=0; ii<boxes->nHalfShell; ++ii)
+   {
+      int jBox = boxIndex[boxes->halfShellStride[ii]];
+      if (jBox < 0)
+         continue;
+      if (! haloPairs && ! iLocal && jBox >= boxes->nLocalBoxes)
+         continue;
+      nbrBoxes[count++] = jBox;
+   }
+
+   return count;
+}
+
 /// \details
 /// Finds the appropriate link cell for an atom based on the spatial
-/// coordinates and stores data in that link cell.
+/// coordinates and stores data in that link cell.  A full link cell is
+/// moved to a place with twice the room first.  The force and energy of
+/// the atom are zero.
 /// \param [in] gid   The global of the atom.
 /// \param [in] iType The species index of the atom.
 /// \param [in] x     The x-coordinate of the atom.
@@ -153,17 +289,24 @@ int getNeighborBoxes(LinkCell* boxes, int iBox, int* nbrBoxes)
 /// \param [in] px    The x-component of the atom's momentum.
 /// \param [in] py    The y-component of the atom's momentum.
 /// \param [in] pz    The z-component of the atom's momentum.
-void putAtomInBox(LinkCell* boxes, Atoms* atoms,
-                  const int gid, const int iType,
-                  const real_t x,  const real_t y,  const real_t z,
-                  const real_t px, const real_t py, const real_t pz)
+/// \return The storage index of the atom.
+int putAtomInBox(LinkCell* boxes, Atoms* atoms,
+                 const int gid, const int iType,
+                 const real_t x,  const real_t y,  const real_t z,
+                 const real_t px, const real_t py, const real_t pz)
 {
    real_t xyz[3] = {x,y,z};
    
    // Find correct box.
    int iBox = getBoxFromCoord(boxes, xyz);
-   int iOff = iBox*MAXATOMS;
-   iOff += boxes->nAtoms[iBox];
+   if (boxes->nAtoms[iBox] == boxes->boxCapacity[iBox])
+   {
+      int capacity = 2*boxes->boxCapacity[iBox] + 1;
+      int local = (iBox < boxes->nLocalBoxes);
+      makeRoom(boxes, atoms, local ? capacity : 0, local ? 0 : capacity, 1);
+      moveBox(boxes, atoms, iBox, capacity);
+   }
+   int iOff = boxes->boxOffset[iBox] + boxes->nAtoms[iBox];
    
    // assign values to array elements
    if (iBox < boxes->nLocalBoxes)
@@ -179,83 +322,64 @@ void putAtomInBox(LinkCell* boxes, Atoms* atoms,
    atoms->p[iOff][0] = px;
    atoms->p[iOff][1] = py;
    atoms->p[iOff][2] = pz;
+
+   // The slot may be new, and a force loop may be under way.
+   zeroReal3(atoms->f[iOff]);
+   atoms->U[iOff] = 0.;
+
+   return iOff;
 }
 
-/// Calculates the link cell index from the grid coords.  The valid
-/// coordinate range in direction ii is [-1, gridSize[ii]].  Any
-/// coordinate that involves a -1 or gridSize[ii] is a halo link cell.
-/// Because of the order in which the local and halo link cells are
-/// stored the indices of the halo cells are special cases.
-/// \see initLinkCells for an explanation of storage order.
-int getBoxFromTuple(LinkCell* boxes, int ix, int iy, int iz)
+/// \details
+/// Makes sure that every box iBox has room for nMore[iBox] atoms in
+/// addition to the ones it holds.  Boxes that are too small are moved
+/// to the end of their region with some headroom.  A halo exchange
+/// calls this before it puts the received atoms in the boxes, since it
+/// may run while a force loop works on the inner boxes (see
+/// progressHaloExchange).  Moving other boxes does not disturb such a
+/// loop, but reallocating the atom arrays would.  Unless mayGrow is
+/// set, nothing is changed if the arrays are too small.
+/// \return 0 if the arrays would have to grow but mayGrow is not set.
+int reserveAtoms(LinkCell* boxes, Atoms* atoms, const int* nMore, int mayGrow)
 {
-   int iBox = 0;
-   const int* gridSize = boxes->gridSize; // alias
-   
-   // Halo in Z+
-   if (iz == gridSize[2])
-   {
-      iBox = boxes->nLocalBoxes + 2*gridSize[2]*gridSize[1] + 2*gridSize[2]*(gridSize[0]+2) +
-         (gridSize[0]+2)*(gridSize[1]+2) + (gridSize[0]+2)*(iy+1) + (ix+1);
-   }
-   // Halo in Z-
-   else if (iz == -1)
-   {
-      iBox = boxes->nLocalBoxes + 2*gridSize[2]*gridSize[1] + 2*gridSize[2]*(gridSize[0]+2) +
-         (gridSize[0]+2)*(iy+1) + (ix+1);
-   }
-   // Halo in Y+
-   else if (iy == gridSize[1])
-   {
-      iBox = boxes->nLocalBoxes + 2*gridSize[2]*gridSize[1] + gridSize[2]*(gridSize[0]+2) +
-         (gridSize[0]+2)*iz + (ix+1);
-   }
-   // Halo in Y-
-   else if (iy == -1)
-   {
-      iBox = boxes->nLocalBoxes + 2*gridSize[2]*gridSize[1] + iz*(gridSize[0]+2) + (ix+1);
-   }
-   // Halo in X+
-   else if (ix == gridSize[0])
-   {
-      iBox = boxes->nLocalBoxes + gridSize[1]*gridSize[2] + iz*gridSize[1] + iy;
-   }
-   // Halo in X-
-   else if (ix == -1)
+   int nSlots[2] = {0, 0};
+   for (int iBox=0; iBox<boxes->nTotalBoxes; ++iBox)
    {
-      iBox = boxes->nLocalBoxes + iz*gridSize[1] + iy;
+      int nAtoms = boxes->nAtoms[iBox] + nMore[iBox];
+      if (nAtoms > boxes->boxCapacity[iBox])
+         nSlots[iBox >= boxes->nLocalBoxes] += nAtoms + headroom(nAtoms);
    }
-   // local link celll.
-   else
+   if (nSlots[0] + nSlots[1] == 0)
+      return 1;
+   if (! makeRoom(boxes, atoms, nSlots[0], nSlots[1], mayGrow))
+      return 0;
+
+   for (int iBox=0; iBox<boxes->nTotalBoxes; ++iBox)
    {
-      iBox = ix + gridSize[0]*iy + gridSize[0]*gridSize[1]*iz;
+      int nAtoms = boxes->nAtoms[iBox] + nMore[iBox];
+      if (nAtoms > boxes->boxCapacity[iBox])
+         moveBox(boxes, atoms, iBox, nAtoms + headroom(nAtoms));
    }
-   assert(iBox >= 0);
-   assert(iBox < boxes->nTotalBoxes);
-
-   return iBox;
+   return 1;
 }
 
-/// Move an atom from one link cell to another.
-/// \param iId [in]  The index with box iBox of the atom to be moved.
-/// \param iBox [in] The index of the link cell the particle is moving from.
-/// \param jBox [in] The index of the link cell the particle is moving to.
-void moveAtom(LinkCell* boxes, Atoms* atoms, int iId, int iBox, int jBox)
+/// Calculates the link cell index from the grid coords.  The valid
+/// coordinate range in direction ii is [-nHaloLayers,
+/// gridSize[ii]+nHaloLayers-1].  Any coordinate outside [0,
+/// gridSize[ii]-1] belongs to a halo link cell.
+/// \see initLinkCells for an explanation of storage order.
+int getBoxFromTuple(LinkCell* boxes, int ix, int iy, int iz)
 {
-   int nj = boxes->nAtoms[jBox];
-   copyAtom(boxes, atoms, iId, iBox, nj, jBox);
-   boxes->nAtoms[jBox]++;
-
-   assert(boxes->nAtoms[jBox] < MAXATOMS);
-
-   boxes->nAtoms[iBox]--;
-   int ni = boxes->nAtoms[iBox];
-   if (ni) copyAtom(boxes, atoms, ni, iBox, iId, iBox);
-
-   if (jBox > boxes->nLocalBoxes)
-      --atoms->nLocal;
-   
-   return;
+   const int* gridSize = boxes->gridSize; // alias
+   int nHalo = boxes->nHaloLayers;
+   assert(ix >= -nHalo && ix < gridSize[0]+nHalo);
+   assert(iy >= -nHalo && iy < gridSize[1]+nHalo);
+   assert(iz >= -nHalo && iz < gridSize[2]+nHalo);
+
+   int pad = nHalo + boxes->cellsPerCutoff;
+   int nx = gridSize[0] + 2*pad;
+   int ny = gridSize[1] + 2*pad;
+   return boxes->boxIndex[(ix+pad) + nx*((iy+pad) + ny*(iz+pad))];
 }
 
 /// \details
@@ -270,24 +394,97 @@ void moveAtom(LinkCell* boxes, Atoms* atoms, int iId, int iBox, int jBox)
 /// cells at the end of this routine have just transitioned from local
 /// to halo atoms.  Such atom must be sent to other tasks by a halo
 /// exchange to avoid being lost.
+///
+/// The atoms are sorted by their new link cells (a counting sort) into
+/// the spare atom arrays of the link cells, which lays out all cells
+/// anew.  Each cell gets room for the atoms it holds plus some headroom.
+/// Halo cells are sized for the number of atoms they held before, which
+/// the next halo exchange will bring again, give or take a few.  Cells
+/// that have overflowed since the last call thus get compact storage
+/// again.  The spare and the current arrays are then swapped.  The spare
+/// arrays are only reallocated when they are too small, so the sort
+/// does not allocate memory every time step.
 /// \see redistributeAtoms
 void updateLinkCells(LinkCell* boxes, Atoms* atoms)
 {
-   emptyHaloCells(boxes);
-   
-   for (int iBox=0; iBox<boxes->nLocalBoxes; ++iBox)
+   int nLocalBoxes = boxes->nLocalBoxes;
+   int nTotalBoxes = boxes->nTotalBoxes;
+   int* oldOffset = comdMalloc(nTotalBoxes*sizeof(int));
+   int* oldCount = comdMalloc(nTotalBoxes*sizeof(int));
+   int* newCount = comdCalloc(nTotalBoxes, sizeof(int));
+   int* newBox = comdMalloc(boxes->localEnd*sizeof(int));
+   for (int iBox=0; iBox<nTotalBoxes; ++iBox)
    {
-      int iOff = iBox*MAXATOMS;
-      int ii=0;
-      while (ii < boxes->nAtoms[iBox])
+      oldOffset[iBox] = boxes->boxOffset[iBox];
+      oldCount[iBox] = boxes->nAtoms[iBox];
+   }
+
+   for (int iBox=0; iBox<nLocalBoxes; ++iBox)
+      for (int iOff=oldOffset[iBox],ii=0; ii<oldCount[iBox]; ++ii,++iOff)
       {
-         int jBox = getBoxFromCoord(boxes, atoms->r[iOff+ii]);
-         if (jBox != iBox)
-            moveAtom(boxes, atoms, ii, iBox, jBox);
-         else
-            ++ii;
+         newBox[iOff] = getBoxFromCoord(boxes, atoms->r[iOff]);
+         newCount[newBox[iOff]]++;
       }
+
+   int nSlots = 0;
+   for (int iBox=0; iBox<nTotalBoxes; ++iBox)
+   {
+      if (iBox == nLocalBoxes)
+      {
+         boxes->localEnd = nSlots;
+         nSlots += headroom(nSlots);
+         boxes->haloBegin = nSlots;
+      }
+      int nAtoms = newCount[iBox];
+      if (iBox >= nLocalBoxes)
+         nAtoms = MAX(nAtoms, oldCount[iBox]);
+      boxes->boxOffset[iBox] = nSlots;
+      boxes->boxCapacity[iBox] = nAtoms + headroom(nAtoms);
+      boxes->nAtoms[iBox] = 0;
+      nSlots += boxes->boxCapacity[iBox];
    }
+   boxes->haloEnd = nSlots;
+   nSlots += headroom(nSlots - boxes->haloBegin);
+
+   Atoms* spare = boxes->spare;
+   if (spare->capacity < nSlots)
+   {
+      comdFree(spare->gid);
+      comdFree(spare->iSpecies);
+      comdFree(spare->r);
+      comdFree(spare->p);
+      comdFree(spare->f);
+      comdFree(spare->U);
+      spare->capacity = nSlots + headroom(nSlots);
+      spare->gid      = comdMalloc(spare->capacity*sizeof(int));
+      spare->iSpecies = comdMalloc(spare->capacity*sizeof(int));
+      spare->r        = comdMalloc(spare->capacity*sizeof(real3));
+      spare->p        = comdMalloc(spare->capacity*sizeof(real3));
+      spare->f        = comdMalloc(spare->capacity*sizeof(real3));
+      spare->U        = comdMalloc(spare->capacity*sizeof(real_t));
+   }
+
+   for (int iBox=0; iBox<nLocalBoxes; ++iBox)
+      for (int iOff=oldOffset[iBox],ii=0; ii<oldCount[iBox]; ++ii,++iOff)
+      {
+         int jBox = newBox[iOff];
+         int jOff = boxes->boxOffset[jBox] + boxes->nAtoms[jBox]++;
+         copyAtoms(spare, jOff, atoms, iOff, 1);
+      }
+
+   spare->nLocal = 0;
+   for (int iBox=0; iBox<nLocalBoxes; ++iBox)
+      spare->nLocal += boxes->nAtoms[iBox];
+   spare->nGlobal = atoms->nGlobal;
+
+   Atoms tmp = *atoms;
+   *atoms = *spare;
+   *spare = tmp;
+
+   comdFree(newBox);
+   comdFree(newCount);
+   comdFree(oldCount);
+   comdFree(oldOffset);
 }
 
 /// \return The largest number of atoms in any link cell.
@@ -306,19 +503,98 @@ int maxOccupancy(LinkCell* boxes)
    return globalMax;
 }
 
-/// Copy atom iAtom in link cell iBox to atom jAtom in link cell jBox.
-/// Any data at jAtom, jBox is overwritten.  This routine can be used to
-/// re-order atoms within a link cell.
-void copyAtom(LinkCell* boxes, Atoms* atoms, int iAtom, int iBox, int jAtom, int jBox)
+/// The number of slots a box or a region of boxes with nAtoms atoms
+/// gets beyond those atoms.
+int headroom(int nAtoms)
+{
+   return nAtoms/8 + 1;
+}
+
+/// Make sure that at least nLocalSlots free slots follow the local
+/// boxes and nHaloSlots follow the halo boxes.  If the local boxes need
+/// more room, all halo boxes are shifted up.  If the atom arrays are
+/// too small, they are reallocated with some headroom, but only if
+/// mayGrow is set.
+/// \return 0 if the arrays are too small and mayGrow is not set.
+int makeRoom(LinkCell* boxes, Atoms* atoms, int nLocalSlots, int nHaloSlots, int mayGrow)
+{
+   int shift = MAX(0, boxes->localEnd + nLocalSlots - boxes->haloBegin);
+   int nSlots = boxes->haloEnd + shift + nHaloSlots;
+   if (nSlots > atoms->capacity)
+   {
+      if (! mayGrow)
+         return 0;
+      if (shift > 0)
+         shift += headroom(boxes->localEnd);
+      nSlots = boxes->haloEnd + shift + nHaloSlots;
+      nSlots += headroom(nSlots);
+      atoms->gid      = comdRealloc(atoms->gid,      nSlots*sizeof(int));
+      atoms->iSpecies = comdRealloc(atoms->iSpecies, nSlots*sizeof(int));
+      atoms->r        = comdRealloc(atoms->r,        nSlots*sizeof(real3));
+      atoms->p        = comdRealloc(atoms->p,        nSlots*sizeof(real3));
+      atoms->f        = comdRealloc(atoms->f,        nSlots*sizeof(real3));
+      atoms->U        = comdRealloc(atoms->U,        nSlots*sizeof(real_t));
+      atoms->capacity = nSlots;
+   }
+   if (shift > 0)
+      shiftHaloBoxes(boxes, atoms, shift);
+   return 1;
+}
+
+/// Move the slots of all halo boxes up by shift.  The caller must make
+/// sure that the atom arrays are long enough.
+void shiftHaloBoxes(LinkCell* boxes, Atoms* atoms, int shift)
 {
-   const int iOff = MAXATOMS*iBox+iAtom;
-   const int jOff = MAXATOMS*jBox+jAtom;
-   atoms->gid[jOff] = atoms->gid[iOff];
-   atoms->iSpecies[jOff] = atoms->iSpecies[iOff];
-   memcpy(atoms->r[jOff], atoms->r[iOff], sizeof(real3));
-   memcpy(atoms->p[jOff], atoms->p[iOff], sizeof(real3));
-   memcpy(atoms->f[jOff], atoms->f[iOff], sizeof(real3));
-   memcpy(atoms->U+jOff,  atoms->U+iOff,  sizeof(real_t));
+   int begin = boxes->haloBegin;
+   int n = boxes->haloEnd - begin;
+   memmove(atoms->gid+begin+shift,      atoms->gid+begin,      n*sizeof(int));
+   memmove(atoms->iSpecies+begin+shift, atoms->iSpecies+begin, n*sizeof(int));
+   memmove(atoms->r+begin+shift,        atoms->r+begin,        n*sizeof(real3));
+   memmove(atoms->p+begin+shift,        atoms->p+begin,        n*sizeof(real3));
+   memmove(atoms->f+begin+shift,        atoms->f+begin,        n*sizeof(real3));
+   memmove(atoms->U+begin+shift,        atoms->U+begin,        n*sizeof(real_t));
+   for (int iBox=boxes->nLocalBoxes; iBox<boxes->nTotalBoxes; ++iBox)
+      boxes->boxOffset[iBox] += shift;
+   boxes->haloBegin += shift;
+   boxes->haloEnd += shift;
+}
+
+/// Give box iBox room for capacity atoms at the end of its region (the
+/// local or the halo boxes).  The last box of a region simply grows.
+/// makeRoom must have made enough room.
+void moveBox(LinkCell* boxes, Atoms* atoms, int iBox, int capacity)
+{
+   int* end = (iBox < boxes->nLocalBoxes) ? &boxes->localEnd : &boxes->haloEnd;
+   int iOff = boxes->boxOffset[iBox];
+   if (iOff + boxes->boxCapacity[iBox] != *end)
+   {
+      copyAtoms(atoms, *end, atoms, iOff, boxes->nAtoms[iBox]);
+      boxes->boxOffset[iBox] = *end;
+      *end += capacity;
+   }
+   else
+      *end += capacity - boxes->boxCapacity[iBox];
+   boxes->boxCapacity[iBox] = capacity;
+   assert(boxes->localEnd <= boxes->haloBegin);
+   assert(boxes->haloEnd <= atoms->capacity);
+}
+
+/// Copy n atoms starting at index iOff of from to index jOff of to.
+/// The ranges must not overlap.
+void copyAtoms(Atoms* to, int jOff, const Atoms* from, int iOff, int n)
+{
+   for (int ii=0; ii<n; ++ii)
+   {
+      to->gid[jOff+ii] = from->gid[iOff+ii];
+      to->iSpecies[jOff+ii] = from->iSpecies[iOff+ii];
+      for (int m=0; m<3; m++)
+      {
+         to->r[jOff+ii][m] = from->r[iOff+ii][m];
+         to->p[jOff+ii][m] = from->p[iOff+ii][m];
+         to->f[jOff+ii][m] = from->f[iOff+ii][m];
+      }
+      to->U[jOff+ii] = from->U[iOff+ii];
+   }
 }
 
 /// Get the index of the link cell that contains the specified
@@ -336,33 +612,29 @@ int getBoxFromCoord(LinkCell* boxes, real_t rr[3])
    const real_t* localMin = boxes->localMin; // alias
    const real_t* localMax = boxes->localMax; // alias
    const int*    gridSize = boxes->gridSize; // alias
-   int ix = (int)(floor((rr[0] - localMin[0])*boxes->invBoxSize[0]));
-   int iy = (int)(floor((rr[1] - localMin[1])*boxes->invBoxSize[1]));
-   int iz = (int)(floor((rr[2] - localMin[2])*boxes->invBoxSize[2]));
-
+   int nHalo = boxes->nHaloLayers;
+   int ixyz[3];
 
    // For each axis, if we are inside the local domain, make sure we get
-   // a local link cell.  Otherwise, make sure we get a halo link cell.
-   if (rr[0] < localMax[0]) 
+   // a local link cell.  Otherwise, make sure we get a halo link cell
+   // (the outermost halo layer if the atom is even further out).
+   for (int m=0; m<3; m++)
    {
-      if (ix == gridSize[0]) ix = gridSize[0] - 1;
-   }
-   else
-      ix = gridSize[0]; // assign to halo cell
-   if (rr[1] < localMax[1])
-   {
-      if (iy == gridSize[1]) iy = gridSize[1] - 1;
-   }
-   else
-      iy = gridSize[1];
-   if (rr[2] < localMax[2])
-   {
-      if (iz == gridSize[2]) iz = gridSize[2] - 1;
+      int ii = (int)(floor((rr[m] - localMin[m])*boxes->invBoxSize[m]));
+      if (rr[m] < localMax[m])
+      {
+         if (ii == gridSize[m]) ii = gridSize[m] - 1;
+         if (ii < -nHalo) ii = -nHalo;
+      }
+      else
+      {
+         if (ii < gridSize[m]) ii = gridSize[m]; // assign to halo cell
+         if (ii >= gridSize[m]+nHalo) ii = gridSize[m]+nHalo-1;
+      }
+      ixyz[m] = ii;
    }
-   else
-      iz = gridSize[2];
    
-   return getBoxFromTuple(boxes, ix, iy, iz);
+   return getBoxFromTuple(boxes, ixyz[0], ixyz[1], ixyz[2]);
 }
 
 /// Set the number of atoms to zero in all halo link cells.
@@ -372,86 +644,234 @@ void emptyHaloCells(LinkCell* boxes)
       boxes->nAtoms[ii] = 0;
 }
 
-/// Get the grid coordinates of the link cell with index iBox.  Local
-/// cells are easy as they use a standard 1D->3D mapping.  Halo cell are
-/// special cases.
-/// \see initLinkCells for information on link cell order.
-/// \param [in]  iBox Index to link cell for which tuple is needed.
-/// \param [out] ixp  x grid coord of link cell.
-/// \param [out] iyp  y grid coord of link cell.
-/// \param [out] izp  z grid coord of link cell.
-void getTuple(LinkCell* boxes, int iBox, int* ixp, int* iyp, int* izp)
+/// \details
+/// A box is inner if it is a local box and at least depth planes of
+/// local boxes lie between it and the domain surface in every
+/// direction.  With depth = 0 all local boxes are inner.
+int isInnerBox(LinkCell* boxes, int iBox, int depth)
+{
+   return boxes->boxDepth[iBox] >= depth;
+}
+
+/// \details
+/// Returns non-zero if the pair (iBox, jBox) belongs to the pairs
+/// selected by pairs, where a pair is inner if both boxes are inner
+/// boxes for the given depth.  The inner and outer pairs together are
+/// all pairs.
+int visitBoxPair(LinkCell* boxes, enum BoxPairs pairs, int depth, int iBox, int jBox)
+{
+   if (pairs == ALL_PAIRS)
+      return 1;
+   int inner = isInnerBox(boxes, iBox, depth) && isInnerBox(boxes, jBox, depth);
+   return (pairs == INNER_PAIRS) == inner;
+}
+
+/// A link cell and its position on the space-filling curve.
+typedef struct CurveCellSt
+{
+   uint64_t key;  //!< position on the curve
+   int tuple[3];  //!< grid coordinates
+} CurveCell;
+
+/// Tabulates the mappings between grid coordinates and link cell
+/// indices (boxIndex and boxTuple).  The local cells come first.  Halo
+/// cells are numbered slab by slab: first the -x and +x slabs (local y
+/// and z range), then the -y and +y slabs (full x range, local z range)
+/// and finally the -z and +z slabs (full x and y range).  Within each
+/// of these regions the cells are stored with x fastest, then y, then
+/// z, or sorted along the curve chosen by boxOrder.  The curve is laid
+/// over the whole halo padded grid, so a region only uses the part of
+/// it that it covers.
+///
+/// Also tabulates the stencils as offsets in boxIndex.  The neighbor
+/// stencil holds every offset of up to cellsPerCutoff boxes along each
+/// axis for which the closest points of the two boxes are within the
+/// cutoff, with z fastest.  The half-shell stencil holds the forward
+/// ones among them (dz > 0, or dz = 0 and dy > 0, or dz = dy = 0 and
+/// dx > 0), with x fastest.  With one box per cutoff this gives the
+/// usual 27 and 13 offsets.
+void mkBoxTables(LinkCell* boxes)
 {
-   int ix, iy, iz;
    const int* gridSize = boxes->gridSize; // alias
-   
-   // If a local box
-   if( iBox < boxes->nLocalBoxes)
+   int nHalo = boxes->nHaloLayers;
+   int reach = boxes->cellsPerCutoff;
+   int pad = nHalo + reach;
+   int nx = gridSize[0] + 2*pad;
+   int ny = gridSize[1] + 2*pad;
+   int nz = gridSize[2] + 2*pad;
+
+   boxes->boxIndex = comdMalloc(nx*ny*nz*sizeof(int));
+   boxes->boxTuple = comdMalloc(3*boxes->nTotalBoxes*sizeof(int));
+   boxes->boxCell  = comdMalloc(boxes->nTotalBoxes*sizeof(int));
+   boxes->boxDepth = comdMalloc(boxes->nTotalBoxes*sizeof(int));
+   for (int ii=0; ii<nx*ny*nz; ++ii)
+      boxes->boxIndex[ii] = -1;
+
+   // The coordinate ranges of the local cells and of the halo slabs.
+   // Each slab is given as {xBegin, xEnd, yBegin, yEnd, zBegin, zEnd}.
+   int gx = gridSize[0], gy = gridSize[1], gz = gridSize[2];
+   int h = nHalo;
+   int ranges[7][6] =
    {
-      ix = iBox % gridSize[0];
-      iBox /= gridSize[0];
-      iy = iBox % gridSize[1];
-      iz = iBox / gridSize[1];
-   }
-   // It's a halo box
-   else 
+      { 0,    gx,   0,    gy,   0,    gz  },  // local
+      {-h,    0,    0,    gy,   0,    gz  },  // -x
+      { gx,   gx+h, 0,    gy,   0,    gz  },  // +x
+      {-h,    gx+h,-h,    0,    0,    gz  },  // -y
+      {-h,    gx+h, gy,   gy+h, 0,    gz  },  // +y
+      {-h,    gx+h,-h,    gy+h,-h,    0   },  // -z
+      {-h,    gx+h,-h,    gy+h, gz,   gz+h},  // +z
+   };
+
+   // bits per coordinate of the curve
+   int nBits = 1;
+   while ((1 << nBits) < MAX(gx, MAX(gy, gz)) + 2*h)
+      ++nBits;
+   assert(3*nBits <= 64);
+
+   CurveCell* cells = comdMalloc(boxes->nTotalBoxes*sizeof(CurveCell));
+   int iBox = 0;
+   for (int iRange=0; iRange<7; ++iRange)
    {
-      int ink;
-      ink = iBox - boxes->nLocalBoxes;
-      if (ink < 2*gridSize[1]*gridSize[2])
+      const int* rr = ranges[iRange];
+      int nCells = 0;
+      for (int iz=rr[4]; iz<rr[5]; ++iz)
+         for (int iy=rr[2]; iy<rr[3]; ++iy)
+            for (int ix=rr[0]; ix<rr[1]; ++ix)
+            {
+               CurveCell* cc = cells + nCells++;
+               cc->key = curveKey(boxes->boxOrder, nBits, ix+h, iy+h, iz+h);
+               cc->tuple[0] = ix;
+               cc->tuple[1] = iy;
+               cc->tuple[2] = iz;
+            }
+      if (boxes->boxOrder != BOX_ORDER_XYZ)
+         qsort(cells, nCells, sizeof(CurveCell), compareCurveCells);
+
+      for (int ii=0; ii<nCells; ++ii)
       {
-         if (ink < gridSize[1]*gridSize[2]) 
+         const int* tt = cells[ii].tuple;
+         int iCell = (tt[0]+pad) + nx*((tt[1]+pad) + ny*(tt[2]+pad));
+         boxes->boxIndex[iCell] = iBox;
+         boxes->boxCell[iBox] = iCell;
+         int depth = gx;
+         for (int m=0; m<3; m++)
          {
-            ix = 0;
+            boxes->boxTuple[3*iBox+m] = tt[m];
+            depth = MIN(depth, MIN(tt[m], gridSize[m]-1-tt[m]));
          }
-         else 
-         {
-            ink -= gridSize[1]*gridSize[2];
-            ix = gridSize[0] + 1;
-         }
-         iy = 1 + ink % gridSize[1];
-         iz = 1 + ink / gridSize[1];
+         boxes->boxDepth[iBox] = (iRange == 0) ? depth : -1;
+         ++iBox;
       }
-      else if (ink < (2 * gridSize[2] * (gridSize[1] + gridSize[0] + 2))) 
-      {
-         ink -= 2 * gridSize[2] * gridSize[1];
-         if (ink < ((gridSize[0] + 2) *gridSize[2])) 
+   }
+   assert(iBox == boxes->nTotalBoxes);
+   comdFree(cells);
+
+   // the stencils
+   real_t cutoff2 = boxes->cutoff*boxes->cutoff;
+   boxes->nNbrBoxes = 0;
+   for (int dx=-reach; dx<=reach; ++dx)
+      for (int dy=-reach; dy<=reach; ++dy)
+         for (int dz=-reach; dz<=reach; ++dz)
          {
-            iy = 0;
+            if (boxGap2(boxes, dx, dy, dz) > cutoff2)
+               continue;
+            boxes->nbrStride[boxes->nNbrBoxes++] = dx + nx*(dy + ny*dz);
          }
-         else 
+   boxes->nHalfShell = 0;
+   for (int dz=0; dz<=reach; ++dz)
+      for (int dy=(dz > 0 ? -reach : 0); dy<=reach; ++dy)
+         for (int dx=(dz > 0 || dy > 0 ? -reach : 1); dx<=reach; ++dx)
          {
-            ink -= (gridSize[0] + 2) * gridSize[2];
-            iy = gridSize[1] + 1;
+            if (boxGap2(boxes, dx, dy, dz) > cutoff2)
+               continue;
+            boxes->halfShellStride[boxes->nHalfShell++] = dx + nx*(dy + ny*dz);
          }
-         ix = ink % (gridSize[0] + 2);
-         iz = 1 + ink / (gridSize[0] + 2);
-      }
-      else 
+   assert(2*boxes->nHalfShell+1 == boxes->nNbrBoxes);
+}
+
+/// Squared distance between the closest points of two boxes whose grid
+/// coordinates differ by dx, dy, dz.
+real_t boxGap2(LinkCell* boxes, int dx, int dy, int dz)
+{
+   int dd[3] = {dx, dy, dz};
+   real_t gap2 = 0.0;
+   for (int m=0; m<3; m++)
+   {
+      real_t gap = MAX(abs(dd[m])-1, 0)*boxes->boxSize[m];
+      gap2 += gap*gap;
+   }
+   return gap2;
+}
+
+/// Position of the cell with (non-negative) grid coordinates ix, iy, iz
+/// on the curve chosen by boxOrder.  The Morton key interleaves the
+/// bits of the coordinates.  For the Hilbert curve the coordinates are
+/// first transformed with Skilling's algorithm (AIP Conf. Proc. 707,
+/// 381 (2004)), after which the interleaved bits are the Hilbert index.
+/// Returns 0 for BOX_ORDER_XYZ.
+uint64_t curveKey(int boxOrder, int nBits, int ix, int iy, int iz)
+{
+   if (boxOrder == BOX_ORDER_XYZ)
+      return 0;
+
+   unsigned xx[3] = {iz, iy, ix};
+   if (boxOrder == BOX_ORDER_HILBERT)
+   {
+      unsigned mm = 1u << (nBits-1);
+      for (unsigned qq=mm; qq>1; qq>>=1)
       {
-         ink -= 2 * gridSize[2] * (gridSize[1] + gridSize[0] + 2);
-         if (ink < ((gridSize[0] + 2) * (gridSize[1] + 2))) 
-         {
-            iz = 0;
-         }
-         else 
+         unsigned pp = qq-1;
+         for (int ii=0; ii<3; ++ii)
          {
-            ink -= (gridSize[0] + 2) * (gridSize[1] + 2);
-            iz = gridSize[2] + 1;
+            if (xx[ii] & qq)
+               xx[0] ^= pp;
+            else
+            {
+               unsigned tt = (xx[0] ^ xx[ii]) & pp;
+               xx[0] ^= tt;
+               xx[ii] ^= tt;
+            }
          }
-         ix = ink % (gridSize[0] + 2);
-         iy = ink / (gridSize[0] + 2);
       }
-      
-      // Calculated as off by 1
-      ix--;
-      iy--;
-      iz--;
+      for (int ii=1; ii<3; ++ii)
+         xx[ii] ^= xx[ii-1];
+      unsigned tt = 0;
+      for (unsigned qq=mm; qq>1; qq>>=1)
+         if (xx[2] & qq)
+            tt ^= qq-1;
+      for (int ii=0; ii<3; ++ii)
+         xx[ii] ^= tt;
    }
-   
-   *ixp = ix;
-   *iyp = iy;
-   *izp = iz;
+
+   uint64_t key = 0;
+   for (int bb=nBits-1; bb>=0; --bb)
+      for (int ii=0; ii<3; ++ii)
+         key = (key << 1) | ((xx[ii] >> bb) & 1);
+   return key;
 }
 
+int compareCurveCells(const void* a, const void* b)
+{
+   uint64_t ka = ((const CurveCell*) a)->key;
+   uint64_t kb = ((const CurveCell*) b)->key;
+   return (ka > kb) - (ka < kb);
+}
+
+int parseBoxOrder(const char* name)
+{
+   if (strcmp(name, "xyz") == 0)     return BOX_ORDER_XYZ;
+   if (strcmp(name, "morton") == 0)  return BOX_ORDER_MORTON;
+   if (strcmp(name, "hilbert") == 0) return BOX_ORDER_HILBERT;
+   return -1;
+}
 
+const char* boxOrderName(int boxOrder)
+{
+   switch (boxOrder)
+   {
+     case BOX_ORDER_XYZ:     return "xyz";
+     case BOX_ORDER_MORTON:  return "morton";
+     case BOX_ORDER_HILBERT: return "hilbert";
+   }
+   return "unknown";
+}
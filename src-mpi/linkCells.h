@@ -6,17 +6,45 @@
 
 #include "mytype.h"
 
-/// The maximum number of atoms that can be stored in a link cell.
-#define MAXATOMS 64 
+/// The largest number of link cells per cutoff distance.
+#define MAX_CELLS_PER_CUTOFF 3
+
+/// Room for the largest neighbor stencil (getNeighborBoxes).
+#define MAX_NBR_BOXES ((2*MAX_CELLS_PER_CUTOFF+1)*(2*MAX_CELLS_PER_CUTOFF+1)*(2*MAX_CELLS_PER_CUTOFF+1))
+
+/// Room for the largest half-shell stencil (getHalfShellBoxes).
+#define MAX_HALF_SHELL_BOXES (MAX_NBR_BOXES/2+1)
 
 struct DomainSt;
 struct AtomsSt;
 
+/// Selects the pairs of link cells visited by a force loop that is
+/// split around a halo exchange.  \see isInnerBox
+enum BoxPairs
+{
+   ALL_PAIRS,   //!< all pairs
+   INNER_PAIRS, //!< pairs of two inner boxes
+   OUTER_PAIRS  //!< pairs with at least one box that is not inner
+};
+
+/// The order in which the link cells of each region (the local cells
+/// and each halo slab) are stored.  \see mkBoxTables
+enum BoxOrder
+{
+   BOX_ORDER_XYZ,     //!< x fastest
+   BOX_ORDER_MORTON,  //!< Morton (Z-order) curve
+   BOX_ORDER_HILBERT  //!< Hilbert curve
+};
+
 /// Link cell data.  For convenience, we keep a copy of the localMin and
 /// localMax coordinates that are also found in the DomainsSt.
 typedef struct LinkCellSt
 {
    int gridSize[3];     //!< number of boxes in each dimension on processor
+   int nHaloLayers;     //!< number of layers of halo boxes around local boxes
+   int cellsPerCutoff;  //!< number of boxes per cutoff distance along each axis
+   int boxOrder;        //!< storage order of the boxes (a BoxOrder)
+   real_t cutoff;       //!< interaction range the boxes were sized for
    int nLocalBoxes;     //!< total number of local boxes on processor
    int nHaloBoxes;      //!< total number of remote halo/ghost boxes on processor
    int nTotalBoxes;     //!< total number of boxes on processor
@@ -27,24 +55,54 @@ typedef struct LinkCellSt
    real3 invBoxSize;    //!< inverse size of box in each dimension
 
    int* nAtoms;         //!< total number of atoms in each box
+   int* boxOffset;      //!< storage index of the first atom of each box
+   int* boxCapacity;    //!< number of storage slots of each box
+   int localEnd;        //!< end of the slots used by local boxes
+   int haloBegin;       //!< start of the slots of the halo boxes
+   int haloEnd;         //!< end of the slots used by halo boxes
+   struct AtomsSt* spare; //!< spare atom arrays that updateLinkCells sorts into
+
+   int* boxIndex;       //!< box index of each cell of the index grid (-1 outside the halo)
+   int* boxTuple;       //!< grid coordinates of each box (3 per box)
+   int* boxCell;        //!< position of each box in boxIndex
+   int* boxDepth;       //!< local planes between each box and the domain surface (-1 for halo boxes)
+   int nNbrBoxes;       //!< number of offsets in the neighbor stencil
+   int nbrStride[MAX_NBR_BOXES];        //!< boxIndex offsets of the neighbor stencil
+   int nHalfShell;      //!< number of offsets in the half-shell stencil
+   int halfShellStride[MAX_HALF_SHELL_BOXES]; //!< boxIndex offsets of the forward neighbors
 } LinkCell;
 
-LinkCell* initLinkCells(const struct DomainSt* domain, real_t cutoff);
+LinkCell* initLinkCells(const struct DomainSt* domain, real_t cutoff,
+                        int cellsPerCutoff, int nHaloLayers, int boxOrder);
 void destroyLinkCells(LinkCell** boxes);
 
 int getNeighborBoxes(LinkCell* boxes, int iBox, int* nbrBoxes);
-void putAtomInBox(LinkCell* boxes, struct AtomsSt* atoms,
-                  const int gid, const int iType,
-                  const real_t x,  const real_t y,  const real_t z,
-                  const real_t px, const real_t py, const real_t pz);
+int getHalfShellBoxes(LinkCell* boxes, int iBox, int* nbrBoxes);
+int getHalfShellBoxesWithHalo(LinkCell* boxes, int iBox, int* nbrBoxes);
+int putAtomInBox(LinkCell* boxes, struct AtomsSt* atoms,
+                 const int gid, const int iType,
+                 const real_t x,  const real_t y,  const real_t z,
+                 const real_t px, const real_t py, const real_t pz);
 int getBoxFromTuple(LinkCell* boxes, int x, int y, int z);
+int getBoxFromCoord(LinkCell* boxes, real_t rr[3]);
+int isInnerBox(LinkCell* boxes, int iBox, int depth);
+int visitBoxPair(LinkCell* boxes, enum BoxPairs pairs, int depth, int iBox, int jBox);
 
-void moveAtom(LinkCell* boxes, struct AtomsSt* atoms, int iId, int iBox, int jBox);
+/// Make room for nMore[iBox] more atoms in each box.
+int reserveAtoms(LinkCell* boxes, struct AtomsSt* atoms, const int* nMore, int mayGrow);
 
 /// Update link cell data structures when the atoms have moved.
 void updateLinkCells(LinkCell* boxes, struct AtomsSt* atoms);
 
+void emptyHaloCells(LinkCell* boxes);
+
 int maxOccupancy(LinkCell* boxes);
 
+/// Return a BoxOrder or -1 if the name is not known.
+int parseBoxOrder(const char* name);
+
+/// Return the name of a BoxOrder.
+const char* boxOrderName(int boxOrder);
+
 
 #endif
@@ -71,6 +71,9 @@
 #include "linkCells.h"
 #include "memUtils.h"
 #include "CoMDTypes.h"
+#include "threadBuffers.h"
+#include "haloExchange.h"
+#include "timestep.h"
 
 #define POT_SHIFT 1.0
 
@@ -94,6 +97,9 @@ typedef struct LjPotentialSt
 
 static int ljForce(SimFlat* s);
 static void ljPrint(FILE* file, BasePotential* pot);
+static real_t ljLinkCellForce(SimFlat* s, enum BoxPairs pairs,
+                              real_t rCut2, real_t s6, real_t eShift);
+static real_t ljNbrListForce(SimFlat* s, real_t rCut2, real_t s6, real_t eShift);
 
 void ljDestroy(BasePotential** inppot)
 {
@@ -152,7 +158,9 @@ int ljForce(SimFlat* s)
    // zero forces and energy
    real_t ePot = 0.0;
    s->ePotential = 0.0;
-   int fSize = s->boxes->nTotalBoxes*MAXATOMS;
+   int fSize = s->atoms->capacity;
+   fitThreadBuffers(s->threadBuffers, fSize);
+   #pragma omp parallel for
    for (int ii=0; ii<fSize; ++ii)
    {
       zeroReal3(s->atoms->f[ii]);
@@ -164,72 +172,181 @@ int ljForce(SimFlat* s)
    real_t rCut6 = s6 / (rCut2*rCut2*rCut2);
    real_t eShift = POT_SHIFT * rCut6 * (rCut6 - 1.0);
 
-   int nbrBoxes[27];
-   // loop over local boxes
-   for (int iBox=0; iBox<s->boxes->nLocalBoxes; iBox++)
+   if (s->nbrList)
    {
-      int nIBox = s->boxes->nAtoms[iBox];
-      if ( nIBox == 0 ) continue;
-      int nNbrBoxes = getNeighborBoxes(s->boxes, iBox, nbrBoxes);
-      // loop over neighbors of iBox
-      for (int jTmp=0; jTmp<nNbrBoxes; jTmp++)
+      ePot = ljNbrListForce(s, rCut2, s6, eShift);
+      s->ePotential = ePot*4.0*epsilon;
+      return 0;
+   }
+
+   if (haloExchangeInFlight(s->atomExchange))
+   {
+      // The pairs of inner boxes do not depend on the atom exchange.
+      ePot = ljLinkCellForce(s, INNER_PAIRS, rCut2, s6, eShift);
+      finishRedistribution(s);
+      ePot += ljLinkCellForce(s, OUTER_PAIRS, rCut2, s6, eShift);
+   }
+   else
+      ePot = ljLinkCellForce(s, ALL_PAIRS, rCut2, s6, eShift);
+
+   ePot = ePot*4.0*epsilon;
+   s->ePotential = ePot;
+
+   return 0;
+}
+
+/// The link cell pair loop of ljForce.  Visits the box pairs selected
+/// by pairs.  While the inner pairs are computed, the master thread
+/// keeps the atom exchange moving.
+///
+/// \return The local potential energy in units of 4 epsilon.
+real_t ljLinkCellForce(SimFlat* s, enum BoxPairs pairs,
+                       real_t rCut2, real_t s6, real_t eShift)
+{
+   real_t epsilon = ((LjPotential*) s->pot)->epsilon;
+   real_t ePot = 0.0;
+
+   // Threads other than the master accumulate in private buffers.
+   #pragma omp parallel reduction(+:ePot)
+   {
+      real3* f = s->atoms->f;
+      real_t* U = s->atoms->U;
+      selectThreadBuffers(s->threadBuffers, &f, &U, NULL);
+      int nbrBoxes[MAX_HALF_SHELL_BOXES];
+      // loop over all boxes.  Halo boxes are needed since the half-shell
+      // stencil of a halo box may contain local boxes.
+      #pragma omp for schedule(dynamic, 4)
+      for (int iBox=0; iBox<s->boxes->nTotalBoxes; iBox++)
       {
-         int jBox = nbrBoxes[jTmp];
+         if (pairs == INNER_PAIRS)
+         {
+            if (! isInnerBox(s->boxes, iBox, ATOM_EXCHANGE_DEPTH)) continue;
+            if (getMyThread() == 0)
+               progressHaloExchange(s->atomExchange);
+         }
+         int nIBox = s->boxes->nAtoms[iBox];
+         if ( nIBox == 0 ) continue;
+         int nNbrBoxes = getHalfShellBoxes(s->boxes, iBox, nbrBoxes);
+         // loop over half-shell neighbors of iBox
+         for (int jTmp=0; jTmp<nNbrBoxes; jTmp++)
+         {
+            int jBox = nbrBoxes[jTmp];
          
-         assert(jBox>=0);
+            assert(jBox>=0);
          
-         int nJBox = s->boxes->nAtoms[jBox];
-         if ( nJBox == 0 ) continue;
+            // check the pair first: during the inner pass the exchange
+            // may be adding atoms to boxes that are not inner.
+            if (! visitBoxPair(s->boxes, pairs, ATOM_EXCHANGE_DEPTH, iBox, jBox)) continue;
+            int nJBox = s->boxes->nAtoms[jBox];
+            if ( nJBox == 0 ) continue;
+
+            // local-local pairs count fully toward the energy, pairs with
+            // a halo atom count half.
+            real_t eScale = 0.5;
+            if (iBox < s->boxes->nLocalBoxes && jBox < s->boxes->nLocalBoxes)
+               eScale = 1.0;
          
-         // loop over atoms in iBox
-         for (int iOff=iBox*MAXATOMS,ii=0; ii<nIBox; ii++,iOff++)
-         {
-            int iId = s->atoms->gid[iOff];
-            // loop over atoms in jBox
-            for (int jOff=MAXATOMS*jBox,ij=0; ij<nJBox; ij++,jOff++)
+            // loop over atoms in iBox
+            for (int iOff=s->boxes->boxOffset[iBox],ii=0; ii<nIBox; ii++,iOff++)
             {
-               real_t dr[3];
-               int jId = s->atoms->gid[jOff];  
-               if (jBox < s->boxes->nLocalBoxes && jId <= iId )
-                  continue; // don't double count local-local pairs.
-               real_t r2 = 0.0;
-               for (int m=0; m<3; m++)
-               {
-                  dr[m] = s->atoms->r[iOff][m]-s->atoms->r[jOff][m];
-                  r2+=dr[m]*dr[m];
-               }
-
-               if ( r2 > rCut2) continue;
-
-               // Important note:
-               // from this point on r actually refers to 1.0/r
-               r2 = 1.0/r2;
-               real_t r6 = s6 * (r2*r2*r2);
-               real_t eLocal = r6 * (r6 - 1.0) - eShift;
-               s->atoms->U[iOff] += 0.5*eLocal;
-               s->atoms->U[jOff] += 0.5*eLocal;
-
-               // calculate energy contribution based on whether
-               // the neighbor box is local or remote
-               if (jBox < s->boxes->nLocalBoxes)
-                  ePot += eLocal;
-               else
-                  ePot += 0.5 * eLocal;
-
-               // different formulation to avoid sqrt computation
-               real_t fr = - 4.0*epsilon*r6*r2*(12.0*r6 - 6.0);
-               for (int m=0; m<3; m++)
+               // loop over atoms in jBox.  Pairs within iBox are visited once.
+               int jBegin = (jBox == iBox) ? ii+1 : 0;
+               for (int jOff=s->boxes->boxOffset[jBox]+jBegin,ij=jBegin; ij<nJBox; ij++,jOff++)
                {
-                  s->atoms->f[iOff][m] -= dr[m]*fr;
-                  s->atoms->f[jOff][m] += dr[m]*fr;
-               }
-            } // loop over atoms in jBox
-         } // loop over atoms in iBox
-      } // loop over neighbor boxes
-   } // loop over local boxes in system
+                  real_t dr[3];
+                  real_t r2 = 0.0;
+                  for (int m=0; m<3; m++)
+                  {
+                     dr[m] = s->atoms->r[iOff][m]-s->atoms->r[jOff][m];
+                     r2+=dr[m]*dr[m];
+                  }
 
-   ePot = ePot*4.0*epsilon;
-   s->ePotential = ePot;
+                  if ( r2 > rCut2) continue;
 
-   return 0;
+                  // Important note:
+                  // from this point on r actually refers to 1.0/r
+                  r2 = 1.0/r2;
+                  real_t r6 = s6 * (r2*r2*r2);
+                  real_t eLocal = r6 * (r6 - 1.0) - eShift;
+                  U[iOff] += 0.5*eLocal;
+                  U[jOff] += 0.5*eLocal;
+                  ePot += eScale*eLocal;
+
+                  // different formulation to avoid sqrt computation
+                  real_t fr = - 4.0*epsilon*r6*r2*(12.0*r6 - 6.0);
+                  for (int m=0; m<3; m++)
+                  {
+                     f[iOff][m] -= dr[m]*fr;
+                     f[jOff][m] += dr[m]*fr;
+                  }
+               } // loop over atoms in jBox
+            } // loop over atoms in iBox
+         } // loop over neighbor boxes
+      } // loop over all boxes in system
+      reduceThreadBuffers(s->threadBuffers, s->boxes, s->atoms->f, s->atoms->U, NULL);
+   }
+
+   return ePot;
+}
+
+/// Same as ljLinkCellForce, but visits only the pairs
+/// stored in the neighbor lists.  Forces and per-atom energies are
+/// accumulated in s->atoms.
+///
+/// \return The local potential energy in units of 4 epsilon.
+real_t ljNbrListForce(SimFlat* s, real_t rCut2, real_t s6, real_t eShift)
+{
+   LjPotential* pot = (LjPotential *) s->pot;
+   real_t epsilon = pot->epsilon;
+   NeighborList* nbrList = s->nbrList;
+   int haloBegin = s->boxes->haloBegin;
+
+   real_t ePot = 0.0;
+   #pragma omp parallel reduction(+:ePot)
+   {
+      real3* f = s->atoms->f;
+      real_t* U = s->atoms->U;
+      selectThreadBuffers(s->threadBuffers, &f, &U, NULL);
+      #pragma omp for
+      for (int iRow=0; iRow<nbrList->nRows; iRow++)
+      {
+         int iOff = nbrList->iOff[iRow];
+         for (int jj=nbrList->start[iRow]; jj<nbrList->start[iRow+1]; jj++)
+         {
+            int jOff = nbrList->nbrs[jj];
+            real_t dr[3];
+            real_t r2 = 0.0;
+            for (int m=0; m<3; m++)
+            {
+               dr[m] = s->atoms->r[iOff][m]-s->atoms->r[jOff][m];
+               r2+=dr[m]*dr[m];
+            }
+
+            if ( r2 > rCut2) continue;
+
+            // from this point on r actually refers to 1.0/r
+            r2 = 1.0/r2;
+            real_t r6 = s6 * (r2*r2*r2);
+            real_t eLocal = r6 * (r6 - 1.0) - eShift;
+            U[iOff] += 0.5*eLocal;
+            U[jOff] += 0.5*eLocal;
+
+            // halo atoms are stored after all local atoms
+            if (jOff < haloBegin)
+               ePot += eLocal;
+            else
+               ePot += 0.5 * eLocal;
+
+            real_t fr = - 4.0*epsilon*r6*r2*(12.0*r6 - 6.0);
+            for (int m=0; m<3; m++)
+            {
+               f[iOff][m] -= dr[m]*fr;
+               f[jOff][m] += dr[m]*fr;
+            }
+         }
+      }
+      reduceThreadBuffers(s->threadBuffers, s->boxes, s->atoms->f, s->atoms->U, NULL);
+   }
+
+   return ePot;
 }
@@ -0,0 +1,391 @@
+/// \file
+/// Dynamic load balancing by moving the boundaries between processors.
+///
+/// The domain decomposition starts out with bricks of equal volume.
+/// If the atoms or the work per atom are not spread evenly (free
+/// surfaces, voids, hot spots) the rank with the most work holds up all
+/// others at every halo exchange.
+///
+/// The balancer keeps the processor grid but moves the planes between
+/// its layers.  The bricks stay a tensor product grid: all processors
+/// in a layer normal to axis i share the same extent along i, so each
+/// task still has exactly one neighbor across every face, edge, and
+/// corner, and the halo exchanges work unchanged.  Every rate time
+/// steps:
+///
+/// -# Each rank measures its force time since the last rebalance
+///    (computeForceTimer without eamHaloTimer, i.e., without the time
+///    spent waiting for the neighbors).  The times are summed over
+///    each layer of the grid.
+/// -# Along each axis the planes are moved so that every layer gets the
+///    same share of the total.  Within a layer the load is assumed to
+///    be spread evenly, so the new planes follow from the piecewise
+///    linear cumulative load of the old layers.  Every layer keeps room
+///    for two link cells.
+/// -# Every rank sends its atoms to their new owners in a single
+///    all-to-all exchange and builds new link cells, atom arrays, halo
+///    exchanges, and neighbor lists for its new brick.  The forces (and
+///    energies) are then recomputed so that the time step can go on.
+///
+/// The imbalance is reported at every rebalance, and for the first and
+/// last intervals at the end of the run.  With NTIMING there are no
+/// timings and the planes never move.
+
+#include "loadBalance.h"
+
+#include "CoMDTypes.h"
+#include "decomposition.h"
+#include "linkCells.h"
+#include "initAtoms.h"
+#include "haloExchange.h"
+#include "neighborList.h"
+#include "threadBuffers.h"
+#include "timestep.h"
+#include "parallel.h"
+#include "performanceTimers.h"
+#include "memUtils.h"
+
+#define   MAX(A,B) ((A) > (B) ? (A) : (B))
+#define   MIN(A,B) ((A) < (B) ? (A) : (B))
+
+/// The planes are left alone below this imbalance.
+#define MIN_IMBALANCE 1.05
+
+/// The state of an atom that moves to a new owner.
+typedef struct BalanceMsgSt
+{
+   int gid;
+   int type;
+   real3 r;
+   real3 p;
+} BalanceMsg;
+
+static double measureLoad(LoadBalance* lb, Domain* dd, double* layerLoad);
+static int movePlanes(Domain* dd, const double* layerLoad, real_t minWidth);
+static int ownerOf(Domain* dd, const real_t* r);
+static void migrateAtoms(SimFlat* s);
+static void rebuildExchanges(SimFlat* s);
+
+LoadBalance* initLoadBalance(int rate)
+{
+   LoadBalance* lb = comdMalloc(sizeof(LoadBalance));
+   lb->rate = rate;
+   lb->nBalances = 0;
+   lb->nIntervals = 0;
+   lb->firstImbalance = 1.0;
+   lb->lastImbalance = 1.0;
+   lb->slowestRank = 0;
+
+   // Start the first interval now.
+   getElapsedTime(computeForceTimer);
+   getElapsedTime(eamHaloTimer);
+   return lb;
+}
+
+void destroyLoadBalance(LoadBalance** lb)
+{
+   if (! lb) return;
+   comdFree(*lb);
+   *lb = NULL;
+}
+
+double measureLoadImbalance(LoadBalance* lb, SimFlat* s)
+{
+   const int* procGrid = s->domain->procGrid;
+   double* layerLoad = comdMalloc((procGrid[0]+procGrid[1]+procGrid[2])*sizeof(double));
+   double imbalance = measureLoad(lb, s->domain, layerLoad);
+   comdFree(layerLoad);
+   return imbalance;
+}
+
+/// \details
+/// Called after a time step is complete, i.e., with all atoms in local
+/// link cells and valid forces.  Leaves them that way.
+void balanceLoad(LoadBalance* lb, SimFlat* s)
+{
+   Domain* dd = s->domain;
+   double* layerLoad = comdMalloc((dd->procGrid[0]+dd->procGrid[1]+dd->procGrid[2])*sizeof(double));
+   double imbalance = measureLoad(lb, dd, layerLoad);
+
+   int moved = 0;
+   if (imbalance > MIN_IMBALANCE)
+   {
+      LinkCell* boxes = s->boxes;
+      int nCells = MAX(2, boxes->nHaloLayers);
+      real_t boxSize = boxes->cutoff/boxes->cellsPerCutoff;
+      moved = movePlanes(dd, layerLoad, nCells*boxSize*(1.0+1.0e-6));
+   }
+   comdFree(layerLoad);
+
+   if (printRank())
+      fprintf(screenOut, "Load balance at step %d: imbalance %.3f (slowest rank %d)%s\n",
+              s->iteration, imbalance, lb->slowestRank, moved ? ", planes moved" : "");
+   if (! moved)
+      return;
+
+   updateLocalBounds(dd);
+   migrateAtoms(s);
+   rebuildExchanges(s);
+
+   startTimer(redistributeTimer);
+   redistributeAtoms(s);
+   stopTimer(redistributeTimer);
+   computeForce(s);
+   kineticEnergy(s);
+   lb->nBalances++;
+
+   // The forces above do not belong to the next interval.
+   getElapsedTime(computeForceTimer);
+   getElapsedTime(eamHaloTimer);
+}
+
+/// \details
+/// As in migrateAtoms, the new link cells are created before the old
+/// ones are freed so that a potential can tell that s->boxes has changed.
+void resizeDomain(SimFlat* s)
+{
+   LinkCell* boxes = s->boxes;
+   Atoms* atoms = s->atoms;
+   updateLocalBounds(s->domain);
+   LinkCell* newBoxes = initLinkCells(s->domain, boxes->cutoff, boxes->cellsPerCutoff,
+                                     boxes->nHaloLayers, boxes->boxOrder);
+   Atoms* newAtoms = initAtoms();
+   newAtoms->nGlobal = atoms->nGlobal;
+
+   destroyAtoms(atoms);
+   destroyLinkCells(&boxes);
+   s->boxes = newBoxes;
+   s->atoms = newAtoms;
+   rebuildExchanges(s);
+}
+
+void printLoadBalance(FILE* file, LoadBalance* lb)
+{
+   if (! lb || ! printRank())
+      return;
+   fprintf(file, "Load balance:\n");
+   fprintf(file, "  Rebalance rate     : %d steps\n", lb->rate);
+   fprintf(file, "  Planes moved       : %d times\n", lb->nBalances);
+   fprintf(file, "  Imbalance before   : %.3f (first interval, max/avg force time)\n",
+           lb->firstImbalance);
+   fprintf(file, "  Imbalance after    : %.3f (last interval, slowest rank %d)\n",
+           lb->lastImbalance, lb->slowestRank);
+   fprintf(file, "\n");
+   fflush(file);
+}
+
+/// Reads the force time of this rank since the last call and sums it
+/// over each layer of the processor grid.  layerLoad holds the layers
+/// along x, then y, then z.  Returns the imbalance.
+double measureLoad(LoadBalance* lb, Domain* dd, double* layerLoad)
+{
+   double load = getElapsedTime(computeForceTimer) - getElapsedTime(eamHaloTimer);
+
+   int nLayers = dd->procGrid[0] + dd->procGrid[1] + dd->procGrid[2];
+   double* myLoad = comdCalloc(nLayers, sizeof(double));
+   for (int i=0, offset=0; i<3; offset+=dd->procGrid[i], i++)
+      myLoad[offset + dd->procCoord[i]] = load;
+   addDoubleParallel(myLoad, layerLoad, nLayers);
+   comdFree(myLoad);
+
+   RankReduceData myMax, maxLoad;
+   myMax.val = load;
+   myMax.rank = getMyRank();
+   maxRankDoubleParallel(&myMax, &maxLoad, 1);
+
+   double total = 0.0;
+   for (int ip=0; ip<dd->procGrid[0]; ip++)
+      total += layerLoad[ip];
+   double imbalance = (total > 0.0) ? maxLoad.val*getNRanks()/total : 1.0;
+
+   if (lb->nIntervals == 0)
+      lb->firstImbalance = imbalance;
+   lb->lastImbalance = imbalance;
+   lb->slowestRank = maxLoad.rank;
+   lb->nIntervals++;
+   return imbalance;
+}
+
+/// Move the inner planes along each axis so that every layer gets the
+/// same share of the load.  No layer gets thinner than minWidth.  Axes
+/// that are too short for that keep their planes.  Returns non-zero if
+/// any plane has moved.
+int movePlanes(Domain* dd, const double* layerLoad, real_t minWidth)
+{
+   int moved = 0;
+   for (int i=0, offset=0; i<3; offset+=dd->procGrid[i], i++)
+   {
+      int nLayers = dd->procGrid[i];
+      const double* load = layerLoad + offset;
+      real_t* plane = dd->plane[i];
+      if (nLayers < 2 || nLayers*minWidth > dd->globalExtent[i])
+         continue;
+      double total = 0.0;
+      for (int ip=0; ip<nLayers; ip++)
+         total += load[ip];
+      if (total <= 0.0)
+         continue;
+
+      // invert the cumulative load.  below is the load of layers 0 to c-1.
+      real_t* newPlane = comdMalloc((nLayers+1)*sizeof(real_t));
+      newPlane[0] = plane[0];
+      newPlane[nLayers] = plane[nLayers];
+      int c = 0;
+      double below = 0.0;
+      for (int ip=1; ip<nLayers; ip++)
+      {
+         double target = total*ip/nLayers;
+         while (c < nLayers-1 && below + load[c] < target)
+            below += load[c++];
+         double frac = (load[c] > 0.0) ? (target - below)/load[c] : 0.0;
+         frac = MIN(MAX(frac, 0.0), 1.0);
+         newPlane[ip] = plane[c] + frac*(plane[c+1] - plane[c]);
+      }
+
+      // keep every layer at least minWidth thick.
+      for (int ip=1; ip<nLayers; ip++)
+         newPlane[ip] = MAX(newPlane[ip], newPlane[ip-1] + minWidth);
+      for (int ip=nLayers-1; ip>0; ip--)
+         newPlane[ip] = MIN(newPlane[ip], newPlane[ip+1] - minWidth);
+
+      for (int ip=1; ip<nLayers; ip++)
+      {
+         if (newPlane[ip] != plane[ip])
+            moved = 1;
+         plane[ip] = newPlane[ip];
+      }
+      comdFree(newPlane);
+   }
+   return moved;
+}
+
+/// Return the rank whose brick (by the current planes) contains r.
+/// Positions beyond the global bounds go to the outermost layer.
+int ownerOf(Domain* dd, const real_t* r)
+{
+   int coord[3];
+   for (int i=0; i<3; i++)
+   {
+      // find the last plane at or below r[i].
+      int lo = 0;
+      int hi = dd->procGrid[i];
+      while (hi - lo > 1)
+      {
+         int mid = (lo + hi)/2;
+         if (r[i] < dd->plane[i][mid])
+            hi = mid;
+         else
+            lo = mid;
+      }
+      coord[i] = lo;
+   }
+   return dd->procRank[coord[0] + dd->procGrid[0]*(coord[1] + dd->procGrid[1]*coord[2])];
+}
+
+/// Send every local atom to the owner of its position and put the
+/// received atoms into new link cells for the local bounds.  The new
+/// link cells and atoms are created before the old ones are freed so
+/// that a potential can tell that s->boxes has changed.
+void migrateAtoms(SimFlat* s)
+{
+   LinkCell* boxes = s->boxes;
+   Atoms* atoms = s->atoms;
+   int nRanks = getNRanks();
+
+   int* sendCount = comdCalloc(nRanks, sizeof(int));
+   int* recvCount = comdMalloc(nRanks*sizeof(int));
+   int* owner = comdMalloc(boxes->haloBegin*sizeof(int));
+   for (int iBox=0; iBox<boxes->nLocalBoxes; iBox++)
+      for (int iOff=boxes->boxOffset[iBox]; iOff<boxes->boxOffset[iBox]+boxes->nAtoms[iBox]; iOff++)
+      {
+         owner[iOff] = ownerOf(s->domain, atoms->r[iOff]);
+         sendCount[owner[iOff]]++;
+      }
+   allToAllIntParallel(sendCount, recvCount, 1);
+
+   int* sendLen   = comdMalloc(nRanks*sizeof(int));
+   int* sendDispl = comdMalloc(nRanks*sizeof(int));
+   int* recvLen   = comdMalloc(nRanks*sizeof(int));
+   int* recvDispl = comdMalloc(nRanks*sizeof(int));
+   int nSend = 0;
+   int nRecv = 0;
+   for (int iRank=0; iRank<nRanks; iRank++)
+   {
+      sendDispl[iRank] = nSend*sizeof(BalanceMsg);
+      sendLen[iRank] = sendCount[iRank]*sizeof(BalanceMsg);
+      recvDispl[iRank] = nRecv*sizeof(BalanceMsg);
+      recvLen[iRank] = recvCount[iRank]*sizeof(BalanceMsg);
+      nSend += sendCount[iRank];
+      nRecv += recvCount[iRank];
+   }
+
+   // pack the atoms in rank order.  sendCount becomes the fill pointer.
+   BalanceMsg* sendBuf = comdMalloc(MAX(nSend, 1)*sizeof(BalanceMsg));
+   BalanceMsg* recvBuf = comdMalloc(MAX(nRecv, 1)*sizeof(BalanceMsg));
+   for (int iRank=0; iRank<nRanks; iRank++)
+      sendCount[iRank] = sendDispl[iRank]/sizeof(BalanceMsg);
+   for (int iBox=0; iBox<boxes->nLocalBoxes; iBox++)
+      for (int iOff=boxes->boxOffset[iBox]; iOff<boxes->boxOffset[iBox]+boxes->nAtoms[iBox]; iOff++)
+      {
+         BalanceMsg* msg = sendBuf + sendCount[owner[iOff]]++;
+         msg->gid = atoms->gid[iOff];
+         msg->type = atoms->iSpecies[iOff];
+         for (int m=0; m<3; m++)
+         {
+            msg->r[m] = atoms->r[iOff][m];
+            msg->p[m] = atoms->p[iOff][m];
+         }
+      }
+   allToAllParallel(sendBuf, sendLen, sendDispl, recvBuf, recvLen, recvDispl);
+
+   LinkCell* newBoxes = initLinkCells(s->domain, boxes->cutoff, boxes->cellsPerCutoff,
+                                     boxes->nHaloLayers, boxes->boxOrder);
+   Atoms* newAtoms = initAtoms();
+   newAtoms->nGlobal = atoms->nGlobal;
+   int* nIncoming = comdCalloc(newBoxes->nTotalBoxes, sizeof(int));
+   for (int ii=0; ii<nRecv; ii++)
+      nIncoming[getBoxFromCoord(newBoxes, recvBuf[ii].r)]++;
+   reserveAtoms(newBoxes, newAtoms, nIncoming, 1);
+   comdFree(nIncoming);
+   for (int ii=0; ii<nRecv; ii++)
+   {
+      BalanceMsg* msg = recvBuf + ii;
+      putAtomInBox(newBoxes, newAtoms, msg->gid, msg->type,
+                   msg->r[0], msg->r[1], msg->r[2],
+                   msg->p[0], msg->p[1], msg->p[2]);
+   }
+
+   destroyAtoms(atoms);
+   destroyLinkCells(&boxes);
+   s->boxes = newBoxes;
+   s->atoms = newAtoms;
+
+   comdFree(recvBuf);
+   comdFree(sendBuf);
+   comdFree(recvDispl);
+   comdFree(recvLen);
+   comdFree(sendDispl);
+   comdFree(sendLen);
+   comdFree(owner);
+   comdFree(recvCount);
+   comdFree(sendCount);
+}
+
+/// Replace everything that depends on the size of the link cells.
+void rebuildExchanges(SimFlat* s)
+{
+   destroyHaloExchange(&(s->atomExchange));
+   s->atomExchange = initAtomHaloExchange(s->domain, s->boxes, s->haloMode, 1);
+   if (s->nbrList)
+   {
+      NeighborList* old = s->nbrList;
+      s->nbrList = initNeighborList(s->pot->cutoff, old->skin);
+      s->nbrList->nBuilds = old->nBuilds;
+      destroyNeighborList(&old);
+
+      destroyHaloExchange(&(s->ghostExchange));
+      destroyHaloExchange(&(s->migrateExchange));
+      s->ghostExchange = initGhostHaloExchange(s->domain, s->boxes, s->haloMode);
+      s->migrateExchange = initMigrationHaloExchange(s->domain, s->boxes, s->haloMode);
+   }
+}
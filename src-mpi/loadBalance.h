@@ -0,0 +1,41 @@
+/// \file
+/// Dynamic load balancing by moving the boundaries between processors.
+
+#ifndef __LOAD_BALANCE_H_
+#define __LOAD_BALANCE_H_
+
+#include <stdio.h>
+
+struct SimFlatSt;
+
+/// Load balancer state.  The imbalance of an interval is the largest
+/// force time of any rank divided by the average over all ranks.
+typedef struct LoadBalanceSt
+{
+   int rate;              //!< number of time steps between rebalances
+   int nBalances;         //!< number of times the planes were moved
+   int nIntervals;        //!< number of intervals measured
+   double firstImbalance; //!< imbalance of the first interval
+   double lastImbalance;  //!< imbalance of the most recent interval
+   int slowestRank;       //!< rank with the largest force time in that interval
+} LoadBalance;
+
+LoadBalance* initLoadBalance(int rate);
+void destroyLoadBalance(LoadBalance** lb);
+
+/// Measure the imbalance since the last call.  Collective.
+double measureLoadImbalance(LoadBalance* lb, struct SimFlatSt* s);
+
+/// Move the planes between processors to even out the measured load
+/// and hand the atoms to their new owners.  Collective.
+void balanceLoad(LoadBalance* lb, struct SimFlatSt* s);
+
+/// Replace the link cells, atoms and exchanges with empty ones for the
+/// local bounds given by the planes, e.g., after a checkpoint restored
+/// planes that were moved.  Collective.
+void resizeDomain(struct SimFlatSt* s);
+
+/// Print the imbalance of the first and the last interval.
+void printLoadBalance(FILE* file, LoadBalance* lb);
+
+#endif
@@ -5,6 +5,7 @@
 #define _MEMUTILS_H_
 
 #include <stdlib.h>
+#include <stdint.h>
 
 #define freeMe(s,element) {if(s->element) comdFree(s->element);  s->element = NULL;}
 
@@ -27,4 +28,23 @@ static void comdFree(void *ptr)
 {
    free(ptr);
 }
+
+/// Allocate iSize bytes starting at a multiple of alignment (a power of
+/// two).  The block must be freed with comdAlignedFree.
+static void* comdAlignedMalloc(size_t alignment, size_t iSize)
+{
+   char* mem = malloc(iSize + alignment + sizeof(void*));
+   if (! mem)
+      return NULL;
+   uintptr_t addr = (uintptr_t)(mem + sizeof(void*)) + alignment - 1;
+   void** ptr = (void**) (addr & ~(uintptr_t)(alignment - 1));
+   ptr[-1] = mem;
+   return ptr;
+}
+
+static void comdAlignedFree(void* ptr)
+{
+   if (ptr)
+      free(((void**)ptr)[-1]);
+}
 #endif
@@ -34,15 +34,26 @@
 /// | \--nx         | -x          | 20            | number of unit cells in x
 /// | \--ny         | -y          | 20            | number of unit cells in y
 /// | \--nz         | -z          | 20            | number of unit cells in z
-/// | \--xproc      | -i          | 1             | number of ranks in x direction
-/// | \--yproc      | -j          | 1             | number of ranks in y direction
-/// | \--zproc      | -k          | 1             | number of ranks in z direction
+/// | \--xproc      | -i          | auto          | number of ranks in x direction
+/// | \--yproc      | -j          | auto          | number of ranks in y direction
+/// | \--zproc      | -k          | auto          | number of ranks in z direction
 /// | \--nSteps     | -N          | 100           | total number of time steps
 /// | \--printRate  | -n          | 10            | number of steps between output
 /// | \--dt         | -D          | 1             | time step (in fs)
 /// | \--lat        | -l          | -1            | lattice parameter (Angstroms)
 /// | \--temp       | -T          | 600           | initial temperature (K)
 /// | \--delta      | -r          | 0             | initial delta (Angstroms)
+/// | \--nbrList    | -V          | N/A           | use Verlet neighbor lists
+/// | \--skin       | -s          | 1             | neighbor list skin (Angstroms)
+/// | \--pairCache  | -c          | N/A           | cache EAM pair data between force passes
+/// | \--ghostDensity | -g        | N/A           | compute EAM densities of ghost atoms redundantly
+/// | \--overlap    | -O          | N/A           | overlap halo exchanges with force computation
+/// | \--haloMode   | -E          | axes          | halo exchange mode (axes, direct, or neighbor)
+/// | \--sharedHalo | -S          | N/A           | read halo data of on-node neighbors from shared memory
+/// | \--rankMap    | -R          | xyz           | placement of ranks on the processor grid (xyz, cart, or node)
+/// | \--balance    | -b          | 0             | number of steps between load balancing (0 for none)
+/// | \--boxOrder   | -B          | xyz           | storage order of the link cells (xyz, morton, or hilbert)
+/// | \--cellsPerCutoff | -C      | 1             | number of link cells per cutoff distance
 ///
 /// Notes: 
 /// 
@@ -176,6 +187,126 @@
 ///
 ///     $ mpirun -np 8 ../bin/CoMD-mpi -i2 -j2 -k2 -x 40 -y 40 -z 40 -N 10000 -n 100
 ///
+/// ------------------------------
+///
+/// If any of -i, -j, and -k is omitted, CoMD chooses it such that the
+/// number of ranks is matched and each task has as few halo link
+/// cells per local link cell as possible.  The chosen grid and the
+/// ratio of halo to local link cells are shown under "Decomposition
+/// data".
+///
+///     $ mpirun -np 12 ../bin/CoMD-mpi -x 40 -y 40 -z 20
+///     $ mpirun -np 12 ../bin/CoMD-mpi -k1
+///
+/// ------------------------------
+///
+/// \subsubsection cmd_examples_nbrlist Neighbor Lists
+///
+/// Use Verlet neighbor lists with a 0.5 Angstrom skin instead of
+/// searching the link cells at every step.  The lists are rebuilt
+/// whenever some atom has moved more than half the skin.
+///
+///     $ ../bin/CoMD-mpi -e --nbrList --skin 0.5
+///
+/// ------------------------------
+///
+/// \subsubsection cmd_examples_ghost EAM Ghost Densities
+///
+/// Use a two cell deep atom halo so that the embedding energy
+/// derivative of every ghost atom can be computed locally.  This
+/// removes the halo exchange between the density and force passes of
+/// the EAM force at the price of redundant work on the ghost atoms.
+///
+///     $ mpirun -np 8 ../bin/CoMD-mpi -e -i2 -j2 -k2 --ghostDensity
+///
+/// ------------------------------
+///
+/// \subsubsection cmd_examples_overlap Overlapping Communication
+///
+/// Compute the forces between atoms in link cells away from the domain
+/// surface while the atom halo exchange (and, for EAM, the exchange of
+/// the embedding energy derivatives) is in flight.  Compare the
+/// commHalo timer with and without the option to see how much of the
+/// communication is hidden.
+///
+///     $ mpirun -np 8 ../bin/CoMD-mpi -e -i2 -j2 -k2 --overlap
+///
+/// ------------------------------
+///
+/// \subsubsection cmd_examples_halo Halo Exchange Modes
+///
+/// By default the halo exchanges send six messages in three steps, one
+/// axis at a time, and data for edge and corner neighbors is forwarded
+/// through the face neighbors.  With \--haloMode direct each task sends
+/// one message to each of its 26 neighbors at once.  With \--haloMode
+/// neighbor the same messages are sent as a single MPI neighborhood
+/// collective (MPI 3 or later).
+///
+///     $ mpirun -np 8 ../bin/CoMD-mpi -e -i2 -j2 -k2 --haloMode direct
+///     $ mpirun -np 8 ../bin/CoMD-mpi -e -i2 -j2 -k2 --haloMode neighbor
+///
+/// With \--sharedHalo the tasks on a node read each other's halo data
+/// from an MPI 3 shared memory window instead of exchanging messages.
+/// Only tasks on different nodes send messages.  Works with the axes
+/// and direct modes.
+///
+///     $ mpirun -np 8 ../bin/CoMD-mpi -e -i2 -j2 -k2 --haloMode direct --sharedHalo
+///
+/// ------------------------------
+///
+/// \subsubsection cmd_examples_rankmap Rank Placement
+///
+/// By default the ranks fill the processor grid in rank order with x
+/// fastest, so the ranks of a node form a thin slab of the grid.  With
+/// \--rankMap node each node owns a compact brick of the grid instead
+/// and more of the halo data stays on the node.  With \--rankMap cart
+/// the MPI library places the ranks (MPI_Cart_create with reorder).
+/// The halo bytes sent on and off node are reported at the end of the
+/// run.
+///
+///     $ mpirun -np 64 ../bin/CoMD-mpi -e -i4 -j4 -k4 --rankMap node
+///
+/// ------------------------------
+///
+/// \subsubsection cmd_examples_balance Load Balancing
+///
+/// With \--balance n the boundaries between the processors are moved
+/// every n time steps (rounded up to a multiple of the print rate) so
+/// that each layer of the processor grid gets the same share of the
+/// measured force time.  The atoms are handed to their new owners.  The
+/// imbalance (the largest force time of any rank divided by the
+/// average) is printed at each rebalance and summarized at the end of
+/// the run.  Restarting from a checkpoint written after the boundaries
+/// have moved is not supported.
+///
+///     $ mpirun -np 8 ../bin/CoMD-mpi -e -i2 -j2 -k2 -N 1000 --balance 100
+///
+/// ------------------------------
+///
+/// \subsubsection cmd_examples_boxorder Link Cell Order
+///
+/// By default the link cells are stored with x fastest.  With
+/// \--boxOrder morton or \--boxOrder hilbert they are stored along a
+/// space-filling curve instead, so that the atoms of neighboring cells
+/// are close in memory.  This matters most for large domains per task.
+/// Results differ from the default order only by round off.
+///
+///     $ mpirun -np 8 ../bin/CoMD-mpi -e -i2 -j2 -k2 -x 80 -y 80 -z 80 --boxOrder hilbert
+///
+/// ------------------------------
+///
+/// \subsubsection cmd_examples_cellspercutoff Link Cell Size
+///
+/// By default the link cells are at least one cutoff wide and each
+/// atom is tested against the atoms of 27 cells.  With
+/// \--cellsPerCutoff n (n up to 3) the cells are only a cutoff/n wide
+/// and the cells that lie entirely beyond the cutoff are dropped from
+/// the stencil, so fewer of the tested pairs are out of range.  The
+/// halo grows to n layers of cells, the same volume as before.  Results
+/// differ from the default only by round off.
+///
+///     $ mpirun -np 8 ../bin/CoMD-mpi -i2 -j2 -k2 -x 40 -y 40 -z 40 --cellsPerCutoff 2
+///
 
 /// \details Initialize a Command structure with default values, then
 /// parse any command line arguments that were supplied to overwrite
@@ -197,15 +328,29 @@ Command parseCommandLine(int argc, char** argv)
    cmd.nx = 20;
    cmd.ny = 20;
    cmd.nz = 20;
-   cmd.xproc = 1;
-   cmd.yproc = 1;
-   cmd.zproc = 1;
+   cmd.xproc = 0;
+   cmd.yproc = 0;
+   cmd.zproc = 0;
    cmd.nSteps = 100;
    cmd.printRate = 10;
    cmd.dt = 1.0;
    cmd.lat = -1.0;
    cmd.temperature = 600.0;
    cmd.initialDelta = 0.0;
+   cmd.useNbrList = 0;
+   cmd.skin = 1.0;
+   cmd.pairCache = 0;
+   cmd.ghostDensity = 0;
+   cmd.overlapHalo = 0;
+   memset(cmd.haloMode, 0, 1024);
+   strcpy(cmd.haloMode, "axes");
+   cmd.sharedHalo = 0;
+   memset(cmd.rankMap, 0, 1024);
+   strcpy(cmd.rankMap, "xyz");
+   cmd.balance = 0;
+   memset(cmd.boxOrder, 0, 1024);
+   strcpy(cmd.boxOrder, "xyz");
+   cmd.cellsPerCutoff = 1;
 
    int help=0;
    // add arguments for processing.  Please update the html documentation too!
@@ -226,6 +371,17 @@ Command parseCommandLine(int argc, char** argv)
    addArg("lat",        'l', 1, 'd',  &(cmd.lat),          0,             "lattice parameter (Angstroms)");
    addArg("temp",       'T', 1, 'd',  &(cmd.temperature),  0,             "initial temperature (K)");
    addArg("delta",      'r', 1, 'd',  &(cmd.initialDelta), 0,             "initial delta (Angstroms)");
+   addArg("nbrList",    'V', 0, 'i',  &(cmd.useNbrList),   0,             "use Verlet neighbor lists");
+   addArg("skin",       's', 1, 'd',  &(cmd.skin),         0,             "neighbor list skin (Angstroms)");
+   addArg("pairCache",  'c', 0, 'i',  &(cmd.pairCache),    0,             "cache EAM pair data between force passes");
+   addArg("ghostDensity", 'g', 0, 'i', &(cmd.ghostDensity), 0,             "compute EAM densities of ghost atoms redundantly");
+   addArg("overlap",    'O', 0, 'i',  &(cmd.overlapHalo),  0,             "overlap halo exchanges with force computation");
+   addArg("haloMode",   'E', 1, 's',  cmd.haloMode,  sizeof(cmd.haloMode), "halo exchange mode (axes, direct, or neighbor)");
+   addArg("sharedHalo", 'S', 0, 'i',  &(cmd.sharedHalo),   0,             "read halo data of on-node neighbors from shared memory");
+   addArg("rankMap",    'R', 1, 's',  cmd.rankMap,   sizeof(cmd.rankMap), "placement of ranks on the processor grid (xyz, cart, or node)");
+   addArg("balance",    'b', 1, 'i',  &(cmd.balance),      0,             "number of steps between load balancing (0 for none)");
+   addArg("boxOrder",   'B', 1, 's',  cmd.boxOrder,  sizeof(cmd.boxOrder), "storage order of the link cells (xyz, morton, or hilbert)");
+   addArg("cellsPerCutoff", 'C', 1, 'i', &(cmd.cellsPerCutoff), 0,         "number of link cells per cutoff distance");
 
    processArgs(argc,argv);
 
@@ -271,6 +427,17 @@ void printCmdYaml(FILE* file, Command* cmd)
            "  Time step: %g fs\n"
            "  Initial Temperature: %g K\n"
            "  Initial Delta: %g Angstroms\n"
+           "  Neighbor lists: %d\n"
+           "  Neighbor list skin: %g Angstroms\n"
+           "  EAM pair cache: %d\n"
+           "  EAM ghost densities: %d\n"
+           "  Overlap halo exchange: %d\n"
+           "  Halo exchange mode: %s\n"
+           "  Shared memory halo: %d\n"
+           "  Rank map: %s\n"
+           "  Load balancing rate: %d\n"
+           "  Box order: %s\n"
+           "  Cells per cutoff: %d\n"
            "\n",
            cmd->doeam,
            cmd->potDir,
@@ -283,7 +450,18 @@ void printCmdYaml(FILE* file, Command* cmd)
            cmd->printRate,
            cmd->dt,
            cmd->temperature,
-           cmd->initialDelta
+           cmd->initialDelta,
+           cmd->useNbrList,
+           cmd->skin,
+           cmd->pairCache,
+           cmd->ghostDensity,
+           cmd->overlapHalo,
+           cmd->haloMode,
+           cmd->sharedHalo,
+           cmd->rankMap,
+           cmd->balance,
+           cmd->boxOrder,
+           cmd->cellsPerCutoff
    );
    fflush(file);
 }
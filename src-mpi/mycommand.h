@@ -26,6 +26,17 @@ typedef struct CommandSt
    double lat;         //!< lattice constant (in Angstroms)
    double temperature; //!< simulation initial temperature (in Kelvin)
    double initialDelta; //!< magnitude of initial displacement from lattice (in Angstroms)
+   int useNbrList;     //!< a flag to determine whether we're using neighbor lists
+   double skin;        //!< neighbor list skin distance (in Angstroms)
+   int pairCache;      //!< a flag to cache EAM pair data between force passes
+   int ghostDensity;   //!< a flag to compute EAM ghost densities redundantly
+   int overlapHalo;    //!< a flag to overlap halo exchanges with force computation
+   char haloMode[1024]; //!< halo exchange mode (axes, direct, or neighbor)
+   int sharedHalo;     //!< a flag to read halo data of on-node neighbors from shared memory
+   char rankMap[1024]; //!< placement of ranks on the processor grid (xyz, cart, or node)
+   int balance;        //!< number of steps between load balancing (0 for none)
+   char boxOrder[1024]; //!< storage order of the link cells (xyz, morton, or hilbert)
+   int cellsPerCutoff; //!< number of link cells per cutoff distance along each axis
 } Command;
 
 /// Process command line arguments into an easy to handle structure.
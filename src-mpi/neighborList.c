@@ -0,0 +1,207 @@
+/// \file
+/// Verlet neighbor lists for the force kernels.
+///
+/// With link cells alone, every force evaluation tests every atom in
+/// the 27 neighboring boxes against the cutoff.  Since the boxes are at
+/// least as large as the cutoff, only about 15% of these candidate
+/// pairs are actually within range.  A Verlet list stores, for each
+/// local atom, the atoms within a slightly larger distance (the cutoff
+/// plus a "skin").  As long as no atom has moved more than half the
+/// skin, every pair that is inside the cutoff must already be on the
+/// list, so the force routines can loop over the list instead of the
+/// link cells.
+///
+/// The lists store atom indices, not atom ids.  Hence they are only
+/// valid as long as atoms stay in the same storage locations.  When
+/// lists are enabled, redistributeAtoms() only moves atoms between link
+/// cells (and tasks) when the lists are rebuilt.  On all other steps it
+/// merely refreshes the positions of the ghost atoms, keeping their
+/// storage order fixed (see updateGhostPositions()).  Consequently the
+/// link cells must be sized by the list cutoff (cutoff+skin) instead of
+/// the potential cutoff.
+///
+/// The lists are half lists: each local-local pair appears once.  Pairs
+/// of a local and a halo atom appear in the row of the local atom.
+/// This is the same set of pairs visited by the link cell kernels, so
+/// energies and forces are computed the same way in both cases.
+///
+/// The neighbor indices of all rows are stored in a single contiguous
+/// arena (compressed sparse row format).  The arena and the rows grow
+/// on demand.
+
+#include "neighborList.h"
+
+#include <assert.h>
+
+#include "CoMDTypes.h"
+#include "linkCells.h"
+#include "parallel.h"
+#include "memUtils.h"
+#include "performanceTimers.h"
+
+/// The storage is allocated by the first build.
+/// \param [in] cutoff The potential cutoff.
+/// \param [in] skin   Extra distance beyond the cutoff included in the lists.
+NeighborList* initNeighborList(real_t cutoff, real_t skin)
+{
+   NeighborList* nbrList = comdMalloc(sizeof(NeighborList));
+   nbrList->skin = skin;
+   nbrList->cutoff = cutoff + skin;
+
+   nbrList->nRows = 0;
+   nbrList->maxRows = 0;
+   nbrList->iOff   = NULL;
+   nbrList->start  = comdMalloc(sizeof(int));
+   nbrList->rBuild = NULL;
+   nbrList->start[0] = 0;
+
+   nbrList->nPairs = 0;
+   nbrList->capacity = 0;
+   nbrList->nbrs = NULL;
+
+   nbrList->forceRebuild = 1;
+   nbrList->nBuilds = 0;
+
+   return nbrList;
+}
+
+void destroyNeighborList(NeighborList** nbrList)
+{
+   if (! nbrList) return;
+   if (! *nbrList) return;
+
+   comdFree((*nbrList)->iOff);
+   comdFree((*nbrList)->start);
+   comdFree((*nbrList)->rBuild);
+   comdFree((*nbrList)->nbrs);
+   comdFree(*nbrList);
+   *nbrList = NULL;
+}
+
+/// \details
+/// Loops over the same box pairs as the link cell force kernels and
+/// stores every pair closer than the list cutoff.  A local-local pair
+/// is stored in the row of the atom in the box with the lower index (or
+/// the lower slot if both are in the same box).  Since halo boxes are
+/// numbered after all local boxes, this rule also places every
+/// local-halo pair in the row of the local atom.
+///
+/// Positions at the time of the build are saved so that
+/// neighborListNeedsRebuild can find the maximum displacement.
+///
+/// There is one row per local atom.  The rows get some headroom when
+/// they grow, and the arena starts out with a guess of 32 neighbors per
+/// row.
+void buildNeighborList(NeighborList* nbrList, LinkCell* boxes, Atoms* atoms)
+{
+   real_t rCut2 = nbrList->cutoff*nbrList->cutoff;
+   int nbrBoxes[MAX_NBR_BOXES];
+
+   if (atoms->nLocal > nbrList->maxRows)
+   {
+      nbrList->maxRows = atoms->nLocal + atoms->nLocal/8;
+      nbrList->iOff   = comdRealloc(nbrList->iOff,   nbrList->maxRows*sizeof(int));
+      nbrList->start  = comdRealloc(nbrList->start,  (nbrList->maxRows+1)*sizeof(int));
+      nbrList->rBuild = comdRealloc(nbrList->rBuild, nbrList->maxRows*sizeof(real3));
+   }
+   if (nbrList->capacity < 32*nbrList->maxRows)
+   {
+      nbrList->capacity = 32*nbrList->maxRows;
+      nbrList->nbrs = comdRealloc(nbrList->nbrs, nbrList->capacity*sizeof(int));
+   }
+
+   int nRows = 0;
+   int nPairs = 0;
+   for (int iBox=0; iBox<boxes->nLocalBoxes; iBox++)
+   {
+      int nIBox = boxes->nAtoms[iBox];
+      if (nIBox == 0) continue;
+      int nNbrBoxes = getNeighborBoxes(boxes, iBox, nbrBoxes);
+      int nCandidates = 0;
+      for (int jTmp=0; jTmp<nNbrBoxes; jTmp++)
+         nCandidates += boxes->nAtoms[nbrBoxes[jTmp]];
+
+      for (int iOff=boxes->boxOffset[iBox],ii=0; ii<nIBox; ii++,iOff++)
+      {
+         // make sure the arena can hold the longest possible row.
+         if (nPairs + nCandidates > nbrList->capacity)
+         {
+            nbrList->capacity = 2*nbrList->capacity + nCandidates;
+            nbrList->nbrs = comdRealloc(nbrList->nbrs, nbrList->capacity*sizeof(int));
+            assert(nbrList->nbrs);
+         }
+
+         assert(nRows < nbrList->maxRows);
+         nbrList->iOff[nRows] = iOff;
+         nbrList->start[nRows] = nPairs;
+         for (int m=0; m<3; m++)
+            nbrList->rBuild[nRows][m] = atoms->r[iOff][m];
+
+         for (int jTmp=0; jTmp<nNbrBoxes; jTmp++)
+         {
+            int jBox = nbrBoxes[jTmp];
+            if (jBox < iBox) continue;
+
+            int nJBox = boxes->nAtoms[jBox];
+            int jBegin = (jBox == iBox) ? ii+1 : 0;
+            for (int jOff=boxes->boxOffset[jBox]+jBegin,ij=jBegin; ij<nJBox; ij++,jOff++)
+            {
+               real_t r2 = 0.0;
+               for (int m=0; m<3; m++)
+               {
+                  real_t dr = atoms->r[iOff][m] - atoms->r[jOff][m];
+                  r2 += dr*dr;
+               }
+               if (r2 > rCut2) continue;
+               nbrList->nbrs[nPairs++] = jOff;
+            }
+         }
+         ++nRows;
+      }
+   }
+   nbrList->start[nRows] = nPairs;
+   nbrList->nRows = nRows;
+   nbrList->nPairs = nPairs;
+   nbrList->forceRebuild = 0;
+   nbrList->nBuilds++;
+}
+
+/// \details
+/// The lists remain valid as long as no pair of atoms has closed the
+/// skin distance, i.e., as long as no atom has moved more than half
+/// the skin since the last build.  Since ghost atoms are displaced by
+/// their owners, the maximum displacement must be reduced over all
+/// ranks.
+int neighborListNeedsRebuild(NeighborList* nbrList, Atoms* atoms)
+{
+   int rebuild = nbrList->forceRebuild;
+
+   real_t maxDr2 = 0.0;
+   #pragma omp parallel for reduction(max:maxDr2)
+   for (int iRow=0; iRow<nbrList->nRows; ++iRow)
+   {
+      int iOff = nbrList->iOff[iRow];
+      real_t dr2 = 0.0;
+      for (int m=0; m<3; m++)
+      {
+         real_t dr = atoms->r[iOff][m] - nbrList->rBuild[iRow][m];
+         dr2 += dr*dr;
+      }
+      if (dr2 > maxDr2) maxDr2 = dr2;
+   }
+   real_t halfSkin = 0.5*nbrList->skin;
+   if (maxDr2 > halfSkin*halfSkin)
+      rebuild = 1;
+
+   int anyRebuild;
+   startTimer(commReduceTimer);
+   maxIntParallel(&rebuild, &anyRebuild, 1);
+   stopTimer(commReduceTimer);
+
+   return anyRebuild;
+}
+
+void invalidateNeighborList(NeighborList* nbrList)
+{
+   nbrList->forceRebuild = 1;
+}
@@ -0,0 +1,51 @@
+/// \file
+/// Verlet neighbor lists for the force kernels.
+
+#ifndef __NEIGHBOR_LIST_H_
+#define __NEIGHBOR_LIST_H_
+
+#include "mytype.h"
+
+struct SimFlatSt;
+struct LinkCellSt;
+struct AtomsSt;
+
+/// Half neighbor lists for all local atoms, stored in compressed sparse
+/// row (CSR) form.  Row iRow belongs to the local atom stored at
+/// atoms index iOff[iRow].  Its neighbors are the atom indices
+/// nbrs[start[iRow]] through nbrs[start[iRow+1]-1].  Each local-local
+/// pair is stored exactly once.  Every pair of a local atom with a halo
+/// atom is stored in the row of the local atom.
+typedef struct NeighborListSt
+{
+   real_t skin;       //!< skin distance beyond the potential cutoff
+   real_t cutoff;     //!< list cutoff: potential cutoff + skin
+
+   int nRows;         //!< number of local atoms with a list
+   int maxRows;       //!< allocated length of iOff and rBuild
+   int* iOff;         //!< atom index of the local atom for each row
+   int* start;        //!< offset of each row into nbrs (nRows+1 values)
+   real3* rBuild;     //!< position of each row atom at last rebuild
+
+   int nPairs;        //!< number of pairs stored in nbrs
+   int capacity;      //!< allocated length of nbrs
+   int* nbrs;         //!< the neighbor index arena
+
+   int forceRebuild;  //!< if non-zero, next check forces a rebuild
+   int nBuilds;       //!< number of times the lists have been built
+} NeighborList;
+
+NeighborList* initNeighborList(real_t cutoff, real_t skin);
+void destroyNeighborList(NeighborList** nbrList);
+
+/// Build the lists from the link cells and current positions.
+void buildNeighborList(NeighborList* nbrList, struct LinkCellSt* boxes, struct AtomsSt* atoms);
+
+/// Return non-zero (on all ranks) if any atom has moved more than half
+/// the skin since the lists were built.
+int neighborListNeedsRebuild(NeighborList* nbrList, struct AtomsSt* atoms);
+
+/// Force the next call to neighborListNeedsRebuild to return true.
+void invalidateNeighborList(NeighborList* nbrList);
+
+#endif
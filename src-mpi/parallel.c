@@ -4,21 +4,77 @@
 /// serial version of the code with no MPI, do not define DO_MPI.  If
 /// DO_MPI is not defined then all MPI functionality is replaced with
 /// equivalent single task behavior.
+///
+/// The code may also be built with OpenMP (DO_OPENMP in the Makefile),
+/// in which case every rank runs threads over its link cells.  Only the
+/// master thread calls MPI, and only outside of parallel regions, so
+/// MPI is initialized with MPI_THREAD_FUNNELED.  The OpenMP runtime
+/// calls are wrapped here as well so that the rest of the code builds
+/// with or without OpenMP.
 
 #include "parallel.h"
 
 #ifdef DO_MPI
 #include <mpi.h>
 #endif
+#if defined(DO_MPI) && MPI_VERSION >= 3
+#define HAVE_NEIGHBOR_COLLECTIVES
+#define HAVE_NONBLOCKING_COLLECTIVES
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include <stdio.h>
 #include <time.h>
 #include <string.h>
 #include <assert.h>
 
+#include "memUtils.h"
+
 static int myRank = 0;
 static int nRanks = 1;
 
+/// A send and a receive started by startSendReceiveParallel.
+struct CommRequestSt
+{
+#ifdef DO_MPI
+   MPI_Request request[2]; //!< receive, send
+#endif
+   int nBytes;             //!< bytes received, valid once done
+   int done;               //!< non-zero once both messages completed
+};
+
+/// A reduction started by startAddDoubleParallel.
+struct ReduceRequestSt
+{
+#ifdef HAVE_NONBLOCKING_COLLECTIVES
+   MPI_Request request;    //!< the allreduce in flight
+#endif
+   int done;               //!< non-zero unless a reduction is in flight
+};
+
+/// A window of memory shared by the tasks of a node.
+struct SharedBufferSt
+{
+#ifdef HAVE_NEIGHBOR_COLLECTIVES
+   MPI_Win win;            //!< shared window, locked for all ranks
+   MPI_Comm nodeComm;      //!< the tasks of this node
+#endif
+   char* base;             //!< the calling task's part
+};
+
+/// A graph communicator for startNeighborExchange.
+struct NeighborCommSt
+{
+#ifdef HAVE_NEIGHBOR_COLLECTIVES
+   MPI_Comm comm;          //!< one edge per block, in block order
+   MPI_Request request;    //!< the alltoallv in flight
+#endif
+   int nNbrs;              //!< number of blocks
+   int done;               //!< non-zero unless an exchange is in flight
+};
+
 #ifdef DO_MPI
 #ifdef SINGLE
 #define REAL_MPI_TYPE MPI_FLOAT
@@ -38,6 +94,24 @@ int getMyRank()
    return myRank;
 }
 
+int getNThreads()
+{
+#ifdef _OPENMP
+   return omp_get_max_threads();
+#else
+   return 1;
+#endif
+}
+
+int getMyThread()
+{
+#ifdef _OPENMP
+   return omp_get_thread_num();
+#else
+   return 0;
+#endif
+}
+
 /// \details
 /// For now this is just a check for rank 0 but in principle it could be
 /// more complex.  It is also possible to suppress practically all
@@ -63,9 +137,18 @@ void timestampBarrier(const char* msg)
 void initParallel(int* argc, char*** argv)
 {
 #ifdef DO_MPI
+#ifdef _OPENMP
+   int provided;
+   MPI_Init_thread(argc, argv, MPI_THREAD_FUNNELED, &provided);
+#else
    MPI_Init(argc, argv);
+#endif
    MPI_Comm_rank(MPI_COMM_WORLD, &myRank);
    MPI_Comm_size(MPI_COMM_WORLD, &nRanks);
+#ifdef _OPENMP
+   if (provided < MPI_THREAD_FUNNELED && printRank())
+      fprintf(screenOut, "WARNING: MPI does not support MPI_THREAD_FUNNELED\n");
+#endif
 #endif
 }
 
@@ -90,6 +173,32 @@ void barrierParallel()
 /// \param [in]  recvLen Maximum number of bytes to receive.
 /// \param [in]  source  Rank in MPI_COMM_WORLD from which to receive.
 /// \return Number of bytes received.
+/// \details
+/// Memory from MPI_Alloc_mem may be registered with the network card
+/// (or come from a pool of pinned pages) so that messages sent from it
+/// need no intermediate copy.  Intended for buffers that are allocated
+/// once and used for many messages.
+void* allocCommBuffer(int size)
+{
+#ifdef DO_MPI
+   void* buf;
+   MPI_Alloc_mem(size, MPI_INFO_NULL, &buf);
+   return buf;
+#else
+   return comdMalloc(size);
+#endif
+}
+
+void freeCommBuffer(void* buf)
+{
+   if (! buf) return;
+#ifdef DO_MPI
+   MPI_Free_mem(buf);
+#else
+   comdFree(buf);
+#endif
+}
+
 int sendReceiveParallel(void* sendBuf, int sendLen, int dest,
                         void* recvBuf, int recvLen, int source)
 {
@@ -110,6 +219,314 @@ int sendReceiveParallel(void* sendBuf, int sendLen, int dest,
 #endif
 }
 
+CommRequest* initCommRequest(void)
+{
+   CommRequest* req = comdMalloc(sizeof(CommRequest));
+   req->nBytes = 0;
+   req->done = 1;
+   return req;
+}
+
+void destroyCommRequest(CommRequest** req)
+{
+   if (! *req) return;
+   assert((*req)->done);
+   comdFree(*req);
+   *req = NULL;
+}
+
+/// \details
+/// The receive is posted before the send.  The tag distinguishes the
+/// two messages of an axis when both neighbors are the same rank.
+void startSendReceiveParallel(CommRequest* req,
+                              void* sendBuf, int sendLen, int dest,
+                              void* recvBuf, int recvLen, int source, int tag)
+{
+   assert(req->done);
+   req->done = 0;
+#ifdef DO_MPI
+   if (dest < 0)   dest = MPI_PROC_NULL;
+   if (source < 0) source = MPI_PROC_NULL;
+   MPI_Irecv(recvBuf, recvLen, MPI_BYTE, source, tag, MPI_COMM_WORLD, &req->request[0]);
+   MPI_Isend(sendBuf, sendLen, MPI_BYTE, dest,   tag, MPI_COMM_WORLD, &req->request[1]);
+#else
+   assert(source == dest);
+   req->nBytes = 0;
+   if (dest >= 0)
+   {
+      memcpy(recvBuf, sendBuf, sendLen);
+      req->nBytes = sendLen;
+   }
+   req->done = 1;
+#endif
+}
+
+int testSendReceiveParallel(CommRequest* req)
+{
+#ifdef DO_MPI
+   if (! req->done)
+   {
+      int flag;
+      MPI_Status status[2];
+      MPI_Testall(2, req->request, &flag, status);
+      if (flag)
+      {
+         MPI_Get_count(&status[0], MPI_BYTE, &req->nBytes);
+         req->done = 1;
+      }
+   }
+#endif
+   return req->done;
+}
+
+int waitSendReceiveParallel(CommRequest* req)
+{
+#ifdef DO_MPI
+   if (! req->done)
+   {
+      MPI_Status status[2];
+      MPI_Waitall(2, req->request, status);
+      MPI_Get_count(&status[0], MPI_BYTE, &req->nBytes);
+      req->done = 1;
+   }
+#endif
+   return req->nBytes;
+}
+
+/// \details
+/// Neighborhood collectives need MPI 3.  Without MPI all neighbors are
+/// this task and the exchange is a copy.
+int neighborCommAvailable(void)
+{
+#if defined(HAVE_NEIGHBOR_COLLECTIVES) || ! defined(DO_MPI)
+   return 1;
+#else
+   return 0;
+#endif
+}
+
+/// \details
+/// A Cartesian communicator only knows the six face neighbors, so the
+/// topology is given as a distributed graph instead.  The same rank
+/// may appear several times in dest and source (e.g., with only one or
+/// two tasks along an axis).  MPI matches such duplicate edges in the
+/// order they are listed, so block ii of the sender must be listed in
+/// the same position among its edges to the receiver as the receiver
+/// lists the matching edge among its edges from the sender.  The ranks
+/// are not reordered.  The edges are given unit weights rather than
+/// MPI_UNWEIGHTED, which some compilers mistake for a real array and
+/// warn about reading past its end.
+NeighborComm* initNeighborComm(int nNbrs, const int* dest, const int* source)
+{
+   assert(neighborCommAvailable());
+   NeighborComm* nc = comdMalloc(sizeof(NeighborComm));
+   nc->nNbrs = nNbrs;
+   nc->done = 1;
+#ifdef HAVE_NEIGHBOR_COLLECTIVES
+   int* weights = comdMalloc((nNbrs > 0 ? nNbrs : 1)*sizeof(int));
+   for (int ii=0; ii<nNbrs; ++ii)
+      weights[ii] = 1;
+   MPI_Dist_graph_create_adjacent(MPI_COMM_WORLD,
+                                  nNbrs, source, weights,
+                                  nNbrs, dest,   weights,
+                                  MPI_INFO_NULL, 0, &nc->comm);
+   comdFree(weights);
+#else
+   for (int ii=0; ii<nNbrs; ++ii)
+      assert(dest[ii] == source[ii]);
+#endif
+   return nc;
+}
+
+void destroyNeighborComm(NeighborComm** nc)
+{
+   if (! *nc) return;
+   assert((*nc)->done);
+#ifdef HAVE_NEIGHBOR_COLLECTIVES
+   MPI_Comm_free(&(*nc)->comm);
+#endif
+   comdFree(*nc);
+   *nc = NULL;
+}
+
+/// \details
+/// The receiver does not know the block sizes in advance, so they are
+/// exchanged first with a blocking collective of one int per block.
+void exchangeNeighborLengths(NeighborComm* nc, int* sendLen, int* recvLen)
+{
+#ifdef HAVE_NEIGHBOR_COLLECTIVES
+   MPI_Neighbor_alltoall(sendLen, 1, MPI_INT, recvLen, 1, MPI_INT, nc->comm);
+#else
+   for (int ii=0; ii<nc->nNbrs; ++ii)
+      recvLen[ii] = sendLen[ii];
+#endif
+}
+
+/// \details
+/// The displacements are in bytes.
+void startNeighborExchange(NeighborComm* nc,
+                           void* sendBuf, int* sendLen, int* sendDispl,
+                           void* recvBuf, int* recvLen, int* recvDispl)
+{
+   assert(nc->done);
+#ifdef HAVE_NEIGHBOR_COLLECTIVES
+   MPI_Ineighbor_alltoallv(sendBuf, sendLen, sendDispl, MPI_BYTE,
+                           recvBuf, recvLen, recvDispl, MPI_BYTE,
+                           nc->comm, &nc->request);
+   nc->done = 0;
+#else
+   for (int ii=0; ii<nc->nNbrs; ++ii)
+   {
+      assert(recvLen[ii] == sendLen[ii]);
+      memcpy((char*)recvBuf+recvDispl[ii], (char*)sendBuf+sendDispl[ii], sendLen[ii]);
+   }
+#endif
+}
+
+int testNeighborExchange(NeighborComm* nc)
+{
+#ifdef HAVE_NEIGHBOR_COLLECTIVES
+   if (! nc->done)
+      MPI_Test(&nc->request, &nc->done, MPI_STATUS_IGNORE);
+#endif
+   return nc->done;
+}
+
+void waitNeighborExchange(NeighborComm* nc)
+{
+#ifdef HAVE_NEIGHBOR_COLLECTIVES
+   if (! nc->done)
+      MPI_Wait(&nc->request, MPI_STATUS_IGNORE);
+   nc->done = 1;
+#endif
+}
+
+/// \details
+/// Shared memory windows need MPI 3, just like neighborhood
+/// collectives.  Without MPI there is nobody to share with and the
+/// buffer is plain memory.
+int sharedBufferAvailable(void)
+{
+   return neighborCommAvailable();
+}
+
+/// \details
+/// The node communicator is split off MPI_COMM_WORLD with
+/// MPI_COMM_TYPE_SHARED.  Each task's part is allowed to be non
+/// contiguous with those of the other tasks so that the library can
+/// page align it (and place it near the task).  The window is locked
+/// for all ranks for its whole life time.  Synchronization is up to the
+/// caller (see syncSharedBuffer).
+SharedBuffer* initSharedBuffer(int size)
+{
+   assert(sharedBufferAvailable());
+   SharedBuffer* sb = comdMalloc(sizeof(SharedBuffer));
+#ifdef HAVE_NEIGHBOR_COLLECTIVES
+   MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, myRank,
+                       MPI_INFO_NULL, &sb->nodeComm);
+   MPI_Info info;
+   MPI_Info_create(&info);
+   MPI_Info_set(info, "alloc_shared_noncontig", "true");
+   MPI_Win_allocate_shared(size, 1, info, sb->nodeComm, &sb->base, &sb->win);
+   MPI_Info_free(&info);
+   MPI_Win_lock_all(MPI_MODE_NOCHECK, sb->win);
+#else
+   sb->base = comdMalloc(size);
+#endif
+   return sb;
+}
+
+void destroySharedBuffer(SharedBuffer** sb)
+{
+   if (! *sb) return;
+#ifdef HAVE_NEIGHBOR_COLLECTIVES
+   MPI_Win_unlock_all((*sb)->win);
+   MPI_Win_free(&(*sb)->win);
+   MPI_Comm_free(&(*sb)->nodeComm);
+#else
+   comdFree((*sb)->base);
+#endif
+   comdFree(*sb);
+   *sb = NULL;
+}
+
+char* sharedBufferBase(SharedBuffer* sb)
+{
+   return sb->base;
+}
+
+char* sharedBufferOfRank(SharedBuffer* sb, int rank)
+{
+#ifdef HAVE_NEIGHBOR_COLLECTIVES
+   MPI_Group worldGroup, nodeGroup;
+   int nodeRank;
+   MPI_Comm_group(MPI_COMM_WORLD, &worldGroup);
+   MPI_Comm_group(sb->nodeComm, &nodeGroup);
+   MPI_Group_translate_ranks(worldGroup, 1, &rank, nodeGroup, &nodeRank);
+   MPI_Group_free(&nodeGroup);
+   MPI_Group_free(&worldGroup);
+   if (nodeRank == MPI_UNDEFINED)
+      return NULL;
+   MPI_Aint size;
+   int dispUnit;
+   char* ptr;
+   MPI_Win_shared_query(sb->win, nodeRank, &size, &dispUnit, &ptr);
+   return ptr;
+#else
+   assert(rank == myRank);
+   return sb->base;
+#endif
+}
+
+void syncSharedBuffer(SharedBuffer* sb)
+{
+#ifdef HAVE_NEIGHBOR_COLLECTIVES
+   MPI_Win_sync(sb->win);
+#endif
+}
+
+ReduceRequest* initReduceRequest(void)
+{
+   ReduceRequest* req = comdMalloc(sizeof(ReduceRequest));
+   req->done = 1;
+   return req;
+}
+
+void destroyReduceRequest(ReduceRequest** req)
+{
+   if (! *req) return;
+   assert((*req)->done);
+   comdFree(*req);
+   *req = NULL;
+}
+
+/// \details
+/// Nonblocking collectives need MPI 3.  With an older MPI the sum is
+/// computed right away and the wait only marks it done.
+void startAddDoubleParallel(ReduceRequest* req,
+                            double* sendBuf, double* recvBuf, int count)
+{
+   assert(req->done);
+   req->done = 0;
+#ifdef HAVE_NONBLOCKING_COLLECTIVES
+   MPI_Iallreduce(sendBuf, recvBuf, count, MPI_DOUBLE, MPI_SUM,
+                  MPI_COMM_WORLD, &req->request);
+#else
+   addDoubleParallel(sendBuf, recvBuf, count);
+#endif
+}
+
+int waitReduceParallel(ReduceRequest* req)
+{
+   if (req->done)
+      return 0;
+#ifdef HAVE_NONBLOCKING_COLLECTIVES
+   MPI_Wait(&req->request, MPI_STATUS_IGNORE);
+#endif
+   req->done = 1;
+   return 1;
+}
+
 void addIntParallel(int* sendBuf, int* recvBuf, int count)
 {
 #ifdef DO_MPI
@@ -140,6 +557,76 @@ void addDoubleParallel(double* sendBuf, double* recvBuf, int count)
 #endif
 }
 
+void gatherIntParallel(int* sendBuf, int* recvBuf, int count)
+{
+#ifdef DO_MPI
+   MPI_Allgather(sendBuf, count, MPI_INT, recvBuf, count, MPI_INT, MPI_COMM_WORLD);
+#else
+   for (int ii=0; ii<count; ++ii)
+      recvBuf[ii] = sendBuf[ii];
+#endif
+}
+
+void allToAllIntParallel(int* sendBuf, int* recvBuf, int count)
+{
+#ifdef DO_MPI
+   MPI_Alltoall(sendBuf, count, MPI_INT, recvBuf, count, MPI_INT, MPI_COMM_WORLD);
+#else
+   for (int ii=0; ii<count; ++ii)
+      recvBuf[ii] = sendBuf[ii];
+#endif
+}
+
+void allToAllParallel(void* sendBuf, int* sendLen, int* sendDispl,
+                      void* recvBuf, int* recvLen, int* recvDispl)
+{
+#ifdef DO_MPI
+   MPI_Alltoallv(sendBuf, sendLen, sendDispl, MPI_BYTE,
+                 recvBuf, recvLen, recvDispl, MPI_BYTE, MPI_COMM_WORLD);
+#else
+   memcpy((char*)recvBuf+recvDispl[0], (char*)sendBuf+sendDispl[0], sendLen[0]);
+#endif
+}
+
+/// \details
+/// The node is the shared memory domain of MPI_COMM_TYPE_SHARED.
+/// Without MPI 3 every task counts as a node of its own.
+int getMyNode(void)
+{
+#ifdef HAVE_NEIGHBOR_COLLECTIVES
+   MPI_Comm nodeComm;
+   int node;
+   MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, myRank,
+                       MPI_INFO_NULL, &nodeComm);
+   MPI_Allreduce(&myRank, &node, 1, MPI_INT, MPI_MIN, nodeComm);
+   MPI_Comm_free(&nodeComm);
+   return node;
+#else
+   return myRank;
+#endif
+}
+
+/// \details
+/// The Cartesian communicator is used only to let the MPI library pick
+/// the placement.  All communication still uses MPI_COMM_WORLD, so the
+/// caller must gather the coordinates of all tasks to find its
+/// neighbors.
+void cartCoordsParallel(const int dims[3], int coords[3])
+{
+#ifdef DO_MPI
+   int periods[3] = {1, 1, 1};
+   int cartDims[3] = {dims[0], dims[1], dims[2]};
+   MPI_Comm cart;
+   int cartRank;
+   MPI_Cart_create(MPI_COMM_WORLD, 3, cartDims, periods, 1, &cart);
+   MPI_Comm_rank(cart, &cartRank);
+   MPI_Cart_coords(cart, cartRank, 3, coords);
+   MPI_Comm_free(&cart);
+#else
+   coords[0] = coords[1] = coords[2] = 0;
+#endif
+}
+
 void maxIntParallel(int* sendBuf, int* recvBuf, int count)
 {
 #ifdef DO_MPI
@@ -194,4 +681,13 @@ int builtWithMpi(void)
 #endif
 }
 
+int builtWithOpenMP(void)
+{
+#ifdef _OPENMP
+   return 1;
+#else
+   return 0;
+#endif
+}
+
 
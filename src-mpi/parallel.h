@@ -19,6 +19,12 @@ int getNRanks(void);
 /// Return local rank.
 int getMyRank(void);
 
+/// Return the number of OpenMP threads per rank (1 without OpenMP).
+int getNThreads(void);
+
+/// Return the calling thread's number (0 without OpenMP).
+int getMyThread(void);
+
 /// Return non-zero if printing occurs from this rank.
 int printRank(void);
 
@@ -34,10 +40,105 @@ void destroyParallel(void);
 /// Wrapper for MPI_Barrier(MPI_COMM_WORLD).
 void barrierParallel(void);
 
+/// Wrapper for MPI_Alloc_mem.
+void* allocCommBuffer(int size);
+
+/// Wrapper for MPI_Free_mem.
+void freeCommBuffer(void* buf);
+
 /// Wrapper for MPI_Sendrecv.
 int sendReceiveParallel(void* sendBuf, int sendLen, int dest,
                         void* recvBuf, int recvLen, int source);
 
+/// Handle for a send and a receive that are in flight.
+typedef struct CommRequestSt CommRequest;
+
+/// Allocate a CommRequest.
+CommRequest* initCommRequest(void);
+
+/// Free a CommRequest.  It must not be in flight.
+void destroyCommRequest(CommRequest** req);
+
+/// Wrapper for MPI_Irecv and MPI_Isend.  A negative dest (source)
+/// means that nothing is sent (received).
+void startSendReceiveParallel(CommRequest* req,
+                              void* sendBuf, int sendLen, int dest,
+                              void* recvBuf, int recvLen, int source, int tag);
+
+/// Wrapper for MPI_Testall.  Returns non-zero if both messages are done.
+int testSendReceiveParallel(CommRequest* req);
+
+/// Wrapper for MPI_Waitall.  Returns the number of bytes received.
+int waitSendReceiveParallel(CommRequest* req);
+
+/// Handle for a neighborhood collective over a fixed set of neighbors.
+typedef struct NeighborCommSt NeighborComm;
+
+/// Return non-zero if this build supports NeighborComm.
+int neighborCommAvailable(void);
+
+/// Wrapper for MPI_Dist_graph_create_adjacent.  Block ii of an exchange
+/// is sent to dest[ii] and received from source[ii].
+NeighborComm* initNeighborComm(int nNbrs, const int* dest, const int* source);
+
+/// Free a NeighborComm.  No exchange may be in flight.
+void destroyNeighborComm(NeighborComm** nc);
+
+/// Wrapper for MPI_Neighbor_alltoall of one int per neighbor.
+void exchangeNeighborLengths(NeighborComm* nc, int* sendLen, int* recvLen);
+
+/// Wrapper for MPI_Ineighbor_alltoallv.  The number of bytes received
+/// in each block must be known (see exchangeNeighborLengths).
+void startNeighborExchange(NeighborComm* nc,
+                           void* sendBuf, int* sendLen, int* sendDispl,
+                           void* recvBuf, int* recvLen, int* recvDispl);
+
+/// Wrapper for MPI_Test.  Returns non-zero if the exchange is done.
+int testNeighborExchange(NeighborComm* nc);
+
+/// Wrapper for MPI_Wait.
+void waitNeighborExchange(NeighborComm* nc);
+
+/// Handle for a buffer that the tasks on the same node can read.
+typedef struct SharedBufferSt SharedBuffer;
+
+/// Return non-zero if this build supports SharedBuffer.
+int sharedBufferAvailable(void);
+
+/// Wrapper for MPI_Win_allocate_shared.  Collective over all tasks.
+SharedBuffer* initSharedBuffer(int size);
+
+/// Free a SharedBuffer.  Collective over all tasks.
+void destroySharedBuffer(SharedBuffer** sb);
+
+/// Return the calling task's part of the buffer.
+char* sharedBufferBase(SharedBuffer* sb);
+
+/// Wrapper for MPI_Win_shared_query.  Returns the part of the buffer
+/// that belongs to rank, or NULL if rank is on another node.
+char* sharedBufferOfRank(SharedBuffer* sb, int rank);
+
+/// Wrapper for MPI_Win_sync.  Call after writing the buffer and before
+/// telling others, and after being told and before reading.
+void syncSharedBuffer(SharedBuffer* sb);
+
+/// Handle for a reduction that is in flight.
+typedef struct ReduceRequestSt ReduceRequest;
+
+/// Allocate a ReduceRequest.
+ReduceRequest* initReduceRequest(void);
+
+/// Free a ReduceRequest.  It must not be in flight.
+void destroyReduceRequest(ReduceRequest** req);
+
+/// Wrapper for MPI_Iallreduce double sum.  Neither buffer may be
+/// touched until waitReduceParallel returns.
+void startAddDoubleParallel(ReduceRequest* req,
+                            double* sendBuf, double* recvBuf, int count);
+
+/// Wrapper for MPI_Wait.  Returns non-zero if a reduction was in flight.
+int waitReduceParallel(ReduceRequest* req);
+
 /// Wrapper for MPI_Allreduce integer sum.
 void addIntParallel(int* sendBuf, int* recvBuf, int count);
 
@@ -59,8 +160,31 @@ void maxRankDoubleParallel(RankReduceData* sendBuf, RankReduceData* recvBuf, int
 /// Wrapper for MPI_Bcast
 void bcastParallel(void* buf, int len, int root);
 
+/// Wrapper for MPI_Allgather of integers.  recvBuf holds count
+/// integers for each rank.
+void gatherIntParallel(int* sendBuf, int* recvBuf, int count);
+
+/// Wrapper for MPI_Alltoall of integers.  Block ii of sendBuf (count
+/// integers) goes to rank ii.
+void allToAllIntParallel(int* sendBuf, int* recvBuf, int count);
+
+/// Wrapper for MPI_Alltoallv.  Lengths and displacements are in bytes.
+void allToAllParallel(void* sendBuf, int* sendLen, int* sendDispl,
+                      void* recvBuf, int* recvLen, int* recvDispl);
+
+/// Return the lowest rank on the node of the calling task.
+int getMyNode(void);
+
+/// Wrapper for MPI_Cart_create (with reorder) and MPI_Cart_coords.
+/// Returns the coordinates of the calling task in a periodic grid of
+/// size dims.
+void cartCoordsParallel(const int dims[3], int coords[3]);
+
 ///  Return non-zero if code was built with MPI active.
 int builtWithMpi(void);
 
+///  Return non-zero if code was built with OpenMP active.
+int builtWithOpenMP(void);
+
 #endif
 
@@ -54,8 +54,10 @@ char* timerName[numberOfTimers] = {
    "  velocity",
    "  redistribute",
    "    atomHalo",
+   "    nbrList",
    "  force",
    "    eamHalo",
+   "balance",
    "commHalo",
    "commReduce",
    "chkptLoad",
@@ -262,50 +264,48 @@ static double getTick(void)
    return seconds_per_cycle; 
 }
 
-/// Collect timer statistics across ranks.
+/// Collect timer statistics across ranks.  The sums for the average
+/// and the standard deviation share one reduction, and the minimum is
+/// found as the maximum of the negated totals in the same reduction as
+/// the maximum.
 void timerStats(void)
 {
-   double sendBuf[numberOfTimers], recvBuf[numberOfTimers];
+   double sendBuf[2*numberOfTimers], recvBuf[2*numberOfTimers];
    
-   // Determine average of each timer across ranks
+   // Determine average and standard deviation of each timer across ranks
    for (int ii = 0; ii < numberOfTimers; ii++)
-      sendBuf[ii] = (double)perfTimer[ii].total;
-   addDoubleParallel(sendBuf, recvBuf, numberOfTimers);
+   {
+      double total = (double)perfTimer[ii].total;
+      sendBuf[ii] = total;
+      sendBuf[numberOfTimers+ii] = total * total;
+   }
+   addDoubleParallel(sendBuf, recvBuf, 2*numberOfTimers);
 
    for (int ii = 0; ii < numberOfTimers; ii++)
-      perfTimer[ii].average = recvBuf[ii] / (double)getNRanks();
-
+   {
+      double average = recvBuf[ii] / (double)getNRanks();
+      double variance = recvBuf[numberOfTimers+ii] / (double)getNRanks()
+                      - average * average;
+      perfTimer[ii].average = average;
+      perfTimer[ii].stdev = variance > 0.0 ? sqrt(variance) : 0.0;
+   }
 
    // Determine min and max across ranks and which rank
-   RankReduceData reduceSendBuf[numberOfTimers], reduceRecvBuf[numberOfTimers];
+   RankReduceData reduceSendBuf[2*numberOfTimers], reduceRecvBuf[2*numberOfTimers];
    for (int ii = 0; ii < numberOfTimers; ii++)
    {
-      reduceSendBuf[ii].val = (double)perfTimer[ii].total;
+      reduceSendBuf[ii].val = -(double)perfTimer[ii].total;
       reduceSendBuf[ii].rank = getMyRank();
+      reduceSendBuf[numberOfTimers+ii].val = (double)perfTimer[ii].total;
+      reduceSendBuf[numberOfTimers+ii].rank = getMyRank();
    }
-   minRankDoubleParallel(reduceSendBuf, reduceRecvBuf, numberOfTimers);   
+   maxRankDoubleParallel(reduceSendBuf, reduceRecvBuf, 2*numberOfTimers);
    for (int ii = 0; ii < numberOfTimers; ii++)
    {
-      perfTimer[ii].minValue = reduceRecvBuf[ii].val;
+      perfTimer[ii].minValue = -reduceRecvBuf[ii].val;
       perfTimer[ii].minRank = reduceRecvBuf[ii].rank;
-   }
-   maxRankDoubleParallel(reduceSendBuf, reduceRecvBuf, numberOfTimers);   
-   for (int ii = 0; ii < numberOfTimers; ii++)
-   {
-      perfTimer[ii].maxValue = reduceRecvBuf[ii].val;
-      perfTimer[ii].maxRank = reduceRecvBuf[ii].rank;
-   }
-   
-   // Determine standard deviation
-   for (int ii = 0; ii < numberOfTimers; ii++)
-   {
-      double temp = (double)perfTimer[ii].total - perfTimer[ii].average;
-      sendBuf[ii] = temp * temp;
-   }
-   addDoubleParallel(sendBuf, recvBuf, numberOfTimers);
-   for (int ii = 0; ii < numberOfTimers; ii++)
-   {
-      perfTimer[ii].stdev = sqrt(recvBuf[ii] / (double) getNRanks());
+      perfTimer[ii].maxValue = reduceRecvBuf[numberOfTimers+ii].val;
+      perfTimer[ii].maxRank = reduceRecvBuf[numberOfTimers+ii].rank;
    }
 }
 
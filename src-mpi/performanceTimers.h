@@ -14,8 +14,10 @@ enum TimerHandle{
    velocityTimer,  
    redistributeTimer, 
    atomHaloTimer, 
+   neighborListTimer, 
    computeForceTimer, 
    eamHaloTimer, 
+   balanceTimer,
    commHaloTimer, 
    commReduceTimer, 
    chkptLoadTimer,
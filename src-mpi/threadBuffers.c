@@ -0,0 +1,145 @@
+/// \file
+/// Per thread accumulation buffers for threaded half pair force loops.
+///
+/// The force kernels of this version use Newton's third law: each pair
+/// of atoms is visited once and updates both atoms.  When the loop over
+/// boxes (or neighbor list rows) is split across OpenMP threads, two
+/// threads may update the same atom at the same time.  To avoid the
+/// race, every thread but the master accumulates forces, energies, and
+/// densities in a private copy of the arrays.  After the pair loop the
+/// copies are added to the atom arrays in parallel.
+///
+/// The master thread writes to the atom arrays directly, so with a
+/// single thread no buffers are allocated and the kernels run exactly
+/// as in a pure MPI build.
+///
+/// The atom arrays change size as the link cells are rebuilt, so the
+/// force routines call fitThreadBuffers before their pair loops.
+///
+/// A kernel uses the buffers as follows:
+///
+///     #pragma omp parallel
+///     {
+///        real3* f = s->atoms->f;
+///        selectThreadBuffers(s->threadBuffers, &f, NULL, NULL);
+///        #pragma omp for
+///        for (...)
+///           ... f[iOff] ... f[jOff] ...
+///        reduceThreadBuffers(s->threadBuffers, s->boxes, s->atoms->f, NULL, NULL);
+///     }
+
+#include "threadBuffers.h"
+
+#include <assert.h>
+
+#include "linkCells.h"
+#include "parallel.h"
+#include "memUtils.h"
+
+/// Sets up one buffer for each thread but the first (as given by
+/// getNThreads()).  The buffers are empty until fitThreadBuffers is
+/// called.
+ThreadBuffers* initThreadBuffers(void)
+{
+   int nThreads = getNThreads();
+   if (nThreads < 2)
+      return NULL;
+
+   ThreadBuffers* tb = comdMalloc(sizeof(ThreadBuffers));
+   tb->nThreads = nThreads;
+   tb->nAtoms = 0;
+   tb->f   = NULL;
+   tb->U   = NULL;
+   tb->rho = NULL;
+   return tb;
+}
+
+/// \details
+/// Must be called outside of parallel regions, before a pair loop that
+/// may index atoms up to nAtoms.  The atom arrays grow and shrink as
+/// the link cells are rebuilt, so the buffers are given some headroom
+/// to avoid reallocating them every time step.  Since the buffers are
+/// zero, nothing needs to be copied.  Does nothing if tb is NULL.
+void fitThreadBuffers(ThreadBuffers* tb, int nAtoms)
+{
+   if (! tb || tb->nAtoms >= nAtoms)
+      return;
+   comdFree(tb->f);
+   comdFree(tb->U);
+   comdFree(tb->rho);
+   tb->nAtoms = nAtoms + nAtoms/8;
+   int n = (tb->nThreads-1)*tb->nAtoms;
+   tb->f   = comdCalloc(n, sizeof(real3));
+   tb->U   = comdCalloc(n, sizeof(real_t));
+   tb->rho = comdCalloc(n, sizeof(real_t));
+}
+
+void destroyThreadBuffers(ThreadBuffers** tb)
+{
+   if (! tb) return;
+   if (! *tb) return;
+   comdFree((*tb)->f);
+   comdFree((*tb)->U);
+   comdFree((*tb)->rho);
+   comdFree(*tb);
+   *tb = NULL;
+}
+
+/// \details
+/// Call inside a parallel region.  Does nothing for the master thread
+/// or if tb is NULL.  Any of f, U, and rho may be NULL.
+void selectThreadBuffers(ThreadBuffers* tb, real3** f, real_t** U, real_t** rho)
+{
+   int iThread = getMyThread();
+   if (! tb || iThread == 0)
+      return;
+   assert(iThread < tb->nThreads);
+   int tOff = (iThread-1)*tb->nAtoms;
+   if (f)   *f   = tb->f + tOff;
+   if (U)   *U   = tb->U + tOff;
+   if (rho) *rho = tb->rho + tOff;
+}
+
+/// \details
+/// Must be called by all threads of a parallel region after the pair
+/// loop has finished (the implicit barrier of an omp for is
+/// sufficient).  The work is shared over all boxes since halo atoms
+/// may have been written as well.  Any of U and rho may be NULL, in
+/// which case the corresponding buffers are skipped.  Those buffers
+/// must not have been written.  Does nothing if tb is NULL.
+void reduceThreadBuffers(ThreadBuffers* tb, LinkCell* boxes,
+                         real3* f, real_t* U, real_t* rho)
+{
+   if (! tb)
+      return;
+   int nBuffers = tb->nThreads-1;
+   int nAtoms = tb->nAtoms;
+   #pragma omp for
+   for (int iBox=0; iBox<boxes->nTotalBoxes; iBox++)
+   {
+      int nIBox = boxes->nAtoms[iBox];
+      int iBegin = boxes->boxOffset[iBox];
+      for (int iOff=iBegin; iOff<iBegin+nIBox; iOff++)
+      {
+         for (int iBuf=0; iBuf<nBuffers; iBuf++)
+         {
+            int tOff = iBuf*nAtoms + iOff;
+            for (int m=0; m<3; m++)
+            {
+               f[iOff][m] += tb->f[tOff][m];
+               tb->f[tOff][m] = 0.0;
+            }
+            if (U)
+            {
+               U[iOff] += tb->U[tOff];
+               tb->U[tOff] = 0.0;
+            }
+            if (rho)
+            {
+               rho[iOff] += tb->rho[tOff];
+               tb->rho[tOff] = 0.0;
+            }
+         }
+      }
+   }
+}
@@ -0,0 +1,39 @@
+/// \file
+/// Per thread accumulation buffers for threaded half pair force loops.
+
+#ifndef __THREAD_BUFFERS_H_
+#define __THREAD_BUFFERS_H_
+
+#include "mytype.h"
+
+struct LinkCellSt;
+
+/// Private copies of the per atom accumulators for threads 1 to
+/// nThreads-1.  Thread 0 accumulates directly into the atom arrays.
+/// The buffer of thread iThread starts at offset (iThread-1)*nAtoms in
+/// each array and is indexed like the atom arrays (local and halo
+/// atoms).  The buffers are kept zero between uses.
+typedef struct ThreadBuffersSt
+{
+   int nThreads;   //!< number of threads
+   int nAtoms;     //!< length of each thread buffer
+   real3* f;       //!< force buffers
+   real_t* U;      //!< energy buffers
+   real_t* rho;    //!< electron density buffers (EAM only)
+} ThreadBuffers;
+
+/// Returns NULL when running with a single thread.
+ThreadBuffers* initThreadBuffers(void);
+void destroyThreadBuffers(ThreadBuffers** tb);
+
+/// Make room in every buffer for nAtoms atoms.
+void fitThreadBuffers(ThreadBuffers* tb, int nAtoms);
+
+/// Point f, U, and rho to the calling thread's buffers.
+void selectThreadBuffers(ThreadBuffers* tb, real3** f, real_t** U, real_t** rho);
+
+/// Add the thread buffers into f, U, and rho, and clear them.
+void reduceThreadBuffers(ThreadBuffers* tb, struct LinkCellSt* boxes,
+                         real3* f, real_t* U, real_t* rho);
+
+#endif
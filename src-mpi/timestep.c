@@ -7,6 +7,7 @@
 #include "linkCells.h"
 #include "parallel.h"
 #include "performanceTimers.h"
+#include "haloExchange.h"
 
 static void advanceVelocity(SimFlat* s, int nBoxes, real_t dt);
 static void advancePosition(SimFlat* s, int nBoxes, real_t dt);
@@ -21,14 +22,20 @@ static void advancePosition(SimFlat* s, int nBoxes, real_t dt);
 ///  - Advance positions full time step using velocities
 ///  - Update link cells and exchange remote particles
 ///  - Compute forces
+///
+/// With \--overlap the exchange of remote particles is only started
+/// before the force computation, which completes it once the forces
+/// between inner link cells are done (see startRedistribution).
 ///  - Update velocities half time step using forces
 ///
 /// This leaves positions, velocities, and forces at t+dt, with the
 /// forces ready to perform the half step velocity update at the top of
 /// the next call.
 ///
-/// After nSteps the kinetic energy is computed for diagnostic output.
-double timestep(SimFlat* s, int nSteps, real_t dt)
+/// After nSteps the sums of the energies and the atom count are
+/// started for diagnostic output.  They are completed by
+/// finishEnergySums.
+void timestep(SimFlat* s, int nSteps, real_t dt)
 {
    for (int ii=0; ii<nSteps; ++ii)
    {
@@ -41,7 +48,7 @@ double timestep(SimFlat* s, int nSteps, real_t dt)
       stopTimer(positionTimer);
 
       startTimer(redistributeTimer);
-      redistributeAtoms(s);
+      startRedistribution(s);
       stopTimer(redistributeTimer);
 
       startTimer(computeForceTimer);
@@ -53,9 +60,7 @@ double timestep(SimFlat* s, int nSteps, real_t dt)
       stopTimer(velocityTimer);
    }
 
-   kineticEnergy(s);
-
-   return s->ePotential;
+   startEnergySums(s);
 }
 
 void computeForce(SimFlat* s)
@@ -66,9 +71,10 @@ void computeForce(SimFlat* s)
 
 void advanceVelocity(SimFlat* s, int nBoxes, real_t dt)
 {
+   #pragma omp parallel for
    for (int iBox=0; iBox<nBoxes; iBox++)
    {
-      for (int iOff=MAXATOMS*iBox,ii=0; ii<s->boxes->nAtoms[iBox]; ii++,iOff++)
+      for (int iOff=s->boxes->boxOffset[iBox],ii=0; ii<s->boxes->nAtoms[iBox]; ii++,iOff++)
       {
          s->atoms->p[iOff][0] += dt*s->atoms->f[iOff][0];
          s->atoms->p[iOff][1] += dt*s->atoms->f[iOff][1];
@@ -79,9 +85,10 @@ void advanceVelocity(SimFlat* s, int nBoxes, real_t dt)
 
 void advancePosition(SimFlat* s, int nBoxes, real_t dt)
 {
+   #pragma omp parallel for
    for (int iBox=0; iBox<nBoxes; iBox++)
    {
-      for (int iOff=MAXATOMS*iBox,ii=0; ii<s->boxes->nAtoms[iBox]; ii++,iOff++)
+      for (int iOff=s->boxes->boxOffset[iBox],ii=0; ii<s->boxes->nAtoms[iBox]; ii++,iOff++)
       {
          int iSpecies = s->atoms->iSpecies[iOff];
          real_t invMass = 1.0/s->species[iSpecies].mass;
@@ -96,28 +103,61 @@ void advancePosition(SimFlat* s, int nBoxes, real_t dt)
 /// local potential energy is a by-product of the force routine.
 void kineticEnergy(SimFlat* s)
 {
-   real_t eLocal[2];
-   eLocal[0] = s->ePotential;
-   eLocal[1] = 0;
+   startEnergySums(s);
+   finishEnergySums(s);
+}
+
+/// \details
+/// The local kinetic energy, the local potential energy, and the number
+/// of local atoms are summed with a single nonblocking reduction so
+/// that the diagnostics printed every printRate steps cost one
+/// collective.  The totals are not stored in s until finishEnergySums,
+/// which the main loop calls only when it needs them.  Any sums still
+/// in flight are completed and dropped first, since they would replace
+/// the local potential energy of a newer force call with an old total.
+void startEnergySums(SimFlat* s)
+{
+   startTimer(commReduceTimer);
+   waitReduceParallel(s->sumRequest);
+   stopTimer(commReduceTimer);
+
+   real_t kenergy = 0.0;
+   int nLocal = 0;
+   #pragma omp parallel for reduction(+:kenergy,nLocal)
    for (int iBox=0; iBox<s->boxes->nLocalBoxes; iBox++)
    {
-      for (int iOff=MAXATOMS*iBox,ii=0; ii<s->boxes->nAtoms[iBox]; ii++,iOff++)
+      nLocal += s->boxes->nAtoms[iBox];
+      for (int iOff=s->boxes->boxOffset[iBox],ii=0; ii<s->boxes->nAtoms[iBox]; ii++,iOff++)
       {
          int iSpecies = s->atoms->iSpecies[iOff];
          real_t invMass = 0.5/s->species[iSpecies].mass;
-         eLocal[1] += ( s->atoms->p[iOff][0] * s->atoms->p[iOff][0] +
+         kenergy += ( s->atoms->p[iOff][0] * s->atoms->p[iOff][0] +
          s->atoms->p[iOff][1] * s->atoms->p[iOff][1] +
          s->atoms->p[iOff][2] * s->atoms->p[iOff][2] )*invMass;
       }
    }
+   s->atoms->nLocal = nLocal;
+
+   s->localSums[0] = s->ePotential;
+   s->localSums[1] = kenergy;
+   s->localSums[2] = nLocal;
+
+   startTimer(commReduceTimer);
+   startAddDoubleParallel(s->sumRequest, s->localSums, s->globalSums, 3);
+   stopTimer(commReduceTimer);
+}
 
-   real_t eSum[2];
+void finishEnergySums(SimFlat* s)
+{
    startTimer(commReduceTimer);
-   addRealParallel(eLocal, eSum, 2);
+   int wasInFlight = waitReduceParallel(s->sumRequest);
    stopTimer(commReduceTimer);
+   if (! wasInFlight)
+      return;
 
-   s->ePotential = eSum[0];
-   s->eKinetic = eSum[1];
+   s->ePotential = s->globalSums[0];
+   s->eKinetic = s->globalSums[1];
+   s->atoms->nGlobal = (int) s->globalSums[2];
 }
 
 /// \details
@@ -130,17 +170,100 @@ void kineticEnergy(SimFlat* s)
 /// - haloExchange (atom version): Sends atom data to remote tasks. 
 /// - sort: Sort the atoms.
 ///
+/// When neighbor lists are in use the atoms stay put between list
+/// rebuilds.  On those steps only the ghost positions are updated.
+/// When the lists must be rebuilt, a migration exchange that sends only
+/// the atoms that have left the local domain takes the place of the
+/// atom exchange.  It is followed by a ghost exchange that sends the
+/// ghost atoms (without momenta), records the communication pattern
+/// for subsequent position updates, and then the lists are rebuilt.
+/// Ghost atoms thus never travel with their full state.
+///
 /// \see updateLinkCells
 /// \see initAtomHaloExchange
+/// \see initMigrationHaloExchange
 /// \see sortAtomsInCell
+/// \see exchangeGhostAtoms
+/// \see updateGhostPositions
 void redistributeAtoms(SimFlat* sim)
 {
+   if (sim->nbrList && ! neighborListNeedsRebuild(sim->nbrList, sim->atoms))
+   {
+      startTimer(atomHaloTimer);
+      updateGhostPositions(sim->ghostExchange, sim);
+      stopTimer(atomHaloTimer);
+      return;
+   }
+
    updateLinkCells(sim->boxes, sim->atoms);
 
    startTimer(atomHaloTimer);
-   haloExchange(sim->atomExchange, sim);
+   if (sim->nbrList)
+      haloExchange(sim->migrateExchange, sim);
+   else
+      haloExchange(sim->atomExchange, sim);
    stopTimer(atomHaloTimer);
 
+   #pragma omp parallel for
    for (int ii=0; ii<sim->boxes->nTotalBoxes; ++ii)
       sortAtomsInCell(sim->atoms, sim->boxes, ii);
+
+   if (sim->nbrList)
+   {
+      startTimer(atomHaloTimer);
+      exchangeGhostAtoms(sim->ghostExchange, sim);
+      stopTimer(atomHaloTimer);
+
+      startTimer(neighborListTimer);
+      buildNeighborList(sim->nbrList, sim->boxes, sim->atoms);
+      stopTimer(neighborListTimer);
+   }
+}
+
+/// \details
+/// Same as redistributeAtoms, except that with \--overlap (and without
+/// neighbor lists) the atom exchange is only posted.  The atoms in the
+/// inner link cells (see isInnerBox) are final once the link cells are
+/// updated, so they are sorted while the first messages are in flight.
+/// The force routine must call finishRedistribution before it touches
+/// any other link cell.
+///
+/// \see postHaloExchange
+void startRedistribution(SimFlat* sim)
+{
+   if (! sim->overlapHalo || sim->nbrList)
+   {
+      redistributeAtoms(sim);
+      return;
+   }
+
+   updateLinkCells(sim->boxes, sim->atoms);
+
+   startTimer(atomHaloTimer);
+   postHaloExchange(sim->atomExchange, sim);
+   stopTimer(atomHaloTimer);
+
+   #pragma omp parallel for
+   for (int ii=0; ii<sim->boxes->nLocalBoxes; ++ii)
+      if (isInnerBox(sim->boxes, ii, ATOM_EXCHANGE_DEPTH))
+         sortAtomsInCell(sim->atoms, sim->boxes, ii);
+}
+
+/// Complete an atom exchange started by startRedistribution and sort
+/// the remaining link cells.  The cells must be sorted even if
+/// progressHaloExchange has already completed the exchange.  The
+/// exchange may have grown the atom arrays, so the thread buffers are
+/// fitted again.
+void finishRedistribution(SimFlat* sim)
+{
+   startTimer(atomHaloTimer);
+   completeHaloExchange(sim->atomExchange);
+   stopTimer(atomHaloTimer);
+
+   #pragma omp parallel for
+   for (int ii=0; ii<sim->boxes->nTotalBoxes; ++ii)
+      if (! isInnerBox(sim->boxes, ii, ATOM_EXCHANGE_DEPTH))
+         sortAtomsInCell(sim->atoms, sim->boxes, ii);
+
+   fitThreadBuffers(sim->threadBuffers, sim->atoms->capacity);
 }
@@ -6,11 +6,23 @@
 
 #include "CoMDTypes.h"
 
-double timestep(SimFlat* s, int n, real_t dt);
+void timestep(SimFlat* s, int n, real_t dt);
 void computeForce(SimFlat* s);
 void kineticEnergy(SimFlat* s);
 
+/// Start summing the energies and the atom count over all tasks.
+void startEnergySums(struct SimFlatSt* s);
+
+/// Complete the sums begun by startEnergySums, if any.
+void finishEnergySums(struct SimFlatSt* s);
+
 /// Update local and remote link cells after atoms have moved.
 void redistributeAtoms(struct SimFlatSt* sim);
 
+/// Start redistributeAtoms, possibly leaving the atom exchange in flight.
+void startRedistribution(struct SimFlatSt* sim);
+
+/// Complete a redistribution begun by startRedistribution.
+void finishRedistribution(struct SimFlatSt* sim);
+
 #endif
@@ -172,6 +172,11 @@ SimFlat* initSimulation(Command cmd)
    sim->ePotential = 0.0;
    sim->eKinetic = 0.0;
    sim->atomExchange = NULL;
+   sim->halfPair = parseHalfPairMode(cmd.halfPair);
+   sim->threadBuffers = NULL;
+   sim->pairSchedule = NULL;
+   sim->atomSchedule = NULL;
+   sim->numaPolicy = parseNumaPolicy(cmd.numaPolicy);
 
    sim->pot = initPotential(cmd.doeam, cmd.potDir, cmd.potName, cmd.potType);
    real_t latticeConstant = cmd.lat;
@@ -192,7 +197,7 @@ SimFlat* initSimulation(Command cmd)
       cmd.xproc, cmd.yproc, cmd.zproc, globalExtent);
 
    sim->boxes = initLinkCells(sim->domain, sim->pot->cutoff);
-   sim->atoms = initAtoms(sim->boxes);
+   sim->atoms = initAtoms(sim->boxes, sim->numaPolicy);
 
    // create lattice with desired temperature and displacement.
    createFccLattice(cmd.nx, cmd.ny, cmd.nz, latticeConstant, sim);
@@ -200,6 +205,13 @@ SimFlat* initSimulation(Command cmd)
    randomDisplacements(sim, cmd.initialDelta);
 
    sim->atomExchange = initAtomHaloExchange(sim->domain, sim->boxes);
+   if (sim->halfPair == HALF_PAIR_BUFFER)
+      sim->threadBuffers = initThreadBuffers(sim->boxes);
+   if (cmd.workSteal)
+   {
+      sim->pairSchedule = initBoxSchedule(sim->boxes, 1);
+      sim->atomSchedule = initBoxSchedule(sim->boxes, 0);
+   }
 
    // Forces must be computed before we call the time stepper.
    startTimer(redistributeTimer);
@@ -228,6 +240,9 @@ void destroySimulation(SimFlat** ps)
    destroyLinkCells(&(s->boxes));
    destroyAtoms(s->atoms);
    destroyHaloExchange(&(s->atomExchange));
+   destroyThreadBuffers(&(s->threadBuffers));
+   destroyBoxSchedule(&(s->pairSchedule));
+   destroyBoxSchedule(&(s->atomSchedule));
    comdFree(s->species);
    comdFree(s->domain);
    comdFree(s);
@@ -409,6 +424,22 @@ void printSimulationDataYaml(FILE* file, SimFlat* s)
            s->boxes->boxSize[2]/s->pot->cutoff);
    fprintf(file, "  Max Link Cell Occupancy: %d of %d\n",
            maxOcc, MAXATOMS);
+   fprintf(file, "  Half pair mode     : %s\n", halfPairModeName(s->halfPair));
+   if (s->threadBuffers)
+      fprintf(file, "  Thread buffers     : %d x %7.3f MB\n", s->threadBuffers->nThreads,
+              (float)s->threadBuffers->nAtoms*(sizeof(real3)+2*sizeof(real_t))/1024/1024);
+   if (s->pairSchedule)
+      fprintf(file, "  Work stealing      : %d tasks, %d stolen, static imbalance %6.3f\n",
+              s->pairSchedule->nTasks, s->pairSchedule->nSteals,
+              s->pairSchedule->imbalance);
+   printSeparator(file);
+   int maxTotalAtoms = MAXATOMS*s->boxes->nTotalBoxes;
+   fprintf(file,"NUMA data (rank 0): \n");
+   fprintf(file,"  Policy             : %s\n", numaPolicyName(s->numaPolicy));
+   numaPrintBinding(file);
+   numaPrintPages(file, "Positions", s->atoms->r, maxTotalAtoms*sizeof(real3));
+   numaPrintPages(file, "Momenta", s->atoms->p, maxTotalAtoms*sizeof(real3));
+   numaPrintPages(file, "Forces", s->atoms->f, maxTotalAtoms*sizeof(real3));
    printSeparator(file);
    fprintf(file,"Potential data: \n");
    s->pot->print(file, s->pot);
@@ -458,6 +489,29 @@ void sanityChecks(Command cmd, double cutoff, double latticeConst, char latticeT
                  "\nOnly FCC Lattice type supported, not %s. Fatal Error.\n",
                  latticeType);
    }
+
+   // Check for a known half pair mode (fail code 8)
+   if (parseHalfPairMode(cmd.halfPair) < 0)
+   {
+      failCode |= 8;
+      if ( printRank() )
+         fprintf(screenOut,
+                 "\nUnknown half pair mode %s.  Use none, color, or buffer.\n",
+                 cmd.halfPair);
+   }
+
+   // Check for a known NUMA policy that this build supports (fail code 16)
+   int numaPolicy = parseNumaPolicy(cmd.numaPolicy);
+   if (numaPolicy < 0 || ! numaPolicyAvailable(numaPolicy))
+   {
+      failCode |= 16;
+      if ( printRank() )
+         fprintf(screenOut,
+                 "\nUnsupported NUMA policy %s.  Use none or firsttouch, or\n"
+                 "build with DO_NUMA=ON for interleave and bind.\n",
+                 cmd.numaPolicy);
+   }
+
    int checkCode = failCode;
    bcastParallel(&checkCode, sizeof(int), 0);
    // This assertion can only fail if different tasks failed different
@@ -493,7 +547,9 @@ void sanityChecks(Command cmd, double cutoff, double latticeConst, char latticeT
 /// precision and enabling/disabling MPI. In the event MPI is not
 /// available, setting the DO_MPI flag to OFF will create a purely
 /// serial build (you will likely also need to change the setting of
-/// CC).
+/// CC).  Setting DO_NUMA to ON links libnuma, which enables the
+/// interleave and bind placement policies (see the \--numa option) and
+/// the per node page counts in the output.
 /// 
 /// The makefile should handle all the dependency checking needed, via
 /// makedepend.
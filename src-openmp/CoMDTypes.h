@@ -10,6 +10,9 @@
 #include "linkCells.h"
 #include "decomposition.h"
 #include "initAtoms.h"
+#include "halfPair.h"
+#include "boxSchedule.h"
+#include "numaUtils.h"
 
 struct SimFlatSt;
 
@@ -79,6 +82,12 @@ typedef struct SimFlatSt
    BasePotential *pot;	  //!< the potential
 
    HaloExchange* atomExchange;
+
+   int halfPair;                  //!< a HalfPairMode
+   ThreadBuffers* threadBuffers;  //!< used by HALF_PAIR_BUFFER
+   BoxSchedule* pairSchedule;     //!< schedule for pair loops (NULL for static)
+   BoxSchedule* atomSchedule;     //!< schedule for atom loops (NULL for static)
+   int numaPolicy;                //!< a NumaPolicy for the per atom arrays
    
 } SimFlat;
 
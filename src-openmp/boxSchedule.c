@@ -0,0 +1,225 @@
+/// \file
+/// Work stealing schedules for parallel loops over link cells.
+///
+/// A plain "omp parallel for" over the local link cells gives every
+/// thread the same number of boxes.  That is fine as long as all boxes
+/// hold about the same number of atoms.  With voids, free surfaces, or
+/// compressed regions, the cost per box varies widely and threads that
+/// own cheap boxes sit idle at the end of the loop.
+///
+/// A BoxSchedule balances such loops in two ways.  First, the work is
+/// dealt out by estimated cost instead of by box count.  The cost of a
+/// box is its number of atoms times the number of atoms in its 27
+/// neighbor boxes for the force loops, or simply its number of atoms
+/// for the integration loops.  Second, the estimate is refined at run
+/// time by work stealing.  The boxes are grouped into tasks of
+/// consecutive boxes (about TASKS_PER_THREAD tasks per thread), each
+/// thread's tasks are put in its own queue, and a thread that empties
+/// its queue steals tasks from the tail of another thread's queue.
+/// Because tasks are ranges of consecutive boxes, the owner of a queue
+/// works through neighboring boxes, as with a static schedule.
+///
+/// Loops use the schedule through a BoxCursor:
+///
+///     startBoxLoop(bs);
+///     #pragma omp parallel
+///     {
+///        BoxCursor cursor = initBoxCursor(bs, nBoxes);
+///        int iBegin, iEnd;
+///        while (nextBoxes(&cursor, &iBegin, &iEnd))
+///           for (int iBox=iBegin; iBox<iEnd; iBox++)
+///              ...
+///     }
+///
+/// With a NULL schedule the cursor hands each thread one block of
+/// boxes, split the same way as "omp for schedule(static)", so loops
+/// behave as before when work stealing is off.
+///
+/// The order in which a thread's partial sums are accumulated depends
+/// on which tasks it steals, so reductions such as the potential energy
+/// may differ in the last bits from run to run.
+
+#include "boxSchedule.h"
+
+#include <assert.h>
+
+#include "linkCells.h"
+#include "memUtils.h"
+
+#define TASKS_PER_THREAD 16
+
+BoxSchedule* initBoxSchedule(LinkCell* boxes, int pairCost)
+{
+   BoxSchedule* bs = comdMalloc(sizeof(BoxSchedule));
+   bs->nThreads = omp_get_max_threads();
+   bs->pairCost = pairCost;
+   bs->nTasks = 0;
+   bs->taskStart = comdMalloc((boxes->nLocalBoxes+1)*sizeof(int));
+   bs->threadStart = comdMalloc((bs->nThreads+1)*sizeof(int));
+   bs->cost = comdMalloc(boxes->nLocalBoxes*sizeof(double));
+   bs->queues = comdMalloc(bs->nThreads*sizeof(TaskQueue));
+   for (int ii=0; ii<bs->nThreads; ++ii)
+      omp_init_lock(&(bs->queues[ii].lock));
+   bs->imbalance = 1.0;
+   bs->nSteals = 0;
+
+   planBoxSchedule(bs, boxes);
+   return bs;
+}
+
+void destroyBoxSchedule(BoxSchedule** bs)
+{
+   if (! bs) return;
+   if (! *bs) return;
+   for (int ii=0; ii<(*bs)->nThreads; ++ii)
+      omp_destroy_lock(&((*bs)->queues[ii].lock));
+   comdFree((*bs)->taskStart);
+   comdFree((*bs)->threadStart);
+   comdFree((*bs)->cost);
+   comdFree((*bs)->queues);
+   comdFree(*bs);
+   *bs = NULL;
+}
+
+/// \details
+/// Tasks are cut greedily whenever the running cost passes the target
+/// task cost.  The task list is then cut into nThreads consecutive
+/// blocks at the multiples of the mean cost per thread.  For
+/// diagnostics the imbalance of a static schedule (equal numbers of
+/// boxes per thread) under the same cost estimate is also recorded.
+void planBoxSchedule(BoxSchedule* bs, LinkCell* boxes)
+{
+   int nLocalBoxes = boxes->nLocalBoxes;
+   double totalCost = 0.0;
+   #pragma omp parallel for reduction(+:totalCost)
+   for (int iBox=0; iBox<nLocalBoxes; iBox++)
+   {
+      double cost = boxes->nAtoms[iBox];
+      if (bs->pairCost)
+      {
+         int nNbrAtoms = 0;
+         for (int jTmp=0; jTmp<27; jTmp++)
+            nNbrAtoms += boxes->nAtoms[boxes->nbrBoxes[iBox][jTmp]];
+         cost *= nNbrAtoms;
+      }
+      bs->cost[iBox] = cost;
+      totalCost += cost;
+   }
+
+   int nThreads = bs->nThreads;
+   double taskCost = totalCost / (nThreads*TASKS_PER_THREAD);
+   double threadCost = totalCost / nThreads;
+
+   // cut tasks
+   int nTasks = 0;
+   double sum = 0.0;
+   bs->taskStart[0] = 0;
+   for (int iBox=0; iBox<nLocalBoxes; iBox++)
+   {
+      sum += bs->cost[iBox];
+      if (sum >= taskCost*(nTasks+1) || iBox == nLocalBoxes-1)
+         bs->taskStart[++nTasks] = iBox+1;
+   }
+   bs->nTasks = nTasks;
+
+   // deal tasks to threads
+   int iThread = 0;
+   sum = 0.0;
+   bs->threadStart[0] = 0;
+   for (int iTask=0; iTask<nTasks; iTask++)
+   {
+      for (int iBox=bs->taskStart[iTask]; iBox<bs->taskStart[iTask+1]; iBox++)
+         sum += bs->cost[iBox];
+      while (iThread < nThreads-1 && sum >= threadCost*(iThread+1))
+         bs->threadStart[++iThread] = iTask+1;
+   }
+   while (iThread < nThreads)
+      bs->threadStart[++iThread] = nTasks;
+
+   // cost imbalance of equal box count blocks
+   double maxCost = 0.0;
+   for (int ii=0; ii<nThreads; ii++)
+   {
+      double cost = 0.0;
+      int iBegin = (ii*nLocalBoxes)/nThreads;
+      int iEnd = ((ii+1)*nLocalBoxes)/nThreads;
+      for (int iBox=iBegin; iBox<iEnd; iBox++)
+         cost += bs->cost[iBox];
+      if (cost > maxCost) maxCost = cost;
+   }
+   bs->imbalance = (totalCost > 0.0) ? maxCost/threadCost : 1.0;
+   bs->nSteals = 0;
+}
+
+void startBoxLoop(BoxSchedule* bs)
+{
+   if (! bs) return;
+   for (int ii=0; ii<bs->nThreads; ii++)
+   {
+      bs->queues[ii].head = bs->threadStart[ii];
+      bs->queues[ii].tail = bs->threadStart[ii+1];
+   }
+}
+
+BoxCursor initBoxCursor(BoxSchedule* bs, int nBoxes)
+{
+   BoxCursor cursor;
+   cursor.bs = bs;
+   cursor.iThread = omp_get_thread_num();
+   cursor.nBoxes = nBoxes;
+   cursor.done = 0;
+   assert(! bs || cursor.iThread < bs->nThreads);
+   return cursor;
+}
+
+/// Take a task from the own queue, or else steal one from the tail of
+/// another queue.
+/// \return The task index or -1 if all queues are empty.
+static int nextTask(BoxSchedule* bs, int iThread)
+{
+   int iTask = -1;
+
+   TaskQueue* q = bs->queues + iThread;
+   omp_set_lock(&(q->lock));
+   if (q->head < q->tail)
+      iTask = q->head++;
+   omp_unset_lock(&(q->lock));
+
+   for (int ii=1; iTask < 0 && ii<bs->nThreads; ii++)
+   {
+      q = bs->queues + (iThread+ii)%bs->nThreads;
+      omp_set_lock(&(q->lock));
+      if (q->head < q->tail)
+         iTask = --q->tail;
+      omp_unset_lock(&(q->lock));
+      if (iTask >= 0)
+      {
+         #pragma omp atomic
+         bs->nSteals++;
+      }
+   }
+   return iTask;
+}
+
+int nextBoxes(BoxCursor* cursor, int* iBegin, int* iEnd)
+{
+   if (! cursor->bs)
+   {
+      if (cursor->done) return 0;
+      cursor->done = 1;
+      int nThreads = omp_get_num_threads();
+      int nBlock = cursor->nBoxes / nThreads;
+      int nExtra = cursor->nBoxes % nThreads;
+      int iThread = cursor->iThread;
+      *iBegin = iThread*nBlock + (iThread < nExtra ? iThread : nExtra);
+      *iEnd = *iBegin + nBlock + (iThread < nExtra ? 1 : 0);
+      return 1;
+   }
+
+   int iTask = nextTask(cursor->bs, cursor->iThread);
+   if (iTask < 0)
+      return 0;
+   *iBegin = cursor->bs->taskStart[iTask];
+   *iEnd = cursor->bs->taskStart[iTask+1];
+   return 1;
+}
@@ -0,0 +1,71 @@
+/// \file
+/// Work stealing schedules for parallel loops over link cells.
+
+#ifndef __BOX_SCHEDULE_H_
+#define __BOX_SCHEDULE_H_
+
+#include <omp.h>
+
+#include "mytype.h"
+
+struct LinkCellSt;
+
+/// The tasks owned by one thread.  The owner takes tasks from the head,
+/// other threads steal from the tail.
+typedef struct TaskQueueSt
+{
+   int head;          //!< next task for the owner
+   int tail;          //!< one past the last task in the queue
+   omp_lock_t lock;   //!< protects head and tail
+   char pad[64];      //!< keeps queues on different cache lines
+} TaskQueue;
+
+/// A schedule for a loop over the local link cells.  The boxes are
+/// split into tasks of consecutive boxes with roughly equal estimated
+/// cost, and the tasks are dealt out to the threads in consecutive
+/// blocks of roughly equal cost.
+typedef struct BoxScheduleSt
+{
+   int nThreads;        //!< number of task queues
+   int pairCost;        //!< if non-zero, estimate pair counts, else atom counts
+   int nTasks;          //!< number of tasks
+   int* taskStart;      //!< first box of each task (nTasks+1 values)
+   int* threadStart;    //!< first task of each thread (nThreads+1 values)
+   double* cost;        //!< estimated cost of each local box
+   TaskQueue* queues;   //!< one queue per thread
+
+   double imbalance;    //!< max/mean cost per thread of a static schedule
+   int nSteals;         //!< tasks stolen since the last plan
+} BoxSchedule;
+
+BoxSchedule* initBoxSchedule(struct LinkCellSt* boxes, int pairCost);
+void destroyBoxSchedule(BoxSchedule** bs);
+
+/// Estimate the cost of every box and build the tasks.  Call after the
+/// atoms have been redistributed.
+void planBoxSchedule(BoxSchedule* bs, struct LinkCellSt* boxes);
+
+/// The state of one thread in a loop over boxes.
+/// \see initBoxCursor
+typedef struct BoxCursorSt
+{
+   BoxSchedule* bs;   //!< the schedule or NULL for a static schedule
+   int iThread;       //!< the thread number
+   int nBoxes;        //!< number of boxes in the loop (static schedule)
+   int done;          //!< set once the static block has been handed out
+} BoxCursor;
+
+/// Refill the task queues.  Call outside of the parallel region before
+/// every loop that uses the schedule.  Does nothing if bs is NULL.
+void startBoxLoop(BoxSchedule* bs);
+
+/// Called by each thread at the start of the parallel region.  If bs is
+/// NULL the loop is statically scheduled over nBoxes boxes, otherwise
+/// the boxes come from the schedule.
+BoxCursor initBoxCursor(BoxSchedule* bs, int nBoxes);
+
+/// Get the next range of boxes [*iBegin, *iEnd) for this thread.
+/// Returns zero when the loop is finished.
+int nextBoxes(BoxCursor* cursor, int* iBegin, int* iEnd);
+
+#endif
@@ -83,6 +83,11 @@
 /// loops, but the disadvantage that three times as much data needs to
 /// be set (three components of the force vector instead of a single
 /// scalar \f$ F'(\bar\rho) \f$.
+///
+/// In this OpenMP version the loops over pairs compute every pair twice
+/// by default so that each thread only updates atoms in its own boxes.
+/// See halfPair.c for the race free alternatives selected with
+/// \--halfPair.
 
 
 #include "eam.h"
@@ -100,6 +105,9 @@
 #include "CoMDTypes.h"
 #include "performanceTimers.h"
 #include "haloExchange.h"
+#include "halfPair.h"
+#include "boxSchedule.h"
+#include "numaUtils.h"
 
 #define MAX(A,B) ((A) > (B) ? (A) : (B))
 
@@ -145,6 +153,10 @@ static int eamForce(SimFlat* s);
 static void eamPrint(FILE* file, BasePotential* pot);
 static void eamDestroy(BasePotential** pot); 
 static void eamBcastPotential(EamPotential* pot);
+static real_t eamFullPairPhiRho(SimFlat* s);
+static void eamFullPairForce(SimFlat* s);
+static real_t eamHalfPairPhiRho(SimFlat* s, int iBox, real3* f, real_t* U, real_t* rhobar);
+static void eamHalfPairForce(SimFlat* s, int iBox, real3* f);
 
 
 // Table interpolation functionality
@@ -224,13 +236,16 @@ int eamForce(SimFlat* s)
       int maxTotalAtoms = MAXATOMS*s->boxes->nTotalBoxes;
       pot->dfEmbed = comdMalloc(maxTotalAtoms*sizeof(real_t));
       pot->rhobar  = comdMalloc(maxTotalAtoms*sizeof(real_t));
+      numaPlaceArray(s->numaPolicy, pot->dfEmbed, MAXATOMS*sizeof(real_t),
+                     s->boxes->nLocalBoxes, s->boxes->nTotalBoxes);
+      numaPlaceArray(s->numaPolicy, pot->rhobar, MAXATOMS*sizeof(real_t),
+                     s->boxes->nLocalBoxes, s->boxes->nTotalBoxes);
       pot->forceExchange = initForceHaloExchange(s->domain, s->boxes);
       pot->forceExchangeData = comdMalloc(sizeof(ForceExchangeData));
       pot->forceExchangeData->dfEmbed = pot->dfEmbed;
       pot->forceExchangeData->boxes = s->boxes;
    }
    
-   real_t rCut2 = pot->cutoff*pot->cutoff;
    real_t etot = 0.;
 
    // zero forces / energy / rho /rhoprime
@@ -244,134 +259,356 @@ int eamForce(SimFlat* s)
       pot->rhobar[ii] = 0.;
    }
 
-   int nNbrBoxes = 27;
-   // loop over local boxes
-   #pragma omp parallel for reduction(+:etot)
-   for (int iBox=0; iBox<s->boxes->nLocalBoxes; iBox++)
+   LinkCell* boxes = s->boxes;
+   switch (s->halfPair)
+   {
+     case HALF_PAIR_COLOR:
+      for (int iColor=0; iColor<boxes->nColors; iColor++)
+      {
+         #pragma omp parallel for reduction(+:etot)
+         for (int ii=boxes->colorStart[iColor]; ii<boxes->colorStart[iColor+1]; ii++)
+            etot += eamHalfPairPhiRho(s, boxes->colorBoxes[ii],
+                                      s->atoms->f, s->atoms->U, pot->rhobar);
+      }
+      break;
+     case HALF_PAIR_BUFFER:
+      startBoxLoop(s->pairSchedule);
+      #pragma omp parallel reduction(+:etot)
+      {
+         ThreadBuffers* tb = s->threadBuffers;
+         int tOff = omp_get_thread_num()*tb->nAtoms;
+         BoxCursor cursor = initBoxCursor(s->pairSchedule, boxes->nLocalBoxes);
+         int iBegin, iEnd;
+         while (nextBoxes(&cursor, &iBegin, &iEnd))
+            for (int iBox=iBegin; iBox<iEnd; iBox++)
+               etot += eamHalfPairPhiRho(s, iBox, tb->f+tOff, tb->U+tOff, tb->rho+tOff);
+         #pragma omp barrier
+         reduceThreadBuffers(tb, boxes, s->atoms->f, s->atoms->U, pot->rhobar);
+      }
+      break;
+     default:
+      etot += eamFullPairPhiRho(s);
+   }
+
+   // Compute Embedding Energy
+   // loop over all local boxes
+   startBoxLoop(s->atomSchedule);
+   #pragma omp parallel reduction(+:etot)
    {
-      int nIBox = s->boxes->nAtoms[iBox];
+      BoxCursor cursor = initBoxCursor(s->atomSchedule, s->boxes->nLocalBoxes);
+      int iBegin, iEnd;
+      while (nextBoxes(&cursor, &iBegin, &iEnd))
+         for (int iBox=iBegin; iBox<iEnd; iBox++)
+         {
+            int nIBox =  s->boxes->nAtoms[iBox];
 
-      // loop over neighbor boxes of iBox (some may be halo boxes)
-      for (int jTmp=0; jTmp<nNbrBoxes; jTmp++)
+            // loop over atoms in iBox
+            for (int iOff=MAXATOMS*iBox; iOff<(MAXATOMS*iBox+nIBox); iOff++)
+            {
+               real_t fEmbed, dfEmbed;
+               interpolate(pot->f, pot->rhobar[iOff], &fEmbed, &dfEmbed);
+               pot->dfEmbed[iOff] = dfEmbed; // save derivative for halo exchange
+               s->atoms->U[iOff] += fEmbed;
+               etot += fEmbed;
+            }
+         }
+   }
+
+   // exchange derivative of the embedding energy with repsect to rhobar
+   startTimer(eamHaloTimer);
+   haloExchange(pot->forceExchange, pot->forceExchangeData);
+   stopTimer(eamHaloTimer);
+
+   // third pass
+   switch (s->halfPair)
+   {
+     case HALF_PAIR_COLOR:
+      for (int iColor=0; iColor<boxes->nColors; iColor++)
       {
-         int jBox = s->boxes->nbrBoxes[iBox][jTmp];
-         int nJBox = s->boxes->nAtoms[jBox];
+         #pragma omp parallel for
+         for (int ii=boxes->colorStart[iColor]; ii<boxes->colorStart[iColor+1]; ii++)
+            eamHalfPairForce(s, boxes->colorBoxes[ii], s->atoms->f);
+      }
+      break;
+     case HALF_PAIR_BUFFER:
+      startBoxLoop(s->pairSchedule);
+      #pragma omp parallel
+      {
+         ThreadBuffers* tb = s->threadBuffers;
+         int tOff = omp_get_thread_num()*tb->nAtoms;
+         BoxCursor cursor = initBoxCursor(s->pairSchedule, boxes->nLocalBoxes);
+         int iBegin, iEnd;
+         while (nextBoxes(&cursor, &iBegin, &iEnd))
+            for (int iBox=iBegin; iBox<iEnd; iBox++)
+               eamHalfPairForce(s, iBox, tb->f+tOff);
+         #pragma omp barrier
+         reduceThreadBuffers(tb, boxes, s->atoms->f, NULL, NULL);
+      }
+      break;
+     default:
+      eamFullPairForce(s);
+   }
+
+   s->ePotential = (real_t) etot;
 
-         // loop over atoms in iBox
-         for (int iOff=MAXATOMS*iBox; iOff<(iBox*MAXATOMS+nIBox); iOff++)
+   return 0;
+}
+
+/// The first full pair loop.  Computes the pair energy and forces and
+/// accumulates rhobar for the atoms of each box only, so every pair is
+/// computed twice.
+///
+/// \return The pair energy.
+real_t eamFullPairPhiRho(SimFlat* s)
+{
+   EamPotential* pot = (EamPotential*) s->pot;
+   real_t rCut2 = pot->cutoff*pot->cutoff;
+   real_t etot = 0.;
+
+   int nNbrBoxes = 27;
+   // loop over local boxes
+   startBoxLoop(s->pairSchedule);
+   #pragma omp parallel reduction(+:etot)
+   {
+      BoxCursor cursor = initBoxCursor(s->pairSchedule, s->boxes->nLocalBoxes);
+      int iBegin, iEnd;
+      while (nextBoxes(&cursor, &iBegin, &iEnd))
+         for (int iBox=iBegin; iBox<iEnd; iBox++)
          {
-            // loop over atoms in jBox
-            for (int jOff=MAXATOMS*jBox; jOff<(jBox*MAXATOMS+nJBox); jOff++)
+            int nIBox = s->boxes->nAtoms[iBox];
+
+            // loop over neighbor boxes of iBox (some may be halo boxes)
+            for (int jTmp=0; jTmp<nNbrBoxes; jTmp++)
             {
+               int jBox = s->boxes->nbrBoxes[iBox][jTmp];
+               int nJBox = s->boxes->nAtoms[jBox];
 
-               real3 dr;
-               real_t r2 = 0.0;
-               for (int k=0; k<3; k++)
+               // loop over atoms in iBox
+               for (int iOff=MAXATOMS*iBox; iOff<(iBox*MAXATOMS+nIBox); iOff++)
                {
-                  dr[k]=s->atoms->r[iOff][k]-s->atoms->r[jOff][k];
-                  r2+=dr[k]*dr[k];
-               }
+                  // loop over atoms in jBox
+                  for (int jOff=MAXATOMS*jBox; jOff<(jBox*MAXATOMS+nJBox); jOff++)
+                  {
 
-               if(r2 <= rCut2 && r2 > 0.0)
-               {
+                     real3 dr;
+                     real_t r2 = 0.0;
+                     for (int k=0; k<3; k++)
+                     {
+                        dr[k]=s->atoms->r[iOff][k]-s->atoms->r[jOff][k];
+                        r2+=dr[k]*dr[k];
+                     }
 
-                  real_t r = sqrt(r2);
+                     if(r2 <= rCut2 && r2 > 0.0)
+                     {
 
-                  real_t phiTmp, dPhi, rhoTmp, dRho;
-                  interpolate(pot->phi, r, &phiTmp, &dPhi);
-                  interpolate(pot->rho, r, &rhoTmp, &dRho);
+                        real_t r = sqrt(r2);
 
-                  for (int k=0; k<3; k++)
-                  {
-                     s->atoms->f[iOff][k] -= dPhi*dr[k]/r;
-                  }
+                        real_t phiTmp, dPhi, rhoTmp, dRho;
+                        interpolate(pot->phi, r, &phiTmp, &dPhi);
+                        interpolate(pot->rho, r, &rhoTmp, &dRho);
 
-                  // Calculate energy contribution
-                  s->atoms->U[iOff] += 0.5*phiTmp;
-                  etot += 0.5*phiTmp;
+                        for (int k=0; k<3; k++)
+                        {
+                           s->atoms->f[iOff][k] -= dPhi*dr[k]/r;
+                        }
 
-                  // accumulate rhobar for each atom
-                  pot->rhobar[iOff] += rhoTmp;
-               }
+                        // Calculate energy contribution
+                        s->atoms->U[iOff] += 0.5*phiTmp;
+                        etot += 0.5*phiTmp;
 
-            } // loop over atoms in jBox
-         } // loop over atoms in iBox
-      } // loop over neighbor boxes
-   } // loop over local boxes
+                        // accumulate rhobar for each atom
+                        pot->rhobar[iOff] += rhoTmp;
+                     }
 
-   // Compute Embedding Energy
-   // loop over all local boxes
-   #pragma omp parallel for reduction(+:etot)
-   for (int iBox=0; iBox<s->boxes->nLocalBoxes; iBox++)
+                  } // loop over atoms in jBox
+               } // loop over atoms in iBox
+            } // loop over neighbor boxes
+         } // loop over local boxes
+   }
+
+   return etot;
+}
+
+/// The third full pair loop.  Adds the embedding forces on the atoms of
+/// each box.
+void eamFullPairForce(SimFlat* s)
+{
+   EamPotential* pot = (EamPotential*) s->pot;
+   real_t rCut2 = pot->cutoff*pot->cutoff;
+   int nNbrBoxes = 27;
+
+   // loop over local boxes
+   startBoxLoop(s->pairSchedule);
+   #pragma omp parallel
    {
-      int nIBox =  s->boxes->nAtoms[iBox];
+      BoxCursor cursor = initBoxCursor(s->pairSchedule, s->boxes->nLocalBoxes);
+      int iBegin, iEnd;
+      while (nextBoxes(&cursor, &iBegin, &iEnd))
+         for (int iBox=iBegin; iBox<iEnd; iBox++)
+         {
+            int nIBox = s->boxes->nAtoms[iBox];
 
-      // loop over atoms in iBox
-      for (int iOff=MAXATOMS*iBox; iOff<(MAXATOMS*iBox+nIBox); iOff++)
-      {
-         real_t fEmbed, dfEmbed;
-         interpolate(pot->f, pot->rhobar[iOff], &fEmbed, &dfEmbed);
-         pot->dfEmbed[iOff] = dfEmbed; // save derivative for halo exchange
-         s->atoms->U[iOff] += fEmbed;
-         etot += fEmbed;
-      }
+            // loop over neighbor boxes of iBox (some may be halo boxes)
+            for (int jTmp=0; jTmp<nNbrBoxes; jTmp++)
+            {
+               int jBox = s->boxes->nbrBoxes[iBox][jTmp];
+               int nJBox = s->boxes->nAtoms[jBox];
+
+               // loop over atoms in iBox
+               for (int iOff=MAXATOMS*iBox; iOff<(MAXATOMS*iBox+nIBox); iOff++)
+               {
+                  // loop over atoms in jBox
+                  for (int jOff=MAXATOMS*jBox; jOff<(MAXATOMS*jBox+nJBox); jOff++)
+                  { 
+
+                     real_t r2 = 0.0;
+                     real3 dr;
+                     for (int k=0; k<3; k++)
+                     {
+                        dr[k]=s->atoms->r[iOff][k]-s->atoms->r[jOff][k];
+                        r2+=dr[k]*dr[k];
+                     }
+
+                     if(r2 <= rCut2 && r2 > 0.0)
+                     {
+
+                        real_t r = sqrt(r2);
+
+                        real_t rhoTmp, dRho;
+                        interpolate(pot->rho, r, &rhoTmp, &dRho);
+
+                        for (int k=0; k<3; k++)
+                        {
+                           s->atoms->f[iOff][k] -= (pot->dfEmbed[iOff]+pot->dfEmbed[jOff])*dRho*dr[k]/r;
+                        }
+                     }
+
+                  } // loop over atoms in jBox
+               } // loop over atoms in iBox
+            } // loop over neighbor boxes
+         } // loop over local boxes
    }
+}
 
-   // exchange derivative of the embedding energy with repsect to rhobar
-   startTimer(eamHaloTimer);
-   haloExchange(pot->forceExchange, pot->forceExchangeData);
-   stopTimer(eamHaloTimer);
+/// The first half pair loop for a single local box.  Computes the pair
+/// energy and forces and accumulates rhobar.  A pair of local atoms is
+/// computed only by the box with the lower index and updates both
+/// atoms.  Pairs with halo atoms update only the local atom.
+///
+/// \return The pair energy of iBox.
+real_t eamHalfPairPhiRho(SimFlat* s, int iBox, real3* f, real_t* U, real_t* rhobar)
+{
+   EamPotential* pot = (EamPotential*) s->pot;
+   real_t rCut2 = pot->cutoff*pot->cutoff;
+   real_t etot = 0.0;
 
-   // third pass
-   // loop over local boxes
-   #pragma omp parallel for
-   for (int iBox=0; iBox<s->boxes->nLocalBoxes; iBox++)
+   int nIBox = s->boxes->nAtoms[iBox];
+   if (nIBox == 0) return etot;
+
+   // loop over neighbor boxes of iBox (some may be halo boxes)
+   for (int jTmp=0; jTmp<27; jTmp++)
    {
-      int nIBox = s->boxes->nAtoms[iBox];
+      int jBox = s->boxes->nbrBoxes[iBox][jTmp];
+      if (jBox < iBox) continue;
 
-      // loop over neighbor boxes of iBox (some may be halo boxes)
-      for (int jTmp=0; jTmp<nNbrBoxes; jTmp++)
-      {
-         int jBox = s->boxes->nbrBoxes[iBox][jTmp];
-         int nJBox = s->boxes->nAtoms[jBox];
+      int jLocal = (jBox < s->boxes->nLocalBoxes);
+      int nJBox = s->boxes->nAtoms[jBox];
 
-         // loop over atoms in iBox
-         for (int iOff=MAXATOMS*iBox; iOff<(MAXATOMS*iBox+nIBox); iOff++)
+      // loop over atoms in iBox
+      for (int iOff=MAXATOMS*iBox,ii=0; ii<nIBox; ii++,iOff++)
+      {
+         // loop over atoms in jBox.  Pairs within iBox are visited once.
+         int jBegin = (jBox == iBox) ? ii+1 : 0;
+         for (int jOff=MAXATOMS*jBox+jBegin,ij=jBegin; ij<nJBox; ij++,jOff++)
          {
-            // loop over atoms in jBox
-            for (int jOff=MAXATOMS*jBox; jOff<(MAXATOMS*jBox+nJBox); jOff++)
-            { 
+            real3 dr;
+            real_t r2 = 0.0;
+            for (int k=0; k<3; k++)
+            {
+               dr[k]=s->atoms->r[iOff][k]-s->atoms->r[jOff][k];
+               r2+=dr[k]*dr[k];
+            }
+
+            if (r2 > rCut2) continue;
+
+            real_t r = sqrt(r2);
+
+            real_t phiTmp, dPhi, rhoTmp, dRho;
+            interpolate(pot->phi, r, &phiTmp, &dPhi);
+            interpolate(pot->rho, r, &rhoTmp, &dRho);
 
-               real_t r2 = 0.0;
-               real3 dr;
+            U[iOff] += 0.5*phiTmp;
+            rhobar[iOff] += rhoTmp;
+            for (int k=0; k<3; k++)
+               f[iOff][k] -= dPhi*dr[k]/r;
+
+            if (jLocal)
+            {
+               U[jOff] += 0.5*phiTmp;
+               rhobar[jOff] += rhoTmp;
+               etot += phiTmp;
                for (int k=0; k<3; k++)
-               {
-                  dr[k]=s->atoms->r[iOff][k]-s->atoms->r[jOff][k];
-                  r2+=dr[k]*dr[k];
-               }
+                  f[jOff][k] += dPhi*dr[k]/r;
+            }
+            else
+               etot += 0.5*phiTmp;
+         } // loop over atoms in jBox
+      } // loop over atoms in iBox
+   } // loop over neighbor boxes
+
+   return etot;
+}
 
-               if(r2 <= rCut2 && r2 > 0.0)
-               {
+/// The third half pair loop for a single local box.  Adds the
+/// embedding forces.  Pairs are visited as in eamHalfPairPhiRho.
+void eamHalfPairForce(SimFlat* s, int iBox, real3* f)
+{
+   EamPotential* pot = (EamPotential*) s->pot;
+   real_t rCut2 = pot->cutoff*pot->cutoff;
 
-                  real_t r = sqrt(r2);
+   int nIBox = s->boxes->nAtoms[iBox];
+   if (nIBox == 0) return;
 
-                  real_t rhoTmp, dRho;
-                  interpolate(pot->rho, r, &rhoTmp, &dRho);
+   // loop over neighbor boxes of iBox (some may be halo boxes)
+   for (int jTmp=0; jTmp<27; jTmp++)
+   {
+      int jBox = s->boxes->nbrBoxes[iBox][jTmp];
+      if (jBox < iBox) continue;
 
-                  for (int k=0; k<3; k++)
-                  {
-                     s->atoms->f[iOff][k] -= (pot->dfEmbed[iOff]+pot->dfEmbed[jOff])*dRho*dr[k]/r;
-                  }
-               }
+      int jLocal = (jBox < s->boxes->nLocalBoxes);
+      int nJBox = s->boxes->nAtoms[jBox];
 
-            } // loop over atoms in jBox
-         } // loop over atoms in iBox
-      } // loop over neighbor boxes
-   } // loop over local boxes
+      // loop over atoms in iBox
+      for (int iOff=MAXATOMS*iBox,ii=0; ii<nIBox; ii++,iOff++)
+      {
+         // loop over atoms in jBox.  Pairs within iBox are visited once.
+         int jBegin = (jBox == iBox) ? ii+1 : 0;
+         for (int jOff=MAXATOMS*jBox+jBegin,ij=jBegin; ij<nJBox; ij++,jOff++)
+         {
+            real3 dr;
+            real_t r2 = 0.0;
+            for (int k=0; k<3; k++)
+            {
+               dr[k]=s->atoms->r[iOff][k]-s->atoms->r[jOff][k];
+               r2+=dr[k]*dr[k];
+            }
 
-   s->ePotential = (real_t) etot;
+            if (r2 > rCut2) continue;
 
-   return 0;
+            real_t r = sqrt(r2);
+
+            real_t rhoTmp, dRho;
+            interpolate(pot->rho, r, &rhoTmp, &dRho);
+
+            real_t fTmp = (pot->dfEmbed[iOff]+pot->dfEmbed[jOff])*dRho/r;
+            for (int k=0; k<3; k++)
+               f[iOff][k] -= fTmp*dr[k];
+            if (jLocal)
+               for (int k=0; k<3; k++)
+                  f[jOff][k] += fTmp*dr[k];
+         } // loop over atoms in jBox
+      } // loop over atoms in iBox
+   } // loop over neighbor boxes
 }
 
 void eamPrint(FILE* file, BasePotential* pot)
@@ -0,0 +1,120 @@
+/// \file
+/// Support for force loops that visit each pair of atoms only once.
+///
+/// By Newton's third law the force that atom j exerts on atom i is
+/// the negative of the force atom i exerts on atom j.  The serial and
+/// MPI force kernels use this to compute each pair only once.  When
+/// the loop over boxes is split across threads, however, two threads
+/// may update the same atom j at the same time.  The original OpenMP
+/// kernels avoid this race by computing every pair twice and updating
+/// only atom i.  This doubles the floating point work.
+///
+/// Two race free alternatives are provided:
+///
+/// - HALF_PAIR_COLOR: The local boxes are split into 27 colors (see
+///   initLinkCells()).  Boxes of one color do not share any neighbors,
+///   so all boxes of a color can be processed concurrently.  The colors
+///   are processed one after the other.  This requires no extra memory,
+///   but there are 27 parallel loops per pass, each with 1/27 of the
+///   boxes.
+///
+/// - HALF_PAIR_BUFFER: Each thread accumulates forces, energies, and
+///   densities in a private copy of the arrays.  After the pair loop
+///   the copies are summed in parallel.  This costs nThreads copies of
+///   the per atom data and a reduction pass, but gives a single, well
+///   balanced parallel loop.
+///
+/// In both modes a pair of two local atoms is handled by the box with
+/// the lower index.  Pairs with a halo atom only update the local atom
+/// since forces on halo atoms are not needed.
+
+#include "halfPair.h"
+
+#include <string.h>
+#include <strings.h>
+#include <omp.h>
+
+#include "linkCells.h"
+#include "memUtils.h"
+
+static const char* modeNames[] = {"none", "color", "buffer"};
+
+int parseHalfPairMode(const char* name)
+{
+   for (int ii=0; ii<3; ++ii)
+      if (strcasecmp(name, modeNames[ii]) == 0)
+         return ii;
+   return -1;
+}
+
+const char* halfPairModeName(int mode)
+{
+   if (mode < 0 || mode > 2)
+      return "unknown";
+   return modeNames[mode];
+}
+
+/// Allocates one buffer per thread (as given by omp_get_max_threads())
+/// for the local atoms of boxes.
+ThreadBuffers* initThreadBuffers(LinkCell* boxes)
+{
+   ThreadBuffers* tb = comdMalloc(sizeof(ThreadBuffers));
+   tb->nThreads = omp_get_max_threads();
+   tb->nAtoms = boxes->nLocalBoxes*MAXATOMS;
+   int n = tb->nThreads*tb->nAtoms;
+   tb->f   = comdCalloc(n, sizeof(real3));
+   tb->U   = comdCalloc(n, sizeof(real_t));
+   tb->rho = comdCalloc(n, sizeof(real_t));
+   return tb;
+}
+
+void destroyThreadBuffers(ThreadBuffers** tb)
+{
+   if (! tb) return;
+   if (! *tb) return;
+   comdFree((*tb)->f);
+   comdFree((*tb)->U);
+   comdFree((*tb)->rho);
+   comdFree(*tb);
+   *tb = NULL;
+}
+
+/// \details
+/// Must be called by all threads of a parallel region after the pair
+/// loop has finished (the implicit barrier of an omp for is
+/// sufficient).  The work is shared over the local boxes.  Any of U
+/// and rho may be NULL, in which case the corresponding buffers are
+/// skipped.  Those buffers must not have been written.
+void reduceThreadBuffers(ThreadBuffers* tb, LinkCell* boxes,
+                         real3* f, real_t* U, real_t* rho)
+{
+   int nThreads = tb->nThreads;
+   int nAtoms = tb->nAtoms;
+   #pragma omp for
+   for (int iBox=0; iBox<boxes->nLocalBoxes; iBox++)
+   {
+      int nIBox = boxes->nAtoms[iBox];
+      for (int iOff=MAXATOMS*iBox; iOff<(MAXATOMS*iBox+nIBox); iOff++)
+      {
+         for (int iThread=0; iThread<nThreads; iThread++)
+         {
+            int tOff = iThread*nAtoms + iOff;
+            for (int m=0; m<3; m++)
+            {
+               f[iOff][m] += tb->f[tOff][m];
+               tb->f[tOff][m] = 0.0;
+            }
+            if (U)
+            {
+               U[iOff] += tb->U[tOff];
+               tb->U[tOff] = 0.0;
+            }
+            if (rho)
+            {
+               rho[iOff] += tb->rho[tOff];
+               tb->rho[tOff] = 0.0;
+            }
+         }
+      }
+   }
+}
@@ -0,0 +1,43 @@
+/// \file
+/// Support for force loops that visit each pair of atoms only once.
+
+#ifndef __HALF_PAIR_H_
+#define __HALF_PAIR_H_
+
+#include "mytype.h"
+
+struct LinkCellSt;
+
+/// The ways the force kernels can be parallelized.
+enum HalfPairMode
+{
+   HALF_PAIR_NONE,   //!< full pairs: each pair is computed by both atoms
+   HALF_PAIR_COLOR,  //!< half pairs, boxes of the same color run concurrently
+   HALF_PAIR_BUFFER  //!< half pairs, each thread accumulates in its own buffer
+};
+
+/// Per thread accumulation buffers for the HALF_PAIR_BUFFER mode.  The
+/// buffer of thread iThread starts at offset iThread*nAtoms in each
+/// array and is indexed like the atom arrays.  Only local atoms are
+/// stored.  The buffers are kept zero between uses.
+typedef struct ThreadBuffersSt
+{
+   int nThreads;   //!< number of thread buffers
+   int nAtoms;     //!< length of each thread buffer
+   real3* f;       //!< force buffers
+   real_t* U;      //!< energy buffers
+   real_t* rho;    //!< electron density buffers (EAM only)
+} ThreadBuffers;
+
+/// Returns the HalfPairMode with the given name, or -1 if unknown.
+int parseHalfPairMode(const char* name);
+const char* halfPairModeName(int mode);
+
+ThreadBuffers* initThreadBuffers(struct LinkCellSt* boxes);
+void destroyThreadBuffers(ThreadBuffers** tb);
+
+/// Add the thread buffers into f, U, and rho, and clear them.
+void reduceThreadBuffers(ThreadBuffers* tb, struct LinkCellSt* boxes,
+                         real3* f, real_t* U, real_t* rho);
+
+#endif
@@ -104,6 +104,7 @@ static int loadForceBuffer(void* vparms, void* data, int face, char* charBuf);
 static void unloadForceBuffer(void* vparms, void* data, int face, int bufSize, char* charBuf);
 static void destroyForceExchange(void* vparms);
 static int sortAtomsById(const void* a, const void* b);
+static int* mkCellOffsets(LinkCell* boxes, int nCells, const int* cellList);
 
 /// \details
 /// When called in proper sequence by redistributeAtoms, the atom halo
@@ -239,6 +240,10 @@ HaloExchange* initForceHaloExchange(Domain* domain, LinkCell* boxes)
 void destroyHaloExchange(HaloExchange** haloExchange)
 {
    (*haloExchange)->destroy((*haloExchange)->parms);
+   freeCommBuffer((*haloExchange)->recvBufP);
+   freeCommBuffer((*haloExchange)->recvBufM);
+   freeCommBuffer((*haloExchange)->sendBufP);
+   freeCommBuffer((*haloExchange)->sendBufM);
    comdFree((*haloExchange)->parms);
    comdFree(*haloExchange);
    *haloExchange = NULL;
@@ -263,6 +268,10 @@ HaloExchange* initHaloExchange(Domain* domain)
    hh->nbrRank[HALO_Z_MINUS] = processorNum(domain,  0,  0, -1);
    hh->nbrRank[HALO_Z_PLUS]  = processorNum(domain,  0,  0, +1);
    hh->bufCapacity = 0; // will be set by sub-class.
+   hh->sendBufM = NULL; // allocated on first exchange.
+   hh->sendBufP = NULL;
+   hh->recvBufM = NULL;
+   hh->recvBufP = NULL;
 
    return hh;
 }
@@ -272,6 +281,11 @@ HaloExchange* initHaloExchange(Domain* domain)
 /// sends and receives two message.  Loading and unloading of the
 /// buffers is in the hands of the sub-class virtual functions.
 ///
+/// The send and receive buffers belong to the HaloExchange.  They are
+/// allocated the first time through and reused by every later call, so
+/// the multi-MB buffers are not mapped and page faulted in again on
+/// each axis of each exchange.
+///
 /// \param [in] iAxis     Axis index.
 /// \param [in, out] data Pointer to data that will be passed to the load and
 ///                       unload functions
@@ -280,10 +294,17 @@ void exchangeData(HaloExchange* haloExchange, void* data, int iAxis)
    enum HaloFaceOrder faceM = 2*iAxis;
    enum HaloFaceOrder faceP = faceM+1;
 
-   char* sendBufM = comdMalloc(haloExchange->bufCapacity);
-   char* sendBufP = comdMalloc(haloExchange->bufCapacity);
-   char* recvBufM = comdMalloc(haloExchange->bufCapacity);
-   char* recvBufP = comdMalloc(haloExchange->bufCapacity);
+   if (! haloExchange->sendBufM)
+   {
+      haloExchange->sendBufM = allocCommBuffer(haloExchange->bufCapacity);
+      haloExchange->sendBufP = allocCommBuffer(haloExchange->bufCapacity);
+      haloExchange->recvBufM = allocCommBuffer(haloExchange->bufCapacity);
+      haloExchange->recvBufP = allocCommBuffer(haloExchange->bufCapacity);
+   }
+   char* sendBufM = haloExchange->sendBufM;
+   char* sendBufP = haloExchange->sendBufP;
+   char* recvBufM = haloExchange->recvBufM;
+   char* recvBufP = haloExchange->recvBufP;
 
    int nSendM = haloExchange->loadBuffer(haloExchange->parms, data, faceM, sendBufM);
    int nSendP = haloExchange->loadBuffer(haloExchange->parms, data, faceP, sendBufP);
@@ -300,10 +321,6 @@ void exchangeData(HaloExchange* haloExchange, void* data, int iAxis)
    
    haloExchange->unloadBuffer(haloExchange->parms, data, faceM, nRecvM, recvBufM);
    haloExchange->unloadBuffer(haloExchange->parms, data, faceP, nRecvP, recvBufP);
-   comdFree(recvBufP);
-   comdFree(recvBufM);
-   comdFree(sendBufP);
-   comdFree(sendBufM);
 }
 
 /// Make a list of link cells that need to be sent across the specified
@@ -372,11 +389,13 @@ int loadAtomsBuffer(void* vparms, void* data, int face, char* charBuf)
    
    int nCells = parms->nCells[face];
    int* cellList = parms->cellList[face];
-   int nBuf = 0;
+   int* cellStart = mkCellOffsets(s->boxes, nCells, cellList);
+   #pragma omp parallel for
    for (int iCell=0; iCell<nCells; ++iCell)
    {
       int iBox = cellList[iCell];
       int iOff = iBox*MAXATOMS;
+      int nBuf = cellStart[iCell];
       for (int ii=iOff; ii<iOff+s->boxes->nAtoms[iBox]; ++ii)
       {
          buf[nBuf].gid  = s->atoms->gid[ii];
@@ -390,6 +409,8 @@ int loadAtomsBuffer(void* vparms, void* data, int face, char* charBuf)
          ++nBuf;
       }
    }
+   int nBuf = cellStart[nCells];
+   comdFree(cellStart);
    return nBuf*sizeof(AtomMsg);
 }
 
@@ -411,6 +432,9 @@ void unloadAtomsBuffer(void* vparms, void* data, int face, int bufSize, char* ch
    int nBuf = bufSize / sizeof(AtomMsg);
    assert(bufSize % sizeof(AtomMsg) == 0);
    
+   // putAtomInBox is thread safe.  The order of the atoms within each
+   // box is fixed by sortAtomsInCell.
+   #pragma omp parallel for
    for (int ii=0; ii<nBuf; ++ii)
    {
       int gid   = buf[ii].gid;
@@ -548,17 +572,21 @@ int loadForceBuffer(void* vparms, void* vdata, int face, char* charBuf)
    
    int nCells = parms->nCells[face];
    int* cellList = parms->sendCells[face];
-   int nBuf = 0;
+   int* cellStart = mkCellOffsets(data->boxes, nCells, cellList);
+   #pragma omp parallel for
    for (int iCell=0; iCell<nCells; ++iCell)
    {
       int iBox = cellList[iCell];
       int iOff = iBox*MAXATOMS;
+      int nBuf = cellStart[iCell];
       for (int ii=iOff; ii<iOff+data->boxes->nAtoms[iBox]; ++ii)
       {
          buf[nBuf].dfEmbed = data->dfEmbed[ii];
          ++nBuf;
       }
    }
+   int nBuf = cellStart[nCells];
+   comdFree(cellStart);
    return nBuf*sizeof(ForceMsg);
 }
 
@@ -577,18 +605,21 @@ void unloadForceBuffer(void* vparms, void* vdata, int face, int bufSize, char* c
    
    int nCells = parms->nCells[face];
    int* cellList = parms->recvCells[face];
-   int iBuf = 0;
+   int* cellStart = mkCellOffsets(data->boxes, nCells, cellList);
+   #pragma omp parallel for
    for (int iCell=0; iCell<nCells; ++iCell)
    {
       int iBox = cellList[iCell];
       int iOff = iBox*MAXATOMS;
+      int iBuf = cellStart[iCell];
       for (int ii=iOff; ii<iOff+data->boxes->nAtoms[iBox]; ++ii)
       {
          data->dfEmbed[ii] = buf[iBuf].dfEmbed;
          ++iBuf;
       }
    }
-   assert(iBuf == bufSize/ sizeof(ForceMsg));
+   assert(cellStart[nCells] == bufSize/ sizeof(ForceMsg));
+   comdFree(cellStart);
 }
 
 void destroyForceExchange(void* vparms)
@@ -660,3 +691,15 @@ int sortAtomsById(const void* a, const void* b)
    return 1;
 }
 
+/// Returns the offset of the first atom of each cell in cellList in a
+/// buffer that holds the atoms of all cells in order.  Element nCells
+/// is the total number of atoms.  This lets the cells be packed and
+/// unpacked in parallel.  The caller must free the array.
+int* mkCellOffsets(LinkCell* boxes, int nCells, const int* cellList)
+{
+   int* cellStart = comdMalloc((nCells+1)*sizeof(int));
+   cellStart[0] = 0;
+   for (int iCell=0; iCell<nCells; ++iCell)
+      cellStart[iCell+1] = cellStart[iCell] + boxes->nAtoms[cellList[iCell]];
+   return cellStart;
+}
@@ -31,6 +31,13 @@ typedef struct HaloExchangeSt
    /// The maximum send/recv buffer size (in bytes) that will be needed
    /// for this halo exchange.
    int bufCapacity;
+   /// Send and receive buffers for the two faces of an axis.  They are
+   /// allocated with bufCapacity bytes on the first exchange and reused
+   /// by all later exchanges.
+   char* sendBufM;
+   char* sendBufP;
+   char* recvBufM;
+   char* recvBufP;
    /// Pointer to a sub-class specific function to load the send buffer.
    /// \param [in] parms The parms member of the structure.  This is a
    ///                   pointer to a sub-class specific structure that can
@@ -14,13 +14,18 @@
 #include "timestep.h"
 #include "memUtils.h"
 #include "performanceTimers.h"
+#include "numaUtils.h"
 
 static void computeVcm(SimFlat* s, real_t vcm[3]);
 
 /// \details
 /// Call functions such as createFccLattice and setTemperature to set up
 /// initial atom positions and momenta.
-Atoms* initAtoms(LinkCell* boxes)
+///
+/// The arrays are zeroed by numaPlaceArray so that, with the default
+/// first touch policy, their pages land on the NUMA node of the thread
+/// that works on the corresponding link cells.
+Atoms* initAtoms(LinkCell* boxes, int numaPolicy)
 {
    Atoms* atoms = comdMalloc(sizeof(Atoms));
 
@@ -36,15 +41,14 @@ Atoms* initAtoms(LinkCell* boxes)
    atoms->nLocal = 0;
    atoms->nGlobal = 0;
 
-   for (int iOff = 0; iOff < maxTotalAtoms; iOff++)
-   {
-      atoms->gid[iOff] = 0;
-      atoms->iSpecies[iOff] = 0;
-      zeroReal3(atoms->r[iOff]);
-      zeroReal3(atoms->p[iOff]);
-      zeroReal3(atoms->f[iOff]);
-      atoms->U[iOff] = 0.;
-   }
+   int nLocalBoxes = boxes->nLocalBoxes;
+   int nTotalBoxes = boxes->nTotalBoxes;
+   numaPlaceArray(numaPolicy, atoms->gid,      MAXATOMS*sizeof(int),    nLocalBoxes, nTotalBoxes);
+   numaPlaceArray(numaPolicy, atoms->iSpecies, MAXATOMS*sizeof(int),    nLocalBoxes, nTotalBoxes);
+   numaPlaceArray(numaPolicy, atoms->r,        MAXATOMS*sizeof(real3),  nLocalBoxes, nTotalBoxes);
+   numaPlaceArray(numaPolicy, atoms->p,        MAXATOMS*sizeof(real3),  nLocalBoxes, nTotalBoxes);
+   numaPlaceArray(numaPolicy, atoms->f,        MAXATOMS*sizeof(real3),  nLocalBoxes, nTotalBoxes);
+   numaPlaceArray(numaPolicy, atoms->U,        MAXATOMS*sizeof(real_t), nLocalBoxes, nTotalBoxes);
 
    return atoms;
 }
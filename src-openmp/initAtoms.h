@@ -26,8 +26,9 @@ typedef struct AtomsSt
 } Atoms;
 
 
-/// Allocates memory to store atom data.
-Atoms* initAtoms(struct LinkCellSt* boxes);
+/// Allocates memory to store atom data.  The pages are placed according
+/// to numaPolicy (a NumaPolicy).
+Atoms* initAtoms(struct LinkCellSt* boxes, int numaPolicy);
 void destroyAtoms(struct AtomsSt* atoms);
 
 void createFccLattice(int nx, int ny, int nz, real_t lat, struct SimFlatSt* s);
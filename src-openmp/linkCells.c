@@ -57,6 +57,14 @@
 /// \see getBoxFromTuple is the 3D->1D mapping for link cell indices.
 /// \see getTuple is the 1D->3D mapping
 ///
+/// For the half-pair force loops the local cells are also sorted by
+/// color, where the color of a cell is (ix%3, iy%3, iz%3).  A cell
+/// and its 26 neighbors all have different colors, so two cells of the
+/// same color never share a neighbor and may be processed concurrently
+/// even if each one updates its neighbors.  Note that a 2x2x2 coloring
+/// is not enough for this: the neighbors of cells 0 and 2 overlap in
+/// cell 1.
+///
 /// \param [in] cutoff The cutoff distance of the potential.
 
 #include "linkCells.h"
@@ -76,9 +84,9 @@
 #define   MAX(A,B) ((A) > (B) ? (A) : (B))
 
 static void copyAtom(LinkCell* boxes, Atoms* atoms, int iAtom, int iBox, int jAtom, int jBox);
-static int getBoxFromCoord(LinkCell* boxes, real_t rr[3]);
 static void emptyHaloCells(LinkCell* boxes);
 static void getTuple(LinkCell* boxes, int iBox, int* ixp, int* iyp, int* izp);
+static void mkColorLists(LinkCell* boxes);
 
 LinkCell* initLinkCells(const Domain* domain, real_t cutoff)
 {
@@ -120,6 +128,12 @@ LinkCell* initLinkCells(const Domain* domain, real_t cutoff)
       int nNbrBoxes = getNeighborBoxes(ll, iBox, ll->nbrBoxes[iBox]);
    }
 
+   mkColorLists(ll);
+
+   // scratch space for updateLinkCells
+   ll->nStart = comdMalloc(ll->nLocalBoxes*sizeof(int));
+   ll->moved  = comdMalloc(ll->nLocalBoxes*MAXATOMS*sizeof(int));
+
    return ll;
 }
 
@@ -129,6 +143,10 @@ void destroyLinkCells(LinkCell** boxes)
    if (! *boxes) return;
 
    comdFree((*boxes)->nAtoms);
+   comdFree((*boxes)->colorStart);
+   comdFree((*boxes)->colorBoxes);
+   comdFree((*boxes)->nStart);
+   comdFree((*boxes)->moved);
    comdFree(*boxes);
    *boxes = NULL;
 
@@ -158,6 +176,7 @@ int getNeighborBoxes(LinkCell* boxes, int iBox, int* nbrBoxes)
 /// \details
 /// Finds the appropriate link cell for an atom based on the spatial
 /// coordinates and stores data in that link cell.
+/// Several threads may call this function at the same time.
 /// \param [in] gid   The global of the atom.
 /// \param [in] iType The species index of the atom.
 /// \param [in] x     The x-coordinate of the atom.
@@ -175,13 +194,20 @@ void putAtomInBox(LinkCell* boxes, Atoms* atoms,
    
    // Find correct box.
    int iBox = getBoxFromCoord(boxes, xyz);
-   int iOff = iBox*MAXATOMS;
-   iOff += boxes->nAtoms[iBox];
+
+   // reserve a slot.  Atomic so that threads can add atoms concurrently.
+   int iOff;
+   #pragma omp atomic capture
+   iOff = boxes->nAtoms[iBox]++;
+   assert(iOff < MAXATOMS);
+   iOff += iBox*MAXATOMS;
    
    // assign values to array elements
    if (iBox < boxes->nLocalBoxes)
+   {
+      #pragma omp atomic
       atoms->nLocal++;
-   boxes->nAtoms[iBox]++;
+   }
    atoms->gid[iOff] = gid;
    atoms->iSpecies[iOff] = iType;
    
@@ -265,7 +291,7 @@ void moveAtom(LinkCell* boxes, Atoms* atoms, int iId, int iBox, int jBox)
    int ni = boxes->nAtoms[iBox];
    if (ni) copyAtom(boxes, atoms, ni, iBox, iId, iBox);
 
-   if (jBox > boxes->nLocalBoxes)
+   if (jBox >= boxes->nLocalBoxes)
       --atoms->nLocal;
    
    return;
@@ -283,24 +309,72 @@ void moveAtom(LinkCell* boxes, Atoms* atoms, int iId, int iBox, int jBox)
 /// cells at the end of this routine have just transitioned from local
 /// to halo atoms.  Such atom must be sent to other tasks by a halo
 /// exchange to avoid being lost.
+///
+/// The boxes are processed in parallel in two phases.  In the first
+/// phase each thread finds the atoms leaving its boxes and copies them
+/// to the end of their new boxes.  The slots are reserved with an
+/// atomic increment of the destination count, and only the atoms that
+/// were in a box at the start are examined, so new arrivals are never
+/// touched by the thread that owns their box.  In the second phase each
+/// box squeezes out its departed atoms.  The order of the atoms within
+/// a box depends on the thread timing, but redistributeAtoms() sorts
+/// every box afterwards, so the final order does not.
 /// \see redistributeAtoms
 void updateLinkCells(LinkCell* boxes, Atoms* atoms)
 {
    emptyHaloCells(boxes);
-   
-   for (int iBox=0; iBox<boxes->nLocalBoxes; ++iBox)
+
+   int nLocalBoxes = boxes->nLocalBoxes;
+   int* nStart = boxes->nStart;
+   int* moved = boxes->moved;
+   int nLeft = 0;
+
+   #pragma omp parallel reduction(+:nLeft)
    {
-      int iOff = iBox*MAXATOMS;
-      int ii=0;
-      while (ii < boxes->nAtoms[iBox])
+      #pragma omp for
+      for (int iBox=0; iBox<nLocalBoxes; ++iBox)
+         nStart[iBox] = boxes->nAtoms[iBox];
+
+      #pragma omp for
+      for (int iBox=0; iBox<nLocalBoxes; ++iBox)
       {
-         int jBox = getBoxFromCoord(boxes, atoms->r[iOff+ii]);
-         if (jBox != iBox)
-            moveAtom(boxes, atoms, ii, iBox, jBox);
-         else
-            ++ii;
+         for (int ii=0; ii<nStart[iBox]; ++ii)
+         {
+            int iOff = iBox*MAXATOMS+ii;
+            int jBox = getBoxFromCoord(boxes, atoms->r[iOff]);
+            moved[iOff] = (jBox != iBox);
+            if (jBox == iBox)
+               continue;
+
+            int jj;
+            #pragma omp atomic capture
+            jj = boxes->nAtoms[jBox]++;
+            assert(jj < MAXATOMS);
+            copyAtom(boxes, atoms, ii, iBox, jj, jBox);
+            if (jBox < nLocalBoxes)
+               moved[jBox*MAXATOMS+jj] = 0;
+            else
+               ++nLeft;
+         }
+      }
+
+      #pragma omp for
+      for (int iBox=0; iBox<nLocalBoxes; ++iBox)
+      {
+         int iOff = iBox*MAXATOMS;
+         int nKeep = 0;
+         for (int ii=0; ii<boxes->nAtoms[iBox]; ++ii)
+         {
+            if (moved[iOff+ii])
+               continue;
+            if (ii != nKeep)
+               copyAtom(boxes, atoms, ii, iBox, nKeep, iBox);
+            ++nKeep;
+         }
+         boxes->nAtoms[iBox] = nKeep;
       }
    }
+   atoms->nLocal -= nLeft;
 }
 
 /// \return The largest number of atoms in any link cell.
@@ -381,6 +455,7 @@ int getBoxFromCoord(LinkCell* boxes, real_t rr[3])
 /// Set the number of atoms to zero in all halo link cells.
 void emptyHaloCells(LinkCell* boxes)
 {
+   #pragma omp parallel for
    for (int ii=boxes->nLocalBoxes; ii<boxes->nTotalBoxes; ++ii)
       boxes->nAtoms[ii] = 0;
 }
@@ -467,4 +542,34 @@ void getTuple(LinkCell* boxes, int iBox, int* ixp, int* iyp, int* izp)
    *izp = iz;
 }
 
+/// Sorts the local boxes into 27 colors (a counting sort, so boxes of
+/// the same color stay in index order).
+/// \see initLinkCells for an explanation of the coloring.
+void mkColorLists(LinkCell* boxes)
+{
+   boxes->nColors = 27;
+   boxes->colorStart = comdMalloc((boxes->nColors+1)*sizeof(int));
+   boxes->colorBoxes = comdMalloc(boxes->nLocalBoxes*sizeof(int));
+   int* color = comdMalloc(boxes->nLocalBoxes*sizeof(int));
 
+   for (int ii=0; ii<=boxes->nColors; ++ii)
+      boxes->colorStart[ii] = 0;
+   for (int iBox=0; iBox<boxes->nLocalBoxes; ++iBox)
+   {
+      int ix, iy, iz;
+      getTuple(boxes, iBox, &ix, &iy, &iz);
+      color[iBox] = ix%3 + 3*(iy%3) + 9*(iz%3);
+      boxes->colorStart[color[iBox]+1]++;
+   }
+   for (int ii=0; ii<boxes->nColors; ++ii)
+      boxes->colorStart[ii+1] += boxes->colorStart[ii];
+
+   int* next = comdMalloc(boxes->nColors*sizeof(int));
+   for (int ii=0; ii<boxes->nColors; ++ii)
+      next[ii] = boxes->colorStart[ii];
+   for (int iBox=0; iBox<boxes->nLocalBoxes; ++iBox)
+      boxes->colorBoxes[next[color[iBox]]++] = iBox;
+
+   comdFree(next);
+   comdFree(color);
+}
@@ -28,6 +28,13 @@ typedef struct LinkCellSt
 
    int* nAtoms;         //!< total number of atoms in each box
    int** nbrBoxes;      //!< neighbor boxes for each box
+
+   int nColors;         //!< number of box colors (27)
+   int* colorStart;     //!< first entry of each color in colorBoxes (nColors+1 values)
+   int* colorBoxes;     //!< local boxes sorted by color
+
+   int* nStart;         //!< scratch: atoms in each local box before the update
+   int* moved;          //!< scratch: per local atom flag set if the atom left its box
 } LinkCell;
 
 LinkCell* initLinkCells(const struct DomainSt* domain, real_t cutoff);
@@ -39,6 +46,7 @@ void putAtomInBox(LinkCell* boxes, struct AtomsSt* atoms,
                   const real_t x,  const real_t y,  const real_t z,
                   const real_t px, const real_t py, const real_t pz);
 int getBoxFromTuple(LinkCell* boxes, int x, int y, int z);
+int getBoxFromCoord(LinkCell* boxes, real_t rr[3]);
 
 void moveAtom(LinkCell* boxes, struct AtomsSt* atoms, int iId, int iBox, int jBox);
 
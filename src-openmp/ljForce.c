@@ -57,6 +57,10 @@
 /// where \f$\hat{r}_{ij}\f$ is a unit vector in the direction from atom
 /// i to atom j.
 /// 
+/// By default every pair is computed twice, once for each atom, so
+/// that threads only ever update the atoms of their own boxes.  The
+/// \--halfPair option selects one of the race free half-pair loops
+/// described in halfPair.c instead.
 ///
 
 #include "ljForce.h"
@@ -72,6 +76,8 @@
 #include "linkCells.h"
 #include "memUtils.h"
 #include "CoMDTypes.h"
+#include "halfPair.h"
+#include "boxSchedule.h"
 
 #define POT_SHIFT 1.0
 
@@ -95,6 +101,9 @@ typedef struct LjPotentialSt
 
 static int ljForce(SimFlat* s);
 static void ljPrint(FILE* file, BasePotential* pot);
+static real_t ljFullPair(SimFlat* s, real_t s6, real_t eShift);
+static real_t ljHalfPairBox(SimFlat* s, int iBox, real_t s6, real_t eShift,
+                            real3* f, real_t* U);
 
 void ljDestroy(BasePotential** inppot)
 {
@@ -166,63 +175,185 @@ int ljForce(SimFlat* s)
    real_t rCut6 = s6 / (rCut2*rCut2*rCut2);
    real_t eShift = POT_SHIFT * rCut6 * (rCut6 - 1.0);
 
+   LinkCell* boxes = s->boxes;
+   switch (s->halfPair)
+   {
+     case HALF_PAIR_COLOR:
+      for (int iColor=0; iColor<boxes->nColors; iColor++)
+      {
+         #pragma omp parallel for reduction(+:ePot)
+         for (int ii=boxes->colorStart[iColor]; ii<boxes->colorStart[iColor+1]; ii++)
+            ePot += ljHalfPairBox(s, boxes->colorBoxes[ii], s6, eShift,
+                                  s->atoms->f, s->atoms->U);
+      }
+      break;
+     case HALF_PAIR_BUFFER:
+      startBoxLoop(s->pairSchedule);
+      #pragma omp parallel reduction(+:ePot)
+      {
+         ThreadBuffers* tb = s->threadBuffers;
+         int tOff = omp_get_thread_num()*tb->nAtoms;
+         BoxCursor cursor = initBoxCursor(s->pairSchedule, boxes->nLocalBoxes);
+         int iBegin, iEnd;
+         while (nextBoxes(&cursor, &iBegin, &iEnd))
+            for (int iBox=iBegin; iBox<iEnd; iBox++)
+               ePot += ljHalfPairBox(s, iBox, s6, eShift, tb->f+tOff, tb->U+tOff);
+         #pragma omp barrier
+         reduceThreadBuffers(tb, boxes, s->atoms->f, s->atoms->U, NULL);
+      }
+      break;
+     default:
+      ePot = ljFullPair(s, s6, eShift);
+   }
+
+   ePot = ePot*4.0*epsilon;
+   s->ePotential = ePot;
+
+   return 0;
+}
+
+/// The full pair loop.  Each thread handles whole boxes and computes
+/// the forces on the atoms of its boxes only, so every pair is
+/// computed twice.
+///
+/// \return The pair energy (before multiplication by 4 epsilon).
+real_t ljFullPair(SimFlat* s, real_t s6, real_t eShift)
+{
+   LjPotential* pot = (LjPotential *) s->pot;
+   real_t epsilon = pot->epsilon;
+   real_t rCut2 = pot->cutoff*pot->cutoff;
+   real_t ePot = 0.0;
+
    int nNbrBoxes = 27;
 
    // loop over local boxes
-   #pragma omp parallel for reduction(+:ePot)
-   for (int iBox=0; iBox<s->boxes->nLocalBoxes; iBox++)
+   startBoxLoop(s->pairSchedule);
+   #pragma omp parallel reduction(+:ePot)
    {
-      int nIBox = s->boxes->nAtoms[iBox];
+      BoxCursor cursor = initBoxCursor(s->pairSchedule, s->boxes->nLocalBoxes);
+      int iBegin, iEnd;
+      while (nextBoxes(&cursor, &iBegin, &iEnd))
+         for (int iBox=iBegin; iBox<iEnd; iBox++)
+         {
+            int nIBox = s->boxes->nAtoms[iBox];
    
-      // loop over neighbors of iBox
-      for (int jTmp=0; jTmp<nNbrBoxes; jTmp++)
-      {
-         int jBox = s->boxes->nbrBoxes[iBox][jTmp];
+            // loop over neighbors of iBox
+            for (int jTmp=0; jTmp<nNbrBoxes; jTmp++)
+            {
+               int jBox = s->boxes->nbrBoxes[iBox][jTmp];
          
-         assert(jBox>=0);
+               assert(jBox>=0);
          
-         int nJBox = s->boxes->nAtoms[jBox];
+               int nJBox = s->boxes->nAtoms[jBox];
          
-         // loop over atoms in iBox
-         for (int iOff=MAXATOMS*iBox; iOff<(iBox*MAXATOMS+nIBox); iOff++)
-         {
+               // loop over atoms in iBox
+               for (int iOff=MAXATOMS*iBox; iOff<(iBox*MAXATOMS+nIBox); iOff++)
+               {
+
+                  // loop over atoms in jBox
+                  for (int jOff=jBox*MAXATOMS; jOff<(jBox*MAXATOMS+nJBox); jOff++)
+                  {
+                     real3 dr;
+                     real_t r2 = 0.0;
+                     for (int m=0; m<3; m++)
+                     {
+                        dr[m] = s->atoms->r[iOff][m]-s->atoms->r[jOff][m];
+                        r2+=dr[m]*dr[m];
+                     }
+
+                     if ( r2 <= rCut2 && r2 > 0.0)
+                     {
+
+                        // Important note:
+                        // from this point on r actually refers to 1.0/r
+                        r2 = 1.0/r2;
+                        real_t r6 = s6 * (r2*r2*r2);
+                        real_t eLocal = r6 * (r6 - 1.0) - eShift;
+                        s->atoms->U[iOff] += 0.5*eLocal;
+                        ePot += 0.5*eLocal;
 
-            // loop over atoms in jBox
-            for (int jOff=jBox*MAXATOMS; jOff<(jBox*MAXATOMS+nJBox); jOff++)
+                        // different formulation to avoid sqrt computation
+                        real_t fr = - 4.0*epsilon*r6*r2*(12.0*r6 - 6.0);
+                        for (int m=0; m<3; m++)
+                        {
+                           s->atoms->f[iOff][m] -= dr[m]*fr;
+                        }
+                     }
+                  } // loop over atoms in jBox
+               } // loop over atoms in iBox
+            } // loop over neighbor boxes
+         } // loop over local boxes in system
+   }
+
+   return ePot;
+}
+
+/// The half pair loop for a single local box.  A pair of local atoms
+/// is computed only by the box with the lower index (within iBox, by
+/// the atom with the lower index) and updates both atoms in f and U.
+/// Pairs with halo atoms update only the local atom.
+///
+/// \return The pair energy of iBox (before multiplication by 4 epsilon).
+real_t ljHalfPairBox(SimFlat* s, int iBox, real_t s6, real_t eShift,
+                     real3* f, real_t* U)
+{
+   LjPotential* pot = (LjPotential *) s->pot;
+   real_t epsilon = pot->epsilon;
+   real_t rCut2 = pot->cutoff*pot->cutoff;
+   real_t ePot = 0.0;
+
+   int nIBox = s->boxes->nAtoms[iBox];
+   if (nIBox == 0) return ePot;
+
+   // loop over neighbors of iBox
+   for (int jTmp=0; jTmp<27; jTmp++)
+   {
+      int jBox = s->boxes->nbrBoxes[iBox][jTmp];
+      if (jBox < iBox) continue;
+
+      int jLocal = (jBox < s->boxes->nLocalBoxes);
+      int nJBox = s->boxes->nAtoms[jBox];
+
+      // loop over atoms in iBox
+      for (int iOff=MAXATOMS*iBox,ii=0; ii<nIBox; ii++,iOff++)
+      {
+         // loop over atoms in jBox.  Pairs within iBox are visited once.
+         int jBegin = (jBox == iBox) ? ii+1 : 0;
+         for (int jOff=MAXATOMS*jBox+jBegin,ij=jBegin; ij<nJBox; ij++,jOff++)
+         {
+            real3 dr;
+            real_t r2 = 0.0;
+            for (int m=0; m<3; m++)
             {
-               real3 dr;
-               real_t r2 = 0.0;
-               for (int m=0; m<3; m++)
-               {
-                  dr[m] = s->atoms->r[iOff][m]-s->atoms->r[jOff][m];
-                  r2+=dr[m]*dr[m];
-               }
+               dr[m] = s->atoms->r[iOff][m]-s->atoms->r[jOff][m];
+               r2+=dr[m]*dr[m];
+            }
 
-               if ( r2 <= rCut2 && r2 > 0.0)
-               {
+            if ( r2 > rCut2) continue;
 
-                  // Important note:
-                  // from this point on r actually refers to 1.0/r
-                  r2 = 1.0/r2;
-                  real_t r6 = s6 * (r2*r2*r2);
-                  real_t eLocal = r6 * (r6 - 1.0) - eShift;
-                  s->atoms->U[iOff] += 0.5*eLocal;
-                  ePot += 0.5*eLocal;
-
-                  // different formulation to avoid sqrt computation
-                  real_t fr = - 4.0*epsilon*r6*r2*(12.0*r6 - 6.0);
-                  for (int m=0; m<3; m++)
-                  {
-                     s->atoms->f[iOff][m] -= dr[m]*fr;
-                  }
-               }
-            } // loop over atoms in jBox
-         } // loop over atoms in iBox
-      } // loop over neighbor boxes
-   } // loop over local boxes in system
+            // Important note:
+            // from this point on r actually refers to 1.0/r
+            r2 = 1.0/r2;
+            real_t r6 = s6 * (r2*r2*r2);
+            real_t eLocal = r6 * (r6 - 1.0) - eShift;
+            real_t fr = - 4.0*epsilon*r6*r2*(12.0*r6 - 6.0);
 
-   ePot = ePot*4.0*epsilon;
-   s->ePotential = ePot;
+            U[iOff] += 0.5*eLocal;
+            for (int m=0; m<3; m++)
+               f[iOff][m] -= dr[m]*fr;
 
-   return 0;
+            if (jLocal)
+            {
+               U[jOff] += 0.5*eLocal;
+               ePot += eLocal;
+               for (int m=0; m<3; m++)
+                  f[jOff][m] += dr[m]*fr;
+            }
+            else
+               ePot += 0.5*eLocal;
+         } // loop over atoms in jBox
+      } // loop over atoms in iBox
+   } // loop over neighbor boxes
+
+   return ePot;
 }
@@ -43,6 +43,9 @@
 /// | \--lat        | -l          | -1            | lattice parameter (Angstroms)
 /// | \--temp       | -T          | 600           | initial temperature (K)
 /// | \--delta      | -r          | 0             | initial delta (Angstroms)
+/// | \--halfPair   | -H          | none          | half pair force loops (none, color, buffer)
+/// | \--workSteal  | -w          | N/A           | schedule box loops by work stealing
+/// | \--numa       | -M          | firsttouch    | NUMA placement (none, firsttouch, interleave, bind)
 ///
 /// Notes: 
 /// 
@@ -176,6 +179,40 @@
 ///
 ///     $ mpirun -np 8 ../bin/CoMD-mpi -i2 -j2 -k2 -x 40 -y 40 -z 40 -N 10000 -n 100
 ///
+/// ------------------------------
+///
+/// \subsubsection cmd_examples_halfpair Half Pair Force Loops
+///
+/// Compute each pair of atoms only once, using per thread force
+/// buffers to avoid races between threads.  Use "color" instead of
+/// "buffer" to process the link cells in 27 conflict free groups.
+///
+///     $ OMP_NUM_THREADS=8 ../bin/CoMD-openmp-mpi -e --halfPair buffer
+///
+/// ------------------------------
+///
+/// \subsubsection cmd_examples_worksteal Work Stealing
+///
+/// Balance the loops over link cells by estimated cost and let idle
+/// threads steal boxes from busy ones.  This helps when the atom
+/// density is far from uniform, for example with voids or surfaces.
+///
+///     $ OMP_NUM_THREADS=8 ../bin/CoMD-openmp-mpi -e --workSteal
+///
+/// ------------------------------
+///
+/// \subsubsection cmd_examples_numa NUMA Placement
+///
+/// Interleave the pages of the atom arrays over all NUMA nodes of a two
+/// socket node (requires DO_NUMA=ON in the Makefile).  The default
+/// first touch placement needs bound threads to be effective, so
+/// compare against
+///
+///     $ OMP_PROC_BIND=close OMP_PLACES=cores OMP_NUM_THREADS=32 ../bin/CoMD-openmp-mpi -e -x 80 -y 80 -z 80
+///     $ OMP_PROC_BIND=close OMP_PLACES=cores OMP_NUM_THREADS=32 ../bin/CoMD-openmp-mpi -e -x 80 -y 80 -z 80 --numa interleave
+///
+/// and "--numa none" for the original serial initialization.
+///
 
 /// \details Initialize a Command structure with default values, then
 /// parse any command line arguments that were supplied to overwrite
@@ -206,6 +243,11 @@ Command parseCommandLine(int argc, char** argv)
    cmd.lat = -1.0;
    cmd.temperature = 600.0;
    cmd.initialDelta = 0.0;
+   memset(cmd.halfPair, 0, 1024);
+   strcpy(cmd.halfPair, "none");
+   cmd.workSteal = 0;
+   memset(cmd.numaPolicy, 0, 1024);
+   strcpy(cmd.numaPolicy, "firsttouch");
 
    int help=0;
    // add arguments for processing.  Please update the html documentation too!
@@ -226,6 +268,9 @@ Command parseCommandLine(int argc, char** argv)
    addArg("lat",        'l', 1, 'd',  &(cmd.lat),          0,             "lattice parameter (Angstroms)");
    addArg("temp",       'T', 1, 'd',  &(cmd.temperature),  0,             "initial temperature (K)");
    addArg("delta",      'r', 1, 'd',  &(cmd.initialDelta), 0,             "initial delta (Angstroms)");
+   addArg("halfPair",   'H', 1, 's',  cmd.halfPair,  sizeof(cmd.halfPair), "half pair force loops (none, color, buffer)");
+   addArg("workSteal",  'w', 0, 'i',  &(cmd.workSteal),    0,             "schedule box loops by work stealing");
+   addArg("numa",       'M', 1, 's',  cmd.numaPolicy, sizeof(cmd.numaPolicy), "NUMA placement (none, firsttouch, interleave, bind)");
 
    processArgs(argc,argv);
 
@@ -271,6 +316,9 @@ void printCmdYaml(FILE* file, Command* cmd)
            "  Time step: %g fs\n"
            "  Initial Temperature: %g K\n"
            "  Initial Delta: %g Angstroms\n"
+           "  Half pair mode: %s\n"
+           "  Work stealing: %d\n"
+           "  NUMA policy: %s\n"
            "\n",
            cmd->doeam,
            cmd->potDir,
@@ -283,7 +331,10 @@ void printCmdYaml(FILE* file, Command* cmd)
            cmd->printRate,
            cmd->dt,
            cmd->temperature,
-           cmd->initialDelta
+           cmd->initialDelta,
+           cmd->halfPair,
+           cmd->workSteal,
+           cmd->numaPolicy
    );
    fflush(file);
 }
@@ -26,6 +26,9 @@ typedef struct CommandSt
    double lat;         //!< lattice constant (in Angstroms)
    double temperature; //!< simulation initial temperature (in Kelvin)
    double initialDelta; //!< magnitude of initial displacement from lattice (in Angstroms)
+   char halfPair[1024]; //!< half pair force loop mode (none, color, or buffer)
+   int workSteal;      //!< a flag to schedule box loops by work stealing
+   char numaPolicy[1024]; //!< NUMA placement of the atom arrays (none, firsttouch, interleave, bind)
 } Command;
 
 /// Process command line arguments into an easy to handle structure.
@@ -0,0 +1,192 @@
+/// \file
+/// Placement of the per atom arrays on NUMA nodes.
+///
+/// On a multi-socket node the OS places a page on the node of the
+/// thread that first writes to it.  If the per atom arrays are
+/// initialized by a serial loop, all of their pages end up on the node
+/// of the master thread and the threads on the other sockets read
+/// remote memory in every force loop.
+///
+/// The default policy (firsttouch) zeroes each array in a parallel loop
+/// that hands out the link cells exactly as the static box loops of the
+/// force and integration routines do (see initBoxCursor).  The local
+/// boxes and the halo boxes are split separately since the loops run
+/// over the local boxes only.  Each page then lives on the node of the
+/// thread that works on it.  This only sticks if the threads are bound
+/// to cores, e.g., with OMP_PROC_BIND=close (or spread) and
+/// OMP_PLACES=cores.
+///
+/// With DO_NUMA=ON in the Makefile, libnuma provides two more policies:
+/// - interleave: pages are spread round robin over all nodes.  No
+///   locality, but the bandwidth of all sockets is used evenly
+///   regardless of thread placement.
+/// - bind: as firsttouch, but each thread also binds its block to its
+///   current node so that pages that were touched before (e.g., by a
+///   previous user of the heap) are placed correctly as well.
+///
+/// The policy none keeps the original serial initialization for
+/// comparison.
+
+// Needed for sched_getcpu
+#define _GNU_SOURCE
+
+#include "numaUtils.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <omp.h>
+#ifdef DO_NUMA
+#include <sched.h>
+#include <numa.h>
+#include <numaif.h>
+#endif
+
+#include "boxSchedule.h"
+#include "memUtils.h"
+
+static void placeBoxes(int policy, char* base, size_t bytesPerBox,
+                       int firstBox, int nBoxes);
+
+int parseNumaPolicy(const char* name)
+{
+   if (strcmp(name, "none") == 0)       return NUMA_NONE;
+   if (strcmp(name, "firsttouch") == 0) return NUMA_FIRST_TOUCH;
+   if (strcmp(name, "interleave") == 0) return NUMA_INTERLEAVE;
+   if (strcmp(name, "bind") == 0)       return NUMA_BIND;
+   return -1;
+}
+
+const char* numaPolicyName(int policy)
+{
+   switch (policy)
+   {
+     case NUMA_NONE:        return "none";
+     case NUMA_FIRST_TOUCH: return "firsttouch";
+     case NUMA_INTERLEAVE:  return "interleave";
+     case NUMA_BIND:        return "bind";
+   }
+   return "unknown";
+}
+
+int numaPolicyAvailable(int policy)
+{
+#ifdef DO_NUMA
+   return (policy >= NUMA_NONE && policy <= NUMA_BIND);
+#else
+   return (policy == NUMA_NONE || policy == NUMA_FIRST_TOUCH);
+#endif
+}
+
+void numaPlaceArray(int policy, void* ptr, size_t bytesPerBox,
+                    int nLocalBoxes, int nTotalBoxes)
+{
+   char* base = (char*) ptr;
+   if (policy == NUMA_NONE)
+   {
+      memset(base, 0, bytesPerBox*nTotalBoxes);
+      return;
+   }
+
+#ifdef DO_NUMA
+   if (policy == NUMA_INTERLEAVE && numa_available() >= 0)
+      numa_interleave_memory(base, bytesPerBox*nTotalBoxes, numa_all_nodes_ptr);
+#endif
+
+   #pragma omp parallel
+   {
+      placeBoxes(policy, base, bytesPerBox, 0, nLocalBoxes);
+      placeBoxes(policy, base, bytesPerBox, nLocalBoxes, nTotalBoxes-nLocalBoxes);
+   }
+}
+
+/// Called by every thread of a parallel region.  Zeroes (and for the
+/// bind policy, binds) the calling thread's static block of boxes
+/// [firstBox, firstBox+nBoxes).
+void placeBoxes(int policy, char* base, size_t bytesPerBox,
+                int firstBox, int nBoxes)
+{
+   BoxCursor cursor = initBoxCursor(NULL, nBoxes);
+   int iBegin, iEnd;
+   while (nextBoxes(&cursor, &iBegin, &iEnd))
+   {
+      char* begin = base + (firstBox+iBegin)*bytesPerBox;
+      size_t bytes = (iEnd-iBegin)*bytesPerBox;
+      if (bytes == 0)
+         continue;
+#ifdef DO_NUMA
+      if (policy == NUMA_BIND && numa_available() >= 0)
+      {
+         // mbind needs a page aligned start
+         uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+         char* page = (char*) ((uintptr_t)begin & ~(pageSize-1));
+         numa_tonode_memory(page, begin+bytes-page, numa_node_of_cpu(sched_getcpu()));
+      }
+#else
+      (void)policy;
+#endif
+      memset(begin, 0, bytes);
+   }
+}
+
+/// \details
+/// Uses move_pages() to query the node of each page.  Pages that have
+/// not been touched yet are counted separately.
+void numaPrintPages(FILE* file, const char* name, void* ptr, size_t bytes)
+{
+#ifdef DO_NUMA
+   if (numa_available() < 0)
+   {
+      fprintf(file, "  %-18s : NUMA not available\n", name);
+      return;
+   }
+   uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+   char* first = (char*) ((uintptr_t)ptr & ~(pageSize-1));
+   int nPages = ((char*)ptr + bytes - first + pageSize - 1) / pageSize;
+   void** pages = comdMalloc(nPages*sizeof(void*));
+   int* status = comdMalloc(nPages*sizeof(int));
+   for (int ii=0; ii<nPages; ii++)
+      pages[ii] = first + ii*pageSize;
+   move_pages(0, nPages, pages, NULL, status, 0);
+
+   int nNodes = numa_max_node() + 1;
+   int* count = comdCalloc(nNodes+1, sizeof(int));
+   for (int ii=0; ii<nPages; ii++)
+   {
+      if (status[ii] >= 0 && status[ii] < nNodes)
+         count[status[ii]]++;
+      else
+         count[nNodes]++;
+   }
+
+   fprintf(file, "  %-18s :", name);
+   for (int ii=0; ii<nNodes; ii++)
+      fprintf(file, " node %d: %d", ii, count[ii]);
+   fprintf(file, " untouched: %d pages\n", count[nNodes]);
+
+   comdFree(count);
+   comdFree(status);
+   comdFree(pages);
+#else
+   (void)ptr;
+   fprintf(file, "  %-18s : %lu pages (build with DO_NUMA=ON for node counts)\n",
+           name, (unsigned long)((bytes + sysconf(_SC_PAGESIZE) - 1) / sysconf(_SC_PAGESIZE)));
+#endif
+}
+
+void numaPrintBinding(FILE* file)
+{
+   const char* name = "unknown";
+   switch (omp_get_proc_bind())
+   {
+     case omp_proc_bind_false:  name = "false";  break;
+     case omp_proc_bind_true:   name = "true";   break;
+     case omp_proc_bind_master: name = "master"; break;
+     case omp_proc_bind_close:  name = "close";  break;
+     case omp_proc_bind_spread: name = "spread"; break;
+   }
+   fprintf(file, "  Thread binding     : %s, %d places\n", name, omp_get_num_places());
+   if (omp_get_proc_bind() == omp_proc_bind_false)
+      fprintf(file, "  Threads are not bound.  Set OMP_PROC_BIND and OMP_PLACES to\n"
+                    "  keep threads near the pages they touched first.\n");
+}
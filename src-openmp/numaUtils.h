@@ -0,0 +1,39 @@
+/// \file
+/// Placement of the per atom arrays on NUMA nodes.
+
+#ifndef __NUMA_UTILS_H_
+#define __NUMA_UTILS_H_
+
+#include <stdio.h>
+#include <stddef.h>
+
+/// How the pages of the per atom arrays are placed on the NUMA nodes.
+enum NumaPolicy
+{
+   NUMA_NONE,        //!< touch serially, as the OS sees fit
+   NUMA_FIRST_TOUCH, //!< each thread touches the boxes of its force loop block
+   NUMA_INTERLEAVE,  //!< pages interleaved over all nodes (needs DO_NUMA)
+   NUMA_BIND         //!< first touch plus an explicit bind (needs DO_NUMA)
+};
+
+/// Return a NumaPolicy or -1 if the name is not known.
+int parseNumaPolicy(const char* name);
+
+/// Return the name of a NumaPolicy.
+const char* numaPolicyName(int policy);
+
+/// Return non-zero if the policy can be used in this build.
+int numaPolicyAvailable(int policy);
+
+/// Place and zero an array that holds bytesPerBox bytes for each of
+/// nTotalBoxes link cells, the first nLocalBoxes of which are local.
+void numaPlaceArray(int policy, void* ptr, size_t bytesPerBox,
+                    int nLocalBoxes, int nTotalBoxes);
+
+/// Print the number of pages of an array on each NUMA node.
+void numaPrintPages(FILE* file, const char* name, void* ptr, size_t bytes);
+
+/// Print how the OpenMP threads are bound to places.
+void numaPrintBinding(FILE* file);
+
+#endif
@@ -16,6 +16,8 @@
 #include <string.h>
 #include <assert.h>
 
+#include "memUtils.h"
+
 static int myRank = 0;
 static int nRanks = 1;
 
@@ -90,6 +92,32 @@ void barrierParallel()
 /// \param [in]  recvLen Maximum number of bytes to receive.
 /// \param [in]  source  Rank in MPI_COMM_WORLD from which to receive.
 /// \return Number of bytes received.
+/// \details
+/// Memory from MPI_Alloc_mem may be registered with the network card
+/// (or come from a pool of pinned pages) so that messages sent from it
+/// need no intermediate copy.  Intended for buffers that are allocated
+/// once and used for many messages.
+void* allocCommBuffer(int size)
+{
+#ifdef DO_MPI
+   void* buf;
+   MPI_Alloc_mem(size, MPI_INFO_NULL, &buf);
+   return buf;
+#else
+   return comdMalloc(size);
+#endif
+}
+
+void freeCommBuffer(void* buf)
+{
+   if (! buf) return;
+#ifdef DO_MPI
+   MPI_Free_mem(buf);
+#else
+   comdFree(buf);
+#endif
+}
+
 int sendReceiveParallel(void* sendBuf, int sendLen, int dest,
                         void* recvBuf, int recvLen, int source)
 {
@@ -34,6 +34,12 @@ void destroyParallel(void);
 /// Wrapper for MPI_Barrier(MPI_COMM_WORLD).
 void barrierParallel(void);
 
+/// Wrapper for MPI_Alloc_mem.
+void* allocCommBuffer(int size);
+
+/// Wrapper for MPI_Free_mem.
+void freeCommBuffer(void* buf);
+
 /// Wrapper for MPI_Sendrecv.
 int sendReceiveParallel(void* sendBuf, int sendLen, int dest,
                         void* recvBuf, int recvLen, int source);
@@ -68,31 +68,43 @@ void computeForce(SimFlat* s)
 
 void advanceVelocity(SimFlat* s, int nBoxes, real_t dt)
 {
-   #pragma omp parallel for
-   for (int iBox=0; iBox<nBoxes; iBox++)
+   startBoxLoop(s->atomSchedule);
+   #pragma omp parallel
    {
-      for (int iOff=MAXATOMS*iBox,ii=0; ii<s->boxes->nAtoms[iBox]; ii++,iOff++)
-      {
-         s->atoms->p[iOff][0] += dt*s->atoms->f[iOff][0];
-         s->atoms->p[iOff][1] += dt*s->atoms->f[iOff][1];
-         s->atoms->p[iOff][2] += dt*s->atoms->f[iOff][2];
-      }
+      BoxCursor cursor = initBoxCursor(s->atomSchedule, nBoxes);
+      int iBegin, iEnd;
+      while (nextBoxes(&cursor, &iBegin, &iEnd))
+         for (int iBox=iBegin; iBox<iEnd; iBox++)
+         {
+            for (int iOff=MAXATOMS*iBox,ii=0; ii<s->boxes->nAtoms[iBox]; ii++,iOff++)
+            {
+               s->atoms->p[iOff][0] += dt*s->atoms->f[iOff][0];
+               s->atoms->p[iOff][1] += dt*s->atoms->f[iOff][1];
+               s->atoms->p[iOff][2] += dt*s->atoms->f[iOff][2];
+            }
+         }
    }
 }
 
 void advancePosition(SimFlat* s, int nBoxes, real_t dt)
 {
-   #pragma omp parallel for
-   for (int iBox=0; iBox<nBoxes; iBox++)
+   startBoxLoop(s->atomSchedule);
+   #pragma omp parallel
    {
-      for (int iOff=MAXATOMS*iBox,ii=0; ii<s->boxes->nAtoms[iBox]; ii++,iOff++)
-      {
-         int iSpecies = s->atoms->iSpecies[iOff];
-         real_t invMass = 1.0/s->species[iSpecies].mass;
-         s->atoms->r[iOff][0] += dt*s->atoms->p[iOff][0]*invMass;
-         s->atoms->r[iOff][1] += dt*s->atoms->p[iOff][1]*invMass;
-         s->atoms->r[iOff][2] += dt*s->atoms->p[iOff][2]*invMass;
-      }
+      BoxCursor cursor = initBoxCursor(s->atomSchedule, nBoxes);
+      int iBegin, iEnd;
+      while (nextBoxes(&cursor, &iBegin, &iEnd))
+         for (int iBox=iBegin; iBox<iEnd; iBox++)
+         {
+            for (int iOff=MAXATOMS*iBox,ii=0; ii<s->boxes->nAtoms[iBox]; ii++,iOff++)
+            {
+               int iSpecies = s->atoms->iSpecies[iOff];
+               real_t invMass = 1.0/s->species[iSpecies].mass;
+               s->atoms->r[iOff][0] += dt*s->atoms->p[iOff][0]*invMass;
+               s->atoms->r[iOff][1] += dt*s->atoms->p[iOff][1]*invMass;
+               s->atoms->r[iOff][2] += dt*s->atoms->p[iOff][2]*invMass;
+            }
+         }
    }
 }
 
@@ -137,6 +149,8 @@ void kineticEnergy(SimFlat* s)
 ///   link cells.
 /// - haloExchange (atom version): Sends atom data to remote tasks. 
 /// - sort: Sort the atoms.
+/// - plan: Update the work stealing schedules (if any) for the new
+///   atom counts.
 ///
 /// \see updateLinkCells
 /// \see initAtomHaloExchange
@@ -152,4 +166,9 @@ void redistributeAtoms(SimFlat* sim)
    #pragma omp parallel for
    for (int ii=0; ii<sim->boxes->nTotalBoxes; ++ii)
       sortAtomsInCell(sim->atoms, sim->boxes, ii);
+
+   if (sim->pairSchedule)
+      planBoxSchedule(sim->pairSchedule, sim->boxes);
+   if (sim->atomSchedule)
+      planBoxSchedule(sim->atomSchedule, sim->boxes);
 }